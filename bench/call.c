@@ -0,0 +1,53 @@
+#include <pseu.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Number of calls per run. */
+#define BENCH_COUNT (1 << 22)
+/* Number of runs; the fastest one is reported. */
+#define BENCH_RUNS  5
+
+static const char *source =
+	"FUNCTION Add(a : INTEGER, b : INTEGER) RETURNS INTEGER\n"
+	"  RETURN a + b\n"
+	"ENDFUNCTION\n";
+
+static double now(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+int main(void)
+{
+	PseuVM *vm = pseu_vm_new(NULL);
+	if (!vm || pseu_vm_eval(vm, source) != PSEU_RESULT_SUCCESS)
+		return 1;
+
+	int fn = pseu_vm_get_function(vm, "Add");
+	if (fn == PSEU_INVALID_FUNCTION)
+		return 1;
+
+	double best = 0;
+	int32_t sum = 0;
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		double start = now();
+		for (int32_t i = 0; i < BENCH_COUNT; i++) {
+			int32_t result;
+			if (pseu_vm_push_integer(vm, sum) ||
+			    pseu_vm_push_integer(vm, i & 7) ||
+			    pseu_vm_call(vm, fn) ||
+			    pseu_vm_pop_integer(vm, &result))
+				return 1;
+			sum = result;
+		}
+
+		double secs = now() - start;
+		if (run == 0 || secs < best)
+			best = secs;
+	}
+
+	printf("%-24s %8.2f ns/op (sum %d)\n", "call Add(a, b)",
+		best * 1e9 / BENCH_COUNT, sum);
+	pseu_vm_free(vm);
+	return 0;
+}
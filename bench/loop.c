@@ -0,0 +1,83 @@
+#include <pseu.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Number of runs; the fastest one is reported. */
+#define BENCH_RUNS 5
+
+/* Loop heavy programs over INTEGER and REAL locals. */
+static const struct {
+	const char *name;
+	const char *source;
+} benches[] = {
+	{ "sum 1..N",
+	  "DECLARE i : INTEGER\n"
+	  "DECLARE t : INTEGER <- 0\n"
+	  "FOR i <- 1 TO 5000000\n"
+	  "  t <- t + i\n"
+	  "NEXT i\n" },
+	{ "while countdown",
+	  "DECLARE n : INTEGER <- 5000000\n"
+	  "DECLARE t : INTEGER <- 0\n"
+	  "WHILE n > 0\n"
+	  "  t <- t + n * 3\n"
+	  "  n <- n - 1\n"
+	  "ENDWHILE\n" },
+	{ "real accumulate",
+	  "DECLARE i : INTEGER\n"
+	  "DECLARE x : REAL <- 0.0\n"
+	  "DECLARE y : REAL <- 0.5\n"
+	  "FOR i <- 1 TO 3000000\n"
+	  "  x <- x * y\n"
+	  "  x <- x + y\n"
+	  "NEXT i\n" },
+	{ "2d array",
+	  "DECLARE a : ARRAY[0:9999] OF INTEGER\n"
+	  "DECLARE r : INTEGER\n"
+	  "DECLARE i : INTEGER\n"
+	  "DECLARE j : INTEGER\n"
+	  "DECLARE w : INTEGER <- 100\n"
+	  "FOR r <- 1 TO 30\n"
+	  "  FOR i <- 0 TO 99\n"
+	  "    FOR j <- 0 TO w - 1\n"
+	  "      a[i * 100 + j] <- a[i * 100 + j] + j * 3 + w\n"
+	  "    NEXT j\n"
+	  "  NEXT i\n"
+	  "NEXT r\n" },
+	{ "nested counters",
+	  "DECLARE i : INTEGER\n"
+	  "DECLARE j : INTEGER\n"
+	  "DECLARE c : INTEGER <- 0\n"
+	  "FOR i <- 1 TO 2000\n"
+	  "  FOR j <- i TO 2000\n"
+	  "    c <- c + 1\n"
+	  "  NEXT j\n"
+	  "NEXT i\n" },
+};
+
+static double now(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+int main(void)
+{
+	for (size_t k = 0; k < sizeof(benches) / sizeof(benches[0]); k++) {
+		double best = 0;
+		for (int run = 0; run < BENCH_RUNS; run++) {
+			PseuVM *vm = pseu_vm_new(NULL);
+			if (!vm)
+				return 1;
+
+			double start = now();
+			if (pseu_vm_eval(vm, benches[k].source) != PSEU_RESULT_SUCCESS)
+				return 1;
+			double secs = now() - start;
+			if (run == 0 || secs < best)
+				best = secs;
+			pseu_vm_free(vm);
+		}
+		printf("%-24s %8.2f ms\n", benches[k].name, best * 1e3);
+	}
+	return 0;
+}
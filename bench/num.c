@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "num.h"
+
+/* Number of values formatted or parsed per run. */
+#define BENCH_COUNT (1 << 20)
+/* Number of runs; the fastest one is reported. */
+#define BENCH_RUNS  5
+
+static i32 ints[BENCH_COUNT];
+static f32 reals[BENCH_COUNT];
+static char text[BENCH_COUNT * 32];
+static size_t text_offsets[BENCH_COUNT + 1];
+
+/* Prevents the compiler from discarding the benchmarked work. */
+static volatile size_t sink;
+
+static u32 rng_state = 2463534242u;
+
+static u32 rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static double now(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void report(const char *name, double secs, size_t bytes)
+{
+	printf("%-24s %8.2f ns/op %8.1f MB/s\n", name,
+		secs * 1e9 / BENCH_COUNT, bytes / secs / 1e6);
+}
+
+#define BENCH(name, body)                               \
+	do {                                                  \
+		double best = 1e9;                                  \
+		size_t bytes = 0;                                   \
+		for (int r = 0; r < BENCH_RUNS; r++) {              \
+			double start = now();                             \
+			bytes = 0;                                        \
+			for (size_t i = 0; i < BENCH_COUNT; i++) {        \
+				body                                            \
+			}                                                 \
+			double secs = now() - start;                      \
+			if (secs < best)                                  \
+				best = secs;                                    \
+		}                                                   \
+		sink += bytes;                                      \
+		report(name, best, bytes);                          \
+	} while (0)
+
+int main(void)
+{
+	for (size_t i = 0; i < BENCH_COUNT; i++) {
+		ints[i] = (i32)rng() >> (rng() % 32);
+		u32 bits = rng() % 0x7F000000u;
+		memcpy(&reals[i], &bits, sizeof(bits));
+	}
+
+	char buf[64];
+
+	BENCH("num_fmt_i32", {
+		bytes += num_fmt_i32(buf, ints[i]);
+	});
+	BENCH("snprintf %d", {
+		bytes += snprintf(buf, sizeof(buf), "%d", ints[i]);
+	});
+	BENCH("num_fmt_f32", {
+		bytes += num_fmt_f32(buf, reals[i]);
+	});
+	BENCH("snprintf %.9g", {
+		bytes += snprintf(buf, sizeof(buf), "%.9g", reals[i]);
+	});
+
+	/* Shortest representations of the reals, used as parser input. */
+	size_t offset = 0;
+	for (size_t i = 0; i < BENCH_COUNT; i++) {
+		text_offsets[i] = offset;
+		offset += num_fmt_f32(text + offset, reals[i]);
+		text[offset++] = '\0';
+	}
+	text_offsets[BENCH_COUNT] = offset;
+
+	BENCH("num_parse_f32", {
+		f32 v;
+		const char *s = text + text_offsets[i];
+		size_t len = text_offsets[i + 1] - text_offsets[i] - 1;
+		num_parse_f32(s, len, &v);
+		bytes += len + (v != reals[i]);
+	});
+	BENCH("strtof", {
+		const char *s = text + text_offsets[i];
+		size_t len = text_offsets[i + 1] - text_offsets[i] - 1;
+		f32 v = strtof(s, NULL);
+		bytes += len + (v != reals[i]);
+	});
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "vec.h"
+
+/* Number of elements per array; well past the last level cache. */
+#define BENCH_COUNT 10000000
+/* Number of runs; the fastest one is reported. */
+#define BENCH_RUNS  5
+
+static i32 ints[BENCH_COUNT];
+static i32 other[BENCH_COUNT];
+static f32 reals[BENCH_COUNT];
+
+/* Prevents the compiler from discarding the benchmarked work. */
+static volatile f32 sink;
+
+static u32 rng_state = 2463534242u;
+
+static u32 rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static double now(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void report(const char *name, double secs, size_t bytes)
+{
+	printf("%-16s %8.2f ms %8.1f MB/s\n", name, secs * 1e3, bytes / secs / 1e6);
+}
+
+#define BENCH(name, bytes, body)                        \
+	do {                                                  \
+		double best = 1e9;                                  \
+		for (int r = 0; r < BENCH_RUNS; r++) {              \
+			double start = now();                             \
+			body                                              \
+			double secs = now() - start;                      \
+			if (secs < best)                                  \
+				best = secs;                                    \
+		}                                                   \
+		report(name, best, bytes);                          \
+	} while (0)
+
+int main(void)
+{
+	for (size_t i = 0; i < BENCH_COUNT; i++) {
+		ints[i] = (i32)(rng() % 1000);
+		other[i] = (i32)(rng() % 1000);
+		reals[i] = (f32)(rng() % 1000) / 8;
+	}
+
+	const VecOps *ops = vec_ops();
+	const size_t n = BENCH_COUNT;
+
+	BENCH("sum_i32", n * 4, {
+		sink += ops->sum_i32(ints, n);
+	});
+	BENCH("sum_f32", n * 4, {
+		sink += ops->sum_f32(reals, n);
+	});
+	BENCH("max_i32", n * 4, {
+		sink += ops->max_i32(ints, n);
+	});
+	BENCH("min_f32", n * 4, {
+		sink += ops->min_f32(reals, n);
+	});
+	BENCH("count_i32", n * 4, {
+		sink += ops->count_i32(ints, n, 7);
+	});
+	BENCH("add_i32", n * 12, {
+		ops->add_i32(ints, other, n);
+	});
+	BENCH("muls_f32", n * 8, {
+		ops->muls_f32(reals, 0.5f, n);
+	});
+	return 0;
+}
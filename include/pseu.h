@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * Represents a pseu virtual machine instance.
@@ -16,6 +17,139 @@ typedef enum pseu_config_flags {
 	PSEU_CONFIG_DUMP_FUNCTION = 0x01,
 } pseu_config_flags_t;
 
+/**
+ * Maximum number of parameters of a function defined with
+ * pseu_vm_def_function().
+ */
+#define PSEU_FUNCTION_MAX_PARAMS 16
+
+/**
+ * Maximum number of parameters of a function defined with
+ * pseu_vm_def_native().
+ */
+#define PSEU_NATIVE_MAX_PARAMS 3
+
+/**
+ * Number of buckets in the garbage collector pause time histogram.
+ */
+#define PSEU_GC_HISTOGRAM_SIZE 16
+
+/**
+ * Maximum number of types tracked by the heap statistics.
+ */
+#define PSEU_HEAP_STATS_TYPES 64
+
+/**
+ * Garbage collector events reported to PseuConfig.gc.
+ */
+typedef enum pseu_gc_event {
+	/** A collection is about to start. */
+	PSEU_GC_EVENT_START,
+	/** A collection has ended. */
+	PSEU_GC_EVENT_END
+} pseu_gc_event_t;
+
+/**
+ * Heap statistics of the objects of a single type.
+ */
+typedef struct PseuTypeStats {
+	/** Identifier of the type. */
+	const char *ident;
+	/** Number of live objects of the type. */
+	size_t objects;
+	/** Number of live bytes used by objects of the type. */
+	size_t bytes;
+} PseuTypeStats;
+
+/**
+ * Heap and garbage collector statistics of a pseu virtual machine.
+ */
+typedef struct PseuHeapStats {
+	/** Number of bytes used by live objects. */
+	size_t bytes_live;
+	/** Total number of bytes allocated for objects since creation. */
+	size_t bytes_allocated;
+	/** Number of live bytes after which the next collection happens. */
+	size_t bytes_threshold;
+	/** Number of live objects. */
+	size_t objects_live;
+
+	/** Number of entries in `types`. */
+	size_t types_count;
+	/** Live objects and bytes by type; indexed in type definition order. */
+	PseuTypeStats types[PSEU_HEAP_STATS_TYPES];
+
+	/** Number of collections done. */
+	size_t collections;
+	/** Cumulative pause time of all collections in microseconds. */
+	uint64_t pause_total_us;
+	/** Longest pause time of a collection in microseconds. */
+	uint64_t pause_max_us;
+	/**
+	 * Histogram of pause times; bucket 0 counts pauses shorter than 1us and
+	 * bucket `i` counts pauses in [2^(i - 1), 2^i) us. The last bucket also
+	 * counts every longer pause.
+	 */
+	size_t pause_histogram[PSEU_GC_HISTOGRAM_SIZE];
+} PseuHeapStats;
+
+/**
+ * Types of the values passed between pseu and host functions.
+ */
+typedef enum pseu_type {
+	/** No value; return type of a procedure. */
+	PSEU_TYPE_VOID,
+	/** BOOLEAN; `bool` in C. */
+	PSEU_TYPE_BOOLEAN,
+	/** INTEGER; `int32_t` in C. */
+	PSEU_TYPE_INTEGER,
+	/** REAL; `float` in C. */
+	PSEU_TYPE_REAL,
+	/** STRING; chars and length in C, not NUL terminated. */
+	PSEU_TYPE_STRING
+} pseu_type_t;
+
+/**
+ * A value passed between pseu and host functions.
+ */
+typedef struct PseuValue {
+	/** Type of the value. */
+	pseu_type_t type;
+	union {
+		/** As a BOOLEAN. */
+		bool boolean;
+		/** As an INTEGER. */
+		int32_t integer;
+		/** As a REAL. */
+		float real;
+		/**
+		 * As a STRING; the chars of an argument are only valid during the call
+		 * and the chars of a result are copied when the call returns.
+		 */
+		struct {
+			const char *chars;
+			size_t length;
+		} string;
+	} as;
+} PseuValue;
+
+/**
+ * A host function called with its arguments converted to PseuValue.
+ *
+ * @param[in] vm Pseu instance.
+ * @param[in] args Arguments of the call; of the declared parameter types.
+ * @param[out] result Result of the call; of the declared return type.
+ * @return 0 if success; otherwise a runtime error is reported.
+ */
+typedef int (*PseuFunction)(PseuVM *vm, const PseuValue *args, PseuValue *result);
+
+/**
+ * A host function taking and returning C primitives directly; cast from a
+ * function such as `int32_t (*)(int32_t, float)`. See
+ * pseu_vm_def_native() for the supported signatures.
+ */
+typedef void (*PseuNative)(void);
+
 /**
  * Represents the configuration of a pseu virtual machine.
  */
@@ -41,6 +175,17 @@ typedef struct PseuConfig {
 	 */
 	void (*print)(PseuVM *vm, const char *text); 	
 
+	/**
+	 * Callback whenever pseu writes a block of its buffered standard output;
+	 * can be NULL, in which case `print` is used. The block is not NUL
+	 * terminated and is only valid during the call.
+	 *
+	 * @param[in] vm Pseu instance.
+	 * @param[in] ptr Pointer to the block to write.
+	 * @param[in] len Length of the block in bytes.
+	 */
+	void (*write)(PseuVM *vm, const char *ptr, size_t len);
+
 	/**
 	 * Fuction to allocate a block of memory of the specified size.
 	 *
@@ -69,6 +214,16 @@ typedef struct PseuConfig {
 	 * @param[in] Pointer to block to free.
 	 */
 	void (*free)(PseuVM *vm, void *ptr);
+
+	/**
+	 * Callback whenever the garbage collector starts or ends a collection; can
+	 * be NULL.
+	 *
+	 * @param[in] vm Pseu instance.
+	 * @param[in] event Collection event; see pseu_gc_event_t.
+	 * @param[in] stats Heap statistics at the time of the event.
+	 */
+	void (*gc)(PseuVM *vm, pseu_gc_event_t event, const PseuHeapStats *stats);
 } PseuConfig;
 
 /**
@@ -116,6 +271,134 @@ void pseu_vm_set_data(PseuVM *vm, void *data);
  */
 void *pseu_vm_get_data(PseuVM *vm);
 
+/**
+ * Writes the buffered standard output of the specified pseu virtual machine
+ * instance through PseuConfig.write or PseuConfig.print. Output is also
+ * flushed when the buffer fills up, at the end of pseu_vm_eval() and before
+ * an error is reported.
+ *
+ * @param[in] vm Pseu instance.
+ */
+void pseu_vm_flush(PseuVM *vm);
+
+/**
+ * Gets the heap and garbage collector statistics of the specified pseu virtual
+ * machine instance.
+ *
+ * @param[in] vm Pseu instance.
+ * @param[out] stats Heap statistics.
+ */
+void pseu_vm_heap_stats(PseuVM *vm, PseuHeapStats *stats);
+
+/**
+ * Defines a function callable from pseu code. The function is a procedure
+ * when `return_type` is PSEU_TYPE_VOID. Arguments are checked against the
+ * parameter types before `fn` is called; INTEGER arguments are converted to
+ * REAL parameters. There can be at most PSEU_FUNCTION_MAX_PARAMS parameters.
+ *
+ * @param[in] vm Pseu instance.
+ * @param[in] ident Identifier of the function.
+ * @param[in] return_type Return type of the function.
+ * @param[in] param_types Types of the parameters.
+ * @param[in] params_count Number of parameters.
+ * @param[in] fn Host function.
+ *
+ * @retval PSEU_RESULT_SUCCESS When success.
+ * @retval PSEU_RESULT_ERROR When the identifier is taken, a type or the
+ * number of parameters is invalid or the function table is full.
+ */
+int pseu_vm_def_function(PseuVM *vm, const char *ident,
+                         pseu_type_t return_type,
+                         const pseu_type_t *param_types, uint8_t params_count,
+                         PseuFunction fn);
+
+/**
+ * Defines a function callable from pseu code which is called with C
+ * primitives directly, without converting its arguments to PseuValue.
+ * Parameters must be BOOLEAN, INTEGER or REAL and there can be at most
+ * PSEU_NATIVE_MAX_PARAMS of them; the return type can also be VOID.
+ *
+ * @param[in] vm Pseu instance.
+ * @param[in] ident Identifier of the function.
+ * @param[in] return_type Return type of the function.
+ * @param[in] param_types Types of the parameters.
+ * @param[in] params_count Number of parameters.
+ * @param[in] fn Host function; cast to PseuNative.
+ *
+ * @retval PSEU_RESULT_SUCCESS When success.
+ * @retval PSEU_RESULT_ERROR When the signature is not supported, the
+ * identifier is taken or the function table is full.
+ */
+int pseu_vm_def_native(PseuVM *vm, const char *ident,
+                       pseu_type_t return_type,
+                       const pseu_type_t *param_types, uint8_t params_count,
+                       PseuNative fn);
+
+/**
+ * Represents an invalid function handle; see pseu_vm_get_function().
+ */
+#define PSEU_INVALID_FUNCTION (-1)
+
+/**
+ * Looks up a FUNCTION or PROCEDURE defined by pseu code which has been
+ * evaluated by the specified pseu virtual machine instance. The handle stays
+ * valid for the lifetime of the instance, so it only needs to be looked up
+ * once.
+ *
+ * @param[in] vm Pseu instance.
+ * @param[in] ident Identifier of the function.
+ * @return Handle of the function if found; otherwise PSEU_INVALID_FUNCTION.
+ */
+int pseu_vm_get_function(PseuVM *vm, const char *ident);
+
+/**
+ * Pushes an argument on the stack of the specified pseu virtual machine
+ * instance; see pseu_vm_call(). Pushing a STRING copies its chars.
+ *
+ * @param[in] vm Pseu instance.
+ * @param[in] value Value to push.
+ *
+ * @retval PSEU_RESULT_SUCCESS When success.
+ * @retval PSEU_RESULT_ERROR When out of memory.
+ */
+int pseu_vm_push_boolean(PseuVM *vm, bool value);
+int pseu_vm_push_integer(PseuVM *vm, int32_t value);
+int pseu_vm_push_real(PseuVM *vm, float value);
+int pseu_vm_push_string(PseuVM *vm, const char *chars, size_t length);
+
+/**
+ * Calls a pseu FUNCTION or PROCEDURE with the arguments on top of the stack,
+ * pushed in parameter order. The arguments are popped and the result of a
+ * FUNCTION is pushed in their place. Output is not flushed; see
+ * pseu_vm_flush().
+ *
+ * @param[in] vm Pseu instance.
+ * @param[in] fn Handle of the function; see pseu_vm_get_function().
+ *
+ * @retval PSEU_RESULT_SUCCESS When success.
+ * @retval PSEU_RESULT_ERROR When the handle or arguments are invalid or a
+ * runtime error occurred.
+ */
+int pseu_vm_call(PseuVM *vm, int fn);
+
+/**
+ * Pops the value on top of the stack of the specified pseu virtual machine
+ * instance. The chars of a popped STRING are valid until the next call into
+ * the instance.
+ *
+ * @param[in] vm Pseu instance.
+ * @param[out] o Popped value; INTEGER values are converted when popped as
+ * REAL.
+ *
+ * @retval PSEU_RESULT_SUCCESS When success.
+ * @retval PSEU_RESULT_ERROR When the stack is empty or the value on top of
+ * it does not have the type; the value is not popped.
+ */
+int pseu_vm_pop_boolean(PseuVM *vm, bool *o);
+int pseu_vm_pop_integer(PseuVM *vm, int32_t *o);
+int pseu_vm_pop_real(PseuVM *vm, float *o);
+int pseu_vm_pop_string(PseuVM *vm, const char **chars, size_t *length);
+
 /**
  * Interprets the specified pseu source code using the specified pseu virtual
  * machine instance.
@@ -2,6 +2,8 @@
 #include <stdio.h>
 
 #include "core.h"
+#include "num.h"
+#include "vec.h"
 
 #define arg(x)      (&args[x])
 #define return_v(x) do {*arg(0) = (x); return 0;} while(0)
@@ -20,8 +22,8 @@
 #define PSEU_COMP_FUNC(x)       \
   PSEU_FUNC(x)                  \
   {                             \
-    pseu_unused(s);             \
     return pseu_compare_binary( \
+        s,                      \
         arg(0),                 \
         arg(1),                 \
         arg(0),                 \
@@ -47,34 +49,62 @@ PSEU_COMP_FUNC(gt)
 PSEU_COMP_FUNC(le)
 PSEU_COMP_FUNC(ge)
 PSEU_COMP_FUNC(eq)
+PSEU_COMP_FUNC(ne)
 
 PSEU_LOGIC_FUNC(and, &&)
 PSEU_LOGIC_FUNC(or,  ||)
 
-PSEU_FUNC(output)
+/* Formats the specified value as OUTPUT and WRITEFILE write it; `*chars` is
+ * set to `buffer` or to the chars of a string.
+ */
+static int format_value(State *s, Value *v, char *buffer, size buffer_size,
+                        const char **chars, size *len)
 {
-  pseu_unused(s);
+  *chars = buffer;
 
-  // TODO: Fix this see parse_err in parse.c.
-  char buffer[256];
-
-  switch (arg(0)->type) {
+  switch (v->type) {
   case VAL_BOOL:
-    sprintf(buffer, v_asbool(arg(0)) == false ? "false\n" : "true\n");
-    break;
+    *chars = v_asbool(v) ? "true" : "false";
+    *len = strlen(*chars);
+    return 0;
   case VAL_INT:
-    sprintf(buffer, "%d\n", v_asint(arg(0)));
-    break;
+    *len = num_fmt_i32(buffer, v_asint(v));
+    return 0;
   case VAL_FLOAT:
-    sprintf(buffer, "%f\n", v_asfloat(arg(0)));
-    break;
+    *len = num_fmt_f32(buffer, v_asfloat(v));
+    return 0;
+  case VAL_OBJ:
+    if (v_isstr(s, v)) {
+      /* Written by length, so slices need no copy. */
+      *chars = string_chars(s, v_asstr(v));
+      *len = v_asstr(v)->length;
+      return *chars == NULL;
+    }
+    /* fallthrough */
 
-  default:
-    sprintf(buffer, "%s<%p>\n", v_get_type(s, arg(0))->ident, (void *)arg(0));
-    break;
+  default: {
+    Type *type = v_get_type(s, v);
+    int n = snprintf(buffer, buffer_size, "%.32s<%p>",
+                     type ? type->ident : "NIL", (void *)v);
+    if (n < 0 || (size)n >= buffer_size)
+      return 1;
+    *len = n;
+    return 0;
+  }
   }
+}
 
-  pseu_print(s, buffer);
+PSEU_FUNC(output)
+{
+  char buffer[64];
+  const char *chars;
+  size len;
+
+  if (format_value(s, arg(0), buffer, sizeof(buffer), &chars, &len))
+    return 1;
+
+  pseu_write(s, chars, len);
+  pseu_write(s, "\n", 1);
   return 0;
 }
 
@@ -93,6 +123,388 @@ PSEU_FUNC(neg)
   }
 }
 
+PSEU_FUNC(concat)
+{
+  if (!v_isstr(s, arg(0)) || !v_isstr(s, arg(1)))
+    return 1;
+
+  String *result = string_concat(s, v_asstr(arg(0)), v_asstr(arg(1)));
+  if (pseu_unlikely(!result))
+    return 1;
+  return_v(v_obj((Object *)result));
+}
+
+/* == String builtins; positions are 1-based and lengths are in bytes. */
+
+PSEU_FUNC(LENGTH)
+{
+  if (!v_isstr(s, arg(0)))
+    return 1;
+  return_v(v_i32((i32)v_asstr(arg(0))->length));
+}
+
+PSEU_FUNC(LEFT)
+{
+  if (!v_isstr(s, arg(0)) || !v_isi32(arg(1)))
+    return 1;
+
+  String *str = v_asstr(arg(0));
+  i32 n = v_asi32(arg(1));
+  if (n < 0 || (u32)n > str->length)
+    return 1;
+
+  String *result = string_slice(s, str, 0, n);
+  if (!result)
+    return 1;
+  return_v(v_obj((Object *)result));
+}
+
+PSEU_FUNC(RIGHT)
+{
+  if (!v_isstr(s, arg(0)) || !v_isi32(arg(1)))
+    return 1;
+
+  String *str = v_asstr(arg(0));
+  i32 n = v_asi32(arg(1));
+  if (n < 0 || (u32)n > str->length)
+    return 1;
+
+  String *result = string_slice(s, str, str->length - n, n);
+  if (!result)
+    return 1;
+  return_v(v_obj((Object *)result));
+}
+
+PSEU_FUNC(MID)
+{
+  if (!v_isstr(s, arg(0)) || !v_isi32(arg(1)) || !v_isi32(arg(2)))
+    return 1;
+
+  String *str = v_asstr(arg(0));
+  i32 start = v_asi32(arg(1));
+  i32 n = v_asi32(arg(2));
+  if (start < 1 || n < 0 || (u64)start - 1 + n > str->length)
+    return 1;
+
+  String *result = string_slice(s, str, start - 1, n);
+  if (!result)
+    return 1;
+  return_v(v_obj((Object *)result));
+}
+
+PSEU_FUNC(UCASE)
+{
+  if (!v_isstr(s, arg(0)))
+    return 1;
+
+  String *result = string_upper(s, v_asstr(arg(0)));
+  if (!result)
+    return 1;
+  return_v(v_obj((Object *)result));
+}
+
+PSEU_FUNC(LCASE)
+{
+  if (!v_isstr(s, arg(0)))
+    return 1;
+
+  String *result = string_lower(s, v_asstr(arg(0)));
+  if (!result)
+    return 1;
+  return_v(v_obj((Object *)result));
+}
+
+PSEU_FUNC(INSTR)
+{
+  if (!v_isstr(s, arg(0)) || !v_isstr(s, arg(1)))
+    return 1;
+
+  /* Returns 0 when the substring is not found. */
+  i64 pos;
+  if (string_find(s, v_asstr(arg(0)), v_asstr(arg(1)), &pos))
+    return 1;
+  return_v(v_i32((i32)(pos + 1)));
+}
+
+/* == Array builtins; packed INTEGER and REAL arrays go through vec.c. */
+
+/* Returns the array referenced by the specified value or NULL. */
+static Array *arg_array(State *s, Value *v)
+{
+  if (!v_isobj(v) || v_asobj(v)->header.type != V(s)->array_type)
+    return NULL;
+  return &v_asobj(v)->as.array;
+}
+
+PSEU_FUNC(SORT)
+{
+  Array *a = arg_array(s, arg(0));
+  if (!a)
+    return 1;
+  return array_sort(s, a);
+}
+
+PSEU_FUNC(SORTBY)
+{
+  Array *a = arg_array(s, arg(0));
+  if (!a || !v_isstr(s, arg(1)))
+    return 1;
+  return array_sort_by(s, a, v_asstr(arg(1)));
+}
+
+PSEU_FUNC(SUM)
+{
+  Array *a = arg_array(s, arg(0));
+  if (!a)
+    return 1;
+
+  switch (a->kind) {
+  case ARR_I32: return_v(v_i32(vec_ops()->sum_i32(a->items.i32s, a->length)));
+  case ARR_F32: return_v(v_f32(vec_ops()->sum_f32(a->items.f32s, a->length)));
+  default:      return pseu_error(s, "Expected an INTEGER or REAL array");
+  }
+}
+
+/* Stores the least or the greatest element of the array in args[0]. */
+static int reduce_extreme(State *s, Value *args, bool max)
+{
+  Array *a = arg_array(s, arg(0));
+  if (!a)
+    return 1;
+  if (a->kind != ARR_I32 && a->kind != ARR_F32)
+    return pseu_error(s, "Expected an INTEGER or REAL array");
+  if (a->length == 0)
+    return pseu_error(s, "Array is empty");
+
+  const VecOps *ops = vec_ops();
+  if (a->kind == ARR_I32) {
+    i32 (*fn)(const i32 *, u32) = max ? ops->max_i32 : ops->min_i32;
+    return_v(v_i32(fn(a->items.i32s, a->length)));
+  }
+  f32 (*fn)(const f32 *, u32) = max ? ops->max_f32 : ops->min_f32;
+  return_v(v_f32(fn(a->items.f32s, a->length)));
+}
+
+PSEU_FUNC(MIN)
+{
+  return reduce_extreme(s, args, false);
+}
+
+PSEU_FUNC(MAX)
+{
+  return reduce_extreme(s, args, true);
+}
+
+PSEU_FUNC(COUNT)
+{
+  Array *a = arg_array(s, arg(0));
+  if (!a)
+    return 1;
+
+  Value *x = arg(1);
+  u32 result = 0;
+  switch (a->kind) {
+  case ARR_I32:
+    if (!v_isi32(x))
+      return 1;
+    result = vec_ops()->count_i32(a->items.i32s, a->length, v_asi32(x));
+    break;
+  case ARR_F32:
+    if (!v_isnum(x))
+      return 1;
+    result = vec_ops()->count_f32(a->items.f32s, a->length,
+                                  v_isi32(x) ? v_i2f(x) : v_asf32(x));
+    break;
+  case ARR_BOOL:
+    if (!v_isbool(x))
+      return 1;
+    for (u32 i = 0; i < a->length; i++)
+      result += a_getbit(a, i) == v_asbool(x);
+    break;
+  case ARR_RECORD:
+    return pseu_error(s, "Cannot COUNT an array of records");
+  default:
+    if (!v_isstr(s, x))
+      return 1;
+    for (u32 i = 0; i < a->length; i++) {
+      Value *v = &a->items.values[i];
+      int o;
+      if (!v_isstr(s, v))
+        continue;
+      if (string_compare(s, v_asstr(v), v_asstr(x), &o))
+        return 1;
+      result += o == 0;
+    }
+    break;
+  }
+  return_v(v_i32((i32)result));
+}
+
+PSEU_FUNC(FILL)
+{
+  Array *a = arg_array(s, arg(0));
+  if (!a)
+    return 1;
+  if (a->length == 0)
+    return 0;
+  /* Converts the value to the element storage once. */
+  if (array_set(a, 0, arg(1)))
+    return 1;
+
+  switch (a->kind) {
+  case ARR_I32:
+    for (u32 i = 1; i < a->length; i++)
+      a->items.i32s[i] = a->items.i32s[0];
+    break;
+  case ARR_F32:
+    for (u32 i = 1; i < a->length; i++)
+      a->items.f32s[i] = a->items.f32s[0];
+    break;
+  case ARR_BOOL:
+    memset(a->items.bits, v_asbool(arg(1)) ? 0xff : 0,
+           array_bytes(ARR_BOOL, a->length));
+    break;
+  default:
+    for (u32 i = 1; i < a->length; i++)
+      a->items.values[i] = a->items.values[0];
+    break;
+  }
+  return 0;
+}
+
+/* Adds or multiplies the elements of the array in args[0] by the elements of
+ * the array of the same length in args[1], or by the number in args[1].
+ */
+static int map_array(State *s, Value *args, bool mul)
+{
+  Array *a = arg_array(s, arg(0));
+  if (!a)
+    return 1;
+  if (a->kind != ARR_I32 && a->kind != ARR_F32)
+    return pseu_error(s, "Expected an INTEGER or REAL array");
+
+  const VecOps *ops = vec_ops();
+  Array *b = arg_array(s, arg(1));
+  if (b) {
+    if (b->length != a->length)
+      return pseu_error(s, "Arrays differ in length");
+
+    if (a->kind == ARR_I32 && b->kind == ARR_I32) {
+      (mul ? ops->mul_i32 : ops->add_i32)(a->items.i32s, b->items.i32s, a->length);
+    } else if (a->kind == ARR_F32 && b->kind == ARR_F32) {
+      (mul ? ops->mul_f32 : ops->add_f32)(a->items.f32s, b->items.f32s, a->length);
+    } else if (a->kind == ARR_F32 && b->kind == ARR_I32) {
+      for (u32 i = 0; i < a->length; i++) {
+        f32 y = (f32)b->items.i32s[i];
+        a->items.f32s[i] = mul ? a->items.f32s[i] * y : a->items.f32s[i] + y;
+      }
+    } else {
+      return pseu_error(s, "Expected an INTEGER or REAL array");
+    }
+    return 0;
+  }
+
+  Value *x = arg(1);
+  if (a->kind == ARR_I32 && v_isi32(x))
+    (mul ? ops->muls_i32 : ops->adds_i32)(a->items.i32s, v_asi32(x), a->length);
+  else if (a->kind == ARR_F32 && v_isnum(x))
+    (mul ? ops->muls_f32 : ops->adds_f32)(a->items.f32s,
+        v_isi32(x) ? v_i2f(x) : v_asf32(x), a->length);
+  else
+    return 1;
+  return 0;
+}
+
+PSEU_FUNC(ADD)
+{
+  return map_array(s, args, false);
+}
+
+PSEU_FUNC(MUL)
+{
+  return map_array(s, args, true);
+}
+
+/* == File builtins; files are identified by the name they were opened with. */
+
+/* Returns the open file named by the specified value or reports an error. */
+static File *find_file(State *s, Value *name, u8 mode)
+{
+  if (!v_isstr(s, name))
+    return NULL;
+
+  File *f = file_find(s, v_asstr(name));
+  if (!f) {
+    pseu_error(s, "File is not open");
+    return NULL;
+  }
+  if ((mode == FILE_READ) != (f->mode == FILE_READ)) {
+    pseu_error(s, mode == FILE_READ ? "File is not open for reading"
+                                    : "File is not open for writing");
+    return NULL;
+  }
+  return f;
+}
+
+PSEU_FUNC(openfile)
+{
+  if (!v_isstr(s, arg(0)) || !v_isi32(arg(1)) || (u32)v_asi32(arg(1)) > FILE_APPEND)
+    return 1;
+  if (file_find(s, v_asstr(arg(0))))
+    return pseu_error(s, "File is already open");
+
+  return file_open(s, v_asstr(arg(0)), (u8)v_asi32(arg(1))) == NULL;
+}
+
+PSEU_FUNC(closefile)
+{
+  if (!v_isstr(s, arg(0)))
+    return 1;
+
+  File *f = file_find(s, v_asstr(arg(0)));
+  if (!f)
+    return pseu_error(s, "File is not open");
+  return file_close(s, f);
+}
+
+PSEU_FUNC(readfile)
+{
+  File *f = find_file(s, arg(0), FILE_READ);
+  if (!f)
+    return 1;
+  if (file_eof(s, f))
+    return pseu_error(s, "Read past the end of file");
+
+  String *result = file_read_line(s, f);
+  if (!result)
+    return 1;
+  return_v(v_obj((Object *)result));
+}
+
+PSEU_FUNC(writefile)
+{
+  File *f = find_file(s, arg(0), FILE_WRITE);
+  if (!f)
+    return 1;
+
+  char buffer[64];
+  const char *chars;
+  size len;
+  if (format_value(s, arg(1), buffer, sizeof(buffer), &chars, &len))
+    return 1;
+  if (file_write(s, f, chars, len) || file_write(s, f, "\n", 1))
+    return 1;
+  return 0;
+}
+
+PSEU_FUNC(EOF)
+{
+  File *f = find_file(s, arg(0), FILE_READ);
+  if (!f)
+    return 1;
+  return_v(v_bool(file_eof(s, f)));
+}
+
 PSEU_FUNC(not)
 {
   pseu_unused(s);
@@ -106,6 +518,10 @@ void pseu_core_init(VM *vm)
   PSEU_DEF_TYPE(BOOLEAN, &vm->boolean_type);
   PSEU_DEF_TYPE(INTEGER, &vm->integer_type);
   PSEU_DEF_TYPE(ARRAY,   &vm->array_type);
+  PSEU_DEF_TYPE(STRING,  &vm->string_type);
+  def_type(vm, "@FILE", &vm->file_type);
+
+  vm->empty_string = string_intern(S(vm), "", 0);
 
   PSEU_DEF_PROC(output, PARAMS("ANY"));
 
@@ -114,6 +530,12 @@ void pseu_core_init(VM *vm)
   PSEU_DEF_FUNC(mul, 	  RETURN("ANY"), PARAMS("ANY", "ANY"));
   PSEU_DEF_FUNC(div, 	  RETURN("ANY"), PARAMS("ANY", "ANY"));
   PSEU_DEF_FUNC(neg,    RETURN("ANY"), PARAMS("ANY"));
+  PSEU_DEF_FUNC(concat, RETURN("STRING"), PARAMS("STRING", "STRING"));
+
+  PSEU_DEF_PROC(openfile,  PARAMS("STRING", "INTEGER"));
+  PSEU_DEF_PROC(closefile, PARAMS("STRING"));
+  PSEU_DEF_PROC(writefile, PARAMS("STRING", "ANY"));
+  PSEU_DEF_FUNC(readfile,  RETURN("STRING"), PARAMS("STRING"));
 
   PSEU_DEF_FUNC(and,    RETURN("BOOLEAN"), PARAMS("BOOLEAN", "BOOLEAN"));
   PSEU_DEF_FUNC(or,     RETURN("BOOLEAN"), PARAMS("BOOLEAN", "BOOLEAN"));
@@ -124,6 +546,25 @@ void pseu_core_init(VM *vm)
   PSEU_DEF_FUNC(le,     RETURN("BOOLEAN"), PARAMS("ANY", "ANY"));
   PSEU_DEF_FUNC(ge,     RETURN("BOOLEAN"), PARAMS("ANY", "ANY"));
   PSEU_DEF_FUNC(eq,     RETURN("BOOLEAN"), PARAMS("ANY", "ANY"));
+  PSEU_DEF_FUNC(ne,     RETURN("BOOLEAN"), PARAMS("ANY", "ANY"));
+
+  PSEU_DEF_BUILTIN(LENGTH, RETURN("INTEGER"), PARAMS("STRING"));
+  PSEU_DEF_BUILTIN(LEFT,   RETURN("STRING"),  PARAMS("STRING", "INTEGER"));
+  PSEU_DEF_BUILTIN(RIGHT,  RETURN("STRING"),  PARAMS("STRING", "INTEGER"));
+  PSEU_DEF_BUILTIN(MID,    RETURN("STRING"),  PARAMS("STRING", "INTEGER", "INTEGER"));
+  PSEU_DEF_BUILTIN(UCASE,  RETURN("STRING"),  PARAMS("STRING"));
+  PSEU_DEF_BUILTIN(LCASE,  RETURN("STRING"),  PARAMS("STRING"));
+  PSEU_DEF_BUILTIN(INSTR,  RETURN("INTEGER"), PARAMS("STRING", "STRING"));
+  PSEU_DEF_BUILTIN(EOF,    RETURN("BOOLEAN"), PARAMS("STRING"));
+  PSEU_DEF_BUILTIN(SORT,   NULL,              PARAMS("ARRAY"));
+  PSEU_DEF_BUILTIN(SORTBY, NULL,              PARAMS("ARRAY", "STRING"));
+  PSEU_DEF_BUILTIN(SUM,    RETURN("ANY"),     PARAMS("ARRAY"));
+  PSEU_DEF_BUILTIN(MIN,    RETURN("ANY"),     PARAMS("ARRAY"));
+  PSEU_DEF_BUILTIN(MAX,    RETURN("ANY"),     PARAMS("ARRAY"));
+  PSEU_DEF_BUILTIN(COUNT,  RETURN("INTEGER"), PARAMS("ARRAY", "ANY"));
+  PSEU_DEF_BUILTIN(FILL,   NULL,              PARAMS("ARRAY", "ANY"));
+  PSEU_DEF_BUILTIN(ADD,    NULL,              PARAMS("ARRAY", "ANY"));
+  PSEU_DEF_BUILTIN(MUL,    NULL,              PARAMS("ARRAY", "ANY"));
 
   PSEU_DEF_CONST(TRUE,  v_bool(true));
   PSEU_DEF_CONST(FALSE, v_bool(false));
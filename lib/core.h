@@ -13,6 +13,9 @@
 #define PSEU_DEF_TYPE(x, r)      def_type(vm, #x, r)
 #define PSEU_DEF_PROC(x, pt)     def_func(vm, "@" #x, NULL, pt, impl_##x)
 #define PSEU_DEF_FUNC(x, rt, pt) def_func(vm, "@" #x, rt, pt, impl_##x)
+/* Defines a builtin callable by name from pseu code; implemented by
+ * PSEU_FUNC(x). */
+#define PSEU_DEF_BUILTIN(x, rt, pt) def_func(vm, #x, rt, pt, impl_##x)
 
 #define PSEU_FUNC(x) \
   static int impl_##x(State *s, Value *args)
@@ -0,0 +1,224 @@
+#include "vm.h"
+#include "obj.h"
+
+/* Operands of an instruction, one letter per operand:
+ *
+ *  b  u8          k  u8 constant; decoded to its Value
+ *  h  u16         g  u16 global; decoded to its Value
+ *  w  u32         f  u16 function; decoded to the Function
+ *                 t  u16 type; decoded to the Type
+ *                 j  u16 branch address; decoded to the target word
+ *
+ * Some instructions have `entries` operands repeating `entry`, between the
+ * `head` and `tail` ones.
+ */
+typedef struct Layout {
+  const char *head;       /* Operands before the entries. */
+  const char *entry;      /* Operands of each entry. */
+  u32 entries;            /* Number of entries. */
+  const char *tail;       /* Operands after the entries. */
+} Layout;
+
+#define u16_at(p) ((u16)((p)[0] << 8 | (p)[1]))
+
+/* Describes the operands of the instruction at `ip`; false if unknown. */
+static bool layout(const BCode *ip, Layout *l)
+{
+  l->entry = "";
+  l->entries = 0;
+  l->tail = "";
+
+  switch (*ip) {
+  case OP_END: case OP_RET: case OP_RET_VAL:
+  case OP_ADD_I32: case OP_SUB_I32: case OP_MUL_I32: case OP_DIV_I32:
+  case OP_ADD_F32: case OP_SUB_F32: case OP_MUL_F32: case OP_DIV_F32:
+  case OP_I2F:
+    l->head = "";
+    return true;
+  case OP_LD_LOCAL: case OP_ST_LOCAL:
+  case OP_LD_I32: case OP_ST_I32: case OP_LD_F32: case OP_ST_F32:
+  case OP_LD_BOOL: case OP_ST_BOOL: case OP_TEE_I32: case OP_TEE_F32:
+  case OP_LD_INDEX: case OP_ST_INDEX: case OP_LD_INDEX_NC: case OP_ST_INDEX_NC:
+  case OP_COLUMN: case OP_REF_LOCAL: case OP_REF_INDEX:
+  case OP_LD_REF: case OP_ST_REF: case OP_OWN:
+    l->head = "b";
+    return true;
+  case OP_LD_CONST:
+    l->head = "k";
+    return true;
+  case OP_LD_GLOBAL: case OP_ST_GLOBAL:
+    l->head = "g";
+    return true;
+  case OP_CALL:
+    l->head = "f";
+    return true;
+  case OP_BR: case OP_BR_FALSE: case OP_BR_TRUE:
+    l->head = "j";
+    return true;
+  case OP_BR_CMP:
+    l->head = "bj";
+    return true;
+  case OP_CHK_TYPE: case OP_NEW_RECORD: case OP_NEW_RECORD_FRAME:
+  case OP_COPY_RECORD: case OP_COPY_RECORD_FRAME:
+    l->head = "t";
+    return true;
+  case OP_LD_FIELD: case OP_ST_FIELD: case OP_REF_FIELD:
+    l->head = "tb";
+    return true;
+  case OP_LD_COLUMN: case OP_ST_COLUMN: case OP_LD_COLUMN_NC: case OP_ST_COLUMN_NC:
+  case OP_REF_COLUMN: case OP_REF_SLOT: case OP_MOV_I32: case OP_MOV_F32:
+    l->head = "bb";
+    return true;
+  case OP_INC_I32: case OP_SET_I32:
+    l->head = "bw";
+    return true;
+  case OP_ADD_I32_SS: case OP_SUB_I32_SS: case OP_MUL_I32_SS:
+  case OP_ADD_F32_SS: case OP_SUB_F32_SS: case OP_MUL_F32_SS: case OP_DIV_F32_SS:
+    l->head = "bbb";
+    return true;
+  case OP_ADD_I32_SI: case OP_SUB_I32_SI: case OP_MUL_I32_SI:
+    l->head = "bbw";
+    return true;
+  case OP_BR_CMP_SS:
+    l->head = "bbbj";
+    return true;
+  case OP_BR_CMP_SI:
+    l->head = "bbwj";
+    return true;
+  case OP_CHK_INDEX:
+    l->head = "ww";
+    return true;
+  case OP_NEW_ARRAY: case OP_NEW_ARRAY_FRAME:
+    /* Type, dimensions, lower bound and extent of each, base offset. */
+    l->head = "tb";
+    l->entry = "ww";
+    l->entries = ip[3];
+    l->tail = "w";
+    return true;
+  case OP_SWITCH_TABLE:
+    /* Lower label, count, other; an address per label. */
+    l->head = "whj";
+    l->entry = "j";
+    l->entries = u16_at(ip + 5);
+    return true;
+  case OP_SWITCH_RANGE:
+    /* Count, other; lower, upper and address of each range. */
+    l->head = "hj";
+    l->entry = "wwj";
+    l->entries = u16_at(ip + 1);
+    return true;
+  case OP_SWITCH_STR:
+    /* Mask, other; constant and address of each slot of the hash table. */
+    l->head = "hj";
+    l->entry = "hj";
+    l->entries = (u32)u16_at(ip + 1) + 1;
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* Returns the number of bytes of the operands in `fmt`. */
+static u32 format_bytes(const char *fmt)
+{
+  u32 result = 0;
+  for (; *fmt; fmt++)
+    result += *fmt == 'b' || *fmt == 'k' ? 1 : *fmt == 'w' ? 4 : 2;
+  return result;
+}
+
+u32 pseu_code_len(const BCode *ip)
+{
+  Layout l;
+  if (!layout(ip, &l))
+    return 0;
+  return 1 + format_bytes(l.head) + l.entries * format_bytes(l.entry) + format_bytes(l.tail);
+}
+
+/* Returns the number of words of the instruction at `ip`. */
+static u32 code_words(const BCode *ip)
+{
+  Layout l;
+  layout(ip, &l);
+  return 1 + (u32)strlen(l.head) + l.entries * (u32)strlen(l.entry) + (u32)strlen(l.tail);
+}
+
+/* Decodes the operands in `fmt` from `ip` into `w`; returns the end of the
+ * operands.
+ */
+static const BCode *decode_operands(State *s, Function *fn, Word *words, u32 *at,
+                                    const char *fmt, const BCode *ip, Word **w)
+{
+  for (; *fmt; fmt++) {
+    Word *o = (*w)++;
+    switch (*fmt) {
+    case 'b':
+      o->u = *ip++;
+      break;
+    case 'k':
+      o->value = &fn->as.pseu.consts[*ip++];
+      break;
+    case 'w':
+      o->u = (u32)ip[0] << 24 | (u32)ip[1] << 16 | (u32)ip[2] << 8 | (u32)ip[3];
+      ip += 4;
+      break;
+    default: {
+      u16 index = u16_at(ip);
+      ip += 2;
+      switch (*fmt) {
+      case 'g': o->value = &V(s)->vars[index].value; break;
+      case 'f': o->fn = &V(s)->fns[index]; break;
+      case 't': o->type = &V(s)->types[index]; break;
+      case 'j': o->target = &words[at[index]]; break;
+      default:  o->u = index; break;
+      }
+    }
+    }
+  }
+  return ip;
+}
+
+int pseu_decode(State *s, Function *fn, const void *const *handlers)
+{
+  FunctionPseu *pseu = &fn->as.pseu;
+  size count = pseu->code_count;
+
+  /* Word at which the instruction at each offset starts. */
+  u32 *at = pseu_alloc(s, (count + 1) * sizeof(u32));
+  if (pseu_unlikely(!at))
+    return 1;
+
+  u32 words_count = 0;
+  for (size i = 0; i < count; i += pseu_code_len(pseu->code + i)) {
+    at[i] = words_count;
+    words_count += code_words(pseu->code + i);
+  }
+  at[count] = words_count;
+
+  /* A last END stops a branch to the end of the code. */
+  Word *words = pseu_alloc(s, (words_count + 1) * sizeof(Word));
+  if (pseu_unlikely(!words)) {
+    pseu_free(s, at);
+    return 1;
+  }
+
+  Word *w = words;
+  const BCode *ip = pseu->code;
+  while (ip < pseu->code + count) {
+    Layout l;
+    layout(ip, &l);
+    (w++)->handler = handlers ? handlers[*ip] : (const void *)(size)*ip;
+    ip++;
+
+    ip = decode_operands(s, fn, words, at, l.head, ip, &w);
+    for (u32 e = 0; e < l.entries; e++)
+      ip = decode_operands(s, fn, words, at, l.entry, ip, &w);
+    ip = decode_operands(s, fn, words, at, l.tail, ip, &w);
+  }
+  w->handler = handlers ? handlers[OP_END] : (const void *)(size)OP_END;
+
+  pseu_free(s, at);
+  pseu_free(s, pseu->words);
+  pseu->words = words;
+  return 0;
+}
@@ -21,7 +21,10 @@ void dump_value(State *s, FILE *f, Value *v)
         fprintf(f, "%f)\n", v->as.real);
         break;
       case VAL_OBJ:
-        fprintf(f, "%p)\n", (void *)v->as.object);
+        if (v_isstr(s, v) && !s_isrope(v_asstr(v)) && !s_isslice(v_asstr(v)))
+          fprintf(f, "\"%s\")\n", v_asstr(v)->chars);
+        else
+          fprintf(f, "%p)\n", (void *)v->as.object);
         break;
     }
   }
@@ -47,7 +50,12 @@ void dump_fn_sig(FILE *f, Function *fn)
 
   fprintf(f, "(");
   for (u8 i = 0; i < fn->params_count; i++) {
-    fprintf(f, "%s", fn->param_types[i]->ident);
+    if (fn->byref & (1u << i))
+      fprintf(f, "BYREF ");
+    if (fn->param_elems && fn->param_elems[i])
+      fprintf(f, "ARRAY OF %s", fn->param_elems[i]->ident);
+    else
+      fprintf(f, "%s", fn->param_types[i]->ident);
     if (i != fn->params_count - 1)
       fprintf(f, ", ");
   }
@@ -58,6 +66,8 @@ void dump_fn_sig(FILE *f, Function *fn)
 
   if (fn->type == FN_PSEU)
     fprintf(f, " max_stack %d\n", fn->as.pseu.max_stack);
+  else if (fn->type == FN_HOST)
+    fprintf(f, " host\n");
   else
     fprintf(f, " c\n");
 }
@@ -80,6 +90,7 @@ void dump_fn_locals(FILE *f, Function *fn)
   fprintf(f, "locals %d\n", fn->as.pseu.local_count);
   for (u8 i = 0; i < fn->as.pseu.local_count; i++)
     fprintf(f, " %03d %s\n", i, fn->as.pseu.locals[i]->ident);
+  fprintf(f, "slots %d\n", fn->as.pseu.slot_count);
 }
 
 void dump_fn_code(State *s, FILE *f, Function *fn)
@@ -88,9 +99,13 @@ void dump_fn_code(State *s, FILE *f, Function *fn)
 
   #define READ_UINT8()  	(*ip++)
   #define READ_UINT16() 	(ip += 2, (u16)(ip[-2] << 8 | ip[-1]));
+  #define READ_UINT32() 	(ip += 4, (u32)ip[-4] << 24 | (u32)ip[-3] << 16 | \
+                                    (u32)ip[-2] << 8  | (u32)ip[-1]);
   #define INTERPRET               \
     BCode op;                     \
     decode:                       \
+    if (ip >= ip_end)             \
+      return;                     \
     switch ((op = READ_UINT8()))
   #define DISPATCH_EXIT() return;
   #define DISPATCH()      goto decode
@@ -103,6 +118,7 @@ void dump_fn_code(State *s, FILE *f, Function *fn)
 
   BCode *ip_begin = fn->as.pseu.code;
   BCode *ip = ip_begin;
+  BCode *ip_end = ip_begin + fn->as.pseu.code_count;
 
   INTERPRET {
     OP(LD_CONST): {
@@ -124,6 +140,198 @@ void dump_fn_code(State *s, FILE *f, Function *fn)
       OP_DUMP1("st.local", index);
       DISPATCH();
     }
+    OP(LD_I32): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("ld.i32", index);
+      DISPATCH();
+    }
+    OP(ST_I32): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("st.i32", index);
+      DISPATCH();
+    }
+    OP(LD_F32): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("ld.f32", index);
+      DISPATCH();
+    }
+    OP(ST_F32): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("st.f32", index);
+      DISPATCH();
+    }
+    OP(LD_BOOL): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("ld.bool", index);
+      DISPATCH();
+    }
+    OP(ST_BOOL): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("st.bool", index);
+      DISPATCH();
+    }
+    OP(ADD_I32): {
+      OP_DUMP0("add.i32");
+      DISPATCH();
+    }
+    OP(SUB_I32): {
+      OP_DUMP0("sub.i32");
+      DISPATCH();
+    }
+    OP(MUL_I32): {
+      OP_DUMP0("mul.i32");
+      DISPATCH();
+    }
+    OP(DIV_I32): {
+      OP_DUMP0("div.i32");
+      DISPATCH();
+    }
+    OP(ADD_F32): {
+      OP_DUMP0("add.f32");
+      DISPATCH();
+    }
+    OP(SUB_F32): {
+      OP_DUMP0("sub.f32");
+      DISPATCH();
+    }
+    OP(MUL_F32): {
+      OP_DUMP0("mul.f32");
+      DISPATCH();
+    }
+    OP(DIV_F32): {
+      OP_DUMP0("div.f32");
+      DISPATCH();
+    }
+    OP(I2F): {
+      OP_DUMP0("i2f");
+      DISPATCH();
+    }
+    OP(TEE_I32): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("tee.i32", index);
+      DISPATCH();
+    }
+    OP(TEE_F32): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("tee.f32", index);
+      DISPATCH();
+    }
+    OP(INC_I32): {
+      u8 index = READ_UINT8();
+      i32 step = (i32)READ_UINT32();
+
+      fprintf(f, " %05d %s %d %d\n", IP, "inc.i32", index, step);
+      DISPATCH();
+    }
+    OP(ADD_I32_SS): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+      u8 b = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d %d\n", IP, "add.i32.ss", d, a, b);
+      DISPATCH();
+    }
+    OP(SUB_I32_SS): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+      u8 b = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d %d\n", IP, "sub.i32.ss", d, a, b);
+      DISPATCH();
+    }
+    OP(MUL_I32_SS): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+      u8 b = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d %d\n", IP, "mul.i32.ss", d, a, b);
+      DISPATCH();
+    }
+    OP(ADD_F32_SS): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+      u8 b = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d %d\n", IP, "add.f32.ss", d, a, b);
+      DISPATCH();
+    }
+    OP(SUB_F32_SS): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+      u8 b = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d %d\n", IP, "sub.f32.ss", d, a, b);
+      DISPATCH();
+    }
+    OP(MUL_F32_SS): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+      u8 b = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d %d\n", IP, "mul.f32.ss", d, a, b);
+      DISPATCH();
+    }
+    OP(DIV_F32_SS): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+      u8 b = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d %d\n", IP, "div.f32.ss", d, a, b);
+      DISPATCH();
+    }
+    OP(ADD_I32_SI): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+      i32 b = (i32)READ_UINT32();
+
+      fprintf(f, " %05d %s %d %d %d\n", IP, "add.i32.si", d, a, b);
+      DISPATCH();
+    }
+    OP(SUB_I32_SI): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+      i32 b = (i32)READ_UINT32();
+
+      fprintf(f, " %05d %s %d %d %d\n", IP, "sub.i32.si", d, a, b);
+      DISPATCH();
+    }
+    OP(MUL_I32_SI): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+      i32 b = (i32)READ_UINT32();
+
+      fprintf(f, " %05d %s %d %d %d\n", IP, "mul.i32.si", d, a, b);
+      DISPATCH();
+    }
+    OP(MOV_I32): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d\n", IP, "mov.i32", d, a);
+      DISPATCH();
+    }
+    OP(MOV_F32): {
+      u8 d = READ_UINT8();
+      u8 a = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d\n", IP, "mov.f32", d, a);
+      DISPATCH();
+    }
+    OP(SET_I32): {
+      u8 d = READ_UINT8();
+      i32 value = (i32)READ_UINT32();
+
+      fprintf(f, " %05d %s %d %d\n", IP, "set.i32", d, value);
+      DISPATCH();
+    }
     OP(LD_GLOBAL): {
       u16 index = READ_UINT16(); 
 
@@ -143,6 +351,96 @@ void dump_fn_code(State *s, FILE *f, Function *fn)
       OP_DUMP1("br.false", index);
       DISPATCH();
     }
+    OP(BR_TRUE): {
+      u16 index = READ_UINT16();
+
+      OP_DUMP1("br.true", index);
+      DISPATCH();
+    }
+    OP(BR_CMP): {
+      static const char *const names[] = {
+        #define COMP_NAME(n, _, __, ___, ____) #n,
+        PSEU_COMP_TYPES(COMP_NAME, _, __, ___)
+        #undef  COMP_NAME
+      };
+      u8 cmp = READ_UINT8();
+      u16 index = READ_UINT16();
+
+      fprintf(f, " %05d br.%s.%s %d\n", IP, names[cmp & PSEU_BR_CMP_MASK],
+              cmp & PSEU_BR_CMP_TRUE ? "true" : "false", index);
+      DISPATCH();
+    }
+    OP(BR_CMP_SS): {
+      static const char *const names[] = {
+        #define COMP_NAME(n, _, __, ___, ____) #n,
+        PSEU_COMP_TYPES(COMP_NAME, _, __, ___)
+        #undef  COMP_NAME
+      };
+      u8 cmp = READ_UINT8();
+      u8 a = READ_UINT8();
+      u8 b = READ_UINT8();
+      u16 index = READ_UINT16();
+
+      fprintf(f, " %05d br.%s.%s.ss %d %d %d\n", IP, names[cmp & PSEU_BR_CMP_MASK],
+              cmp & PSEU_BR_CMP_TRUE ? "true" : "false", a, b, index);
+      DISPATCH();
+    }
+    OP(BR_CMP_SI): {
+      static const char *const names[] = {
+        #define COMP_NAME(n, _, __, ___, ____) #n,
+        PSEU_COMP_TYPES(COMP_NAME, _, __, ___)
+        #undef  COMP_NAME
+      };
+      u8 cmp = READ_UINT8();
+      u8 a = READ_UINT8();
+      i32 b = (i32)READ_UINT32();
+      u16 index = READ_UINT16();
+
+      fprintf(f, " %05d br.%s.%s.si %d %d %d\n", IP, names[cmp & PSEU_BR_CMP_MASK],
+              cmp & PSEU_BR_CMP_TRUE ? "true" : "false", a, b, index);
+      DISPATCH();
+    }
+    OP(SWITCH_TABLE): {
+      i32 lower = (i32)READ_UINT32();
+      u16 count = READ_UINT16();
+      u16 other = READ_UINT16();
+
+      fprintf(f, " %05d %s %d:%d", IP, "switch.table", lower, lower + count - 1);
+      for (u16 i = 0; i < count; i++) {
+        u16 target = READ_UINT16();
+        fprintf(f, " %d", target);
+      }
+      fprintf(f, " else %d\n", other);
+      DISPATCH();
+    }
+    OP(SWITCH_RANGE): {
+      u16 count = READ_UINT16();
+      u16 other = READ_UINT16();
+
+      fprintf(f, " %05d %s", IP, "switch.range");
+      for (u16 i = 0; i < count; i++) {
+        i32 lower = (i32)READ_UINT32();
+        i32 upper = (i32)READ_UINT32();
+        u16 target = READ_UINT16();
+        fprintf(f, " %d:%d->%d", lower, upper, target);
+      }
+      fprintf(f, " else %d\n", other);
+      DISPATCH();
+    }
+    OP(SWITCH_STR): {
+      u16 mask = READ_UINT16();
+      u16 other = READ_UINT16();
+
+      fprintf(f, " %05d %s", IP, "switch.str");
+      for (u32 i = 0; i <= mask; i++) {
+        u16 konst = READ_UINT16();
+        u16 target = READ_UINT16();
+        if (konst != PSEU_SWITCH_EMPTY)
+          fprintf(f, " %d->%d", konst, target);
+      }
+      fprintf(f, " else %d\n", other);
+      DISPATCH();
+    }
     OP(CALL): {
       u16 index = READ_UINT16(); 
       Function *nfn = &VM(s)->fns[index]; 
@@ -151,9 +449,173 @@ void dump_fn_code(State *s, FILE *f, Function *fn)
       dump_fn_sig(f, nfn);
       DISPATCH();
     }
+    /* Code may follow a RETURN, so keep going to the end of the code. */
     OP(RET): {
       OP_DUMP0("ret");
-      DISPATCH_EXIT();
+      DISPATCH();
+    }
+    OP(RET_VAL): {
+      OP_DUMP0("ret.val");
+      DISPATCH();
+    }
+    OP(NEW_ARRAY):
+    OP(NEW_ARRAY_FRAME): {
+      u16 type_index = READ_UINT16();
+      u8 dims = READ_UINT8();
+
+      fprintf(f, " %05d %s %s[", IP, op == OP_NEW_ARRAY ? "new.array" : "new.array.frame",
+              VM(s)->types[type_index].ident);
+      for (u8 d = 0; d < dims; d++) {
+        i32 lower = (i32)READ_UINT32();
+        u32 extent = READ_UINT32();
+        fprintf(f, d ? ", %d:%d" : "%d:%d", lower, lower + (i32)extent - 1);
+      }
+      i32 base = (i32)READ_UINT32();
+      fprintf(f, "] base %d\n", base);
+      DISPATCH();
+    }
+    OP(LD_INDEX): {
+      u8 dims = READ_UINT8();
+
+      OP_DUMP1("ld.index", dims);
+      DISPATCH();
+    }
+    OP(ST_INDEX): {
+      u8 dims = READ_UINT8();
+
+      OP_DUMP1("st.index", dims);
+      DISPATCH();
+    }
+    OP(LD_INDEX_NC): {
+      u8 dims = READ_UINT8();
+
+      OP_DUMP1("ld.index.nc", dims);
+      DISPATCH();
+    }
+    OP(ST_INDEX_NC): {
+      u8 dims = READ_UINT8();
+
+      OP_DUMP1("st.index.nc", dims);
+      DISPATCH();
+    }
+    OP(CHK_INDEX): {
+      i32 lower = (i32)READ_UINT32();
+      i32 upper = (i32)READ_UINT32();
+
+      fprintf(f, " %05d %s %d:%d\n", IP, "chk.index", lower, upper);
+      DISPATCH();
+    }
+    OP(CHK_TYPE): {
+      u16 type_index = READ_UINT16();
+
+      fprintf(f, " %05d %s %s\n", IP, "chk.type", VM(s)->types[type_index].ident);
+      DISPATCH();
+    }
+    OP(NEW_RECORD):
+    OP(NEW_RECORD_FRAME): {
+      u16 type_index = READ_UINT16();
+
+      fprintf(f, " %05d %s %s\n", IP, op == OP_NEW_RECORD ? "new.record" : "new.record.frame",
+              VM(s)->types[type_index].ident);
+      DISPATCH();
+    }
+    OP(LD_FIELD): {
+      u16 type_index = READ_UINT16();
+      u8 slot = READ_UINT8();
+      Type *type = &VM(s)->types[type_index];
+
+      fprintf(f, " %05d %s %s.%s %d\n", IP, "ld.field", type->ident,
+              type->fields[slot].ident, slot);
+      DISPATCH();
+    }
+    OP(ST_FIELD): {
+      u16 type_index = READ_UINT16();
+      u8 slot = READ_UINT8();
+      Type *type = &VM(s)->types[type_index];
+
+      fprintf(f, " %05d %s %s.%s %d\n", IP, "st.field", type->ident,
+              type->fields[slot].ident, slot);
+      DISPATCH();
+    }
+    OP(COPY_RECORD):
+    OP(COPY_RECORD_FRAME): {
+      u16 type_index = READ_UINT16();
+
+      fprintf(f, " %05d %s %s\n", IP, op == OP_COPY_RECORD ? "copy.record" : "copy.record.frame",
+              VM(s)->types[type_index].ident);
+      DISPATCH();
+    }
+    OP(LD_COLUMN):
+    OP(ST_COLUMN):
+    OP(LD_COLUMN_NC):
+    OP(ST_COLUMN_NC): {
+      static const char *const names[] = {
+        "ld.column", "st.column", "ld.column.nc", "st.column.nc"
+      };
+      u8 dims = READ_UINT8();
+      u8 slot = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d\n", IP, names[op - OP_LD_COLUMN], dims, slot);
+      DISPATCH();
+    }
+    OP(COLUMN): {
+      u8 slot = READ_UINT8();
+
+      OP_DUMP1("column", slot);
+      DISPATCH();
+    }
+    OP(REF_LOCAL): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("ref.local", index);
+      DISPATCH();
+    }
+    OP(REF_SLOT): {
+      u8 index = READ_UINT8();
+      u8 raw = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d\n", IP, "ref.slot", index, raw);
+      DISPATCH();
+    }
+    OP(REF_INDEX): {
+      u8 dims = READ_UINT8();
+
+      OP_DUMP1("ref.index", dims);
+      DISPATCH();
+    }
+    OP(REF_COLUMN): {
+      u8 dims = READ_UINT8();
+      u8 slot = READ_UINT8();
+
+      fprintf(f, " %05d %s %d %d\n", IP, "ref.column", dims, slot);
+      DISPATCH();
+    }
+    OP(REF_FIELD): {
+      u16 type_index = READ_UINT16();
+      u8 slot = READ_UINT8();
+      Type *type = &VM(s)->types[type_index];
+
+      fprintf(f, " %05d %s %s.%s %d\n", IP, "ref.field", type->ident,
+              type->fields[slot].ident, slot);
+      DISPATCH();
+    }
+    OP(LD_REF): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("ld.ref", index);
+      DISPATCH();
+    }
+    OP(ST_REF): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("st.ref", index);
+      DISPATCH();
+    }
+    OP(OWN): {
+      u8 index = READ_UINT8();
+
+      OP_DUMP1("own", index);
+      DISPATCH();
     }
     OP_UNDEF(): {
       OP_DUMP0("undef");
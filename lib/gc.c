@@ -1,61 +1,366 @@
+#include <time.h>
+
 #include "vm.h"
 #include "obj.h"
 
-bool mark_dfs(GC *gc, Object *o)
+/* Initial number of live bytes before the first collection. */
+#define PSEU_GC_INIT_THRESHOLD (1024 * 1024)
+/* Initial capacity of the gray stack. */
+#define PSEU_GC_INIT_GRAY_SIZE 64
+
+/* Returns the index of the specified type in the VM type table. */
+static size type_index(GC *gc, Type *type)
+{
+  return (size)(type - gc->vm->types);
+}
+
+/* Returns the number of bytes used by the specified object. */
+static size object_size(GC *gc, Object *o)
+{
+  VM *vm = gc->vm;
+  Type *type = o->header.type;
+
+  if (type == vm->array_type) {
+    Array *a = &o->as.array;
+    size sz = sizeof(Array) + array_bytes(a->kind, a->capacity);
+    if (a->kind == ARR_RECORD)
+      sz += a->record->fields_count * sizeof(Array *);
+    return sz;
+  }
+  if (type == vm->string_type)
+    return string_bytes(&o->as.string);
+  if (type == vm->file_type)
+    return file_bytes(&o->as.file);
+  if (t_isrecord(type))
+    return sizeof(UObject) + type->fields_count * sizeof(Value);
+
+  pseu_unreachable();
+  return 0;
+}
+
+/* Frees the specified object and the blocks it owns. */
+static void object_free(GC *gc, Object *o)
+{
+  VM *vm = gc->vm;
+  State *s = S(vm);
+
+  if (o->header.type == vm->array_type) {
+    pseu_free(s, o->as.array.items.ptr);
+  } else if (o->header.type == vm->string_type) {
+    if (o->as.string.flags & STR_OWNED)
+      pseu_free(s, o->as.string.chars);
+    else if (s_ismapped(&o->as.string))
+      file_unmap(&o->as.string);
+  } else if (o->header.type == vm->file_type) {
+    file_close(s, &o->as.file);
+  }
+  pseu_free(s, o);
+}
+
+/* Accounts `sz` bytes of the specified object as live. */
+static void account_new(GC *gc, Object *o, size sz)
+{
+  PseuTypeStats *ts = &gc->stats.types[type_index(gc, o->header.type)];
+
+  ts->objects++;
+  ts->bytes += sz;
+  gc->stats.objects_live++;
+  gc->stats.bytes_live += sz;
+  gc->stats.bytes_allocated += sz;
+}
+
+/* Accounts `sz` bytes of the specified object as freed. */
+static void account_free(GC *gc, Object *o, size sz)
+{
+  PseuTypeStats *ts = &gc->stats.types[type_index(gc, o->header.type)];
+
+  ts->objects--;
+  ts->bytes -= sz;
+  gc->stats.objects_live--;
+  gc->stats.bytes_live -= sz;
+}
+
+/* Records a pause of `us` microseconds in the statistics. */
+static void account_pause(GC *gc, u64 us)
+{
+  PseuHeapStats *stats = &gc->stats;
+
+  size bucket = 0;
+  while (bucket < PSEU_GC_HISTOGRAM_SIZE - 1 && (us >> bucket) != 0)
+    bucket++;
+
+  stats->collections++;
+  stats->pause_total_us += us;
+  if (us > stats->pause_max_us)
+    stats->pause_max_us = us;
+  stats->pause_histogram[bucket]++;
+}
+
+/* Notifies the user GC callback if any. */
+static void notify(GC *gc, pseu_gc_event_t event)
 {
-  pseu_unused(gc);
+  VM *vm = gc->vm;
+  if (pseu_unlikely(vm->config.gc != NULL))
+    vm->config.gc(vm, event, &gc->stats);
+}
+
+static void traverse(GC *gc, Object *o);
 
-  if (!o)
-    return false;
+/* Marks the specified object and pushes it on the gray stack. */
+static void mark_object(GC *gc, Object *o)
+{
+  if (!o || o->header.marked)
+    return;
 
-  return true;
+  /* Objects of frames are not swept, so they are traversed whenever they are
+   * reached instead; no object refers back to them. */
+  if (!o->header.frame)
+    o->header.marked = true;
+
+  if (gc->gray_count >= gc->gray_size) {
+    State *s = S(gc->vm);
+    size new_size = gc->gray_size ? gc->gray_size * 2 : PSEU_GC_INIT_GRAY_SIZE;
+    Object **new_gray = pseu_realloc(s, gc->gray, new_size * sizeof(Object *));
+    if (pseu_unlikely(!new_gray)) {
+      /* Traverse it right away rather than sweep its reachable children. */
+      traverse(gc, o);
+      return;
+    }
+
+    gc->gray = new_gray;
+    gc->gray_size = new_size;
+  }
+
+  gc->gray[gc->gray_count++] = o;
 }
 
-bool mark(GC *gc)
+static void mark_value(GC *gc, Value *v)
 {
-  pseu_unused(gc);
-  return mark_dfs(gc, gc->root);
+  /* References keep the array or record holding the variable alive; raw
+   * slots live in the frame region. */
+  if (v_isobj(v) || (v_isref(v) && !v->raw))
+    mark_object(gc, v_asobj(v));
 }
 
-void sweep(GC *gc)
+static void mark_function(GC *gc, Function *fn)
 {
-  pseu_unused(gc);
+  if (fn->type != FN_PSEU)
+    return;
+
+  for (size i = 0; i < fn->as.pseu.const_count; i++)
+    mark_value(gc, &fn->as.pseu.consts[i]);
+  if (!fn->as.pseu.frame)
+    return;
+  for (size i = fn->params_count; i < fn->as.pseu.local_count; i++)
+    mark_value(gc, &fn->as.pseu.frame[i - fn->params_count]);
+}
+
+/* Marks the objects referenced by the specified object. */
+static void traverse(GC *gc, Object *o)
+{
+  VM *vm = gc->vm;
+  Type *type = o->header.type;
+
+  if (type == vm->array_type) {
+    Array *a = &o->as.array;
+    if (a->kind == ARR_RECORD) {
+      for (size i = 0; i < a->record->fields_count; i++)
+        mark_object(gc, (Object *)a->items.columns[i]);
+      return;
+    }
+    if (a->kind != ARR_VALUE)
+      return;
+    for (size i = 0; i < a->length; i++)
+      mark_value(gc, &a->items.values[i]);
+  } else if (type == vm->string_type) {
+    String *str = &o->as.string;
+    /* Parent of a slice is in `left`. */
+    mark_object(gc, (Object *)str->left);
+    mark_object(gc, (Object *)str->right);
+  } else if (type == vm->file_type) {
+    File *f = &o->as.file;
+    mark_object(gc, (Object *)f->name);
+    mark_object(gc, (Object *)f->map);
+  } else if (t_isrecord(type)) {
+    UObject *r = &o->as.uobject;
+    for (size i = 0; i < type->fields_count; i++)
+      mark_value(gc, &r->fields[i]);
+  }
+}
+
+static void mark_roots(GC *gc)
+{
+  VM *vm = gc->vm;
+  State *s = S(vm);
+
+  for (Value *v = s->stack; v < s->sp; v++)
+    mark_value(gc, v);
+  for (size i = 0; i < s->frames_count; i++)
+    mark_function(gc, s->frames[i].fn);
+  for (size i = 0; i < vm->vars_count; i++)
+    mark_value(gc, &vm->vars[i].value);
+  for (size i = 0; i < vm->fns_count; i++)
+    mark_function(gc, &vm->fns[i]);
+
+  for (File *f = vm->files; f; f = f->link)
+    mark_object(gc, (Object *)f);
+
+  mark_object(gc, (Object *)vm->empty_string);
+  mark_object(gc, gc->root);
+}
+
+static void mark(GC *gc)
+{
+  mark_roots(gc);
+
+  while (gc->gray_count > 0)
+    traverse(gc, gc->gray[--gc->gray_count]);
+}
+
+static void sweep(GC *gc)
+{
+  Object **walk = &gc->objects;
+
+  while (*walk) {
+    Object *o = *walk;
+    if (o->header.marked) {
+      o->header.marked = false;
+      walk = &o->header.next;
+    } else {
+      *walk = o->header.next;
+      account_free(gc, o, object_size(gc, o));
+      object_free(gc, o);
+    }
+  }
+}
+
+void pseu_gc_init(VM *vm)
+{
+  GC *gc = &vm->gc;
+
+  memset(gc, 0, sizeof(*gc));
+  gc->vm = vm;
+  gc->stats.bytes_threshold = PSEU_GC_INIT_THRESHOLD;
+}
+
+void pseu_gc_free(State *s)
+{
+  GC *gc = &V(s)->gc;
+
+  /* Files still open are closed as they are freed; in no particular order. */
+  V(s)->files = NULL;
+  while (gc->objects) {
+    Object *o = gc->objects;
+    gc->objects = o->header.next;
+    account_free(gc, o, object_size(gc, o));
+    object_free(gc, o);
+  }
+
+  string_table_free(s, &V(s)->strings);
+  pseu_free(s, gc->gray);
+  gc->gray = NULL;
+  gc->gray_count = 0;
+  gc->gray_size = 0;
+}
+
+void pseu_gc_track_type(VM *vm, Type *type)
+{
+  GC *gc = &vm->gc;
+  size index = type_index(gc, type);
+
+  pseu_assert(index < PSEU_HEAP_STATS_TYPES);
+  gc->stats.types[index].ident = type->ident;
+  if (index >= gc->stats.types_count)
+    gc->stats.types_count = index + 1;
+}
+
+void pseu_gc_resize(State *s, Object *o, size old_sz, size new_sz)
+{
+  GC *gc = &V(s)->gc;
+  PseuTypeStats *ts = &gc->stats.types[type_index(gc, o->header.type)];
+
+  ts->bytes = ts->bytes - old_sz + new_sz;
+  gc->stats.bytes_live = gc->stats.bytes_live - old_sz + new_sz;
+  if (new_sz > old_sz)
+    gc->stats.bytes_allocated += new_sz - old_sz;
 }
 
 bool pseu_gc_poll(State *s)
 {
-  pseu_unused(s);
-  return true;
+  GC *gc = &V(s)->gc;
+  return gc->stats.bytes_live >= gc->stats.bytes_threshold;
 }
 
 void pseu_gc_collect(State *s)
 {
   GC *gc = &V(s)->gc;
 
-  /* If we marked anything, we sweep all objects allocated. */
-  if (mark(gc))
-    sweep(gc);
+  notify(gc, PSEU_GC_EVENT_START);
+  clock_t start = clock();
+
+  mark(gc);
+  /* Interned strings are weak; drop the ones about to be freed. */
+  string_table_sweep(s, &V(s)->strings);
+  sweep(gc);
+
+  clock_t end = clock();
+  account_pause(gc, (u64)(end - start) * 1000000 / CLOCKS_PER_SEC);
+
+  size threshold = gc->stats.bytes_live * 2;
+  if (threshold < PSEU_GC_INIT_THRESHOLD)
+    threshold = PSEU_GC_INIT_THRESHOLD;
+  gc->stats.bytes_threshold = threshold;
+
+  notify(gc, PSEU_GC_EVENT_END);
+}
+
+/* Returns the size of an object of the specified type with `n` extra bytes. */
+static size new_size(State *s, Type *type, size n)
+{
+  if (t_isarray(s, type))
+    return n + sizeof(Array);
+  if (t_isstring(s, type))
+    return n + sizeof(String);
+  if (type == V(s)->file_type)
+    return n + sizeof(File);
+  if (t_isrecord(type))
+    return n + sizeof(UObject);
+
+  pseu_unreachable();
+  return n;
 }
 
 Object *pseu_gc_new(State *s, Type *type, size n)
 {
-  size sz = n;
-  if (t_isarray(s, type)) {
-    sz += sizeof(Array);
-  } else {
-    pseu_unreachable();
-  }
+  size sz = new_size(s, type, n);
 
   Object *result = (Object *)pseu_alloc(s, sz);
+  if (pseu_unlikely(!result))
+    return NULL;
   result->header.marked = false;
-  result->header.next = NULL;
+  result->header.frame = false;
   result->header.type = type;
 
-  /* Append object to list of allocated objects. */
+  /* Prepend object to list of allocated objects. */
   GC *gc = &V(s)->gc;
-  Object **walk = &gc->objects;
-  while (*walk)
-    walk = &(*walk)->header.next;
-  *walk = result;
+  result->header.next = gc->objects;
+  gc->objects = result;
+
+  account_new(gc, result, sz);
+  return result;
+}
+
+Object *pseu_frame_new(State *s, Type *type, size n)
+{
+  /* Not linked in the objects list nor accounted; the region of the frame
+   * releases it when the frame returns. */
+  Object *result = (Object *)pseu_region_alloc(s, new_size(s, type, n));
+  if (pseu_unlikely(!result))
+    return NULL;
+
+  result->header.marked = false;
+  result->header.frame = true;
+  result->header.type = type;
+  result->header.next = NULL;
   return result;
 }
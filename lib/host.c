@@ -0,0 +1,353 @@
+#include "vm.h"
+#include "obj.h"
+
+/* == Native thunks.
+ *
+ * A thunk is generated for every signature of up to PSEU_NATIVE_MAX_PARAMS
+ * BOOLEAN (b), INTEGER (i) or REAL (r) parameters returning nothing (v) or
+ * one of those types. The thunks load the arguments straight from the stack
+ * and store the result in place of the first one.
+ */
+
+#define NATIVE_T_v void
+#define NATIVE_T_b bool
+#define NATIVE_T_i i32
+#define NATIVE_T_r f32
+
+#define NATIVE_OK_b(v)  v_isbool(v)
+#define NATIVE_OK_i(v)  v_isi32(v)
+#define NATIVE_OK_r(v)  v_isnum(v)
+
+#define NATIVE_GET_b(v) v_asbool(v)
+#define NATIVE_GET_i(v) v_asi32(v)
+#define NATIVE_GET_r(v) (v_isf32(v) ? v_asf32(v) : v_i2f(v))
+
+/* Stores the result of `call` with `n` arguments; evaluates to the new sp. */
+#define NATIVE_RET_v(sp, n, call) ((call), (sp) - (n))
+#define NATIVE_RET_b(sp, n, call) ((sp)[-(n)] = v_bool(call), (sp) - (n) + 1)
+#define NATIVE_RET_i(sp, n, call) ((sp)[-(n)] = v_i32(call), (sp) - (n) + 1)
+#define NATIVE_RET_r(sp, n, call) ((sp)[-(n)] = v_f32(call), (sp) - (n) + 1)
+
+#define NATIVE_FN(R, ...) ((NATIVE_T_##R (*)(__VA_ARGS__))fn->as.host.fn.native)
+
+#define NATIVE_THUNK0(R)                                         \
+  static Value *native_##R(State *s, Function *fn, Value *sp)    \
+  {                                                              \
+    pseu_unused(s);                                              \
+    return NATIVE_RET_##R(sp, 0, NATIVE_FN(R, void)());          \
+  }
+
+#define NATIVE_THUNK1(R, A)                                      \
+  static Value *native_##R##_##A(State *s, Function *fn, Value *sp) \
+  {                                                              \
+    pseu_unused(s);                                              \
+    if (pseu_unlikely(!NATIVE_OK_##A(&sp[-1])))                  \
+      return NULL;                                               \
+    return NATIVE_RET_##R(sp, 1, NATIVE_FN(R, NATIVE_T_##A)(     \
+          NATIVE_GET_##A(&sp[-1])));                             \
+  }
+
+#define NATIVE_THUNK2(R, A, B)                                   \
+  static Value *native_##R##_##A##B(State *s, Function *fn, Value *sp) \
+  {                                                              \
+    pseu_unused(s);                                              \
+    if (pseu_unlikely(!NATIVE_OK_##A(&sp[-2]) ||                 \
+                      !NATIVE_OK_##B(&sp[-1])))                  \
+      return NULL;                                               \
+    return NATIVE_RET_##R(sp, 2, NATIVE_FN(R, NATIVE_T_##A,      \
+                                           NATIVE_T_##B)(        \
+          NATIVE_GET_##A(&sp[-2]),                               \
+          NATIVE_GET_##B(&sp[-1])));                             \
+  }
+
+#define NATIVE_THUNK3(R, A, B, C)                                \
+  static Value *native_##R##_##A##B##C(State *s, Function *fn, Value *sp) \
+  {                                                              \
+    pseu_unused(s);                                              \
+    if (pseu_unlikely(!NATIVE_OK_##A(&sp[-3]) ||                 \
+                      !NATIVE_OK_##B(&sp[-2]) ||                 \
+                      !NATIVE_OK_##C(&sp[-1])))                  \
+      return NULL;                                               \
+    return NATIVE_RET_##R(sp, 3, NATIVE_FN(R, NATIVE_T_##A,      \
+                                           NATIVE_T_##B,         \
+                                           NATIVE_T_##C)(        \
+          NATIVE_GET_##A(&sp[-3]),                               \
+          NATIVE_GET_##B(&sp[-2]),                               \
+          NATIVE_GET_##C(&sp[-1])));                             \
+  }
+
+/* Expands `_` for every parameter list of each arity; the first parameter
+ * varies the slowest, so the lists are in the order of native_thunk().
+ */
+#define NATIVE_EACH1(_, R)          _(R, b) _(R, i) _(R, r)
+#define NATIVE_EACH2(_, R)          NATIVE_EACH2_(_, R, b) \
+                                    NATIVE_EACH2_(_, R, i) \
+                                    NATIVE_EACH2_(_, R, r)
+#define NATIVE_EACH2_(_, R, A)      _(R, A, b) _(R, A, i) _(R, A, r)
+#define NATIVE_EACH3(_, R)          NATIVE_EACH3_(_, R, b) \
+                                    NATIVE_EACH3_(_, R, i) \
+                                    NATIVE_EACH3_(_, R, r)
+#define NATIVE_EACH3_(_, R, A)      NATIVE_EACH3__(_, R, A, b) \
+                                    NATIVE_EACH3__(_, R, A, i) \
+                                    NATIVE_EACH3__(_, R, A, r)
+#define NATIVE_EACH3__(_, R, A, B)  _(R, A, B, b) _(R, A, B, i) _(R, A, B, r)
+
+#define NATIVE_RETURNS(_) _(v) _(b) _(i) _(r)
+
+#define NATIVE_THUNKS(R)              \
+  NATIVE_THUNK0(R)                    \
+  NATIVE_EACH1(NATIVE_THUNK1, R)      \
+  NATIVE_EACH2(NATIVE_THUNK2, R)      \
+  NATIVE_EACH3(NATIVE_THUNK3, R)
+
+NATIVE_RETURNS(NATIVE_THUNKS)
+
+#define NATIVE_ENTRY0(R)          native_##R,
+#define NATIVE_ENTRY1(R, A)       native_##R##_##A,
+#define NATIVE_ENTRY2(R, A, B)    native_##R##_##A##B,
+#define NATIVE_ENTRY3(R, A, B, C) native_##R##_##A##B##C,
+
+#define NATIVE_ENTRIES(R)             \
+  {                                   \
+    NATIVE_ENTRY0(R)                  \
+    NATIVE_EACH1(NATIVE_ENTRY1, R)    \
+    NATIVE_EACH2(NATIVE_ENTRY2, R)    \
+    NATIVE_EACH3(NATIVE_ENTRY3, R)    \
+  },
+
+/* Number of parameter lists of up to PSEU_NATIVE_MAX_PARAMS parameters. */
+#define NATIVE_SIGS_COUNT (1 + 3 + 9 + 27)
+
+/* Native thunks indexed by return type and parameter list; see native_thunk(). */
+static const HostThunk natives[][NATIVE_SIGS_COUNT] = {
+  NATIVE_RETURNS(NATIVE_ENTRIES)
+};
+
+/* Returns the digit of a native parameter type; -1 if not supported. */
+static int native_digit(pseu_type_t type)
+{
+  switch (type) {
+  case PSEU_TYPE_BOOLEAN: return 0;
+  case PSEU_TYPE_INTEGER: return 1;
+  case PSEU_TYPE_REAL:    return 2;
+
+  default:
+    return -1;
+  }
+}
+
+/* Returns the thunk of the specified native signature; NULL if none. */
+static HostThunk native_thunk(pseu_type_t return_type,
+                              const pseu_type_t *param_types, u8 count)
+{
+  static const int offsets[] = { 0, 1, 1 + 3, 1 + 3 + 9 };
+
+  if (count > PSEU_NATIVE_MAX_PARAMS)
+    return NULL;
+
+  int index = 0;
+  for (u8 i = 0; i < count; i++) {
+    int digit = native_digit(param_types[i]);
+    if (digit == -1)
+      return NULL;
+    index = index * 3 + digit;
+  }
+
+  int ret = return_type == PSEU_TYPE_VOID ? 0 : native_digit(return_type) + 1;
+  if (ret == 0 && return_type != PSEU_TYPE_VOID)
+    return NULL;
+  return natives[ret][offsets[count] + index];
+}
+
+/* == Generic thunk. */
+
+/* Returns the public type of the specified type. */
+static pseu_type_t host_type(VM *vm, Type *type)
+{
+  if (!type)
+    return PSEU_TYPE_VOID;
+  if (type == vm->boolean_type)
+    return PSEU_TYPE_BOOLEAN;
+  if (type == vm->integer_type)
+    return PSEU_TYPE_INTEGER;
+  if (type == vm->real_type)
+    return PSEU_TYPE_REAL;
+  return PSEU_TYPE_STRING;
+}
+
+/* Converts a value to an argument of the specified type; returns 1 if the
+ * value does not have the type.
+ */
+static int to_host(State *s, Value *v, pseu_type_t type, PseuValue *o)
+{
+  o->type = type;
+  switch (type) {
+  case PSEU_TYPE_BOOLEAN:
+    if (!v_isbool(v))
+      return 1;
+    o->as.boolean = v_asbool(v);
+    return 0;
+  case PSEU_TYPE_INTEGER:
+    if (!v_isi32(v))
+      return 1;
+    o->as.integer = v_asi32(v);
+    return 0;
+  case PSEU_TYPE_REAL:
+    if (!v_isnum(v))
+      return 1;
+    o->as.real = v_isf32(v) ? v_asf32(v) : v_i2f(v);
+    return 0;
+  case PSEU_TYPE_STRING:
+    if (!v_isstr(s, v))
+      return 1;
+    o->as.string.chars = string_chars(s, v_asstr(v));
+    o->as.string.length = v_asstr(v)->length;
+    return o->as.string.chars == NULL;
+
+  default:
+    return 1;
+  }
+}
+
+/* Converts the result of a host function to a value of the declared type. */
+static int from_host(State *s, PseuValue *v, pseu_type_t type, Value *o)
+{
+  switch (type) {
+  case PSEU_TYPE_BOOLEAN: *o = v_bool(v->as.boolean); return 0;
+  case PSEU_TYPE_INTEGER: *o = v_i32(v->as.integer); return 0;
+  case PSEU_TYPE_REAL:    *o = v_f32(v->as.real); return 0;
+  case PSEU_TYPE_STRING: {
+    if (v->as.string.length > UINT32_MAX)
+      return 1;
+
+    String *str = string_new(s, v->as.string.chars, (u32)v->as.string.length);
+    *o = v_obj((Object *)str);
+    return 0;
+  }
+
+  default:
+    return 1;
+  }
+}
+
+static Value *host_generic(State *s, Function *fn, Value *sp)
+{
+  VM *vm = V(s);
+  u8 n = fn->params_count;
+  Value *args = sp - n;
+
+  PseuValue params[PSEU_FUNCTION_MAX_PARAMS];
+  for (u8 i = 0; i < n; i++) {
+    if (to_host(s, &args[i], host_type(vm, fn->param_types[i]), &params[i]))
+      return NULL;
+  }
+
+  /* The host may call back into pseu, which can move the stack. */
+  size offset = args - s->stack;
+  pseu_type_t return_type = host_type(vm, fn->return_type);
+  PseuValue result = { .type = return_type };
+  if (fn->as.host.fn.generic(vm, params, &result))
+    return NULL;
+  args = s->stack + offset;
+
+  if (return_type == PSEU_TYPE_VOID) {
+    s->sp = args;
+  } else {
+    if (from_host(s, &result, return_type, &args[0]))
+      return NULL;
+    s->sp = args + 1;
+  }
+
+  /* The result may have been allocated. */
+  if (pseu_gc_poll(s))
+    pseu_gc_collect(s);
+  return s->sp;
+}
+
+/* == Definition. */
+
+/* Resolves the type of the specified public type; NULL if VOID. */
+static int resolve_host_type(VM *vm, pseu_type_t type, Type **o)
+{
+  switch (type) {
+  case PSEU_TYPE_VOID:    *o = NULL; return 0;
+  case PSEU_TYPE_BOOLEAN: *o = vm->boolean_type; return 0;
+  case PSEU_TYPE_INTEGER: *o = vm->integer_type; return 0;
+  case PSEU_TYPE_REAL:    *o = vm->real_type; return 0;
+  case PSEU_TYPE_STRING:  *o = vm->string_type; return 0;
+
+  default:
+    return 1;
+  }
+}
+
+static int def_host(VM *vm, const char *ident,
+                    pseu_type_t return_type,
+                    const pseu_type_t *param_types, u8 params_count,
+                    FunctionHost *host)
+{
+  State *s = S(vm);
+
+  if (pseu_get_function(vm, ident, strlen(ident)) != PSEU_INVALID_FUNC)
+    return PSEU_RESULT_ERROR;
+
+  Function fn = {
+    .type = FN_HOST,
+    .params_count = params_count,
+    .as.host = *host
+  };
+  if (resolve_host_type(vm, return_type, &fn.return_type))
+    return PSEU_RESULT_ERROR;
+
+  fn.param_types = pseu_alloc_nt(s, Type *, params_count);
+  if (params_count > 0 && !fn.param_types)
+    return PSEU_RESULT_ERROR;
+
+  for (u8 i = 0; i < params_count; i++) {
+    if (param_types[i] == PSEU_TYPE_VOID ||
+        resolve_host_type(vm, param_types[i], &fn.param_types[i]))
+      goto free_params;
+  }
+
+  fn.ident = pseu_strdup(s, ident);
+  if (!fn.ident)
+    goto free_params;
+  if (pseu_def_function(vm, &fn) == PSEU_INVALID_FUNC)
+    goto free_ident;
+  return PSEU_RESULT_SUCCESS;
+
+free_ident:
+  pseu_free(s, (char *)fn.ident);
+free_params:
+  pseu_free(s, fn.param_types);
+  return PSEU_RESULT_ERROR;
+}
+
+int pseu_vm_def_function(PseuVM *vm, const char *ident,
+                         pseu_type_t return_type,
+                         const pseu_type_t *param_types, uint8_t params_count,
+                         PseuFunction fn)
+{
+  assert(vm && ident && fn);
+
+  if (params_count > PSEU_FUNCTION_MAX_PARAMS)
+    return PSEU_RESULT_ERROR;
+
+  FunctionHost host = { .thunk = host_generic, .fn.generic = fn };
+  return def_host(vm, ident, return_type, param_types, params_count, &host);
+}
+
+int pseu_vm_def_native(PseuVM *vm, const char *ident,
+                       pseu_type_t return_type,
+                       const pseu_type_t *param_types, uint8_t params_count,
+                       PseuNative fn)
+{
+  assert(vm && ident && fn);
+
+  HostThunk thunk = native_thunk(return_type, param_types, params_count);
+  if (!thunk)
+    return PSEU_RESULT_ERROR;
+
+  FunctionHost host = { .thunk = thunk, .fn.native = fn };
+  return def_host(vm, ident, return_type, param_types, params_count, &host);
+}
@@ -0,0 +1,344 @@
+#include "vm.h"
+#include "obj.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PSEU_FILE_MMAP
+#endif
+
+/* Modes passed to fopen() for each FileMode. */
+static const char *const modes[] = { "rb", "wb", "ab" };
+
+/* == Accounting. */
+
+size file_bytes(File *f)
+{
+  size result = sizeof(File) + f->line_size;
+  if (f->buffer)
+    result += PSEU_FILE_BUFFER_SIZE;
+  return result;
+}
+
+/* Reserves `cap` chars for the line being assembled from several blocks. */
+static int reserve_line(State *s, File *f, u32 cap)
+{
+  if (cap <= f->line_size)
+    return 0;
+
+  u32 new_size = f->line_size ? f->line_size : 256;
+  while (new_size < cap) {
+    if (new_size > UINT32_MAX / 2)
+      return pseu_error(s, "Line is too long");
+    new_size *= 2;
+  }
+
+  char *line = pseu_realloc(s, f->line, new_size);
+  if (pseu_unlikely(!line))
+    return pseu_error(s, "Out of memory");
+
+  size old_sz = file_bytes(f);
+  f->line = line;
+  f->line_size = new_size;
+  pseu_gc_resize(s, (Object *)f, old_sz, file_bytes(f));
+  return 0;
+}
+
+/* == Memory mapped reader. */
+
+#if defined(PSEU_FILE_MMAP)
+/* Maps the window of the file which starts at the page holding `offset`.
+ * The previous window is left to the GC, as lines may still reference it.
+ */
+static int map_window(State *s, File *f, u64 offset)
+{
+  u64 page = (u64)sysconf(_SC_PAGESIZE);
+  u64 start = offset & ~(page - 1);
+  u64 len = f->length - start;
+  if (len > PSEU_FILE_MAP_WINDOW)
+    len = PSEU_FILE_MAP_WINDOW;
+
+  void *base = mmap(NULL, (size)len, PROT_READ, MAP_PRIVATE,
+                    fileno(f->stream), (off_t)start);
+  if (base == MAP_FAILED)
+    return 1;
+  madvise(base, (size)len, MADV_SEQUENTIAL);
+
+  String *map = &pseu_gc_new(s, V(s)->string_type, 0)->as.string;
+  map->flags = STR_MAPPED;
+  map->length = (u32)len;
+  map->hash = 0;
+  map->chars = base;
+  map->left = NULL;
+  map->right = NULL;
+
+  f->map = map;
+  f->map_offset = start;
+  return 0;
+}
+
+/* Maps the first window of the file if it is large enough to be worth it;
+ * the file is read through the block buffer otherwise.
+ */
+static bool map_file(State *s, File *f)
+{
+  struct stat st;
+  if (fstat(fileno(f->stream), &st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+  if (st.st_size < PSEU_FILE_MAP_THRESHOLD)
+    return false;
+
+  f->length = (u64)st.st_size;
+  return map_window(s, f, 0) == 0;
+}
+
+void file_unmap(String *map)
+{
+  munmap(map->chars, map->length);
+}
+#else
+static int map_window(State *s, File *f, u64 offset)
+{
+  pseu_unused(s);
+  pseu_unused(f);
+  pseu_unused(offset);
+  return 1;
+}
+
+static bool map_file(State *s, File *f)
+{
+  pseu_unused(s);
+  pseu_unused(f);
+  return false;
+}
+
+void file_unmap(String *map)
+{
+  pseu_unused(map);
+}
+#endif
+
+/* Reads the next line of a mapped file; lines longer than PSEU_STR_FLAT_MAX
+ * are slices of the window rather than copies.
+ */
+static String *read_mapped(State *s, File *f)
+{
+  String *map = f->map;
+  u32 start = (u32)(f->offset - f->map_offset);
+  const char *chars = map->chars + start;
+  const char *nl = memchr(chars, '\n', map->length - start);
+
+  /* The line runs past the window; map the window starting at the line. */
+  if (!nl && f->map_offset + map->length < f->length) {
+    if (map_window(s, f, f->offset)) {
+      pseu_error(s, "Cannot map file");
+      return NULL;
+    }
+
+    map = f->map;
+    start = (u32)(f->offset - f->map_offset);
+    chars = map->chars + start;
+    nl = memchr(chars, '\n', map->length - start);
+    if (!nl && f->map_offset + map->length < f->length) {
+      pseu_error(s, "Line is too long");
+      return NULL;
+    }
+  }
+
+  u32 len = nl ? (u32)(nl - chars) : map->length - start;
+  f->offset += len + (nl != NULL);
+  if (len > 0 && chars[len - 1] == '\r')
+    len--;
+
+  /* Even a line filling the window is a slice of it; see string_slice(). */
+  return string_slice(s, map, start, len);
+}
+
+/* == Buffered reader and writer. */
+
+/* Reads the next block of the file; `count` is 0 at the end of the file. */
+static int fill(State *s, File *f)
+{
+  f->pos = 0;
+  f->count = (u32)fread(f->buffer, 1, PSEU_FILE_BUFFER_SIZE, f->stream);
+  if (f->count == 0 && ferror(f->stream))
+    return pseu_error(s, "Cannot read file");
+  return 0;
+}
+
+/* Writes the buffered chars of the file. */
+static int flush(State *s, File *f)
+{
+  if (f->count > 0 && fwrite(f->buffer, 1, f->count, f->stream) != f->count)
+    return pseu_error(s, "Cannot write file");
+  f->count = 0;
+  return 0;
+}
+
+/* Returns a string of the line in `chars` without its carriage return. */
+static String *make_line(State *s, const char *chars, u32 len)
+{
+  if (len > 0 && chars[len - 1] == '\r')
+    len--;
+  return string_new(s, chars, len);
+}
+
+/* Reads the next line of a buffered file. Lines within a block are copied
+ * straight out of it; lines spanning blocks are assembled in `line`.
+ */
+static String *read_buffered(State *s, File *f)
+{
+  f->line_count = 0;
+  for (;;) {
+    if (f->pos == f->count) {
+      if (fill(s, f))
+        return NULL;
+      if (f->count == 0)
+        break;
+    }
+
+    const char *chars = f->buffer + f->pos;
+    const char *nl = memchr(chars, '\n', f->count - f->pos);
+    u32 len = nl ? (u32)(nl - chars) : f->count - f->pos;
+    f->pos += len + (nl != NULL);
+
+    if (nl && f->line_count == 0)
+      return make_line(s, chars, len);
+
+    if (len > UINT32_MAX - f->line_count) {
+      pseu_error(s, "Line is too long");
+      return NULL;
+    }
+    if (reserve_line(s, f, f->line_count + len))
+      return NULL;
+    memcpy(f->line + f->line_count, chars, len);
+    f->line_count += len;
+    if (nl)
+      break;
+  }
+  return make_line(s, f->line, f->line_count);
+}
+
+/* == Files. */
+
+File *file_open(State *s, String *name, u8 mode)
+{
+  const char *path = string_cstr(s, name);
+  if (pseu_unlikely(!path))
+    return NULL;
+
+  FILE *stream = fopen(path, modes[mode]);
+  if (!stream) {
+    pseu_error(s, "Cannot open file");
+    return NULL;
+  }
+  /* Blocks are buffered by the file itself. */
+  setvbuf(stream, NULL, _IONBF, 0);
+
+  File *f = &pseu_gc_new(s, V(s)->file_type, 0)->as.file;
+  f->mode = mode;
+  f->stream = stream;
+  f->name = name;
+  f->map = NULL;
+  f->map_offset = 0;
+  f->offset = 0;
+  f->length = 0;
+  f->pos = 0;
+  f->count = 0;
+  f->buffer = NULL;
+  f->line_count = 0;
+  f->line_size = 0;
+  f->line = NULL;
+
+  f->link = V(s)->files;
+  V(s)->files = f;
+
+  if (mode == FILE_READ && map_file(s, f))
+    return f;
+
+  f->buffer = pseu_alloc(s, PSEU_FILE_BUFFER_SIZE);
+  if (pseu_unlikely(!f->buffer)) {
+    file_close(s, f);
+    pseu_error(s, "Out of memory");
+    return NULL;
+  }
+  pseu_gc_resize(s, (Object *)f, sizeof(File), file_bytes(f));
+  return f;
+}
+
+File *file_find(State *s, String *name)
+{
+  for (File *f = V(s)->files; f; f = f->link) {
+    int o;
+    if (f->name->length == name->length &&
+        string_compare(s, f->name, name, &o) == 0 && o == 0)
+      return f;
+  }
+  return NULL;
+}
+
+int file_close(State *s, File *f)
+{
+  if (!f->stream)
+    return 0;
+
+  int result = 0;
+  if (f->mode != FILE_READ && f->buffer)
+    result = flush(s, f);
+  if (fclose(f->stream) != 0 && !result)
+    result = pseu_error(s, "Cannot close file");
+  f->stream = NULL;
+
+  for (File **walk = &V(s)->files; *walk; walk = &(*walk)->link) {
+    if (*walk == f) {
+      *walk = f->link;
+      break;
+    }
+  }
+
+  size old_sz = file_bytes(f);
+  pseu_free(s, f->buffer);
+  pseu_free(s, f->line);
+  f->buffer = NULL;
+  f->line = NULL;
+  f->line_size = 0;
+  f->link = NULL;
+  /* The window is unmapped by the GC once the lines read are gone. */
+  f->map = NULL;
+  pseu_gc_resize(s, (Object *)f, old_sz, file_bytes(f));
+  return result;
+}
+
+bool file_eof(State *s, File *f)
+{
+  if (f->map)
+    return f->offset >= f->length;
+  if (f->pos == f->count && fill(s, f))
+    return true;
+  return f->count == 0;
+}
+
+String *file_read_line(State *s, File *f)
+{
+  if (f->map)
+    return read_mapped(s, f);
+  return read_buffered(s, f);
+}
+
+int file_write(State *s, File *f, const char *chars, size len)
+{
+  if (f->count + len > PSEU_FILE_BUFFER_SIZE && flush(s, f))
+    return 1;
+
+  /* Blocks larger than the buffer are written through. */
+  if (len >= PSEU_FILE_BUFFER_SIZE) {
+    if (fwrite(chars, 1, len, f->stream) != len)
+      return pseu_error(s, "Cannot write file");
+    return 0;
+  }
+
+  memcpy(f->buffer + f->count, chars, len);
+  f->count += (u32)len;
+  return 0;
+}
@@ -3,15 +3,23 @@
 
 #include "vm.h"
 #include "lex.h"
+#include "num.h"
 
 #define char_isalpha(x) ((x >= 'a' && x <= 'z') || (x >= 'A' && x <= 'Z'))
 #define char_isdigit(x) ((x >= '0' && x <= '9'))
 
 static void lex_err(Lexer *l, const char *message, ...)
 {
+  /* Lexer messages are short; also works when out of memory. */
+  char buffer[128];
+  va_list args;
+  va_start(args, message);
+  vsnprintf(buffer, sizeof(buffer), message, args);
+  va_end(args);
+
+  pseu_print(l->state, buffer);
+  pseu_print(l->state, "\n");
   l->failed = 1;
-  /* Proper error reporting. */
-  pseu_print(l->state, message);
 }
 
 /* Moves l->pos to the next character, setting l->peek. */
@@ -55,10 +63,55 @@ static void lex_skip_line_comment(Lexer *l)
   } while (l->peek != TK_eof && l->peek != '\n');
 }
 
+/* Reserved keywords. */
+static const struct {
+  const char *ident;
+  Token tok;
+} keywords[] = {
+  { "PROCEDURE", TK_kw_procedure },
+  { "FUNCTION",  TK_kw_function },
+  { "OUTPUT",    TK_kw_output },
+  { "DECLARE",   TK_kw_declare },
+  { "NOT",       TK_kw_not },
+  { "AND",       TK_kw_and },
+  { "OR",        TK_kw_or },
+  { "IF",        TK_kw_if },
+  { "ELSE",      TK_kw_else },
+  { "ENDIF",     TK_kw_endif },
+  { "THEN",      TK_kw_then },
+  { "ARRAY",     TK_kw_array },
+  { "OF",        TK_kw_of },
+  { "FOR",       TK_kw_for },
+  { "TO",        TK_kw_to },
+  { "STEP",      TK_kw_step },
+  { "NEXT",      TK_kw_next },
+  { "OPENFILE",  TK_kw_openfile },
+  { "READFILE",  TK_kw_readfile },
+  { "WRITEFILE", TK_kw_writefile },
+  { "CLOSEFILE", TK_kw_closefile },
+  { "READ",      TK_kw_read },
+  { "WRITE",     TK_kw_write },
+  { "APPEND",    TK_kw_append },
+  { "ENDFUNCTION",  TK_kw_endfunction },
+  { "ENDPROCEDURE", TK_kw_endprocedure },
+  { "RETURN",    TK_kw_return },
+  { "RETURNS",   TK_kw_returns },
+  { "CALL",      TK_kw_call },
+  { "WHILE",     TK_kw_while },
+  { "DO",        TK_kw_do },
+  { "ENDWHILE",  TK_kw_endwhile },
+  { "CASE",      TK_kw_case },
+  { "OTHERWISE", TK_kw_otherwise },
+  { "ENDCASE",   TK_kw_endcase },
+  { "TYPE",      TK_kw_type },
+  { "ENDTYPE",   TK_kw_endtype },
+  { "BYREF",     TK_kw_byref },
+  { "BYVAL",     TK_kw_byval },
+};
+
 /* Lexes an identifier or a reserved keyword. */
 static Token lex_ident(Lexer *l)
 {
-  Token result;
   char *start = l->pos;
   size len = 0;
 
@@ -70,69 +123,106 @@ static Token lex_ident(Lexer *l)
        char_isdigit(l->peek) ||
        l->peek == '_'));
 
-  if (strncmp("PROCEDURE", start, len) == 0) {
-    result = TK_kw_procedure;
-  } else if (strncmp("FUNCTION", start, len) == 0) {
-    result = TK_kw_function;
-  } else if (strncmp("OUTPUT", start, len) == 0) {
-    result = TK_kw_output;
-  } else if (strncmp("DECLARE", start, len) == 0) {
-    result = TK_kw_declare;
-  } else if (strncmp("NOT", start, len) == 0) {
-    result = TK_kw_not;
-  } else if (strncmp("AND", start, len) == 0) {
-    result = TK_kw_and;
-  } else if (strncmp("OR", start, len) == 0) {
-    result = TK_kw_or;
-  } else if (strncmp("IF", start, len) == 0) {
-    result = TK_kw_if;
-  } else if (strncmp("ELSE", start, len) == 0) {
-    result = TK_kw_else;
-  } else if (strncmp("ENDIF", start, len) == 0) {
-    result = TK_kw_endif;
-  } else if (strncmp("THEN", start, len) == 0) {
-    result = TK_kw_then;
-  } else {
-    l->span.pos = start;
-    l->span.len = len;
-    result = TK_identifier;
+  for (size i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+    if (strlen(keywords[i].ident) == len &&
+        strncmp(keywords[i].ident, start, len) == 0)
+      return keywords[i].tok;
   }
 
-  return result;
+  l->span.pos = start;
+  l->span.len = len;
+  return TK_identifier;
 }
 
+/* Lexes a string literal; the string is interned. */
 static void lex_string(Lexer *l)
 {
+  char *start = l->pos + 1;
+
   do {
     lex_eat(l);
-    /* TODO: Implement. */
-  } while (l->peek != TK_eof);
+    if (l->peek == TK_eof || l->peek == '\n') {
+      lex_err(l, "Unterminated string literal");
+      l->value = (Value) { 0 };
+      return;
+    }
+  } while (l->peek != '"');
 
-  l->value.type = VAL_OBJ;
-  l->value.as.object = NULL;
+  u32 len = (u32)(l->pos - start);
+  lex_eat(l);
+
+  if (!string_valid_utf8(start, len)) {
+    lex_err(l, "Invalid UTF-8 in string literal");
+    l->value = (Value) { 0 };
+    return;
+  }
+
+  String *str = string_intern(l->state, start, len);
+
+  if (!str) {
+    lex_err(l, "Out of memory");
+    l->value = (Value) { 0 };
+    return;
+  }
+  l->value = v_obj((Object *)str);
+}
+
+/* Returns the char `n` chars after the current one or '\0'. */
+static char lex_ahead(Lexer *l, size n)
+{
+  return l->pos + n < l->end ? l->pos[n] : '\0';
 }
 
+static void lex_digits(Lexer *l)
+{
+  while (l->peek != TK_eof && char_isdigit(l->peek))
+    lex_eat(l);
+}
+
+/* Lexes an INTEGER literal or a REAL literal; digits[.digits][e[+-]digits]. */
 static Token lex_number(Lexer *l)
 {
   Token result = TK_lit_integer;
   char *start = l->pos;
-  char *end = start;
 
-  do {
-    end++;
+  lex_digits(l);
+  if (l->peek == '.' && char_isdigit(lex_ahead(l, 1))) {
+    result = TK_lit_real;
     lex_eat(l);
-  } while (l->peek != TK_eof && char_isdigit(l->peek));
-
-  if (result == TK_lit_integer) {
-    l->value.type = VAL_INT;
-    l->value.as.integer = (u32)strtol(start, &end, 10);
+    lex_digits(l);
+  }
+  if (l->peek == 'e' || l->peek == 'E') {
+    char c = lex_ahead(l, 1);
+    if (char_isdigit(c) || ((c == '+' || c == '-') && char_isdigit(lex_ahead(l, 2)))) {
+      result = TK_lit_real;
+      lex_eat(l);
+      lex_eat(l);
+      lex_digits(l);
+    }
+  }
 
-    /* TODO: Check if overflow and stuff. */
-  } else if (result == TK_lit_real) {
-    l->value.type = VAL_FLOAT;
-    l->value.as.real = 0;
+  /* lex_eat does not move past the last char of the source. */
+  size len = l->peek == TK_eof ? (size)(l->end - start) : (size)(l->pos - start);
 
-    /* TODO: Implement. */
+  if (result == TK_lit_integer) {
+    i32 value;
+    l->int_min = 0;
+    if (len == 10 && !memcmp(start, "2147483648", 10)) {
+      /* Left to the parser, which accepts it after a unary minus. */
+      l->int_min = 1;
+      value = INT32_MIN;
+    } else if (num_parse_i32(start, len, &value)) {
+      lex_err(l, "INTEGER literal out of range");
+      value = 0;
+    }
+    l->value = v_i32(value);
+  } else {
+    f32 value;
+    if (num_parse_f32(start, len, &value)) {
+      lex_err(l, "REAL literal out of range");
+      value = 0;
+    }
+    l->value = v_f32(value);
   }
 
   return result;
@@ -148,6 +238,7 @@ int pseu_lex_init(State *s, Lexer *l, const char *src)
   l->row = 1;
   l->col = 1;
   l->failed = 0;
+  l->int_min = 0;
   l->peek = l->pos < l->end ? *l->pos : TK_eof;
   return 0;
 }
@@ -179,11 +270,15 @@ Token pseu_lex_scan(Lexer *l)
 
     case '(':
     case ')':
+    case '[':
+    case ']':
+    case ',':
     case '+':
     case '-':
     case '*':
     case '=':
     case ':':
+    case '&':
       lex_eat(l);
       return c;
 
@@ -210,16 +305,16 @@ Token pseu_lex_scan(Lexer *l)
     case '<':
       lex_eat(l);
       if (l->peek == '>')
-        return lex_eat(l), TK_op_not;
+        return lex_eat(l), TK_op_ne;
       else if (l->peek == '-')
         return lex_eat(l), TK_op_assign;
       else if (l->peek == '=')
         return lex_eat(l), TK_op_le;
       return '<';
     case '.':
-      lex_eat(l);
-      if (char_isdigit(l->peek))
+      if (char_isdigit(lex_ahead(l, 1)))
         return lex_number(l);
+      lex_eat(l);
       return '.';
 
     default:
@@ -6,7 +6,7 @@
 typedef enum TokenType {
 	TK_eof,
 	TK_identifier,
-	TK_op_not,
+	TK_op_ne,
 	TK_op_assign,
 	TK_kw_declare,
 	TK_kw_output,
@@ -25,10 +25,40 @@ typedef enum TokenType {
 	TK_lit_string,
   TK_op_le,
   TK_op_ge,
+
+  /* Tokens from here on are numbered past the single character tokens. */
+  TK_kw_array = 128,
+  TK_kw_of,
+  TK_kw_for,
+  TK_kw_to,
+  TK_kw_step,
+  TK_kw_next,
+  TK_kw_openfile,
+  TK_kw_readfile,
+  TK_kw_writefile,
+  TK_kw_closefile,
+  TK_kw_read,
+  TK_kw_write,
+  TK_kw_append,
+  TK_kw_endfunction,
+  TK_kw_endprocedure,
+  TK_kw_return,
+  TK_kw_returns,
+  TK_kw_call,
+  TK_kw_while,
+  TK_kw_do,
+  TK_kw_endwhile,
+  TK_kw_case,
+  TK_kw_otherwise,
+  TK_kw_endcase,
+  TK_kw_type,
+  TK_kw_endtype,
+  TK_kw_byref,
+  TK_kw_byval,
 } TokenType;
 
 /* Represents a token. */
-typedef char Token;
+typedef int Token;
 
 /* Represents a region of memory - usually is a region of a string. */
 typedef struct Span {
@@ -46,6 +76,8 @@ typedef struct Lexer {
 	u32 col;
 	u32 row;
 	u8 failed;
+	/* Set when the INTEGER literal is 2147483648, only valid negated. */
+	u8 int_min;
 	Span span;
 	Value value;
 } Lexer;
@@ -0,0 +1,480 @@
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+
+#include "vm.h"
+#include "num.h"
+
+/* == Integer formatting. */
+
+/* Two digit decimal representation of 0 to 99. */
+static const char digit_pairs[200] = {
+  '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+  '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+  '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+  '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+  '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+  '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+  '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+  '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+  '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+  '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9'
+};
+
+/* Returns the number of decimal digits of `v`. */
+static u32 digits_u32(u32 v)
+{
+  u32 n = 1;
+  for (;;) {
+    if (v < 10) return n;
+    if (v < 100) return n + 1;
+    if (v < 1000) return n + 2;
+    if (v < 10000) return n + 3;
+    v /= 10000;
+    n += 4;
+  }
+}
+
+/* Writes the `n` digits of `v` ending at `end`, two digits at a time. */
+static void write_u32(char *end, u32 v)
+{
+  while (v >= 100) {
+    u32 k = (v % 100) * 2;
+    v /= 100;
+    *--end = digit_pairs[k + 1];
+    *--end = digit_pairs[k];
+  }
+  if (v >= 10) {
+    *--end = digit_pairs[v * 2 + 1];
+    *--end = digit_pairs[v * 2];
+  } else {
+    *--end = (char)('0' + v);
+  }
+}
+
+size num_fmt_i32(char *buf, i32 value)
+{
+  size n = 0;
+  u32 v = (u32)value;
+  if (value < 0) {
+    buf[n++] = '-';
+    v = 0u - v;
+  }
+
+  u32 len = digits_u32(v);
+  write_u32(buf + n + len, v);
+  return n + len;
+}
+
+/* == Real formatting.
+ *
+ * Shortest round-trip formatting of binary32 values based on Ryu by Ulf Adams
+ * (PLDI 2018); computes the shortest decimal in the rounding interval of the
+ * value using 64-bit multiplications by tabulated powers of 5.
+ */
+
+#define F32_MANTISSA_BITS   23
+#define F32_EXPONENT_BITS   8
+#define F32_BIAS            127
+#define F32_POW5_INV_BITS   59
+#define F32_POW5_BITS       61
+
+/* floor(2^(pow5bits(i) - 1 + F32_POW5_INV_BITS) / 5^i) + 1 */
+static const u64 f32_pow5_inv_split[31] = {
+  0x0800000000000001ull, 0x0666666666666667ull, 0x051eb851eb851eb9ull,
+  0x04189374bc6a7efaull, 0x068db8bac710cb2aull, 0x053e2d6238da3c22ull,
+  0x0431bde82d7b634eull, 0x06b5fca6af2bd216ull, 0x055e63b88c230e78ull,
+  0x044b82fa09b5a52dull, 0x06df37f675ef6eaeull, 0x057f5ff85e592558ull,
+  0x0465e6604b7a8447ull, 0x0709709a125da071ull, 0x05a126e1a84ae6c1ull,
+  0x0480ebe7b9d58567ull, 0x0734aca5f6226f0bull, 0x05c3bd5191b525a3ull,
+  0x049c97747490eae9ull, 0x0760f253edb4ab0eull, 0x05e72843249088d8ull,
+  0x04b8ed0283a6d3e0ull, 0x078e480405d7b966ull, 0x060b6cd004ac9452ull,
+  0x04d5f0a66a23a9dbull, 0x07bcb43d769f762bull, 0x063090312bb2c4efull,
+  0x04f3a68dbc8f03f3ull, 0x07ec3daf94180651ull, 0x065697bfa9acd1daull,
+  0x051212ffbaf0a7e2ull,
+};
+
+/* 5^i normalized to F32_POW5_BITS bits. */
+static const u64 f32_pow5_split[48] = {
+  0x1000000000000000ull, 0x1400000000000000ull, 0x1900000000000000ull,
+  0x1f40000000000000ull, 0x1388000000000000ull, 0x186a000000000000ull,
+  0x1e84800000000000ull, 0x1312d00000000000ull, 0x17d7840000000000ull,
+  0x1dcd650000000000ull, 0x12a05f2000000000ull, 0x174876e800000000ull,
+  0x1d1a94a200000000ull, 0x12309ce540000000ull, 0x16bcc41e90000000ull,
+  0x1c6bf52634000000ull, 0x11c37937e0800000ull, 0x16345785d8a00000ull,
+  0x1bc16d674ec80000ull, 0x1158e460913d0000ull, 0x15af1d78b58c4000ull,
+  0x1b1ae4d6e2ef5000ull, 0x10f0cf064dd59200ull, 0x152d02c7e14af680ull,
+  0x1a784379d99db420ull, 0x108b2a2c28029094ull, 0x14adf4b7320334b9ull,
+  0x19d971e4fe8401e7ull, 0x1027e72f1f128130ull, 0x1431e0fae6d7217cull,
+  0x193e5939a08ce9dbull, 0x1f8def8808b02452ull, 0x13b8b5b5056e16b3ull,
+  0x18a6e32246c99c60ull, 0x1ed09bead87c0378ull, 0x13426172c74d822bull,
+  0x1812f9cf7920e2b6ull, 0x1e17b84357691b64ull, 0x12ced32a16a1b11eull,
+  0x178287f49c4a1d66ull, 0x1d6329f1c35ca4bfull, 0x125dfa371a19e6f7ull,
+  0x16f578c4e0a060b5ull, 0x1cb2d6f618c878e3ull, 0x11efc659cf7d4b8dull,
+  0x166bb7f0435c9e71ull, 0x1c06a5ec5433c60dull, 0x118427b3b4a05bc8ull,
+};
+
+/* Returns ceil(log2(5^e)) for e > 0 and 1 for e = 0. */
+static i32 pow5bits(i32 e)
+{
+  return (i32)(((u32)e * 1217359) >> 19) + 1;
+}
+
+/* Returns floor(log10(2^e)). */
+static u32 log10_pow2(i32 e)
+{
+  return ((u32)e * 78913) >> 18;
+}
+
+/* Returns floor(log10(5^e)). */
+static u32 log10_pow5(i32 e)
+{
+  return ((u32)e * 732923) >> 20;
+}
+
+static u32 pow5_factor(u32 v)
+{
+  u32 count = 0;
+  while (v % 5 == 0) {
+    v /= 5;
+    count++;
+  }
+  return count;
+}
+
+static bool multiple_of_pow5(u32 v, u32 p)
+{
+  return pow5_factor(v) >= p;
+}
+
+static bool multiple_of_pow2(u32 v, u32 p)
+{
+  return (v & ((1u << p) - 1)) == 0;
+}
+
+static u32 mul_shift(u32 m, u64 factor, i32 shift)
+{
+  u64 lo = (u64)m * (u32)factor;
+  u64 hi = (u64)m * (u32)(factor >> 32);
+  return (u32)(((lo >> 32) + hi) >> (shift - 32));
+}
+
+/* Computes the shortest decimal `*digits` * 10^`*exp` which rounds to the
+ * value with the specified mantissa and exponent bits.
+ */
+static void f32_shortest(u32 ieee_m, u32 ieee_e, u32 *digits, i32 *exp)
+{
+  i32 e2;
+  u32 m2;
+  if (ieee_e == 0) {
+    e2 = 1 - F32_BIAS - F32_MANTISSA_BITS - 2;
+    m2 = ieee_m;
+  } else {
+    e2 = (i32)ieee_e - F32_BIAS - F32_MANTISSA_BITS - 2;
+    m2 = (1u << F32_MANTISSA_BITS) | ieee_m;
+  }
+
+  bool accept_bounds = (m2 & 1) == 0;
+
+  /* Step 2: Determine the interval of valid decimal representations. */
+  u32 mv = 4 * m2;
+  u32 mp = 4 * m2 + 2;
+  u32 mm_shift = ieee_m != 0 || ieee_e <= 1;
+  u32 mm = 4 * m2 - 1 - mm_shift;
+
+  /* Step 3: Convert to a decimal power base. */
+  u32 vr, vp, vm;
+  i32 e10;
+  bool vm_trailing_zeros = false;
+  bool vr_trailing_zeros = false;
+  u8 last_removed = 0;
+
+  if (e2 >= 0) {
+    u32 q = log10_pow2(e2);
+    i32 k = F32_POW5_INV_BITS + pow5bits(q) - 1;
+    i32 i = -e2 + (i32)q + k;
+    e10 = (i32)q;
+    vr = mul_shift(mv, f32_pow5_inv_split[q], i);
+    vp = mul_shift(mp, f32_pow5_inv_split[q], i);
+    vm = mul_shift(mm, f32_pow5_inv_split[q], i);
+
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      i32 l = F32_POW5_INV_BITS + pow5bits(q - 1) - 1;
+      last_removed = (u8)(mul_shift(mv, f32_pow5_inv_split[q - 1],
+                                    -e2 + (i32)q - 1 + l) % 10);
+    }
+    if (q <= 9) {
+      if (mv % 5 == 0)
+        vr_trailing_zeros = multiple_of_pow5(mv, q);
+      else if (accept_bounds)
+        vm_trailing_zeros = multiple_of_pow5(mm, q);
+      else
+        vp -= multiple_of_pow5(mp, q);
+    }
+  } else {
+    u32 q = log10_pow5(-e2);
+    i32 i = -e2 - (i32)q;
+    i32 k = pow5bits(i) - F32_POW5_BITS;
+    i32 j = (i32)q - k;
+    e10 = (i32)q + e2;
+    vr = mul_shift(mv, f32_pow5_split[i], j);
+    vp = mul_shift(mp, f32_pow5_split[i], j);
+    vm = mul_shift(mm, f32_pow5_split[i], j);
+
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      j = (i32)q - 1 - (pow5bits(i + 1) - F32_POW5_BITS);
+      last_removed = (u8)(mul_shift(mv, f32_pow5_split[i + 1], j) % 10);
+    }
+    if (q <= 1) {
+      vr_trailing_zeros = true;
+      if (accept_bounds)
+        vm_trailing_zeros = mm_shift == 1;
+      else
+        vp--;
+    } else if (q < 31) {
+      vr_trailing_zeros = multiple_of_pow2(mv, q - 1);
+    }
+  }
+
+  /* Step 4: Find the shortest decimal representation in the interval. */
+  i32 removed = 0;
+  u32 output;
+  if (vm_trailing_zeros || vr_trailing_zeros) {
+    while (vp / 10 > vm / 10) {
+      vm_trailing_zeros &= vm % 10 == 0;
+      vr_trailing_zeros &= last_removed == 0;
+      last_removed = (u8)(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vm_trailing_zeros) {
+      while (vm % 10 == 0) {
+        vr_trailing_zeros &= last_removed == 0;
+        last_removed = (u8)(vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed++;
+      }
+    }
+    /* Round even if the exact value is .....50..0. */
+    if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+      last_removed = 4;
+    output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+                   last_removed >= 5);
+  } else {
+    while (vp / 10 > vm / 10) {
+      last_removed = (u8)(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    output = vr + (vr == vm || last_removed >= 5);
+  }
+
+  *digits = output;
+  *exp = e10 + removed;
+}
+
+/* Writes `n` zeros to `buf`. */
+static size write_zeros(char *buf, i32 n)
+{
+  for (i32 i = 0; i < n; i++)
+    buf[i] = '0';
+  return n > 0 ? (size)n : 0;
+}
+
+size num_fmt_f32(char *buf, f32 value)
+{
+  u32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  bool sign = (bits >> 31) != 0;
+  u32 ieee_m = bits & ((1u << F32_MANTISSA_BITS) - 1);
+  u32 ieee_e = (bits >> F32_MANTISSA_BITS) & ((1u << F32_EXPONENT_BITS) - 1);
+
+  size n = 0;
+  if (ieee_e == 0xFF && ieee_m != 0) {
+    memcpy(buf, "nan", 3);
+    return 3;
+  }
+  if (sign)
+    buf[n++] = '-';
+  if (ieee_e == 0xFF) {
+    memcpy(buf + n, "inf", 3);
+    return n + 3;
+  }
+  if (ieee_e == 0 && ieee_m == 0) {
+    memcpy(buf + n, "0.0", 3);
+    return n + 3;
+  }
+
+  u32 digits;
+  i32 exp;
+  f32_shortest(ieee_m, ieee_e, &digits, &exp);
+
+  /* Position of the decimal point relative to the first digit. */
+  i32 len = (i32)digits_u32(digits);
+  i32 point = len + exp;
+
+  /* Same notation as the repr() of Python floats. */
+  if (point - 1 < -4 || point - 1 >= 16) {
+    char tmp[PSEU_NUM_I32_MAX];
+    write_u32(tmp + len, digits);
+
+    buf[n++] = tmp[0];
+    if (len > 1) {
+      buf[n++] = '.';
+      memcpy(buf + n, tmp + 1, len - 1);
+      n += len - 1;
+    }
+
+    i32 e = point - 1;
+    buf[n++] = 'e';
+    buf[n++] = e < 0 ? '-' : '+';
+    if (e < 0)
+      e = -e;
+    if (e < 10)
+      buf[n++] = '0';
+    n += num_fmt_i32(buf + n, e);
+    return n;
+  }
+
+  if (point <= 0) {
+    /* 0.000ddd */
+    buf[n++] = '0';
+    buf[n++] = '.';
+    n += write_zeros(buf + n, -point);
+    write_u32(buf + n + len, digits);
+    return n + len;
+  }
+
+  if (point >= len) {
+    /* ddd000.0 */
+    write_u32(buf + n + len, digits);
+    n += len;
+    n += write_zeros(buf + n, point - len);
+    buf[n++] = '.';
+    buf[n++] = '0';
+    return n;
+  }
+
+  /* ddd.ddd */
+  write_u32(buf + n + len + 1, digits);
+  memmove(buf + n, buf + n + 1, point);
+  buf[n + point] = '.';
+  return n + len + 1;
+}
+
+/* == Number parsing. */
+
+int num_parse_i32(const char *chars, size len, i32 *o)
+{
+  u32 v = 0;
+  for (size i = 0; i < len; i++) {
+    u32 d = (u32)(chars[i] - '0');
+    if (d > 9 || v > (INT32_MAX - d) / 10)
+      return 1;
+    v = v * 10 + d;
+  }
+
+  *o = (i32)v;
+  return 0;
+}
+
+/* Powers of 10 exactly representable as doubles. */
+static const f64 f64_pow10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Parses with strtof; used when the fast paths cannot round correctly. */
+static int parse_f32_slow(const char *chars, size len, f32 *o)
+{
+  char tmp[64];
+  char *buf = len < sizeof(tmp) ? tmp : malloc(len + 1);
+  if (!buf)
+    return 1;
+
+  memcpy(buf, chars, len);
+  buf[len] = '\0';
+  *o = strtof(buf, NULL);
+
+  if (buf != tmp)
+    free(buf);
+  return 0;
+}
+
+int num_parse_f32(const char *chars, size len, f32 *o)
+{
+  /* Decompose into w * 10^q; digits past 19 only shift the exponent. */
+  u64 w = 0;
+  i32 q = 0;
+  u32 ndigits = 0;
+  bool truncated = false;
+  size i = 0;
+
+  for (; i < len && chars[i] >= '0' && chars[i] <= '9'; i++) {
+    if (ndigits < 19) {
+      w = w * 10 + (u64)(chars[i] - '0');
+      ndigits += w != 0;
+    } else {
+      truncated |= chars[i] != '0';
+      q++;
+    }
+  }
+  if (i < len && chars[i] == '.') {
+    for (i++; i < len && chars[i] >= '0' && chars[i] <= '9'; i++) {
+      if (ndigits < 19) {
+        w = w * 10 + (u64)(chars[i] - '0');
+        ndigits += w != 0;
+        q--;
+      } else {
+        truncated |= chars[i] != '0';
+      }
+    }
+  }
+  if (i < len && (chars[i] == 'e' || chars[i] == 'E')) {
+    bool neg = false;
+    i32 e = 0;
+
+    i++;
+    if (i < len && (chars[i] == '+' || chars[i] == '-'))
+      neg = chars[i++] == '-';
+    for (; i < len && chars[i] >= '0' && chars[i] <= '9'; i++) {
+      if (e < 100000)
+        e = e * 10 + (chars[i] - '0');
+    }
+    q += neg ? -e : e;
+  }
+
+  f32 result;
+  if (w == 0) {
+    result = 0;
+  } else if (!truncated && w <= (1u << 24) && q >= -10 && q <= 10) {
+    /* w and 10^|q| are exact floats so a single operation rounds
+     * correctly (Clinger's fast path). */
+    f32 fw = (f32)w;
+    result = q < 0 ? fw / (f32)f64_pow10[-q] : fw * (f32)f64_pow10[q];
+  } else if (!truncated && w <= (1ull << 53) && q >= -22 && q <= 22) {
+    /* Correctly rounded as a double; rounding it to a float again is only
+     * wrong if the double lies exactly halfway between two floats. */
+    f64 d = (f64)w;
+    d = q < 0 ? d / f64_pow10[-q] : d * f64_pow10[q];
+
+    u64 bits;
+    memcpy(&bits, &d, sizeof(bits));
+    u64 low = bits & ((1ull << 29) - 1);
+    if (d < FLT_MIN || d > FLT_MAX || low == (1ull << 28))
+      return parse_f32_slow(chars, len, o) || !isfinite(*o);
+    result = (f32)d;
+  } else {
+    return parse_f32_slow(chars, len, o) || !isfinite(*o);
+  }
+
+  *o = result;
+  return !isfinite(result);
+}
@@ -0,0 +1,17 @@
+#ifndef PSEU_NUM_H
+#define PSEU_NUM_H
+
+#include "obj.h"
+
+/* Maximum number of chars written by num_fmt_i32(). */
+#define PSEU_NUM_I32_MAX 11
+/* Maximum number of chars written by num_fmt_f32(). */
+#define PSEU_NUM_F32_MAX 24
+
+size num_fmt_i32(char *buf, i32 value);
+size num_fmt_f32(char *buf, f32 value);
+
+int num_parse_i32(const char *chars, size len, i32 *o);
+int num_parse_f32(const char *chars, size len, f32 *o);
+
+#endif /* PSEU_NUM_H */
@@ -1,28 +1,252 @@
 #include "vm.h"
 #include "obj.h"
 
-Array *array_new(State *s, u32 cap)
+/* Initial capacity of an array which grows from empty. */
+#define PSEU_ARRAY_INIT_CAP 8
+
+/* Returns the element storage kind used for arrays of the specified type. */
+static u8 array_kind(State *s, Type *elem_type)
+{
+  if (t_isint(s, elem_type))
+    return ARR_I32;
+  if (t_isfloat(s, elem_type))
+    return ARR_F32;
+  if (elem_type == V(s)->boolean_type)
+    return ARR_BOOL;
+  if (t_isrecord(elem_type))
+    return ARR_RECORD;
+  return ARR_VALUE;
+}
+
+size array_bytes(u8 kind, u32 n)
+{
+  switch (kind) {
+  case ARR_I32:    return (size)n * sizeof(i32);
+  case ARR_F32:    return (size)n * sizeof(f32);
+  case ARR_BOOL:   return (((size)n + 31) >> 5) * sizeof(u32);
+  case ARR_RECORD: return 0;
+  default:         return (size)n * sizeof(Value);
+  }
+}
+
+/* Initializes an empty array with the specified element storage. */
+static void array_init(Array *a, u8 kind)
+{
+  a->kind = kind;
+  a->dims = 1;
+  a->strings = false;
+  a->base = 0;
+  a->lower[0] = 0;
+  a->extent[0] = 0;
+  a->length = 0;
+  a->capacity = 0;
+  a->items.ptr = NULL;
+  a->record = NULL;
+}
+
+/* Allocates an empty array with the specified element storage. */
+static Array *array_alloc(State *s, u8 kind)
+{
+  Object *o = pseu_gc_new(s, V(s)->array_type, 0);
+  if (pseu_unlikely(!o))
+    return NULL;
+
+  Array *result = &o->as.array;
+  array_init(result, kind);
+  return result;
+}
+
+/* Allocates an empty array for `cap` elements in the region of the current
+ * frame. Its storage follows the header and is never reallocated; the
+ * columns of an array of records are allocated along with it.
+ */
+static Array *array_frame(State *s, u8 kind, Type *record, u32 cap)
 {
-  Array *result = pseu_gc_new(s, V(s)->array_type, cap * sizeof(Value)); /* @ovf */
-  result->length = 0;
+  size sz = kind == ARR_RECORD ? record->fields_count * sizeof(Array *) : array_bytes(kind, cap);
+  Object *o = pseu_frame_new(s, V(s)->array_type, sz);
+  if (pseu_unlikely(!o))
+    return NULL;
+
+  Array *result = &o->as.array;
+  array_init(result, kind);
+  result->items.ptr = result + 1;
   result->capacity = cap;
+
+  if (kind == ARR_RECORD) {
+    result->record = record;
+    for (u8 i = 0; i < record->fields_count; i++) {
+      Type *field_type = record->fields[i].type;
+      u8 field_kind = t_isrecord(field_type) ? ARR_VALUE : array_kind(s, field_type);
+      result->items.columns[i] = array_frame(s, field_kind, NULL, cap);
+      if (pseu_unlikely(!result->items.columns[i]))
+        return NULL;
+      result->items.columns[i]->strings = t_isstring(s, field_type);
+    }
+  }
   return result;
 }
 
-Array *array_push(State *s, Array *a, Value *v)
+/* Creates the columns of an array of records of the specified type. No
+ * collection happens before the columns are reachable from the array.
+ */
+static int array_columns(State *s, Array *a, Type *record)
 {
-  Array *result = a;
-  if (a->length >= a->capacity) {
-    result = array_new(s, a->capacity * 2); /* @ovf */
-    result->length = a->length;
-    memcpy(result->items, a->items, sizeof(Value) * a->length);
+  size sz = record->fields_count * sizeof(Array *);
+  a->items.columns = pseu_alloc(s, sz);
+  if (pseu_unlikely(!a->items.columns))
+    return 1;
+
+  pseu_gc_resize(s, (Object *)a, 0, sz);
+  a->record = record;
+  for (u8 i = 0; i < record->fields_count; i++) {
+    Type *field_type = record->fields[i].type;
+    u8 kind = t_isrecord(field_type) ? ARR_VALUE : array_kind(s, field_type);
+    Array *column = array_alloc(s, kind);
+    if (pseu_unlikely(!column))
+      return 1;
+    column->strings = t_isstring(s, field_type);
+    a->items.columns[i] = column;
   }
+  return 0;
+}
+
+Array *array_new(State *s, Type *elem_type, u32 cap)
+{
+  Array *result = array_alloc(s, array_kind(s, elem_type));
+  if (pseu_unlikely(!result))
+    return NULL;
+
+  result->strings = t_isstring(s, elem_type);
+  if (result->kind == ARR_RECORD && array_columns(s, result, elem_type))
+    return NULL;
+  if (cap > 0 && array_reserve(s, result, cap))
+    return NULL;
+  return result;
+}
 
-  result->items[result->length++] = *v;
+Array *array_new_frame(State *s, Type *elem_type, u32 cap)
+{
+  Array *result = array_frame(s, array_kind(s, elem_type), elem_type, cap);
+  if (result)
+    result->strings = t_isstring(s, elem_type);
   return result;
 }
 
-Array *array_pop(State *s, Array *a)
+void array_clear(Array *a)
+{
+  a->length = 0;
+  if (a->kind == ARR_RECORD) {
+    for (u8 i = 0; i < a->record->fields_count; i++)
+      a->items.columns[i]->length = 0;
+  }
+}
+
+int array_reserve(State *s, Array *a, u32 cap)
+{
+  if (cap <= a->capacity)
+    return 0;
+
+  if (a->kind == ARR_RECORD) {
+    for (u8 i = 0; i < a->record->fields_count; i++) {
+      if (array_reserve(s, a->items.columns[i], cap))
+        return 1;
+    }
+    a->capacity = cap;
+    return 0;
+  }
+
+  size old_sz = array_bytes(a->kind, a->capacity);
+  size new_sz = array_bytes(a->kind, cap);
+  void *items = pseu_realloc(s, a->items.ptr, new_sz);
+  if (pseu_unlikely(!items))
+    return 1;
+
+  pseu_gc_resize(s, (Object *)a, old_sz, new_sz);
+  a->items.ptr = items;
+  a->capacity = cap;
+  return 0;
+}
+
+/* Resizes the columns of an array of records to its bounds and length;
+ * new fields get the initial value of their type as in record_new(). STRING
+ * columns initialize their elements themselves; see array_resize().
+ */
+static int array_resize_columns(State *s, Array *a, u32 len)
+{
+  if (array_reserve(s, a, len))
+    return 1;
+
+  for (u8 i = 0; i < a->record->fields_count; i++) {
+    Type *field_type = a->record->fields[i].type;
+    Array *column = a->items.columns[i];
+    u32 from = column->length;
+
+    column->dims = a->dims;
+    column->base = a->base;
+    memcpy(column->lower, a->lower, sizeof(a->lower));
+    memcpy(column->extent, a->extent, sizeof(a->extent));
+    if (array_resize(s, column, len))
+      return 1;
+
+    if (t_isrecord(field_type)) {
+      for (u32 k = from; k < len; k++)
+        column->items.values[k] = v_obj((Object *)record_new(s, field_type));
+    }
+  }
+
+  a->length = len;
+  return 0;
+}
+
+int array_resize(State *s, Array *a, u32 len)
+{
+  if (a->kind == ARR_RECORD)
+    return array_resize_columns(s, a, len);
+  if (array_reserve(s, a, len))
+    return 1;
+
+  /* Zero new elements; a zeroed Value is treated as NIL. STRINGs start out
+   * empty like STRING variables. */
+  if (len > a->length) {
+    if (a->kind == ARR_BOOL) {
+      for (u32 i = a->length; i < len; i++)
+        a_setbit(a, i, false);
+    } else if (a->strings) {
+      for (u32 i = a->length; i < len; i++)
+        a->items.values[i] = v_obj((Object *)V(s)->empty_string);
+    } else {
+      size from = array_bytes(a->kind, a->length);
+      memset((u8 *)a->items.ptr + from, 0, array_bytes(a->kind, len) - from);
+    }
+  }
+
+  a->length = len;
+  return 0;
+}
+
+int array_push(State *s, Array *a, Value *v)
+{
+  /* Grow geometrically so pushes are amortized O(1), and realloc the element
+   * block in place so references to the array stay valid. */
+  if (a->length >= a->capacity) {
+    if (pseu_unlikely(a->capacity == UINT32_MAX))
+      return pseu_error(s, "Array is too large");
+
+    u32 cap = PSEU_ARRAY_INIT_CAP;
+    if (a->capacity)
+      cap = a->capacity > UINT32_MAX / 2 ? UINT32_MAX : a->capacity * 2;
+    if (array_reserve(s, a, cap))
+      return 1;
+  }
+
+  if (array_set(a, a->length, v))
+    return 1;
+
+  a->length++;
+  return 0;
+}
+
+void array_pop(State *s, Array *a)
 {
   pseu_unused(s);
 
@@ -30,17 +254,147 @@ Array *array_pop(State *s, Array *a)
     a->length--;
 
   /* TODO: Shrink array if its worth it.*/
-  return a;
 }
 
-/*
-Value *array_get(State *s, Array *a, u32 i)
+Array *array_copy(State *s, Array *a)
 {
-  pseu_unused(s);
+  Array *result = array_alloc(s, a->kind);
+  if (pseu_unlikely(!result))
+    return NULL;
+
+  result->dims = a->dims;
+  result->strings = a->strings;
+  result->base = a->base;
+  memcpy(result->lower, a->lower, sizeof(a->lower));
+  memcpy(result->extent, a->extent, sizeof(a->extent));
+
+  if (a->kind == ARR_RECORD) {
+    if (array_columns(s, result, a->record))
+      return NULL;
+    for (u8 i = 0; i < a->record->fields_count; i++) {
+      Array *column = array_copy(s, a->items.columns[i]);
+      if (pseu_unlikely(!column))
+        return NULL;
+      result->items.columns[i] = column;
+    }
+    result->length = result->capacity = a->length;
+    return result;
+  }
+
+  if (array_reserve(s, result, a->length))
+    return NULL;
+  memcpy(result->items.ptr, a->items.ptr, array_bytes(a->kind, a->length));
+  result->length = a->length;
+
+  /* Records are values; the copy must not share the nested ones. */
+  if (a->kind == ARR_VALUE) {
+    for (u32 i = 0; i < a->length; i++) {
+      Value *v = &result->items.values[i];
+      if (v_isobj(v) && t_isrecord(v_asobj(v)->header.type))
+        *v = v_obj((Object *)record_copy(s, &v_asobj(v)->as.uobject));
+    }
+  }
+  return result;
+}
+
+UObject *record_new(State *s, Type *type)
+{
+  UObject *result = &pseu_gc_new(s, type, type->fields_count * sizeof(Value))->as.uobject;
+  record_init(s, result);
+  return result;
+}
+
+UObject *record_new_frame(State *s, Type *type)
+{
+  Object *o = pseu_frame_new(s, type, type->fields_count * sizeof(Value));
+  if (pseu_unlikely(!o))
+    return NULL;
+  record_init(s, &o->as.uobject);
+  return &o->as.uobject;
+}
+
+void record_init(State *s, UObject *r)
+{
+  Type *type = r->type;
+
+  /* Records are values, so nested records are created along with it. No
+   * collection happens before the result is reachable. */
+  for (u8 i = 0; i < type->fields_count; i++) {
+    Type *field_type = type->fields[i].type;
+    Value *v = &r->fields[i];
+
+    if (t_isint(s, field_type))
+      *v = v_int(0);
+    else if (t_isfloat(s, field_type))
+      *v = v_float(0);
+    else if (field_type == V(s)->boolean_type)
+      *v = v_bool(false);
+    else if (t_isstring(s, field_type))
+      *v = v_obj((Object *)V(s)->empty_string);
+    else if (t_isrecord(field_type))
+      *v = v_obj((Object *)record_new(s, field_type));
+    else
+      *v = (Value) { 0 };
+  }
+}
+
+UObject *record_copy(State *s, UObject *r)
+{
+  Type *type = r->type;
+  UObject *result = &pseu_gc_new(s, type, type->fields_count * sizeof(Value))->as.uobject;
+
+  memcpy(result->fields, r->fields, type->fields_count * sizeof(Value));
+  for (u8 i = 0; i < type->fields_count; i++) {
+    if (t_isrecord(type->fields[i].type))
+      result->fields[i] = v_obj((Object *)record_copy(s, &v_asobj(&r->fields[i])->as.uobject));
+  }
+
+  return result;
+}
+
+void record_assign(State *s, UObject *r, UObject *from)
+{
+  Type *type = r->type;
+
+  memmove(r->fields, from->fields, type->fields_count * sizeof(Value));
+  for (u8 i = 0; i < type->fields_count; i++) {
+    if (t_isrecord(type->fields[i].type))
+      r->fields[i] = v_obj((Object *)record_copy(s, &v_asobj(&r->fields[i])->as.uobject));
+  }
+}
 
-  return a->values[i];
+int array_gather(State *s, Array *a, u32 i, Value *o)
+{
+  Type *type = a->record;
+  UObject *result = &pseu_gc_new(s, type, type->fields_count * sizeof(Value))->as.uobject;
+
+  /* The element is a copy; nested records are not shared with the array. */
+  for (u8 k = 0; k < type->fields_count; k++) {
+    Value *v = &result->fields[k];
+    array_get(a->items.columns[k], i, v);
+    if (t_isrecord(type->fields[k].type))
+      *v = v_obj((Object *)record_copy(s, &v_asobj(v)->as.uobject));
+  }
+
+  *o = v_obj((Object *)result);
+  return 0;
+}
+
+int array_scatter(State *s, Array *a, u32 i, Value *v)
+{
+  Type *type = a->record;
+  if (!v_isobj(v) || v_asobj(v)->header.type != type)
+    return 1;
+
+  UObject *r = &v_asobj(v)->as.uobject;
+  for (u8 k = 0; k < type->fields_count; k++) {
+    Value field = r->fields[k];
+    if (t_isrecord(type->fields[k].type))
+      field = v_obj((Object *)record_copy(s, &v_asobj(&field)->as.uobject));
+    array_set(a->items.columns[k], i, &field);
+  }
+  return 0;
 }
-*/
 
 Type *v_type(State *s, Value *v)
 {
@@ -2,6 +2,7 @@
 #define PSEU_OBJ_H
 
 #include <pseu.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -57,7 +58,8 @@ typedef enum ArithType {
   _(gt, >,  a, b, o)                    \
   _(le, <=, a, b, o)                    \
   _(ge, >=, a, b, o)                    \
-  _(eq, ==, a, b, o)
+  _(eq, ==, a, b, o)                    \
+  _(ne, !=, a, b, o)
 
 /* Types of pseu compares. */
 typedef enum CompareType {
@@ -76,6 +78,9 @@ typedef struct Field {
 #define t_isint(S, t)   ((t) == V(S)->integer_type)
 #define t_isfloat(S, t) ((t) == V(S)->real_type)
 #define t_isarray(S, t) ((t) == V(S)->array_type)
+#define t_isstring(S, t) ((t) == V(S)->string_type)
+/* Builtin types have a `fields_count` of -1; record TYPEs have fields. */
+#define t_isrecord(t)   ((t)->fields_count != (u8)-1)
 
 /* A pseu type. */
 struct Type {
@@ -90,25 +95,45 @@ typedef enum ValueType {
   VAL_BOOL,             /* Boolean. */
   VAL_INT,              /* Signed 32-bit integer. */
   VAL_FLOAT,            /* Single-precision floating point. */
-  VAL_OBJ               /* Pointer to a heap allocated pseu object. */
+  VAL_OBJ,              /* Pointer to a heap allocated pseu object. */
+  VAL_REF               /* Reference to a variable, an element of the array or
+                         * a field of the record in `object`; the variable is
+                         * the stack slot at `offset` when `object` is NULL.
+                         * Only held by BYREF parameters. */
 } ValueType;
 
+/* A raw frame slot holding an INTEGER, REAL or BOOLEAN local unboxed. */
+typedef union Slot {
+  i32 integer;
+  f32 real;
+  bool boolean;
+} Slot;
+
 /* A pseu value. */
 typedef struct Value {
   u8 type;              /* Type of value; see value_type. */
+  bool borrowed;        /* Is the object still shared with the caller which
+                         * passed it BYVAL; see OP_OWN. */
+  u8 raw;               /* Type of the value in the raw slot referenced by
+                         * `as.slot`, or VAL_NIL; VAL_REF. */
+  u32 offset;           /* Offset of the referenced variable; VAL_REF. */
   union {
     float real;         /* As a real value. */
     bool boolean;       /* As a boolean. */
     i32 integer;        /* As an integer. */
     Object *object;     /* As an object. */
+    Slot *slot;         /* As a raw slot; VAL_REF. */
   } as;
 } Value;
 
+#define v_isnil(v)   ((v)->type == VAL_NIL)
 #define v_isbool(v)  ((v)->type == VAL_BOOL)
 #define v_isobj(v)   ((v)->type == VAL_OBJ)
+#define v_isref(v)   ((v)->type == VAL_REF)
 #define v_isint(v)   ((v)->type == VAL_INT)
 #define v_isfloat(v) ((v)->type == VAL_FLOAT)
 #define v_isnum(v)   (v_isint(v) || v_isfloat(v))
+#define v_isstr(S, v) (v_isobj(v) && t_isstring(S, (v)->as.object->header.type))
 #define v_isi32(v)   v_isint(v)
 #define v_isf32(v)   v_isfloat(v)
 
@@ -118,11 +143,14 @@ typedef struct Value {
 #define v_asfloat(v) ((v)->as.real)
 #define v_asi32(v)   v_asint(v)
 #define v_asf32(v)   v_asfloat(v)
+#define v_asstr(v)   (&(v)->as.object->as.string)
 
 #define v_bool(k)    ((Value) {.type = VAL_BOOL,  .as.boolean = (k)})
 #define v_obj(k)     ((Value) {.type = VAL_OBJ,   .as.object = (k)})
 #define v_int(k)     ((Value) {.type = VAL_INT,   .as.integer = (k)})
 #define v_float(k)   ((Value) {.type = VAL_FLOAT, .as.real = (k)})
+#define v_ref(o, k)  ((Value) {.type = VAL_REF, .offset = (k), .as.object = (o)})
+#define v_refslot(p, t) ((Value) {.type = VAL_REF, .raw = (t), .as.slot = (p)})
 #define v_i32(k)     v_int(k)
 #define v_f32(k)     v_float(k)
 
@@ -136,35 +164,251 @@ typedef struct Variable {
   Value value;            /* Value of variable. */
 } Variable;
 
-#define GC_HEADER u8 marked; Type *type; Object* next
+/* Generic fields of an object; `frame` is set on objects allocated in the
+ * region of a call frame rather than the GC heap, see pseu_frame_new().
+ */
+#define GC_HEADER u8 marked; u8 frame; Type *type; Object* next
 
-/* A pseu user object. */
+/* A pseu user object; an instance of a record TYPE. Fields are stored in
+ * the slots given by their order of declaration in the TYPE.
+ */
 typedef struct UObject {
   GC_HEADER;
   Value fields[];        /* Field values of the object. */
 } UObject;
 
-/* A pseu string object. */
+UObject *record_new(State *s, Type *type);
+UObject *record_new_frame(State *s, Type *type);
+UObject *record_copy(State *s, UObject *r);
+void record_init(State *s, UObject *r);
+void record_assign(State *s, UObject *r, UObject *from);
+
+/* Flags of a pseu string object. */
+typedef enum StringFlag {
+  STR_ROPE     = 1 << 0,  /* Concatenation of `left` and `right`. */
+  STR_SLICE    = 1 << 1,  /* Chars are shared with the `left` string. */
+  STR_OWNED    = 1 << 2,  /* Chars are in an owned block; not inline. */
+  STR_INTERNED = 1 << 3,  /* String is in the VM intern table. */
+  STR_HASHED   = 1 << 4,  /* `hash` is computed. */
+  STR_MAPPED   = 1 << 5   /* Chars are a memory mapped window of a file. */
+} StringFlag;
+
+/* Maximum length of a concatenation or substring which is copied into a flat
+ * string instead of creating a rope or slice.
+ */
+#define PSEU_STR_FLAT_MAX 64
+
+/* A pseu string object. 
+ *
+ * Flat strings store their chars inline after the header, or in an owned
+ * block once a rope is flattened; their chars are NUL terminated. Ropes
+ * defer the copy of a concatenation until the chars are needed, so that
+ * building a string piece by piece is linear. Slices share the chars of
+ * their parent and are not NUL terminated. Ropes and slices are always
+ * longer than PSEU_STR_FLAT_MAX. Mapped strings are only used as the parent
+ * of the slices returned when reading a memory mapped file.
+ */
 typedef struct String {
   GC_HEADER;
-  u32 length;	            /* Length of string. */
-  u8 buffer[];            /* Buffer containing string. */
+  u8 flags;               /* Flags of string; see StringFlag. */
+  u32 length;	            /* Length of string in bytes. */
+  u32 hash;               /* Cached hash; valid when STR_HASHED. */
+  char *chars;            /* Chars of string; NULL when a rope. */
+  struct String *left;    /* Left half of a rope; parent of a slice. */
+  struct String *right;   /* Right half of a rope. */
+  char buffer[];          /* Inline chars of a flat string. */
 } String;
 
-String *string_new(State *s, const char* value);
-
-/* A pseu array object. */
+#define s_isrope(str)  (((str)->flags & STR_ROPE) != 0)
+#define s_isslice(str) (((str)->flags & STR_SLICE) != 0)
+#define s_ismapped(str) (((str)->flags & STR_MAPPED) != 0)
+
+/* Weak table of interned strings. */
+typedef struct StringTable {
+  u32 count;              /* Number of used slots; includes tombstones. */
+  u32 size;               /* Number of slots; power of 2. */
+  String **slots;         /* Slots of table. */
+} StringTable;
+
+u32 string_hash_chars(const char *chars, u32 len);
+bool string_valid_utf8(const char *chars, size len);
+String *string_new(State *s, const char *chars, u32 len);
+String *string_intern(State *s, const char *chars, u32 len);
+String *string_concat(State *s, String *a, String *b);
+String *string_slice(State *s, String *str, u32 start, u32 len);
+String *string_upper(State *s, String *str);
+String *string_lower(State *s, String *str);
+const char *string_chars(State *s, String *str);
+const char *string_cstr(State *s, String *str);
+u32 string_hash(State *s, String *str);
+int string_compare(State *s, String *a, String *b, int *o);
+int string_find(State *s, String *str, String *sub, i64 *o);
+size string_bytes(String *str);
+void string_table_sweep(State *s, StringTable *t);
+void string_table_free(State *s, StringTable *t);
+
+/* Kinds of pseu array element storage. */
+typedef enum ArrayKind {
+  ARR_VALUE,              /* Tagged values; any element type. */
+  ARR_I32,                /* Packed signed 32-bit integers; INTEGER. */
+  ARR_F32,                /* Packed single-precision reals; REAL. */
+  ARR_BOOL,               /* Bitset of booleans; BOOLEAN. */
+  ARR_RECORD              /* One column array per field; record TYPEs. */
+} ArrayKind;
+
+/* Maximum number of dimensions of a pseu array. */
+#define PSEU_MAX_DIMS 2
+
+/* A pseu array object. 
+ *
+ * Elements of multi-dimensional arrays are stored contiguously in row-major
+ * order. The linear offset of an element is the sum of its indices multiplied
+ * by the stride of their dimension plus `base`, which folds the lower bounds.
+ *
+ * Arrays of records are stored by column: each field of the record has its
+ * own array with the same bounds, so an element field is at the same offset
+ * in its column as the element would be in the array. Columns of record
+ * fields hold the nested records as values.
+ */
 typedef struct Array {
   GC_HEADER;
+  u8 kind;                /* Kind of element storage; see ArrayKind. */
+  u8 dims;                /* Number of dimensions. */
+  bool strings;           /* Are the elements STRINGs; new ones start out as
+                           * the empty string. ARR_VALUE. */
+  i32 base;               /* Offset added to the linear index. */
+  i32 lower[PSEU_MAX_DIMS];  /* Lower bound of each dimension. */
+  u32 extent[PSEU_MAX_DIMS]; /* Number of elements in each dimension. */
   u32 length;             /* Length of array. */
   u32 capacity;           /* Capacity of array. */
-  Value items[];          /* Values of array. */
+  union {
+    void *ptr;            /* As an untyped block. */
+    Value *values;        /* As tagged values; ARR_VALUE. */
+    i32 *i32s;            /* As packed integers; ARR_I32. */
+    f32 *f32s;            /* As packed reals; ARR_F32. */
+    u32 *bits;            /* As a bitset; ARR_BOOL. */
+    struct Array **columns; /* As a column per field; ARR_RECORD. */
+  } items;                /* Element storage; grown in place. */
+  Type *record;           /* Type of the elements; ARR_RECORD. */
 } Array;
 
-Array *array_new(State *s, u32 cap);
-Array *array_push(State *s, Array* a, Value *v);
-Array *array_pop(State *s, Array *a);
-Value *array_get(State *s, Array *a, u32 i);
+#define a_getbit(a, i)   (((a)->items.bits[(i) >> 5] >> ((i) & 31)) & 1)
+#define a_setbit(a, i, b)                                 \
+  ((a)->items.bits[(i) >> 5] = ((a)->items.bits[(i) >> 5] \
+      & ~(1u << ((i) & 31))) | ((u32)!!(b) << ((i) & 31)))
+
+size array_bytes(u8 kind, u32 n);
+Array *array_new(State *s, Type *elem_type, u32 cap);
+int array_reserve(State *s, Array *a, u32 cap);
+int array_resize(State *s, Array *a, u32 len);
+int array_push(State *s, Array *a, Value *v);
+void array_pop(State *s, Array *a);
+Array *array_copy(State *s, Array *a);
+Array *array_new_frame(State *s, Type *elem_type, u32 cap);
+void array_clear(Array *a);
+int array_sort(State *s, Array *a);
+int array_sort_by(State *s, Array *a, String *field);
+int array_gather(State *s, Array *a, u32 i, Value *o);
+int array_scatter(State *s, Array *a, u32 i, Value *v);
+
+/* Loads the element at offset `i` of the specified array into `o`; arrays of
+ * records are loaded through array_gather(). */
+static inline
+void array_get(Array *a, u32 i, Value *o)
+{
+  switch (a->kind) {
+  case ARR_I32:  *o = v_i32(a->items.i32s[i]); break;
+  case ARR_F32:  *o = v_f32(a->items.f32s[i]); break;
+  case ARR_BOOL: *o = v_bool(a_getbit(a, i)); break;
+  default:       *o = a->items.values[i]; break;
+  }
+}
+
+/* Stores `v` at offset `i` of the specified array; returns 1 if the value
+ * does not fit the element storage.
+ */
+static inline
+int array_set(Array *a, u32 i, Value *v)
+{
+  switch (a->kind) {
+  case ARR_I32:
+    if (!v_isi32(v))
+      return 1;
+    a->items.i32s[i] = v_asi32(v);
+    return 0;
+  case ARR_F32:
+    if (v_isf32(v))
+      a->items.f32s[i] = v_asf32(v);
+    else if (v_isi32(v))
+      a->items.f32s[i] = v_i2f(v);
+    else
+      return 1;
+    return 0;
+  case ARR_BOOL:
+    if (!v_isbool(v))
+      return 1;
+    a_setbit(a, i, v_asbool(v));
+    return 0;
+  case ARR_RECORD:
+    /* Stored field by field; see array_scatter(). */
+    return 1;
+
+  default:
+    a->items.values[i] = *v;
+    return 0;
+  }
+}
+
+/* Modes a pseu file can be opened in. */
+typedef enum FileMode {
+  FILE_READ,              /* Read lines from the start. */
+  FILE_WRITE,             /* Write lines; truncates the file. */
+  FILE_APPEND             /* Write lines at the end of the file. */
+} FileMode;
+
+/* Size of the block buffer of a file. */
+#define PSEU_FILE_BUFFER_SIZE   (64 * 1024)
+/* Files opened for reading at least this large are memory mapped. */
+#define PSEU_FILE_MAP_THRESHOLD (64 * 1024)
+/* Length of the window of a memory mapped file. */
+#define PSEU_FILE_MAP_WINDOW    (256 * 1024 * 1024)
+
+/* A pseu file object.
+ *
+ * Reads and writes go through a block buffer so the stream itself is
+ * unbuffered. Large files opened for reading are instead memory mapped one
+ * window at a time, and the lines read are slices of the window; a window
+ * stays mapped until the file has moved past it and no line references it.
+ */
+typedef struct File {
+  GC_HEADER;
+  u8 mode;                /* Mode of file; see FileMode. */
+  FILE *stream;           /* Stream of file; NULL once closed. */
+  String *name;           /* Name the file was opened with. */
+  struct File *link;      /* Next open file of the VM. */
+
+  String *map;            /* Mapped window; NULL when buffered. */
+  u64 map_offset;         /* Offset of the window in the file. */
+  u64 offset;             /* Offset of the next line in the file. */
+  u64 length;             /* Length of the file when mapped. */
+
+  u32 pos;                /* Position of the next char in `buffer`. */
+  u32 count;              /* Number of chars in `buffer`. */
+  char *buffer;           /* Block buffer; NULL when mapped or closed. */
+
+  u32 line_count;         /* Number of chars in `line`. */
+  u32 line_size;          /* Capacity of `line`. */
+  char *line;             /* Line spanning more than one block. */
+} File;
+
+File *file_open(State *s, String *name, u8 mode);
+File *file_find(State *s, String *name);
+int file_close(State *s, File *f);
+bool file_eof(State *s, File *f);
+String *file_read_line(State *s, File *f);
+int file_write(State *s, File *f, const char *chars, size len);
+void file_unmap(String *map);
+size file_bytes(File *f);
 
 /* A pseu user object. */
 union Object {
@@ -173,6 +417,7 @@ union Object {
     UObject uobject;      /* As a user object. */
     String string;        /* As a string object. */
     Array array;          /* As an array. */
+    File file;            /* As a file. */
   } as;
 };
 
@@ -190,26 +435,61 @@ void cbuf_free(State *s, CBuffer *buf);
 /* Types of pseu function. */
 typedef enum FunctionType {
   FN_PSEU,                /* Pseu function; consisting of VM bytecode. */
-  FN_C                    /* Native C function which operates on a VM state
+  FN_C,                   /* Native C function which operates on a VM state
                            * evalulation stack. */
+  FN_HOST                 /* Host function defined through the public API;
+                           * called through a thunk. */
 } FunctionType;
 
+struct Function;
+
+/* A pre-decoded instruction word; an instruction is its handler followed by
+ * a word for each operand.
+ */
+typedef union Word {
+  const void *handler;    /* Handler of the instruction; its opcode when
+                           * computed gotos are not used. */
+  u32 u;                  /* Immediate operand. */
+  union Word *target;     /* Branch address. */
+  struct Function *fn;    /* Function called. */
+  Type *type;             /* Type operand. */
+  Value *value;           /* Constant or global. */
+} Word;
+
 /* A pseu function. */
 typedef struct FunctionPseu {
   u8 const_count;         /* Number of constants in `consts`. */
-  u8 local_count;         /* Number of locals in `locals`.*/
+  u8 local_count;         /* Number of locals in `locals`; held as Values. */
+  u8 slot_count;          /* Number of raw slots of the unboxed locals. */
   u16 code_count;         /* Number of instructions in `code`. */
 
   u32 max_stack;          /* Maximum space the function occupies on the stack. */
 
   Value *consts;          /* Constants in the function. */
   Type **locals;          /* Locals in the function. */
+  Value *frame;           /* Initial values of the locals which are not
+                           * parameters; copied into each new frame. */
   BCode *code;            /* Instructions of function. */
+  Word *words;            /* Pre-decoded instructions; NULL until called. */
 } FunctionPseu;
 
 /* A C function. */
 typedef int (*FunctionC)(State *s, Value *args);
 
+/* Calls a host function with the `params_count` arguments below `sp` and
+ * returns the new stack pointer, past the result if any; NULL on error.
+ */
+typedef Value *(*HostThunk)(State *s, struct Function *fn, Value *sp);
+
+/* A host function. */
+typedef struct FunctionHost {
+  HostThunk thunk;        /* Thunk calling `fn`; specialized by signature. */
+  union {
+    PseuFunction generic; /* As a function taking PseuValue. */
+    PseuNative native;    /* As a function taking C primitives. */
+  } fn;
+} FunctionHost;
+
 /* A pseu function description. It can also represent a procedure; see
  * function.return_type.
  */
@@ -219,19 +499,36 @@ typedef struct Function {
 
   u8 params_count;        /* Number of parameters (arity).*/
   Type **param_types;     /* Types of parameters. */
+  Type **param_elems;     /* Element types of ARRAY parameters, NULL for
+                           * others; NULL if there are none. */
+  u32 byref;              /* Bit mask of the parameters passed BYREF. */
   Type *return_type;      /* Return type; NULL when procedure. */
 
   union {
     FunctionC c;          /* As a C function. */
     FunctionPseu pseu;    /* As a pseu function. */
+    FunctionHost host;    /* As a host function. */
   } as;
 } Function;
 
+/* A chunk of the region which objects that do not escape their call frame
+ * are allocated from; it is released in stack order as frames return.
+ */
+typedef struct Region {
+  struct Region *prev;    /* Previously filled chunk. */
+  size size;              /* Capacity of `data` in bytes. */
+  size top;               /* Bytes of `data` in use. */
+  u8 data[];
+} Region;
+
 /* A pseu call frame. */
 typedef struct Frame {
   Function *fn;           /* Function of that frame. */
-  BCode *ip;              /* Instruction pointer. */
+  Word *ip;               /* Instruction pointer. */
   Value *bp;              /* Base of stack frame. */
+  Slot *slots;            /* Raw slots of the unboxed locals. */
+  Region *region;         /* Region chunk when the frame was entered. */
+  size top;               /* Top of `region` when the frame was entered. */
 } Frame;
 
 /* Reference to the VM instance of state `S`. */
@@ -250,9 +547,13 @@ struct State {
   size stack_size;        /* Capacity of evaluation stack. */	
   Value *stack;           /* Evaluation stack; points to bottom. */
 
+  CBuffer out;            /* Buffered standard output; see pseu_write(). */
+
   size frames_count;      /* Number of frames in the call frame stack. */
   size frames_size;       /* Capacity of call frame stack. */
   Frame *frames;          /* Call frame stack; points to bottom. */
+
+  Region *region;         /* Current chunk of the frame region. */
 };
 
 /* A pseu garbage collector state. */
@@ -261,8 +562,19 @@ typedef struct GC {
 
   Object *objects;        /* Linked-list of allocated objects. */
   Object *root;           /* Reference to GC root. */
+
+  size gray_count;        /* Number of objects in `gray`. */
+  size gray_size;         /* Capacity of `gray`. */
+  Object **gray;          /* Stack of marked objects left to traverse. */
+
+  PseuHeapStats stats;    /* Heap statistics; see pseu_vm_heap_stats(). */
 } GC;
 
+/* Capacity of the function, global and type tables of a VM instance. */
+#define PSEU_VM_FNS_SIZE   256
+#define PSEU_VM_VARS_SIZE  64
+#define PSEU_VM_TYPES_SIZE PSEU_HEAP_STATS_TYPES
+
 /* Global VM instance in a pseu instance. */
 struct PseuVM {
   // TODO: Turn these into an Array object when we are up and running.
@@ -270,13 +582,15 @@ struct PseuVM {
   u16 vars_count;
   u16 types_count;
 
-  Function fns[16];
-  Variable vars[16];
-  Type types[16];
+  Function fns[PSEU_VM_FNS_SIZE];
+  Variable vars[PSEU_VM_VARS_SIZE];
+  Type types[PSEU_VM_TYPES_SIZE];
   // XXX
   //
 
   GC gc;                  /* Garbage collector of VM instance. */
+  StringTable strings;    /* Interned strings; weak references. */
+  File *files;            /* Linked-list of open files. */
   State *state;           /* Current state executing. */
 
   /* TODO: Wrap this in a struct called `primitives`. */
@@ -285,6 +599,10 @@ struct PseuVM {
   Type *integer_type;
   Type *boolean_type;
   Type *array_type;
+  Type *string_type;
+  Type *file_type;        /* Internal; not nameable from pseu code. */
+
+  String *empty_string;   /* Interned empty string; initial STRING value. */
 
   char *error;            /* Error message set; NULL when no error. */
   void *data;             /* User attached data; pseu_vm_{set,get}_data(). */
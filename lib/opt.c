@@ -0,0 +1,1037 @@
+#include "vm.h"
+#include "obj.h"
+
+/* Optimizer of the bytecode of a function.
+ *
+ * The code is decoded into a list of instructions which the passes rewrite in
+ * place, delete, or surround with new code; it is then emitted again with its
+ * branches relocated. The passes work on the expressions of the typed
+ * arithmetic whose operands are constants or locals, where the stack order
+ * gives the data flow directly:
+ *
+ *  - multiplications of an induction variable by a constant are replaced by
+ *    a temporary incremented along with the variable;
+ *  - expressions invariant in an innermost loop are computed once in front
+ *    of it;
+ *  - expressions computed again in a block are reused from a temporary;
+ *  - stores of pure expressions to raw slots which are never read after are
+ *    removed.
+ *
+ * Temporaries are raw slots following those of the locals. Locals of which
+ * a reference is taken are left alone, as are the operations which can fail.
+ */
+
+/* Code inserted before or after an instruction. */
+typedef struct Extra {
+  BCode *code;            /* Instructions of the code. */
+  size count;             /* Number of bytes in `code`. */
+  size size;              /* Capacity of `code`. */
+} Extra;
+
+/* A decoded instruction. */
+typedef struct Insn {
+  const BCode *code;      /* Bytes of the instruction. */
+  u32 at;                 /* Offset in the original code. */
+  u32 len;                /* Length of the instruction. */
+  u32 latch;              /* Last instruction of the loop headed, if any. */
+  bool target;            /* Is the instruction the target of a branch. */
+  bool dead;              /* Is the instruction removed. */
+  BCode op[10];           /* Bytes of the instruction once rewritten. */
+  Extra pre;              /* Code in front of the loop headed; entered from
+                           * outside the loop only. */
+  Extra post;             /* Code after the instruction. */
+} Insn;
+
+/* An expression `leaf leaf op` or `leaf I2F`. */
+typedef struct Expr {
+  u32 insn[3];            /* Instructions of the expression. */
+  u8 n;                   /* Number of instructions. */
+  BCode key[5];           /* Leaves and operation. */
+  u8 raw;                 /* Kind of the result; VAL_INT or VAL_FLOAT. */
+} Expr;
+
+/* A temporary holding the value of an expression. */
+typedef struct Temp {
+  BCode key[5];           /* Expression held. */
+  u32 last;               /* Last instruction of its first occurrence. */
+  int slot;               /* Raw slot of the temporary; -1 if none yet. */
+} Temp;
+
+#define PSEU_OPT_MAX_TEMPS 64
+
+typedef struct Opt {
+  State *s;
+  Function *fn;
+  Insn *insns;            /* Instructions of the function. */
+  size count;             /* Number of instructions in `insns`. */
+  u32 *index;             /* Instruction at each offset of the code. */
+  u32 slots;              /* Number of raw slots, temporaries included. */
+  bool hoisted;           /* Has code been moved in front of a loop. */
+  bool changed;           /* Has the code been changed. */
+
+  u32 ref_slots[8];       /* Raw slots of which a reference is taken. */
+  u32 ref_locals[8];      /* Locals of which a reference is taken. */
+} Opt;
+
+#define bit_get(b, i) (((b)[(i) >> 5] >> ((i) & 31)) & 1)
+#define bit_set(b, i) ((b)[(i) >> 5] |= 1u << ((i) & 31))
+
+#define u16_at(p) ((u16)((p)[0] << 8 | (p)[1]))
+
+/* Returns the number of branch addresses of the instruction at `ip`. */
+static u32 branch_count(const BCode *ip)
+{
+  switch (*ip) {
+  case OP_BR: case OP_BR_FALSE: case OP_BR_TRUE: case OP_BR_CMP:
+  case OP_BR_CMP_SS: case OP_BR_CMP_SI:
+    return 1;
+  case OP_SWITCH_TABLE:
+    return 1 + u16_at(ip + 5);
+  case OP_SWITCH_RANGE:
+    return 1 + u16_at(ip + 1);
+  case OP_SWITCH_STR:
+    return 1 + u16_at(ip + 1) + 1;
+  default:
+    return 0;
+  }
+}
+
+/* Returns the position in the instruction at `ip` of its `i`th branch
+ * address; 0 if the entry is unused.
+ */
+static u32 branch_at(const BCode *ip, u32 i)
+{
+  switch (*ip) {
+  case OP_BR: case OP_BR_FALSE: case OP_BR_TRUE:
+    return 1;
+  case OP_BR_CMP:
+    return 2;
+  case OP_BR_CMP_SS:
+    return 4;
+  case OP_BR_CMP_SI:
+    return 7;
+  case OP_SWITCH_TABLE:
+    return i == 0 ? 7 : 9 + (i - 1) * 2;
+  case OP_SWITCH_RANGE:
+    return i == 0 ? 3 : 5 + (i - 1) * 10 + 8;
+  case OP_SWITCH_STR:
+    if (i == 0)
+      return 3;
+    return u16_at(ip + 5 + (i - 1) * 4) == PSEU_SWITCH_EMPTY ? 0 : 5 + (i - 1) * 4 + 2;
+  default:
+    return 0;
+  }
+}
+
+/* Does control leave the instruction other than to the next one. */
+static bool ends_block(BCode op)
+{
+  switch (op) {
+  case OP_BR: case OP_BR_FALSE: case OP_BR_TRUE: case OP_BR_CMP:
+  case OP_BR_CMP_SS: case OP_BR_CMP_SI:
+  case OP_SWITCH_TABLE: case OP_SWITCH_RANGE: case OP_SWITCH_STR:
+  case OP_RET: case OP_RET_VAL: case OP_END:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* Returns the raw slot written by the instruction at `ip`, -1 if none. */
+static int slot_written(const BCode *ip)
+{
+  switch (*ip) {
+  case OP_ST_I32: case OP_ST_F32: case OP_ST_BOOL:
+  case OP_TEE_I32: case OP_TEE_F32: case OP_INC_I32: case OP_REF_SLOT:
+    return ip[1];
+  default:
+    return -1;
+  }
+}
+
+/* Returns the raw slot read by the instruction at `ip`, -1 if none. */
+static int slot_read(const BCode *ip)
+{
+  switch (*ip) {
+  case OP_LD_I32: case OP_LD_F32: case OP_LD_BOOL:
+  case OP_INC_I32: case OP_REF_SLOT:
+    return ip[1];
+  default:
+    return -1;
+  }
+}
+
+/* Returns the local written by the instruction at `ip`, -1 if none. */
+static int local_written(const BCode *ip)
+{
+  switch (*ip) {
+  case OP_ST_LOCAL: case OP_REF_LOCAL: case OP_OWN:
+    return ip[1];
+  default:
+    return -1;
+  }
+}
+
+/* Appends code to the code inserted before or after an instruction. */
+static bool extra_emit(Opt *o, Extra *e, const BCode *code, u32 len)
+{
+  while (e->count + len > e->size) {
+    if (e->size == 0) {
+      e->size = 16;
+      if (pseu_vec_init(o->s, &e->code, e->size, BCode))
+        return false;
+    } else if (pseu_vec_grow(o->s, &e->code, &e->size, BCode)) {
+      return false;
+    }
+  }
+  memcpy(e->code + e->count, code, len);
+  e->count += len;
+  return true;
+}
+
+/* Returns the next instruction after `k` which is not removed. */
+static size next_live(Opt *o, size k)
+{
+  for (k++; k < o->count && o->insns[k].dead; k++)
+    ;
+  return k;
+}
+
+/* Returns the previous instruction before `k` which is not removed; or
+ * `o->count` if none.
+ */
+static size prev_live(Opt *o, size k)
+{
+  while (k > 0) {
+    if (!o->insns[--k].dead)
+      return k;
+  }
+  return o->count;
+}
+
+/* Removes an instruction; branches to it go to the next one. */
+static void kill(Opt *o, size k)
+{
+  Insn *in = &o->insns[k];
+  in->dead = true;
+  o->changed = true;
+
+  size next = next_live(o, k);
+  if (in->target && next < o->count)
+    o->insns[next].target = true;
+}
+
+/* Rewrites an instruction to a load of the raw slot `slot`. */
+static void rewrite_ld(Opt *o, size k, u8 raw, int slot)
+{
+  Insn *in = &o->insns[k];
+  in->op[0] = raw == VAL_INT ? OP_LD_I32 : OP_LD_F32;
+  in->op[1] = (BCode)slot;
+  in->code = in->op;
+  in->len = 2;
+  o->changed = true;
+}
+
+/* Returns a new temporary; -1 if the raw slots are exhausted. */
+static int new_temp(Opt *o)
+{
+  if (o->slots >= 255)
+    return -1;
+  return (int)o->slots++;
+}
+
+/* Is the instruction a constant or a local which an expression may read. */
+static bool is_leaf(Opt *o, const BCode *ip)
+{
+  FunctionPseu *pseu = &o->fn->as.pseu;
+  State *s = o->s;
+
+  switch (*ip) {
+  case OP_LD_CONST: {
+    Value *v = &pseu->consts[ip[1]];
+    return v_isi32(v) || v_isf32(v);
+  }
+  case OP_LD_I32: case OP_LD_F32:
+    return !bit_get(o->ref_slots, ip[1]);
+  case OP_LD_LOCAL: {
+    /* Only parameters passed BYVAL hold their value directly. */
+    u8 i = ip[1];
+    if (i >= o->fn->params_count || (o->fn->byref & (1u << i)) || bit_get(o->ref_locals, i))
+      return false;
+    return t_isint(s, pseu->locals[i]) || t_isfloat(s, pseu->locals[i]);
+  }
+  default:
+    return false;
+  }
+}
+
+/* Matches an expression starting at instruction `k`. */
+static bool match_expr(Opt *o, size k, Expr *e)
+{
+  if (k >= o->count || o->insns[k].dead || !is_leaf(o, o->insns[k].code))
+    return false;
+
+  size a = next_live(o, k);
+  if (a >= o->count || o->insns[a].target)
+    return false;
+
+  const BCode *x = o->insns[k].code;
+  const BCode *y = o->insns[a].code;
+  e->insn[0] = (u32)k;
+  e->key[0] = x[0];
+  e->key[1] = x[1];
+
+  if (*y == OP_I2F) {
+    e->insn[1] = (u32)a;
+    e->n = 2;
+    e->key[2] = e->key[3] = 0;
+    e->key[4] = OP_I2F;
+    e->raw = VAL_FLOAT;
+    return true;
+  }
+
+  size b = next_live(o, a);
+  if (b >= o->count || o->insns[b].target || !is_leaf(o, y))
+    return false;
+
+  /* Integer division is left in place as it fails on zero. */
+  BCode op = o->insns[b].code[0];
+  switch (op) {
+  case OP_ADD_I32: case OP_SUB_I32: case OP_MUL_I32:
+    e->raw = VAL_INT;
+    break;
+  case OP_ADD_F32: case OP_SUB_F32: case OP_MUL_F32: case OP_DIV_F32:
+    e->raw = VAL_FLOAT;
+    break;
+  default:
+    return false;
+  }
+
+  e->insn[1] = (u32)a;
+  e->insn[2] = (u32)b;
+  e->n = 3;
+  e->key[2] = y[0];
+  e->key[3] = y[1];
+  e->key[4] = op;
+  return true;
+}
+
+/* Does the expression read the specified raw slot or local. */
+static bool expr_reads(const BCode *key, int slot, int local)
+{
+  for (int i = 0; i < 4; i += 2) {
+    if ((key[i] == OP_LD_I32 || key[i] == OP_LD_F32) && key[i + 1] == slot)
+      return true;
+    if (key[i] == OP_LD_LOCAL && key[i + 1] == local)
+      return true;
+  }
+  return false;
+}
+
+/* Emits the code computing an expression into `t` in front of a loop. */
+static bool emit_hoisted(Opt *o, size head, const BCode *key, u8 raw, int t)
+{
+  BCode code[8];
+  u32 len = 0;
+
+  code[len++] = key[0];
+  code[len++] = key[1];
+  if (key[4] != OP_I2F) {
+    code[len++] = key[2];
+    code[len++] = key[3];
+  }
+  code[len++] = key[4];
+  code[len++] = raw == VAL_INT ? OP_ST_I32 : OP_ST_F32;
+  code[len++] = (BCode)t;
+  o->hoisted = true;
+  return extra_emit(o, &o->insns[head].pre, code, len);
+}
+
+/* Replaces the occurrence of an expression by a load of `slot`. */
+static void replace_expr(Opt *o, Expr *e, int slot)
+{
+  rewrite_ld(o, e->insn[0], e->raw, slot);
+  for (u8 i = 1; i < e->n; i++)
+    kill(o, e->insn[i]);
+}
+
+/* Marks the raw slots and locals written in the loop [h, l]. */
+static void loop_writes(Opt *o, size h, size l, u32 *slots, u32 *locals)
+{
+  memset(slots, 0, 8 * sizeof(u32));
+  memset(locals, 0, 8 * sizeof(u32));
+
+  for (size k = h; k <= l; k++) {
+    Insn *in = &o->insns[k];
+    int w;
+    if (!in->dead) {
+      if ((w = slot_written(in->code)) >= 0)
+        bit_set(slots, w);
+      if ((w = local_written(in->code)) >= 0)
+        bit_set(locals, w);
+    }
+    for (size i = 0; i < in->post.count; i += pseu_code_len(in->post.code + i)) {
+      if ((w = slot_written(in->post.code + i)) >= 0)
+        bit_set(slots, w);
+    }
+  }
+}
+
+/* Is the leaf `key` not written in the loop. */
+static bool invariant(const BCode *key, u32 *slots, u32 *locals)
+{
+  switch (key[0]) {
+  case OP_LD_CONST: return true;
+  case OP_LD_LOCAL: return !bit_get(locals, key[1]);
+  default:          return !bit_get(slots, key[1]);
+  }
+}
+
+/* Replaces the multiplications of an induction variable of the loop [h, l]
+ * by a constant with a temporary incremented along with the variable.
+ */
+static bool reduce_loop(Opt *o, size h, size l)
+{
+  FunctionPseu *pseu = &o->fn->as.pseu;
+  u16 writes[256] = { 0 };
+  u32 where[256];
+
+  for (size k = h; k <= l; k++) {
+    Insn *in = &o->insns[k];
+    int w;
+    if (!in->dead && (w = slot_written(in->code)) >= 0) {
+      writes[w]++;
+      where[w] = (u32)k;
+    }
+    for (size i = 0; i < in->post.count; i += pseu_code_len(in->post.code + i)) {
+      if ((w = slot_written(in->post.code + i)) >= 0)
+        writes[w] += 2;
+    }
+  }
+
+  for (u32 v = 0; v < o->slots; v++) {
+    if (writes[v] != 1 || bit_get(o->ref_slots, v))
+      continue;
+
+    /* The variable is only stored as `v <- v + c`. */
+    size st = where[v];
+    size add = prev_live(o, st);
+    size c = add < o->count ? prev_live(o, add) : o->count;
+    size ld = c < o->count ? prev_live(o, c) : o->count;
+    if (ld >= o->count || ld < h || o->insns[st].code[0] != OP_ST_I32 ||
+        o->insns[add].code[0] != OP_ADD_I32 || o->insns[c].code[0] != OP_LD_CONST ||
+        o->insns[ld].code[0] != OP_LD_I32 || o->insns[ld].code[1] != v ||
+        o->insns[st].target || o->insns[add].target || o->insns[c].target)
+      continue;
+    Value *step = &pseu->consts[o->insns[c].code[1]];
+    if (!v_isi32(step))
+      continue;
+
+    Temp temps[PSEU_OPT_MAX_TEMPS];
+    u32 temps_count = 0;
+
+    for (size k = h; k <= l; k++) {
+      Expr e;
+      if (!match_expr(o, k, &e) || e.key[4] != OP_MUL_I32)
+        continue;
+
+      int konst;
+      if (e.key[0] == OP_LD_I32 && e.key[1] == v && e.key[2] == OP_LD_CONST)
+        konst = e.key[3];
+      else if (e.key[2] == OP_LD_I32 && e.key[3] == v && e.key[0] == OP_LD_CONST)
+        konst = e.key[1];
+      else
+        continue;
+      Value *factor = &pseu->consts[konst];
+      if (!v_isi32(factor))
+        continue;
+
+      int t = -1;
+      for (u32 i = 0; i < temps_count; i++) {
+        if (memcmp(temps[i].key, e.key, 5) == 0)
+          t = temps[i].slot;
+      }
+      if (t < 0) {
+        if (temps_count >= PSEU_OPT_MAX_TEMPS || (t = new_temp(o)) < 0)
+          return true;
+        memcpy(temps[temps_count].key, e.key, 5);
+        temps[temps_count++].slot = t;
+
+        /* t <- v * k in front of the loop, t <- t + c * k after v <- v + c. */
+        u32 inc = (u32)v_asi32(step) * (u32)v_asi32(factor);
+        BCode post[6] = { OP_INC_I32, (BCode)t, inc >> 24, inc >> 16, inc >> 8, inc };
+        if (!emit_hoisted(o, h, e.key, VAL_INT, t) ||
+            !extra_emit(o, &o->insns[st].post, post, 6))
+          return false;
+      }
+      replace_expr(o, &e, t);
+    }
+  }
+  return true;
+}
+
+/* Moves the expressions invariant in the loop [h, l] in front of it. */
+static bool hoist_loop(Opt *o, size h, size l)
+{
+  Temp temps[PSEU_OPT_MAX_TEMPS];
+  u32 temps_count = 0;
+  u32 slots[8], locals[8];
+  bool again = true;
+
+  /* Hoisted expressions may make the ones using them invariant. */
+  while (again) {
+    again = false;
+    loop_writes(o, h, l, slots, locals);
+
+    for (size k = h; k <= l; k++) {
+      Expr e;
+      if (!match_expr(o, k, &e) || !invariant(e.key, slots, locals) ||
+          (e.n == 3 && !invariant(e.key + 2, slots, locals)))
+        continue;
+
+      int t = -1;
+      for (u32 i = 0; i < temps_count; i++) {
+        if (memcmp(temps[i].key, e.key, 5) == 0)
+          t = temps[i].slot;
+      }
+      if (t < 0) {
+        if (temps_count >= PSEU_OPT_MAX_TEMPS || (t = new_temp(o)) < 0)
+          return true;
+        memcpy(temps[temps_count].key, e.key, 5);
+        temps[temps_count++].slot = t;
+        if (!emit_hoisted(o, h, e.key, e.raw, t))
+          return false;
+      }
+      replace_expr(o, &e, t);
+      again = true;
+    }
+  }
+  return true;
+}
+
+/* Finds the innermost loops and optimizes them. A loop is the range from
+ * the target of a backward branch to that branch, entered only at its head.
+ */
+static bool optimize_loops(Opt *o)
+{
+  for (size l = 0; l < o->count; l++) {
+    Insn *latch = &o->insns[l];
+    if (latch->dead || latch->code[0] != OP_BR)
+      continue;
+    u32 target = u16_at(latch->code + 1);
+    if (target > latch->at)
+      continue;
+    size h = o->index[target];
+
+    /* Innermost loops only; with no other backward branch in them. */
+    bool valid = true;
+    for (size k = h; k < l && valid; k++) {
+      Insn *in = &o->insns[k];
+      for (u32 i = 0; i < branch_count(in->code) && valid; i++) {
+        u32 at = branch_at(in->code, i);
+        if (at && u16_at(in->code + at) <= in->at)
+          valid = false;
+      }
+    }
+
+    /* Nothing outside the loop branches into it but to its head. */
+    for (size k = 0; k < o->count && valid; k++) {
+      Insn *in = &o->insns[k];
+      if (k >= h && k <= l)
+        continue;
+      for (u32 i = 0; i < branch_count(in->code) && valid; i++) {
+        u32 at = branch_at(in->code, i);
+        if (!at)
+          continue;
+        size t = o->index[u16_at(in->code + at)];
+        if (t > h && t <= l)
+          valid = false;
+      }
+    }
+    if (!valid || o->insns[h].latch)
+      continue;
+
+    o->insns[h].latch = (u32)l;
+    if (!reduce_loop(o, h, l) || !hoist_loop(o, h, l))
+      return false;
+  }
+  return true;
+}
+
+/* Reuses the expressions computed again in a block from a temporary. */
+static bool eliminate_common(Opt *o)
+{
+  Temp temps[PSEU_OPT_MAX_TEMPS];
+  u32 temps_count = 0;
+
+  for (size k = 0; k < o->count; k++) {
+    Insn *in = &o->insns[k];
+    if (in->dead)
+      continue;
+    if (in->target || in->pre.count)
+      temps_count = 0;
+
+    Expr e;
+    if (match_expr(o, k, &e)) {
+      Temp *found = NULL;
+      for (u32 i = 0; i < temps_count; i++) {
+        if (memcmp(temps[i].key, e.key, 5) == 0)
+          found = &temps[i];
+      }
+
+      if (!found) {
+        if (temps_count < PSEU_OPT_MAX_TEMPS) {
+          memcpy(temps[temps_count].key, e.key, 5);
+          temps[temps_count].last = e.insn[e.n - 1];
+          temps[temps_count++].slot = -1;
+        }
+        k = e.insn[e.n - 1];
+      } else {
+        /* The first occurrence keeps its value in the temporary. */
+        if (found->slot < 0) {
+          int t = new_temp(o);
+          if (t < 0)
+            return true;
+          BCode tee[2] = { e.raw == VAL_INT ? OP_TEE_I32 : OP_TEE_F32, (BCode)t };
+          if (!extra_emit(o, &o->insns[found->last].post, tee, 2))
+            return false;
+          found->slot = t;
+        }
+        replace_expr(o, &e, found->slot);
+        k = e.insn[e.n - 1];
+      }
+      in = &o->insns[k];
+    }
+
+    if (ends_block(in->code[0])) {
+      temps_count = 0;
+      continue;
+    }
+
+    /* Drop the expressions reading what the instruction writes. */
+    int slot = slot_written(in->code);
+    int local = local_written(in->code);
+    for (size i = 0; i < in->post.count; i += pseu_code_len(in->post.code + i)) {
+      int w = slot_written(in->post.code + i);
+      if (w >= 0) {
+        for (u32 j = 0; j < temps_count; j++) {
+          if (expr_reads(temps[j].key, w, -1))
+            temps[j] = temps[--temps_count], j--;
+        }
+      }
+    }
+    for (u32 j = 0; j < temps_count; j++) {
+      if (expr_reads(temps[j].key, slot, local))
+        temps[j] = temps[--temps_count], j--;
+    }
+  }
+  return true;
+}
+
+/* Returns the first instruction of the pure expression stored by the store
+ * `st`, of a kind the store accepts; or `o->count` if none.
+ */
+static size stored_expr(Opt *o, size st)
+{
+  FunctionPseu *pseu = &o->fn->as.pseu;
+  BCode op = o->insns[st].code[0];
+  size k = prev_live(o, st);
+  if (k >= o->count || o->insns[st].target)
+    return o->count;
+
+  const BCode *ip = o->insns[k].code;
+  switch (*ip) {
+  case OP_LD_CONST: {
+    Value *v = &pseu->consts[ip[1]];
+    if ((op == OP_ST_I32 && v_isi32(v)) || (op == OP_ST_BOOL && v_isbool(v)) ||
+        (op == OP_ST_F32 && (v_isi32(v) || v_isf32(v))))
+      return k;
+    return o->count;
+  }
+  case OP_LD_I32:
+    return op != OP_ST_BOOL ? k : o->count;
+  case OP_LD_F32:
+    return op == OP_ST_F32 ? k : o->count;
+  case OP_LD_BOOL:
+    return op == OP_ST_BOOL ? k : o->count;
+  default:
+    break;
+  }
+
+  /* Expressions ending in the instruction before the store. */
+  size start = k;
+  for (int i = 0; i < 2; i++) {
+    start = prev_live(o, start);
+    if (start >= o->count)
+      return o->count;
+
+    Expr e;
+    if (!match_expr(o, start, &e) || e.insn[e.n - 1] != k)
+      continue;
+    if (op == OP_ST_BOOL || (op == OP_ST_I32 && e.raw != VAL_INT))
+      return o->count;
+    for (u8 j = 0; j < e.n; j++) {
+      if (o->insns[e.insn[j]].post.count || (j > 0 && o->insns[e.insn[j]].pre.count))
+        return o->count;
+    }
+    return start;
+  }
+  return o->count;
+}
+
+/* Removes the stores to raw slots which are never read after. */
+static bool eliminate_stores(Opt *o)
+{
+  u32 read[8];
+  bool again = true;
+
+  while (again) {
+    again = false;
+
+    memset(read, 0, sizeof(read));
+    for (size k = 0; k < o->count; k++) {
+      Insn *in = &o->insns[k];
+      int r;
+      if (!in->dead && (r = slot_read(in->code)) >= 0)
+        bit_set(read, r);
+      for (size i = 0; i < in->pre.count; i += pseu_code_len(in->pre.code + i)) {
+        if ((r = slot_read(in->pre.code + i)) >= 0)
+          bit_set(read, r);
+      }
+      for (size i = 0; i < in->post.count; i += pseu_code_len(in->post.code + i)) {
+        if ((r = slot_read(in->post.code + i)) >= 0)
+          bit_set(read, r);
+      }
+    }
+
+    for (size k = 0; k < o->count; k++) {
+      Insn *in = &o->insns[k];
+      BCode op = in->code[0];
+      if (in->dead || (op != OP_ST_I32 && op != OP_ST_F32 && op != OP_ST_BOOL) ||
+          in->post.count || bit_get(o->ref_slots, in->code[1]))
+        continue;
+
+      u8 slot = in->code[1];
+      bool dead = !bit_get(read, slot);
+
+      /* Or stored again in the block before it is read. */
+      for (size m = next_live(o, k); !dead && m < o->count; m = next_live(o, m)) {
+        Insn *next = &o->insns[m];
+        if (next->target || next->pre.count || next->post.count ||
+            slot_read(next->code) == slot)
+          break;
+        if (slot_written(next->code) == slot) {
+          dead = true;
+          break;
+        }
+        if (ends_block(next->code[0]))
+          break;
+      }
+      if (!dead)
+        continue;
+
+      size start = stored_expr(o, k);
+      if (start >= o->count)
+        continue;
+      for (size m = start; m <= k; m = next_live(o, m))
+        kill(o, m);
+      again = true;
+    }
+  }
+  return true;
+}
+
+#if defined(PSEU_USE_REGISTERS)
+/* Returns the three-address form of the typed arithmetic `op`, with a raw
+ * slot or, if `imm` is set, an immediate as second operand; 0 if none.
+ */
+static BCode register_op(BCode op, bool imm)
+{
+  switch (op) {
+  case OP_ADD_I32: return imm ? OP_ADD_I32_SI : OP_ADD_I32_SS;
+  case OP_SUB_I32: return imm ? OP_SUB_I32_SI : OP_SUB_I32_SS;
+  case OP_MUL_I32: return imm ? OP_MUL_I32_SI : OP_MUL_I32_SS;
+  case OP_ADD_F32: return imm ? 0 : OP_ADD_F32_SS;
+  case OP_SUB_F32: return imm ? 0 : OP_SUB_F32_SS;
+  case OP_MUL_F32: return imm ? 0 : OP_MUL_F32_SS;
+  case OP_DIV_F32: return imm ? 0 : OP_DIV_F32_SS;
+  default:         return 0;
+  }
+}
+
+/* Can the instruction be merged into the one before it. */
+static bool fusable(Opt *o, size k)
+{
+  return k < o->count && !o->insns[k].target && !o->insns[k].pre.count;
+}
+
+/* Replaces the instruction `k` by `code` and removes the `n` after it. */
+static void fuse(Opt *o, size k, const BCode *code, u32 len, int n)
+{
+  Insn *in = &o->insns[k];
+  memcpy(in->op, code, len);
+  in->code = in->op;
+  in->len = len;
+  o->changed = true;
+
+  for (size next = k; n > 0; n--) {
+    next = next_live(o, next);
+    kill(o, next);
+  }
+}
+
+/* Lowers the typed arithmetic and compares on raw slots to three-address
+ * instructions reading and writing the slots directly: `d <- a op b`,
+ * `d <- a`, `d <- k` and the branch on the compare of a slot with a slot or
+ * a constant. Runs last as the other passes only know the stack code.
+ */
+static void lower_registers(Opt *o)
+{
+  FunctionPseu *pseu = &o->fn->as.pseu;
+
+  for (size k = 0; k < o->count; k++) {
+    Insn *in = &o->insns[k];
+    if (in->dead || in->post.count)
+      continue;
+    const BCode *x = in->code;
+    if (*x != OP_LD_I32 && *x != OP_LD_F32 && *x != OP_LD_CONST)
+      continue;
+
+    size b = next_live(o, k);
+    if (!fusable(o, b) || o->insns[b].post.count)
+      continue;
+    const BCode *y = o->insns[b].code;
+    BCode code[9];
+
+    if (*x == OP_LD_CONST) {
+      Value *v = &pseu->consts[x[1]];
+      if (*y != OP_ST_I32 || !v_isi32(v))
+        continue;
+      u32 value = (u32)v_asi32(v);
+      BCode set[6] = { OP_SET_I32, y[1], value >> 24, value >> 16, value >> 8, value };
+      fuse(o, k, set, 6, 1);
+      continue;
+    }
+    if ((*x == OP_LD_I32 && *y == OP_ST_I32) || (*x == OP_LD_F32 && *y == OP_ST_F32)) {
+      BCode mov[3] = { *x == OP_LD_I32 ? OP_MOV_I32 : OP_MOV_F32, y[1], x[1] };
+      fuse(o, k, mov, 3, 1);
+      continue;
+    }
+
+    /* The second operand is a slot of the same kind or an INTEGER constant. */
+    bool imm = *y == OP_LD_CONST;
+    u32 value = 0;
+    if (imm) {
+      Value *v = &pseu->consts[y[1]];
+      if (*x != OP_LD_I32 || !v_isi32(v))
+        continue;
+      value = (u32)v_asi32(v);
+    } else if (*y != *x) {
+      continue;
+    }
+
+    size c = next_live(o, b);
+    if (!fusable(o, c))
+      continue;
+    const BCode *z = o->insns[c].code;
+
+    if (*z == OP_BR_CMP && *x == OP_LD_I32) {
+      u32 len = 0;
+      code[len++] = imm ? OP_BR_CMP_SI : OP_BR_CMP_SS;
+      code[len++] = z[1];
+      code[len++] = x[1];
+      if (imm) {
+        code[len++] = value >> 24;
+        code[len++] = value >> 16;
+        code[len++] = value >> 8;
+        code[len++] = value;
+      } else {
+        code[len++] = y[1];
+      }
+      code[len++] = z[2];
+      code[len++] = z[3];
+      fuse(o, k, code, len, 2);
+      continue;
+    }
+
+    BCode op = register_op(*z, imm);
+    bool ints = *z == OP_ADD_I32 || *z == OP_SUB_I32 || *z == OP_MUL_I32;
+    if (!op || o->insns[c].post.count || ints != (*x == OP_LD_I32))
+      continue;
+    size d = next_live(o, c);
+    if (!fusable(o, d) || o->insns[d].code[0] != (ints ? OP_ST_I32 : OP_ST_F32))
+      continue;
+
+    u32 len = 0;
+    code[len++] = op;
+    code[len++] = o->insns[d].code[1];
+    code[len++] = x[1];
+    if (imm) {
+      code[len++] = value >> 24;
+      code[len++] = value >> 16;
+      code[len++] = value >> 8;
+      code[len++] = value;
+    } else {
+      code[len++] = y[1];
+    }
+    fuse(o, k, code, len, 3);
+  }
+}
+#endif
+
+/* Emits the optimized code into the function. */
+static void emit_code(Opt *o)
+{
+  State *s = o->s;
+  FunctionPseu *pseu = &o->fn->as.pseu;
+
+  size len = 0;
+  for (size k = 0; k < o->count; k++) {
+    Insn *in = &o->insns[k];
+    len += in->pre.count + in->post.count + (in->dead ? 0 : in->len);
+  }
+  if (len > 0xFFFF)
+    return;
+
+  BCode *code = pseu_alloc(s, len > 0 ? len : 1);
+  u32 *pre_at = pseu_alloc(s, (o->count + 1) * sizeof(u32));
+  u32 *new_at = pseu_alloc(s, (o->count + 1) * sizeof(u32));
+  if (!code || !pre_at || !new_at)
+    goto done;
+
+  size pos = 0;
+  for (size k = 0; k < o->count; k++) {
+    Insn *in = &o->insns[k];
+    pre_at[k] = (u32)pos;
+    if (in->pre.count)
+      memcpy(code + pos, in->pre.code, in->pre.count);
+    pos += in->pre.count;
+    new_at[k] = (u32)pos;
+    if (!in->dead) {
+      memcpy(code + pos, in->code, in->len);
+      pos += in->len;
+    }
+    if (in->post.count)
+      memcpy(code + pos, in->post.code, in->post.count);
+    pos += in->post.count;
+  }
+  pre_at[o->count] = new_at[o->count] = (u32)pos;
+
+  /* Branches from outside a loop enter the code in front of it. */
+  for (size k = 0; k < o->count; k++) {
+    Insn *in = &o->insns[k];
+    if (in->dead)
+      continue;
+    BCode *ip = code + new_at[k];
+    for (u32 i = 0; i < branch_count(ip); i++) {
+      u32 at = branch_at(in->code, i);
+      if (!at)
+        continue;
+      size t = o->index[u16_at(in->code + at)];
+      bool inside = t < o->count && k >= t && k <= o->insns[t].latch;
+      u32 dest = inside ? new_at[t] : pre_at[t];
+      ip[at] = (dest >> 8) & 0xFF;
+      ip[at + 1] = dest & 0xFF;
+    }
+  }
+
+  pseu_free(s, pseu->code);
+  pseu->code = code;
+  pseu->code_count = (u16)pos;
+  pseu->slot_count = (u8)o->slots;
+  if (o->hoisted)
+    pseu->max_stack += 2;
+  code = NULL;
+
+done:
+  pseu_free(s, code);
+  pseu_free(s, pre_at);
+  pseu_free(s, new_at);
+}
+
+/* Decodes the code of the function; false if it cannot be optimized. */
+static bool decode(Opt *o)
+{
+  FunctionPseu *pseu = &o->fn->as.pseu;
+  size count = 0;
+
+  for (size at = 0; at < pseu->code_count; count++) {
+    u32 len = pseu_code_len(pseu->code + at);
+    if (len == 0)
+      return false;
+    at += len;
+    if (at > pseu->code_count)
+      return false;
+  }
+
+  o->insns = pseu_alloc(o->s, (count > 0 ? count : 1) * sizeof(Insn));
+  o->index = pseu_alloc(o->s, ((size)pseu->code_count + 1) * sizeof(u32));
+  if (!o->insns || !o->index)
+    return false;
+  memset(o->insns, 0, count * sizeof(Insn));
+  for (size at = 0; at <= pseu->code_count; at++)
+    o->index[at] = (u32)-1;
+
+  size at = 0;
+  for (size k = 0; k < count; k++) {
+    Insn *in = &o->insns[k];
+    in->code = pseu->code + at;
+    in->at = (u32)at;
+    in->len = pseu_code_len(in->code);
+    o->index[at] = (u32)k;
+    at += in->len;
+
+    if (*in->code == OP_REF_SLOT)
+      bit_set(o->ref_slots, in->code[1]);
+    else if (*in->code == OP_REF_LOCAL)
+      bit_set(o->ref_locals, in->code[1]);
+  }
+  o->index[at] = (u32)count;
+  o->count = count;
+
+  /* Branches must go to the start of an instruction. */
+  for (size k = 0; k < count; k++) {
+    Insn *in = &o->insns[k];
+    for (u32 i = 0; i < branch_count(in->code); i++) {
+      u32 b = branch_at(in->code, i);
+      if (!b)
+        continue;
+      u16 target = u16_at(in->code + b);
+      if (target > pseu->code_count || o->index[target] == (u32)-1)
+        return false;
+      if (o->index[target] < count)
+        o->insns[o->index[target]].target = true;
+    }
+  }
+  return true;
+}
+
+void pseu_optimize(State *s, Function *fn)
+{
+  pseu_assert(fn->type == FN_PSEU);
+
+  Opt o;
+  memset(&o, 0, sizeof(o));
+  o.s = s;
+  o.fn = fn;
+  o.slots = fn->as.pseu.slot_count;
+
+  /* The code is left as is if it cannot be decoded or memory runs out. */
+  if (decode(&o) && optimize_loops(&o) && eliminate_common(&o) &&
+      eliminate_stores(&o)) {
+#if defined(PSEU_USE_REGISTERS)
+    lower_registers(&o);
+#endif
+    if (o.changed)
+      emit_code(&o);
+  }
+
+  if (o.insns) {
+    for (size k = 0; k < o.count; k++) {
+      pseu_free(s, o.insns[k].pre.code);
+      pseu_free(s, o.insns[k].post.code);
+    }
+  }
+  pseu_free(s, o.insns);
+  pseu_free(s, o.index);
+}
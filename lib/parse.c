@@ -4,14 +4,141 @@
 
 #include <stdarg.h>
 
+/* Maximum number of nested blocks in a function. */
+#define PSEU_MAX_BLOCKS 64
+/* Maximum number of nested FOR loops in a function. */
+#define PSEU_MAX_LOOPS  16
+/* Maximum number of bounds checks hoisted out of a FOR loop. */
+#define PSEU_MAX_CHECKS 16
+/* Maximum number of accesses relying on the checks hoisted out of a loop. */
+#define PSEU_MAX_UNCHECKED 32
+/* Largest span of INTEGER labels a CASE dispatches through a dense table. */
+#define PSEU_CASE_TABLE_MAX 4096
+
+/* Declared bounds of an array. */
+typedef struct Bounds {
+  u8 dims;                /* Number of dimensions. */
+  i32 lower[PSEU_MAX_DIMS];  /* Lower bound of each dimension. */
+  i32 upper[PSEU_MAX_DIMS];  /* Upper bound of each dimension. */
+} Bounds;
+
+/* How a parameter is passed. */
+typedef enum PassMode {
+  PASS_NONE,              /* Not a parameter. */
+  PASS_BYVAL,             /* Value of the argument; arrays and records are
+                           * shared with the caller until written. */
+  PASS_BYREF              /* Reference to the argument variable. */
+} PassMode;
+
 /* A local variable. */
 typedef struct Local {
   size scope;             /* Scope of local. */
   Span ident;             /* Identifier of local. */
   Span type_ident;	      /* Type identifier of local. */
   Type *type;             /* Type of local. */
+  Type *elem_type;        /* Element type when local is an array. */
+  Bounds bounds;          /* Declared bounds when local is an array. */
+  u16 block;              /* Block the local was declared in. */
+  u8 pass;                /* Passing mode when local is a parameter. */
+  u8 raw;                 /* Type of the value held unboxed in a raw slot;
+                           * VAL_NIL if the local is held as a Value. */
+  u8 slot;                /* Stack or raw slot of the local in the frame. */
+  u32 escapes;            /* Uses through which the array or record held by
+                           * the local may escape the frame. */
 } Local;
 
+/* An instruction creating or copying the array or record of a local, which
+ * is followed by the ST_LOCAL of that local. It is made to allocate in the
+ * frame region if the local does not escape; see parser_finish().
+ */
+typedef struct Site {
+  size offset;            /* Offset of the instruction. */
+  u8 local;               /* Local the instruction stores to. */
+} Site;
+
+/* A bounds check hoisted out of a FOR loop; checks that the value of a local
+ * is within [lower, upper] before the loop is entered.
+ */
+typedef struct Check {
+  u8 local;               /* Local holding the value to check. */
+  i32 lower;              /* Lower bound of the value. */
+  i32 upper;              /* Upper bound of the value. */
+} Check;
+
+/* A FOR loop being parsed. 
+ *
+ * Loop variables cannot be assigned in their loop, so the range of the
+ * variable is known from the start and end values. Element accesses indexed
+ * by loop variables are emitted unchecked when that range is proven to be
+ * within the array bounds, either at compile time when the start and end are
+ * constants or by checks hoisted in front of the loop otherwise.
+ */
+typedef struct Loop {
+  u8 var;                 /* Local of the loop variable. */
+  int end_local;          /* Local holding the end value; -1 if constant. */
+  bool start_konst;       /* Is the start value a constant. */
+  bool end_konst;         /* Is the end value a constant. */
+  i32 start;              /* Start value when constant. */
+  i32 end;                /* End value when constant. */
+  i32 step;               /* Step of the loop; always a constant. */
+  u16 block;              /* Block of the loop body. */
+
+  u8 checks_count;        /* Number of checks in `checks`. */
+  Check checks[PSEU_MAX_CHECKS]; /* Checks hoisted in front of the loop. */
+  bool returns;           /* Can the body RETURN before the loop ends. */
+  u8 unchecked_count;     /* Number of accesses in `unchecked`. */
+  u32 unchecked[PSEU_MAX_UNCHECKED]; /* Offsets of the accesses emitted
+                                      * without checks because of `checks`. */
+} Loop;
+
+/* How an array index expression was emitted. */
+typedef struct Index {
+  int local;              /* Local loaded by the expression; -1 if not. */
+  bool konst;             /* Is the expression an INTEGER constant. */
+  i32 value;              /* Value when constant. */
+} Index;
+
+/* A field access still to be emitted; of the record on top of the stack or,
+ * when `array` is set, of the element of that array of records at the
+ * indices on top of the stack.
+ */
+typedef struct FieldRef {
+  Type *type;             /* Record type holding the field. */
+  int slot;               /* Slot of the field; -1 if none yet. */
+  Local *array;           /* Array of records; NULL if none. */
+  u8 dims;                /* Number of indices of the element. */
+  Index idx[PSEU_MAX_DIMS];  /* Indices of the element. */
+} FieldRef;
+
+/* Ends a chain of branches still to be patched. */
+#define PSEU_NO_JUMP -1
+
+/* What a condition leaves to be tested once its branches are resolved. */
+typedef enum CondKind {
+  COND_NONE,              /* Nothing; the branches hold the outcome. */
+  COND_VALUE,             /* A BOOLEAN on the stack. */
+  COND_COMPARE            /* The two operands of a comparison on the stack. */
+} CondKind;
+
+/* A condition being emitted. The branches still to be patched are chained
+ * through their address operands.
+ */
+typedef struct Cond {
+  int t;                  /* Branches taken when the condition holds. */
+  int f;                  /* Branches taken when it does not. */
+  u8 kind;                /* What is left to test; see CondKind. */
+  u8 compare;             /* CompareType when COND_COMPARE. */
+  bool negate;            /* Is what is left to test negated. */
+} Cond;
+
+/* A label of a CASE arm. */
+typedef struct CaseLabel {
+  i32 lower;              /* First INTEGER matched. */
+  i32 upper;              /* Last INTEGER matched. */
+  u16 konst;              /* Constant of a STRING label. */
+  u16 target;             /* Address of the arm. */
+} CaseLabel;
+
 /* A parser state. */
 typedef struct Parser {
   Token tok;
@@ -24,6 +151,7 @@ typedef struct Parser {
   size code_size;
   size code_count;
   BCode *code;	
+  size calls[2];          /* Offsets of the last two CALLs, latest first. */
 
   size consts_size;
   size consts_count;
@@ -32,7 +160,25 @@ typedef struct Parser {
   size vars_size;
   size vars_count;
   Local *vars;
+  size values_count;      /* Number of locals held as Values. */
+  size slots_count;       /* Number of locals held in raw slots. */
+
+  size sites_size;
+  size sites_count;
+  Site *sites;
+
+  u16 next_block;
+  u8 blocks_count;
+  u16 blocks[PSEU_MAX_BLOCKS];
 
+  u8 loops_count;
+  Loop loops[PSEU_MAX_LOOPS];
+
+  Type *expr;             /* Static type of the last expression parsed;
+                           * NULL if it is not known. */
+  bool body;              /* Is parsing a FUNCTION or PROCEDURE body. */
+  bool own_args;          /* Is parsing arguments of a C procedure, which
+                           * may write the arrays passed to it. */
   int failed;
 } Parser;
 
@@ -48,16 +194,32 @@ static void spanval(Span *a, char *buf)
   memcpy(buf, a->pos, a->len);
 }
 
+/* Returns a NUL terminated copy of the specified span; NULL if out of
+ * memory. */
+static char *spandup(State *s, Span *a)
+{
+  char *result = pseu_alloc(s, a->len + 1);
+  if (pseu_unlikely(!result))
+    return NULL;
+
+  memcpy(result, a->pos, a->len);
+  result[a->len] = '\0';
+  return result;
+}
+
 /* TODO: Move this stuff to err.c */
 static void parse_err(Parser *p, const char *message, ...)
 {
   va_list args;
+  va_list args_copy;
   va_start(args, message);
+  va_copy(args_copy, args);
 
-  size needed = vsnprintf(NULL, 0, message, args);
+  size needed = vsnprintf(NULL, 0, message, args) + 1;
   char *buffer = pseu_alloc(p->lex.state, needed);
 
-  vsprintf(buffer, message, args);
+  vsnprintf(buffer, needed, message, args_copy);
+  va_end(args_copy);
   va_end(args);
 
   pseu_print(p->lex.state, buffer);
@@ -82,21 +244,68 @@ static int resolve_local(Parser *p, const char *ident, size len) {
   return -1;
 }
 
-static u8 declare_const(Parser *p, Value *v)
+/* == Static types. */
+
+/* Returns `type` as the static type of an expression; ANY is not known. */
+static Type *static_type(Parser *p, Type *type)
 {
-  if (p->consts_count >= PSEU_MAX_CONST)
-    return -1;
+  return type == V(p->lex.state)->any_type ? NULL : type;
+}
+
+static bool is_num(Parser *p, Type *type)
+{
+  return t_isint(p->lex.state, type) || t_isfloat(p->lex.state, type);
+}
+
+/* Is `type` held directly in a Value rather than by reference. */
+static bool is_scalar(Parser *p, Type *type)
+{
+  State *s = p->lex.state;
+  return is_num(p, type) || type == V(s)->boolean_type || t_isstring(s, type);
+}
+
+/* Returns false if a value of static type `from` can never be stored as
+ * type `to`; INTEGER values are converted to REAL.
+ */
+static bool assignable(Parser *p, Type *to, Type *from)
+{
+  if (!from || !to || !is_scalar(p, to))
+    return true;
+  return from == to || (t_isfloat(p->lex.state, to) && t_isint(p->lex.state, from));
+}
+
+/* Reports a type error if the value of the last expression parsed can never
+ * be stored as type `to`.
+ */
+static void check_type(Parser *p, Type *to)
+{
+  if (!assignable(p, to, p->expr))
+    parse_err(p, "Expected a value of type %s, not %s", to->ident, p->expr->ident);
+}
 
+static int declare_const(Parser *p, Value *v)
+{
   /* Check if there already exists a constant with the specified value in the
    * constant table.
    */
-  for (u8 i = 0; i < p->consts_count; i++) {
+  for (size i = 0; i < p->consts_count; i++) {
     Value is_equal;
-    pseu_compare_binary(&p->consts[i], v, &is_equal, COMP_eq);
+    if (p->consts[i].type != v->type)
+      continue;
+    if (v_isbool(v)) {
+      if (v_asbool(&p->consts[i]) == v_asbool(v))
+        return i;
+      continue;
+    }
+    if (pseu_compare_binary(p->lex.state, &p->consts[i], v, &is_equal, COMP_eq))
+      continue;
     if (v_asbool(&is_equal))
       return i;
   }
 
+  if (p->consts_count >= PSEU_MAX_CONST)
+    return -1;
+
   /* If not, we insert the new value into the constant table. */
   if (p->consts_count >= p->consts_size)
     pseu_vec_grow(p->lex.state, &p->consts, &p->consts_size, Value);
@@ -104,6 +313,26 @@ static u8 declare_const(Parser *p, Value *v)
   return p->consts_count++;
 }
 
+/* Gives the specified local its slot in the frame. INTEGER, REAL and BOOLEAN
+ * locals are held unboxed, except parameters which arrive as Values.
+ */
+static void assign_slot(Parser *p, Local *lcl)
+{
+  State *s = p->lex.state;
+  Type *type = lcl->type;
+
+  lcl->raw = VAL_NIL;
+  if (lcl->pass == PASS_NONE && type) {
+    if (t_isint(s, type))
+      lcl->raw = VAL_INT;
+    else if (t_isfloat(s, type))
+      lcl->raw = VAL_FLOAT;
+    else if (type == V(s)->boolean_type)
+      lcl->raw = VAL_BOOL;
+  }
+  lcl->slot = (u8)(lcl->raw != VAL_NIL ? p->slots_count++ : p->values_count++);
+}
+
 static int declare_local(Parser *p, Local *lcl)
 {
   /* Look for duplicate ident in globals. */
@@ -122,19 +351,91 @@ static int declare_local(Parser *p, Local *lcl)
     }
   }
 
+  if (p->vars_count >= PSEU_MAX_LOCAL) {
+    parse_err(p, "Exceeded maximum number of locals in a function/procedure");
+    return 1;
+  }
   if (p->vars_count >= p->vars_size)
     pseu_vec_grow(p->lex.state, &p->vars, &p->vars_size, Local);
 
+  lcl->block = p->blocks[p->blocks_count - 1];
+  assign_slot(p, lcl);
   p->vars[p->vars_count++] = *lcl;
   return 0;
 }
 
+/* Declares an unnamed local of the specified type; returns its index or -1. */
+static int declare_temp(Parser *p, Type *type)
+{
+  if (p->vars_count >= PSEU_MAX_LOCAL) {
+    parse_err(p, "Exceeded maximum number of locals in a function/procedure");
+    return -1;
+  }
+  if (p->vars_count >= p->vars_size)
+    pseu_vec_grow(p->lex.state, &p->vars, &p->vars_size, Local);
+
+  p->vars[p->vars_count] = (Local) {
+    .scope = p->scope,
+    .type = type,
+    .block = p->blocks[p->blocks_count - 1]
+  };
+  assign_slot(p, &p->vars[p->vars_count]);
+  return p->vars_count++;
+}
+
+/* Opens a new block of statements. */
+static void begin_block(Parser *p)
+{
+  if (p->blocks_count >= PSEU_MAX_BLOCKS) {
+    parse_err(p, "Exceeded maximum nesting of blocks");
+    return;
+  }
+  p->blocks[p->blocks_count++] = p->next_block++;
+}
+
+/* Closes the current block of statements. */
+static void end_block(Parser *p)
+{
+  if (p->blocks_count > 1)
+    p->blocks_count--;
+}
+
+/* Returns true if the specified block is still open; statements in it have
+ * been executed before the current one.
+ */
+static bool block_open(Parser *p, u16 block)
+{
+  for (u8 i = 0; i < p->blocks_count; i++) {
+    if (p->blocks[i] == block)
+      return true;
+  }
+  return false;
+}
+
+/* Returns the FOR loop using the specified local as its variable or NULL. */
+static Loop *find_loop(Parser *p, int local)
+{
+  for (u8 i = 0; i < p->loops_count; i++) {
+    if (p->loops[i].var == local)
+      return &p->loops[i];
+  }
+  return NULL;
+}
+
 static void emit_u8(Parser *p, u8 code)
 {
   if (p->failed)
     return;
-  if (p->code_count >= p->code_size)
-    pseu_vec_grow(p->lex.state, &p->code, &p->code_size, BCode);
+  /* Offsets are u16 and 0xFFFF ends the chains of branches to patch. */
+  if (p->code_count >= 0xFFFF) {
+    parse_err(p, "Function is too large");
+    return;
+  }
+  if (p->code_count >= p->code_size &&
+      pseu_vec_grow(p->lex.state, &p->code, &p->code_size, BCode)) {
+    parse_err(p, "Out of memory");
+    return;
+  }
   p->code[p->code_count++] = code;
 }
 
@@ -144,6 +445,12 @@ static void emit_u16(Parser *p, u16 value)
   emit_u8(p, (value) & 0xFF);
 }
 
+static void emit_u32(Parser *p, u32 value)
+{
+  emit_u16(p, (value >> 16) & 0xFFFF);
+  emit_u16(p, (value) & 0xFFFF);
+}
+
 static void emit_ld_const(Parser *p, Value *v)
 {
   int index = declare_const(p, v);
@@ -159,23 +466,116 @@ static void emit_ld_const(Parser *p, Value *v)
 
 static void emit_ld_global(Parser *p, int index)
 {
+  Variable *var = &V(p->lex.state)->vars[index];
   p->max_stack++;
 
+  /* Only the values of constants are known to keep their type. */
+  p->expr = var->konst ? v_type(p->lex.state, &var->value) : NULL;
+
   emit_u8(p, OP_LD_GLOBAL);
   emit_u16(p, index);
 }
 
+/* Returns the instruction loading (`st` false) or storing the local; BYREF
+ * parameters hold a reference to the variable.
+ */
+static u8 local_op(Local *lcl, bool st)
+{
+  if (lcl->pass == PASS_BYREF)
+    return st ? OP_ST_REF : OP_LD_REF;
+
+  switch (lcl->raw) {
+  case VAL_INT:   return st ? OP_ST_I32 : OP_LD_I32;
+  case VAL_FLOAT: return st ? OP_ST_F32 : OP_LD_F32;
+  case VAL_BOOL:  return st ? OP_ST_BOOL : OP_LD_BOOL;
+  default:        return st ? OP_ST_LOCAL : OP_LD_LOCAL;
+  }
+}
+
+static void emit_ld_local_index(Parser *p, u8 index)
+{
+  p->max_stack++;
+
+  emit_u8(p, local_op(&p->vars[index], false));
+  emit_u8(p, p->vars[index].slot);
+}
+
+static void emit_st_local_index(Parser *p, u8 index)
+{
+  emit_u8(p, local_op(&p->vars[index], true));
+  emit_u8(p, p->vars[index].slot);
+}
+
+/* Emits an OWN of the specified local if it is a parameter passed BYVAL
+ * which can hold an array or a record; it must own it before it is written.
+ */
+static void emit_own(Parser *p, int index)
+{
+  State *s = p->lex.state;
+  Type *type = p->vars[index].type;
+
+  if (p->vars[index].pass != PASS_BYVAL || !type || t_isint(s, type) ||
+      t_isfloat(s, type) || t_isstring(s, type) || type == V(s)->boolean_type)
+    return;
+
+  emit_u8(p, OP_OWN);
+  emit_u8(p, p->vars[index].slot);
+}
+
 static void emit_ld_local(Parser *p, const char *ident, size len)
 {
   int index = resolve_local(p, ident, len);
   if (index == -1) {
     parse_err(p, "Local \"%s\" not defined", ident);
   } else {
-    p->max_stack++;
+    if (p->own_args)
+      emit_own(p, index);
+    emit_ld_local_index(p, index);
+    p->expr = static_type(p, p->vars[index].type);
+  }
+}
 
-    emit_u8(p, OP_LD_LOCAL);
-    emit_u8(p, index);
+/* Emits a copy of the record of the specified type on top of the stack;
+ * records are assigned by value. */
+static void emit_copy_record(Parser *p, Type *type)
+{
+  emit_u8(p, OP_COPY_RECORD);
+  emit_u16(p, (u16)(type - V(p->lex.state)->types));
+}
+
+/* Adds a site for the specified local at the instruction about to be
+ * emitted; parameters are not allocated by the function.
+ */
+static void add_site(Parser *p, int index)
+{
+  if (p->failed || p->vars[index].pass != PASS_NONE)
+    return;
+  if (p->sites_count >= p->sites_size &&
+      pseu_vec_grow(p->lex.state, &p->sites, &p->sites_size, Site)) {
+    parse_err(p, "Out of memory");
+    return;
+  }
+
+  p->sites[p->sites_count++] = (Site) {
+    .offset = p->code_count,
+    .local = (u8)index
+  };
+}
+
+/* Emits a store of the value of the last expression parsed in the local.
+ * Its type is checked here if it is known; otherwise it is checked by
+ * CHK_TYPE for locals held as Values, as only stores to raw slots check it.
+ */
+static void emit_st_checked(Parser *p, u8 index)
+{
+  Local *lcl = &p->vars[index];
+
+  check_type(p, lcl->type);
+  if (!p->expr && lcl->raw == VAL_NIL && lcl->type && is_scalar(p, lcl->type)) {
+    emit_u8(p, OP_CHK_TYPE);
+    emit_u16(p, (u16)(lcl->type - V(p->lex.state)->types));
   }
+  emit_st_local_index(p, index);
 }
 
 static void emit_st_local(Parser *p, const char *ident, size len)
@@ -183,12 +583,223 @@ static void emit_st_local(Parser *p, const char *ident, size len)
   int index = resolve_local(p, ident, len);
   if (index == -1) {
     parse_err(p, "Local \"%s\" not defined", ident);
+  } else if (find_loop(p, index)) {
+    parse_err(p, "Cannot assign to a FOR loop variable inside its loop");
   } else {
-    emit_u8(p, OP_ST_LOCAL);
-    emit_u8(p, index);
+    if (p->vars[index].type && t_isrecord(p->vars[index].type)) {
+      add_site(p, index);
+      emit_copy_record(p, p->vars[index].type);
+    }
+    emit_st_checked(p, index);
+  }
+}
+
+/* Emits the creation of a record of the specified type. */
+static void emit_new_record(Parser *p, Type *type)
+{
+  p->max_stack++;
+
+  emit_u8(p, OP_NEW_RECORD);
+  emit_u16(p, (u16)(type - V(p->lex.state)->types));
+}
+
+/* Emits a load or store of the field in `slot` of a record of the specified
+ * type. */
+static void emit_field(Parser *p, u8 op, Type *type, u8 slot)
+{
+  emit_u8(p, op);
+  emit_u16(p, (u16)(type - V(p->lex.state)->types));
+  emit_u8(p, slot);
+}
+
+/* Emits the creation of an array with the specified element type and bounds.
+ * The lower bounds are folded into the base offset of the array here so
+ * element accesses only have to add it.
+ */
+static void emit_new_array(Parser *p, Type *elem_type, Bounds *bounds)
+{
+  VM *vm = V(p->lex.state);
+  u32 base = 0;
+  u32 stride = 1;
+
+  /* Wraps around like the offsets computed from it. */
+  for (int d = bounds->dims - 1; d >= 0; d--) {
+    base -= (u32)bounds->lower[d] * stride;
+    stride *= (u32)(bounds->upper[d] - bounds->lower[d] + 1);
+  }
+
+  p->max_stack++;
+
+  emit_u8(p, OP_NEW_ARRAY);
+  emit_u16(p, (u16)(elem_type - vm->types));
+  emit_u8(p, bounds->dims);
+  for (u8 d = 0; d < bounds->dims; d++) {
+    emit_u32(p, (u32)bounds->lower[d]);
+    emit_u32(p, (u32)(bounds->upper[d] - bounds->lower[d] + 1));
+  }
+  emit_u32(p, (u32)base);
+}
+
+/* Adds a check of the value of `local` to the specified loop. */
+static bool add_check(Loop *loop, u8 local, i32 lower, i32 upper)
+{
+  for (u8 i = 0; i < loop->checks_count; i++) {
+    Check *c = &loop->checks[i];
+    if (c->local == local && c->lower == lower && c->upper == upper)
+      return true;
+  }
+
+  if (loop->checks_count >= PSEU_MAX_CHECKS)
+    return false;
+
+  loop->checks[loop->checks_count++] = (Check) {
+    .local = local,
+    .lower = lower,
+    .upper = upper
+  };
+  return true;
+}
+
+/* Returns true if the index of dimension `d` of array `lcl` is proven to be
+ * within bounds, hoisting checks in front of the innermost loop if needed;
+ * sets `hoisted` if it did.
+ */
+static bool prove_index(Parser *p, Local *lcl, u8 d, Index *idx, bool *hoisted)
+{
+  i32 lower = lcl->bounds.lower[d];
+  i32 upper = lcl->bounds.upper[d];
+
+  if (idx->konst)
+    return idx->value >= lower && idx->value <= upper;
+  if (idx->local == -1)
+    return false;
+
+  Loop *loop = find_loop(p, idx->local);
+  if (!loop)
+    return false;
+
+  /* The range of the variable is known at compile time. */
+  if (loop->start_konst && loop->end_konst) {
+    i64 first = loop->start;
+    i64 last = first + ((loop->end - first) / loop->step) * loop->step;
+
+    /* The loop body is never executed. */
+    if (loop->step > 0 ? first > last : first < last)
+      return true;
+    if (first > last) {
+      i64 tmp = first;
+      first = last;
+      last = tmp;
+    }
+    return first >= lower && last <= upper;
+  }
+
+  /* Otherwise hoist checks in front of the innermost loop. That is only valid
+   * if the access is executed on every iteration of that loop, and if the
+   * loop visits its end value; a RETURN in the body cancels them, see
+   * cancel_checks().
+   */
+  Loop *inner = &p->loops[p->loops_count - 1];
+  if (inner->block != p->blocks[p->blocks_count - 1] || inner->returns ||
+      inner->unchecked_count >= PSEU_MAX_UNCHECKED)
+    return false;
+
+  *hoisted = true;
+  if (loop != inner)
+    return add_check(inner, loop->var, lower, upper);
+  if (loop->step != 1 && loop->step != -1)
+    return false;
+  if (!add_check(inner, loop->var, lower, upper))
+    return false;
+  if (loop->end_konst)
+    return loop->end >= lower && loop->end <= upper;
+  return add_check(inner, loop->end_local, lower, upper);
+}
+
+/* Returns true if the indices of an element access of array `lcl` are proven
+ * to be within bounds. The access is about to be emitted at the end of the
+ * code.
+ */
+static bool prove_indices(Parser *p, Local *lcl, u8 dims, Index *idx)
+{
+  bool proven = lcl && lcl->elem_type && dims == lcl->bounds.dims &&
+                block_open(p, lcl->block);
+  bool hoisted = false;
+
+  /* Drop the checks hoisted for this access if the proof fails. */
+  u8 checks_count = p->loops_count ? p->loops[p->loops_count - 1].checks_count : 0;
+  for (u8 d = 0; proven && d < dims; d++)
+    proven = prove_index(p, lcl, d, &idx[d], &hoisted);
+  if (!proven && p->loops_count)
+    p->loops[p->loops_count - 1].checks_count = checks_count;
+
+  if (proven && hoisted) {
+    Loop *inner = &p->loops[p->loops_count - 1];
+    inner->unchecked[inner->unchecked_count++] = p->code_count;
+  }
+  return proven;
+}
+
+/* Cancels the checks hoisted out of the enclosing loops, which a RETURN in
+ * their body may leave before they visit their end value; the accesses
+ * relying on them are checked again.
+ */
+static void cancel_checks(Parser *p)
+{
+  for (u8 i = 0; i < p->loops_count; i++) {
+    Loop *loop = &p->loops[i];
+    for (u8 k = 0; k < loop->unchecked_count; k++) {
+      BCode *op = &p->code[loop->unchecked[k]];
+      switch (*op) {
+      case OP_LD_INDEX_NC:  *op = OP_LD_INDEX;  break;
+      case OP_ST_INDEX_NC:  *op = OP_ST_INDEX;  break;
+      case OP_LD_COLUMN_NC: *op = OP_LD_COLUMN; break;
+      case OP_ST_COLUMN_NC: *op = OP_ST_COLUMN; break;
+      default:              pseu_unreachable();
+      }
+    }
+    loop->returns = true;
+    loop->checks_count = 0;
+    loop->unchecked_count = 0;
   }
 }
 
+/* Emits an element access of array `lcl` with the specified indices,
+ * skipping the bounds checks if they can be proven to pass.
+ */
+static void emit_index(Parser *p, Local *lcl, u8 op, u8 dims, Index *idx)
+{
+  /* Elements of records are gathered from their columns by the checked ops. */
+  bool records = lcl && lcl->elem_type && t_isrecord(lcl->elem_type);
+
+  if (!records && prove_indices(p, lcl, dims, idx))
+    op = op == OP_LD_INDEX ? OP_LD_INDEX_NC : OP_ST_INDEX_NC;
+
+  emit_u8(p, op);
+  emit_u8(p, dims);
+}
+
+/* Emits an access of the field in `slot` of an element of the array of
+ * records `lcl` with the specified indices; see emit_index().
+ */
+static void emit_column(Parser *p, Local *lcl, u8 op, u8 dims, Index *idx, u8 slot)
+{
+  if (prove_indices(p, lcl, dims, idx))
+    op = op == OP_LD_COLUMN ? OP_LD_COLUMN_NC : OP_ST_COLUMN_NC;
+
+  emit_u8(p, op);
+  emit_u8(p, dims);
+  emit_u8(p, slot);
+}
+
+static void emit_chk_index(Parser *p, Check *c)
+{
+  emit_ld_local_index(p, c->local);
+  emit_u8(p, OP_CHK_INDEX);
+  emit_u32(p, (u32)c->lower);
+  emit_u32(p, (u32)c->upper);
+}
+
 static void emit_ld_variable(Parser *p, const char *ident, size len)
 {
   u16 index = pseu_get_variable(V(p->lex.state), ident, len);
@@ -202,10 +813,14 @@ static void emit_calln(Parser *p, const char *ident, size len)
 {
   u16 index = pseu_get_function(VM(p->lex.state), ident, len);
   if (index == PSEU_INVALID_FUNC) {
-    parse_err(p, "Function or procedure \"%s\" is not defined.", ident);
+    parse_err(p, "Function or procedure \"%.*s\" is not defined.", (int)len, ident);
   } else {
+    Function *fn = &VM(p->lex.state)->fns[index];
+    p->calls[1] = p->calls[0];
+    p->calls[0] = p->code_count;
     emit_u8(p, OP_CALL);
     emit_u16(p, index);
+    p->expr = fn->type == FN_HOST ? NULL : static_type(p, fn->return_type);
   }
 }
 
@@ -214,29 +829,280 @@ static void emit_call(Parser *p, const char *ident)
   emit_calln(p, ident, strlen(ident));
 }
 
+/* Emits the arithmetic operator `op` on operands of static types `a` and
+ * `b`. Operators on INTEGERs, or on REALs and INTEGERs converted to REAL
+ * first, get typed instructions.
+ */
+static void emit_arith(Parser *p, Token op, Type *a, Type *b)
+{
+  static const char *const fns[] = { "@add", "@sub", "@mul", "@div" };
+  static const BCode ints[] = { OP_ADD_I32, OP_SUB_I32, OP_MUL_I32, OP_DIV_I32 };
+  static const BCode reals[] = { OP_ADD_F32, OP_SUB_F32, OP_MUL_F32, OP_DIV_F32 };
+  State *s = p->lex.state;
+  int k = op == '+' ? 0 : op == '-' ? 1 : op == '*' ? 2 : 3;
+
+  if ((a && !is_num(p, a)) || (b && !is_num(p, b))) {
+    parse_err(p, "Expected INTEGER or REAL operands");
+    return;
+  }
+
+  if (t_isint(s, a) && t_isint(s, b)) {
+    emit_u8(p, ints[k]);
+    p->expr = a;
+  } else if (t_isfloat(s, a) && b) {
+    if (t_isint(s, b))
+      emit_u8(p, OP_I2F);
+    emit_u8(p, reals[k]);
+    p->expr = a;
+  } else {
+    /* An INTEGER and a REAL give a REAL. */
+    emit_call(p, fns[k]);
+    p->expr = a && b ? V(s)->real_type : NULL;
+  }
+}
+
+/* Reports a type error if values of the static types `a` and `b` cannot be
+ * compared; only numbers and only STRINGs compare with each other.
+ */
+static void check_compare(Parser *p, Type *a, Type *b)
+{
+  State *s = p->lex.state;
+  if (!a || !b || (is_num(p, a) && is_num(p, b)) ||
+      (t_isstring(s, a) && t_isstring(s, b)))
+    return;
+  parse_err(p, "Cannot compare %s with %s", a->ident, b->ident);
+}
+
 static int emit_br(Parser *p)
 {
   emit_u8(p, OP_BR);
 
   int result = p->code_count;
-  p->code_count += sizeof(u16);
+  emit_u16(p, 0);
   return result;
 }
 
-static int emit_br_false(Parser *p)
+/* Emits a branch to an already emitted address. */
+static void emit_br_to(Parser *p, u16 address)
+{
+  emit_u8(p, OP_BR);
+  emit_u16(p, address);
+}
+
+static void patch_br_to(Parser *p, int offset, u16 address)
+{
+  if (p->failed)
+    return;
+  p->code[offset] = (address >> 8) & 0xFF;
+  p->code[offset + 1] = (address) & 0xFF;
+}
+
+static void patch_br(Parser *p, int offset)
+{
+  patch_br_to(p, offset, p->code_count);
+}
+
+/* Emits a branch on the comparison of the two values on top of the stack,
+ * taken when it comes out as `when`; returns the offset of its address.
+ */
+static int emit_br_cmp(Parser *p, CompareType cmp, bool when)
 {
-  emit_u8(p, OP_BR_FALSE);
+  emit_u8(p, OP_BR_CMP);
+  emit_u8(p, (u8)cmp | (when ? PSEU_BR_CMP_TRUE : 0));
 
   int result = p->code_count;
-  p->code_count += sizeof(u16);
+  emit_u16(p, 0);
   return result;
 }
 
-static void patch_br(Parser *p, int offset)
+/* == Branch chains and conditions. */
+
+/* Builtins implementing each CompareType. */
+static const char *const compare_fns[] = {
+  #define COMP_FN(n, _, __, ___, ____) "@" #n,
+  PSEU_COMP_TYPES(COMP_FN, _, __, ___)
+  #undef  COMP_FN
+};
+
+/* Returns the next branch of the chain after the one at `offset`. */
+static int jump_next(Parser *p, int offset)
 {
-  u16 address = p->code_count;
-  p->code[offset] = (address >> 8) & 0xFF;
-  p->code[offset + 1] = (address) & 0xFF;
+  u16 next = (u16)(p->code[offset] << 8 | p->code[offset + 1]);
+  return next == 0xFFFF ? PSEU_NO_JUMP : next;
+}
+
+/* Adds the branch whose address is at `offset` to the chain `list`. */
+static void jump_append(Parser *p, int *list, int offset)
+{
+  patch_br_to(p, offset, *list == PSEU_NO_JUMP ? 0xFFFF : (u16)*list);
+  *list = offset;
+}
+
+/* Adds the branches of the chain `other` to the chain `list`. */
+static void jump_concat(Parser *p, int *list, int other)
+{
+  if (other == PSEU_NO_JUMP || p->failed)
+    return;
+  if (*list == PSEU_NO_JUMP) {
+    *list = other;
+    return;
+  }
+
+  int last = *list;
+  while (jump_next(p, last) != PSEU_NO_JUMP)
+    last = jump_next(p, last);
+  patch_br_to(p, last, (u16)other);
+}
+
+/* Points every branch of the chain at `address` and empties it. */
+static void jump_patch(Parser *p, int *list, u16 address)
+{
+  int offset = *list;
+  while (offset != PSEU_NO_JUMP && !p->failed) {
+    int next = jump_next(p, offset);
+    patch_br_to(p, offset, address);
+    offset = next;
+  }
+  *list = PSEU_NO_JUMP;
+}
+
+/* Returns true if the code emitted from `start` ends with a call to the
+ * specified builtin.
+ */
+static bool emitted_call(Parser *p, size start, const char *ident)
+{
+  size offset = p->calls[0];
+  if (p->failed || offset < start || offset + 3 != p->code_count ||
+      p->code[offset] != OP_CALL)
+    return false;
+
+  u16 index = (u16)(p->code[offset + 1] << 8 | p->code[offset + 2]);
+  return index == pseu_get_function(VM(p->lex.state), ident, strlen(ident));
+}
+
+/* Removes the call found by emitted_call(). */
+static void unemit_call(Parser *p)
+{
+  p->code_count -= 3;
+  p->calls[0] = p->calls[1];
+  p->calls[1] = 0;
+}
+
+/* Emits the test of what the condition leaves on the stack, branching when
+ * the condition comes out as `when`; returns the offset of its address.
+ */
+static int emit_cond_test(Parser *p, Cond *c, bool when)
+{
+  int result;
+  if (c->kind == COND_COMPARE) {
+    result = emit_br_cmp(p, c->compare, when != c->negate);
+  } else {
+    emit_u8(p, when != c->negate ? OP_BR_TRUE : OP_BR_FALSE);
+    result = p->code_count;
+    emit_u16(p, 0);
+  }
+  c->kind = COND_NONE;
+  return result;
+}
+
+/* Continues with the code following the condition when it holds. */
+static void cond_true(Parser *p, Cond *c)
+{
+  if (c->kind != COND_NONE)
+    jump_append(p, &c->f, emit_cond_test(p, c, false));
+  jump_patch(p, &c->t, p->code_count);
+}
+
+/* Continues with the code following the condition when it does not hold. */
+static void cond_false(Parser *p, Cond *c)
+{
+  if (c->kind != COND_NONE)
+    jump_append(p, &c->t, emit_cond_test(p, c, true));
+  jump_patch(p, &c->f, p->code_count);
+}
+
+/* Leaves the outcome of the condition on the stack as a BOOLEAN. */
+static void cond_value(Parser *p, Cond *c)
+{
+  if (c->t == PSEU_NO_JUMP && c->f == PSEU_NO_JUMP) {
+    if (c->kind == COND_COMPARE)
+      emit_call(p, compare_fns[c->compare]);
+    if (c->negate)
+      emit_call(p, "@not");
+    return;
+  }
+
+  Value yes = v_bool(true);
+  Value no = v_bool(false);
+  cond_true(p, c);
+  emit_ld_const(p, &yes);
+  int end = emit_br(p);
+  jump_patch(p, &c->f, p->code_count);
+  emit_ld_const(p, &no);
+  patch_br(p, end);
+  p->expr = V(p->lex.state)->boolean_type;
+}
+
+/* Returns true if the code emitted from `start` is only the load of an
+ * INTEGER constant, setting `o` to its value.
+ */
+static bool emitted_konst(Parser *p, size start, i32 *o)
+{
+  if (p->failed || p->code_count - start != 2 || p->code[start] != OP_LD_CONST)
+    return false;
+
+  Value *v = &p->consts[p->code[start + 1]];
+  if (!v_isi32(v))
+    return false;
+
+  *o = v_asi32(v);
+  return true;
+}
+
+/* Returns the local loaded by the instruction at `at`; otherwise -1. */
+static int loaded_local(Parser *p, size at)
+{
+  BCode op = p->code[at];
+  if (op == OP_LD_REF)
+    return -1;
+
+  for (size i = 0; i < p->vars_count; i++) {
+    Local *lcl = &p->vars[i];
+    if (lcl->slot == p->code[at + 1] && lcl->pass != PASS_BYREF && local_op(lcl, false) == op)
+      return i;
+  }
+  return -1;
+}
+
+/* Returns the local if the code emitted from `start` is only the load of a
+ * local; otherwise -1.
+ */
+static int emitted_local(Parser *p, size start)
+{
+  if (p->failed || p->code_count - start != 2)
+    return -1;
+  return loaded_local(p, start);
+}
+
+/* Returns the local if the code emitted from `start` is only the load of an
+ * array or record local, or of a column of it; otherwise -1.
+ */
+static int emitted_whole(Parser *p, size start)
+{
+  if (!p->failed && p->code_count - start == 4 && p->code[start] == OP_LD_LOCAL &&
+      p->code[start + 2] == OP_COLUMN)
+    return loaded_local(p, start);
+  return emitted_local(p, start);
+}
+
+/* Takes back the escape of the local loaded by the code emitted from `start`
+ * when the value is only copied, or read by a C function.
+ */
+static void unescape(Parser *p, size start)
+{
+  int index = emitted_whole(p, start);
+  if (index != -1 && p->vars[index].escapes > 0)
+    p->vars[index].escapes--;
 }
 
 /* Returns the precedence of the specifed token. */
@@ -253,10 +1119,12 @@ static int op_precedence(Token tok)
     case '<':
     case TK_op_ge:
     case TK_op_le:
+    case TK_op_ne:
       return 3;
 
     case '+':
     case '-':
+    case '&':
       return 4;
 
     case '*':
@@ -276,8 +1144,331 @@ static int op_precedence(Token tok)
 /* == Forward declaration. */
 static void parse_expr(Parser *p);
 static void parse_statement(Parser *p);
+static int parser_init(Parser *p, State *s, Function *fn);
+static void parser_finish(Parser *p);
 
-/* Parse an expression term. */
+/* Parse the indices of an array element access, after the array has been
+ * loaded; returns the number of indices and describes them in `idx`.
+ */
+static u8 parse_indices(Parser *p, Local *lcl, Index *idx)
+{
+  u8 dims = 0;
+
+  next(p);
+  for (;;) {
+    size start = p->code_count;
+    parse_expr(p);
+
+    if (dims < PSEU_MAX_DIMS) {
+      idx[dims].konst = emitted_konst(p, start, &idx[dims].value);
+      idx[dims].local = emitted_local(p, start);
+    }
+    dims++;
+
+    if (peek(p) != ',')
+      break;
+    next(p);
+  }
+
+  if (peek(p) != ']')
+    parse_err(p, "Expected ']'");
+  else
+    next(p);
+
+  /* Array parameters have no declared bounds. */
+  if (dims > PSEU_MAX_DIMS ||
+      (lcl && lcl->elem_type && lcl->bounds.dims && dims != lcl->bounds.dims))
+    parse_err(p, "Wrong number of array indices");
+  return dims;
+}
+
+/* Resolves the field of a value of type `type` named by the current token;
+ * returns the slot of the field or -1.
+ */
+static int resolve_field(Parser *p, Type *type)
+{
+  if (peek(p) != TK_identifier) {
+    parse_err(p, "Expected field identifier after '.'");
+    return -1;
+  }
+
+  Span ident = p->lex.span;
+  if (!type || !t_isrecord(type)) {
+    parse_err(p, "Value has no field \"%.*s\"; it is not a record", (int)ident.len, ident.pos);
+    return -1;
+  }
+
+  for (u8 i = 0; i < type->fields_count; i++) {
+    const char *field = type->fields[i].ident;
+    if (strncmp(field, ident.pos, ident.len) == 0 && field[ident.len] == '\0')
+      return i;
+  }
+
+  parse_err(p, "TYPE %s has no field \"%.*s\"", type->ident, (int)ident.len, ident.pos);
+  return -1;
+}
+
+/* Emits a load or store of the field referenced by `ref`. */
+static void emit_field_ref(Parser *p, FieldRef *ref, bool store)
+{
+  if (ref->array)
+    emit_column(p, ref->array, store ? OP_ST_COLUMN : OP_LD_COLUMN,
+                ref->dims, ref->idx, ref->slot);
+  else
+    emit_field(p, store ? OP_ST_FIELD : OP_LD_FIELD, ref->type, ref->slot);
+}
+
+/* Parse the indices of an element access of array `lcl` into `ref`. The
+ * element is loaded when `load` or when a field access follows, unless that
+ * field is accessed in its column of an array of records.
+ */
+static void parse_element(Parser *p, Local *lcl, FieldRef *ref, bool load)
+{
+  ref->dims = parse_indices(p, lcl, ref->idx);
+  ref->type = lcl ? lcl->elem_type : NULL;
+
+  if (peek(p) == '.' && ref->type && t_isrecord(ref->type))
+    ref->array = lcl;
+  else if (load || peek(p) == '.')
+    emit_index(p, lcl, OP_LD_INDEX, ref->dims, ref->idx);
+}
+
+/* Parse the field accesses following a value of type `ref->type`, loading
+ * every field but the last which is left in `ref`; returns 1 on error.
+ */
+static int parse_fields(Parser *p, FieldRef *ref)
+{
+  while (peek(p) == '.') {
+    if (ref->slot != -1) {
+      emit_field_ref(p, ref, false);
+      ref->type = ref->type->fields[ref->slot].type;
+      ref->array = NULL;
+    }
+
+    next(p);
+    ref->slot = resolve_field(p, ref->type);
+    if (ref->slot == -1)
+      return 1;
+    next(p);
+  }
+
+  return 0;
+}
+
+/* Parse the field following array of records `lcl` and emit its column,
+ * which shares the storage of the array; returns the slot of the field or -1.
+ */
+static int parse_column(Parser *p, Local *lcl)
+{
+  next(p);
+  int slot = resolve_field(p, lcl->elem_type);
+  if (slot == -1)
+    return -1;
+  next(p);
+
+  emit_u8(p, OP_COLUMN);
+  emit_u8(p, slot);
+  return slot;
+}
+
+/* Parse an argument passed BYREF for parameter `i` of `fn`; a reference to
+ * the variable, array element or record field it names is passed.
+ */
+static void parse_ref_arg(Parser *p, Function *fn, u8 i)
+{
+  int index = -1;
+  if (peek(p) == TK_identifier)
+    index = resolve_local(p, p->lex.span.pos, p->lex.span.len);
+  if (index == -1) {
+    parse_err(p, "BYREF argument must be a variable");
+    parse_expr(p);
+    return;
+  }
+
+  Local *lcl = &p->vars[index];
+  Type *type, *elem = NULL;
+
+  next(p);
+  emit_own(p, index);
+  if (peek(p) != '[' && peek(p) != '.') {
+    if (find_loop(p, index)) {
+      parse_err(p, "Cannot pass a FOR loop variable BYREF inside its loop");
+      return;
+    }
+
+    /* A BYREF parameter passes on the reference it holds. */
+    lcl->escapes++;
+    p->max_stack++;
+    if (lcl->raw != VAL_NIL) {
+      emit_u8(p, OP_REF_SLOT);
+      emit_u8(p, lcl->slot);
+      emit_u8(p, lcl->raw);
+    } else {
+      emit_u8(p, lcl->pass == PASS_BYREF ? OP_LD_LOCAL : OP_REF_LOCAL);
+      emit_u8(p, lcl->slot);
+    }
+    type = lcl->type;
+    elem = lcl->elem_type;
+  } else {
+    FieldRef ref = {
+      .type = lcl->type,
+      .slot = -1
+    };
+
+    emit_ld_local_index(p, index);
+    if (peek(p) == '[')
+      parse_element(p, lcl, &ref, false);
+    if (peek(p) == '.' && parse_fields(p, &ref))
+      return;
+
+    if (ref.slot != -1) {
+      type = ref.type->fields[ref.slot].type;
+      if (ref.array) {
+        emit_u8(p, OP_REF_COLUMN);
+        emit_u8(p, ref.dims);
+        emit_u8(p, ref.slot);
+      } else {
+        emit_field(p, OP_REF_FIELD, ref.type, ref.slot);
+      }
+    } else {
+      type = ref.type;
+      if (type && t_isrecord(type)) {
+        parse_err(p, "Elements of arrays of records cannot be passed BYREF; pass their fields");
+        return;
+      }
+      emit_u8(p, OP_REF_INDEX);
+      emit_u8(p, ref.dims);
+    }
+  }
+
+  /* The callee stores through the reference unchecked, so the types must
+   * be the same; an ARRAY OF ANY takes any array. */
+  Type *param_elem = fn->param_elems ? fn->param_elems[i] : NULL;
+  bool match = param_elem ?
+    elem && (elem == param_elem || param_elem == V(p->lex.state)->any_type) :
+    !elem && type == fn->param_types[i];
+  if (!match)
+    parse_err(p, "BYREF argument does not match the type of parameter %d of \"%s\"",
+              i + 1, fn->ident);
+}
+
+/* Parse an argument for an ARRAY parameter with element type `elem`; it
+ * must be an array variable or a column of an array of records.
+ */
+static void parse_array_arg(Parser *p, Type *elem)
+{
+  int index = -1;
+  if (peek(p) == TK_identifier)
+    index = resolve_local(p, p->lex.span.pos, p->lex.span.len);
+
+  Local *lcl = index != -1 ? &p->vars[index] : NULL;
+  if (!lcl || !lcl->elem_type) {
+    parse_err(p, "Expected an array variable as argument");
+    parse_expr(p);
+    return;
+  }
+
+  Type *arg = lcl->elem_type;
+  lcl->escapes++;
+  next(p);
+  if (p->own_args)
+    emit_own(p, index);
+  emit_ld_local_index(p, index);
+  if (peek(p) == '.' && t_isrecord(arg)) {
+    int slot = parse_column(p, lcl);
+    if (slot == -1)
+      return;
+    arg = arg->fields[slot].type;
+  }
+
+  if (arg != elem && elem != V(p->lex.state)->any_type)
+    parse_err(p, "Array argument does not match the element type of the parameter");
+}
+
+/* Parse a call after the identifier of the callee; the arguments can be left
+ * out when calling a procedure without parameters.
+ */
+static int parse_call(Parser *p, Span *ident, bool procedure)
+{
+  VM *vm = V(p->lex.state);
+  u16 index = pseu_get_function(vm, ident->pos, ident->len);
+  if (index == PSEU_INVALID_FUNC) {
+    parse_err(p, "Function \"%.*s\" is not defined", (int)ident->len, ident->pos);
+    return 1;
+  }
+
+  Function *fn = &vm->fns[index];
+  if (!procedure && !fn->return_type) {
+    parse_err(p, "Procedure \"%s\" does not return a value", fn->ident);
+    return 1;
+  }
+  if (procedure && fn->return_type) {
+    parse_err(p, "Function \"%s\" cannot be CALLed; use its value instead", fn->ident);
+    return 1;
+  }
+
+  /* The parameter is known before its argument is parsed, so BYREF and ARRAY
+   * arguments can be checked. */
+  bool own_args = p->own_args;
+  u8 args_count = 0;
+
+  if (peek(p) == '(') {
+    if (next(p) != ')') {
+      for (;;) {
+        bool param = args_count < fn->params_count;
+        p->own_args = fn->type == FN_C && !fn->return_type;
+
+        if (param && fn->byref & (1u << args_count))
+          parse_ref_arg(p, fn, args_count);
+        else if (param && fn->param_elems && fn->param_elems[args_count])
+          parse_array_arg(p, fn->param_elems[args_count]);
+        else {
+          size start = p->code_count;
+          parse_expr(p);
+          if (param)
+            check_type(p, fn->param_types[args_count]);
+
+          /* C functions do not keep the arrays passed to them. */
+          if (param && fn->type == FN_C && fn->param_types[args_count] == vm->array_type)
+            unescape(p, start);
+        }
+        args_count++;
+
+        if (peek(p) != ',')
+          break;
+        next(p);
+      }
+    }
+
+    p->own_args = own_args;
+    if (peek(p) != ')') {
+      parse_err(p, "Expected ')'");
+      return 1;
+    }
+    next(p);
+  }
+
+  if (fn->params_count != args_count) {
+    parse_err(p, "Function \"%s\" expects %d arguments", fn->ident, fn->params_count);
+    return 1;
+  }
+
+  emit_u8(p, OP_CALL);
+  emit_u16(p, index);
+  p->expr = fn->type == FN_HOST ? NULL : static_type(p, fn->return_type);
+  return 0;
+}
+
+/* Returns the INTEGER literal at `p`, negated if `neg`. */
+static i32 literal_i32(Parser *p, bool neg)
+{
+  i32 value = v_asint(&p->lex.value);
+  if (p->lex.int_min && !neg)
+    parse_err(p, "INTEGER literal out of range");
+  return neg ? (i32)(0u - (u32)value) : value;
+}
+
+/* Parse an expression term. */
 static int parse_expr_primary(Parser *p)
 {
   switch (p->tok) {
@@ -286,12 +1477,39 @@ static int parse_expr_primary(Parser *p)
   case TK_kw_not: {
     Token op = peek(p);
     next(p);
+
+    /* 2147483648 is only an INTEGER once negated. */
+    if (op == '-' && peek(p) == TK_lit_integer) {
+      Value v = v_i32(literal_i32(p, true));
+      next(p);
+      emit_ld_const(p, &v);
+      p->expr = v_type(p->lex.state, &v);
+      return 0;
+    }
+
+    size start = p->code_count;
     int result = parse_expr_primary(p);
+    Type *type = p->expr;
 
-    if (op == '-')
-      emit_call(p, "@neg");
-    else if (op == TK_kw_not)
+    if (op == TK_kw_not) {
+      if (type && type != V(p->lex.state)->boolean_type)
+        parse_err(p, "Expected a BOOLEAN operand to NOT");
       emit_call(p, "@not");
+      return result;
+    }
+    if (type && !is_num(p, type))
+      parse_err(p, "Expected an INTEGER or REAL operand");
+
+    /* Fold negation of INTEGER constants so they can be used as constants. */
+    i32 k;
+    if (op == '-' && emitted_konst(p, start, &k)) {
+      Value v = v_i32((i32)(0u - (u32)k));
+      p->code_count = start;
+      emit_ld_const(p, &v);
+    } else if (op == '-') {
+      emit_call(p, "@neg");
+    }
+    p->expr = type;
     return result;
   }
 
@@ -305,180 +1523,1350 @@ static int parse_expr_primary(Parser *p)
     parse_err(p, "Expected ')'");
     return 1;
 
-  case TK_lit_real:
   case TK_lit_integer:
+    if (p->lex.int_min)
+      parse_err(p, "INTEGER literal out of range");
+    /* fallthrough */
+  case TK_lit_real:
   case TK_lit_string:
     next(p);
     emit_ld_const(p, &p->lex.value);
+    p->expr = v_type(p->lex.state, &p->lex.value);
     return 0;
 
-  case TK_identifier:
+  case TK_identifier: {
+    Span ident = p->lex.span;
     next(p);
-    emit_ld_variable(p, p->lex.span.pos, p->lex.span.len);
+
+    if (peek(p) == '(')
+      return parse_call(p, &ident, false);
+
+    emit_ld_variable(p, ident.pos, ident.len);
+
+    int index = resolve_local(p, ident.pos, ident.len);
+    Local *lcl = index != -1 ? &p->vars[index] : NULL;
+    FieldRef ref = {
+      .type = lcl ? lcl->type : NULL,
+      .slot = -1
+    };
+
+    if (peek(p) == '[') {
+      parse_element(p, lcl, &ref, true);
+      p->expr = static_type(p, ref.type);
+    } else if (peek(p) == '.' && lcl && lcl->elem_type && t_isrecord(lcl->elem_type)) {
+      /* A field of an array of records is its column. */
+      lcl->escapes++;
+      p->expr = V(p->lex.state)->array_type;
+      return parse_column(p, lcl) == -1;
+    } else if (peek(p) != '.' && lcl) {
+      lcl->escapes++;
+    }
+    if (peek(p) == '.') {
+      if (parse_fields(p, &ref))
+        return 1;
+      emit_field_ref(p, &ref, false);
+      p->expr = static_type(p, ref.type->fields[ref.slot].type);
+    }
     return 0;
+  }
+
+  default:
+    parse_err(p, "Expected expression term");
+    return 1;
+  }
+}
+
+/* Parse a binary expression. */
+static void parse_expr_binop(Parser *p, int prece)
+{
+  /* Parse lhs of expression; bail if failed. */
+  if (parse_expr_primary(p))
+    return;
+
+  for (;;) {
+    Token op_tok = p->tok;
+    int cur_prece = op_precedence(op_tok);
+    if (cur_prece <= prece)
+      return;
+
+    Type *lhs = p->expr;
+    next(p);
+    /* Parse rhs of expression. */
+    parse_expr_binop(p, cur_prece);
+    Type *rhs = p->expr;
+
+    if (op_tok == '&') {
+      State *s = p->lex.state;
+      if ((lhs && !t_isstring(s, lhs)) || (rhs && !t_isstring(s, rhs)))
+        parse_err(p, "Expected STRING operands to '&'");
+    } else if (op_precedence(op_tok) == op_precedence('=')) {
+      check_compare(p, lhs, rhs);
+    }
+
+    switch (op_tok) {
+    case '+':
+    case '-':
+    case '*':
+    case '/': emit_arith(p, op_tok, lhs, rhs); break;
+    case '&': emit_call(p, "@concat"); break;
+
+    case '=': emit_call(p, "@eq"); break;
+    case '>': emit_call(p, "@gt"); break;
+    case '<': emit_call(p, "@lt"); break;
+    case TK_op_ge: emit_call(p, "@ge"); break;
+    case TK_op_le: emit_call(p, "@le"); break;
+    case TK_op_ne: emit_call(p, "@ne"); break;
+
+    default:
+      pseu_unreachable();
+      break;
+    }
+  }
+}
+
+/* Parse an operand of AND and OR into a condition. A trailing NOT or
+ * comparison is taken back off, so the condition can branch on it directly.
+ */
+static void parse_cond_operand(Parser *p, Cond *c)
+{
+  size start = p->code_count;
+  parse_expr_binop(p, op_precedence(TK_kw_and));
+
+  c->t = PSEU_NO_JUMP;
+  c->f = PSEU_NO_JUMP;
+  c->kind = COND_VALUE;
+  c->negate = false;
+
+  if (emitted_call(p, start, "@not")) {
+    unemit_call(p);
+    c->negate = true;
+  }
+  for (u8 i = 0; i < sizeof(compare_fns) / sizeof(compare_fns[0]); i++) {
+    if (emitted_call(p, start, compare_fns[i])) {
+      unemit_call(p);
+      c->kind = COND_COMPARE;
+      c->compare = i;
+      break;
+    }
+  }
+}
+
+/* Parse AND and OR operators binding tighter than `prece`; the right operand
+ * is only evaluated when the left one does not decide the outcome.
+ */
+static void parse_cond_binop(Parser *p, int prece, Cond *c)
+{
+  parse_cond_operand(p, c);
+
+  for (;;) {
+    Token op_tok = p->tok;
+    int cur_prece = op_precedence(op_tok);
+    if ((op_tok != TK_kw_and && op_tok != TK_kw_or) || cur_prece <= prece)
+      return;
+
+    next(p);
+    if (op_tok == TK_kw_and)
+      cond_true(p, c);
+    else
+      cond_false(p, c);
+
+    Cond rhs;
+    parse_cond_binop(p, cur_prece, &rhs);
+    if (op_tok == TK_kw_and)
+      jump_concat(p, &rhs.f, c->f);
+    else
+      jump_concat(p, &rhs.t, c->t);
+    *c = rhs;
+  }
+}
+
+/* Parse a condition; control continues after it when it holds. */
+static void parse_cond(Parser *p, Cond *c)
+{
+  parse_cond_binop(p, 0, c);
+  cond_true(p, c);
+}
+
+/* Parse an expression. */
+static void parse_expr(Parser *p)
+{
+  Cond c;
+  parse_cond_binop(p, 0, &c);
+  cond_value(p, &c);
+}
+
+/* Parse an output statement. */
+static void parse_output(Parser *p)
+{
+  next(p);
+
+  size start = p->code_count;
+  parse_expr(p);
+  unescape(p, start);
+  emit_call(p, "@output");
+}
+
+/* Parse an OPENFILE statement. */
+static void parse_openfile(Parser *p)
+{
+  next(p);
+  parse_expr(p);
+
+  if (!expect_peek(p, TK_kw_for)) {
+    parse_err(p, "Expected 'FOR' after file name.");
+    return;
+  }
+
+  Value mode;
+  switch (next(p)) {
+  case TK_kw_read:   mode = v_i32(FILE_READ);   break;
+  case TK_kw_write:  mode = v_i32(FILE_WRITE);  break;
+  case TK_kw_append: mode = v_i32(FILE_APPEND); break;
+
+  default:
+    parse_err(p, "Expected file mode 'READ', 'WRITE' or 'APPEND'.");
+    return;
+  }
+
+  next(p);
+  emit_ld_const(p, &mode);
+  emit_call(p, "@openfile");
+}
+
+/* Parse a READFILE statement; the line read is assigned to a variable. */
+static void parse_readfile(Parser *p)
+{
+  next(p);
+  parse_expr(p);
+
+  if (!expect_peek(p, ',')) {
+    parse_err(p, "Expected ',' after file name.");
+    return;
+  }
+  if (next(p) != TK_identifier) {
+    parse_err(p, "Expected variable identifier.");
+    return;
+  }
+
+  Span ident = p->lex.span;
+  next(p);
+  emit_call(p, "@readfile");
+  emit_st_local(p, ident.pos, ident.len);
+}
+
+/* Parse a WRITEFILE statement. */
+static void parse_writefile(Parser *p)
+{
+  next(p);
+  parse_expr(p);
+
+  if (!expect_peek(p, ',')) {
+    parse_err(p, "Expected ',' after file name.");
+    return;
+  }
+
+  next(p);
+  parse_expr(p);
+  emit_call(p, "@writefile");
+}
+
+/* Parse a CLOSEFILE statement. */
+static void parse_closefile(Parser *p)
+{
+  next(p);
+  parse_expr(p);
+  emit_call(p, "@closefile");
+}
+
+/* Parse a CALL statement. */
+static void parse_call_statement(Parser *p)
+{
+  if (!expect_next(p, TK_identifier)) {
+    parse_err(p, "Expected procedure identifier.");
+    return;
+  }
+
+  Span ident = p->lex.span;
+  next(p);
+  parse_call(p, &ident, true);
+}
+
+/* Parse a RETURN statement. */
+static void parse_return(Parser *p)
+{
+  next(p);
+
+  if (!p->body) {
+    parse_err(p, "RETURN outside of a FUNCTION or PROCEDURE.");
+    return;
+  }
+
+  if (p->fn->return_type) {
+    parse_expr(p);
+    check_type(p, p->fn->return_type);
+    emit_u8(p, OP_RET_VAL);
+  } else {
+    emit_u8(p, OP_RET);
+  }
+  cancel_checks(p);
+}
+
+/* Parse the type of a parameter or the return type of a function. */
+static int parse_type(Parser *p, Type **o)
+{
+  if (peek(p) != TK_identifier) {
+    parse_err(p, "Expected type identifier.");
+    return 1;
+  }
+
+  Span type_ident = p->lex.span;
+  u16 type_index = pseu_get_type(V(p->lex.state), type_ident.pos, type_ident.len);
+  if (type_index == PSEU_INVALID_TYPE) {
+    parse_err(p, "Unknown type specified.");
+    return 1;
+  }
+
+  *o = &V(p->lex.state)->types[type_index];
+  if (t_isarray(p->lex.state, *o)) {
+    parse_err(p, "Array parameters are not supported.");
+    return 1;
+  }
+
+  next(p);
+  return 0;
+}
+
+/* Parse a parameter; parameters are the first locals of the function. BYREF
+ * or BYVAL sets `*pass` for this and the following parameters; the element
+ * type of an ARRAY parameter is set in `*elem`.
+ */
+static int parse_param(Parser *p, u8 *pass, Type **o, Type **elem)
+{
+  if (peek(p) == TK_kw_byref || peek(p) == TK_kw_byval) {
+    *pass = peek(p) == TK_kw_byref ? PASS_BYREF : PASS_BYVAL;
+    next(p);
+  }
+  if (peek(p) != TK_identifier) {
+    parse_err(p, "Expected parameter identifier.");
+    return 1;
+  }
+
+  Local lcl = {
+    .scope = p->scope,
+    .ident = p->lex.span,
+    .pass = *pass
+  };
+
+  if (!expect_next(p, ':')) {
+    parse_err(p, "Expected ':' after parameter identifier.");
+    return 1;
+  }
+
+  /* Arrays of any bounds are passed to ARRAY OF parameters. */
+  if (next(p) == TK_kw_array) {
+    if (!expect_next(p, TK_kw_of)) {
+      parse_err(p, "Expected 'OF' after 'ARRAY'.");
+      return 1;
+    }
+    next(p);
+    if (parse_type(p, &lcl.elem_type))
+      return 1;
+    lcl.type = V(p->lex.state)->array_type;
+  } else if (parse_type(p, &lcl.type)) {
+    return 1;
+  }
+
+  *o = lcl.type;
+  *elem = lcl.elem_type;
+  return declare_local(p, &lcl);
+}
+
+/* Parse the parameters and return type of a function into `fn`. */
+static int parse_signature(Parser *p, Function *fn, bool returns)
+{
+  State *s = p->lex.state;
+  Type *param_types[PSEU_MAX_PARAMS];
+  Type *param_elems[PSEU_MAX_PARAMS];
+  u8 params_count = 0;
+  u8 pass = PASS_BYVAL;
+  bool arrays = false;
+
+  fn->byref = 0;
+  if (peek(p) == '(' && next(p) != ')') {
+    for (;;) {
+      if (params_count >= PSEU_MAX_PARAMS) {
+        parse_err(p, "Exceeded maximum number of parameters.");
+        return 1;
+      }
+      if (parse_param(p, &pass, &param_types[params_count], &param_elems[params_count]))
+        return 1;
+      if (pass == PASS_BYREF)
+        fn->byref |= 1u << params_count;
+      arrays |= param_elems[params_count] != NULL;
+      params_count++;
+
+      if (peek(p) != ',')
+        break;
+      next(p);
+    }
+
+    if (peek(p) != ')') {
+      parse_err(p, "Expected ')'.");
+      return 1;
+    }
+  }
+  if (peek(p) == ')')
+    next(p);
+
+  /* Both `RETURNS type` and `: type` are accepted. */
+  if (returns) {
+    if (peek(p) != TK_kw_returns && peek(p) != ':') {
+      parse_err(p, "Expected 'RETURNS' and the return type of the function.");
+      return 1;
+    }
+    next(p);
+    if (parse_type(p, &fn->return_type))
+      return 1;
+  }
+
+  fn->params_count = params_count;
+  fn->param_types = pseu_alloc_nt(s, Type *, params_count);
+  if (params_count > 0 && !fn->param_types)
+    return 1;
+  memcpy(fn->param_types, param_types, params_count * sizeof(Type *));
+
+  if (arrays) {
+    fn->param_elems = pseu_alloc_nt(s, Type *, params_count);
+    if (!fn->param_elems)
+      return 1;
+    memcpy(fn->param_elems, param_elems, params_count * sizeof(Type *));
+  }
+  return 0;
+}
+
+/* Parse a FUNCTION or PROCEDURE definition. The body is compiled by a parser
+ * of its own which shares the lexer. The function is defined before its body
+ * is parsed so that it can call itself.
+ */
+static void parse_function(Parser *p)
+{
+  State *s = p->lex.state;
+  VM *vm = V(s);
+  bool returns = peek(p) == TK_kw_function;
+  Token end = returns ? TK_kw_endfunction : TK_kw_endprocedure;
+
+  if (p->body) {
+    parse_err(p, "FUNCTION and PROCEDURE cannot be nested.");
+    return;
+  }
+  if (!expect_next(p, TK_identifier)) {
+    parse_err(p, "Expected function identifier.");
+    return;
+  }
+
+  Span ident = p->lex.span;
+  if (pseu_get_function(vm, ident.pos, ident.len) != PSEU_INVALID_FUNC) {
+    parse_err(p, "Function \"%.*s\" is already defined.", (int)ident.len, ident.pos);
+    return;
+  }
+
+  Function def = {
+    .type = FN_PSEU,
+    .ident = pseu_alloc(s, ident.len + 1)
+  };
+  if (!def.ident) {
+    parse_err(p, "Out of memory.");
+    return;
+  }
+  memcpy((char *)def.ident, ident.pos, ident.len);
+  ((char *)def.ident)[ident.len] = '\0';
+
+  Parser sub;
+  sub.lex = p->lex;
+  if (parser_init(&sub, s, &def)) {
+    pseu_free(s, (char *)def.ident);
+    parse_err(p, "Out of memory.");
+    return;
+  }
+  sub.body = true;
+
+  next(&sub);
+  if (!parse_signature(&sub, &def, returns)) {
+    u16 index = pseu_def_function(vm, &def);
+    if (index == PSEU_INVALID_FUNC) {
+      parse_err(&sub, "Exceeded maximum number of functions.");
+    } else {
+      sub.fn = &vm->fns[index];
+      while (peek(&sub) != end && peek(&sub) != TK_eof)
+        parse_statement(&sub);
+
+      if (peek(&sub) == end)
+        next(&sub);
+      else
+        parse_err(&sub, returns ? "Expected 'ENDFUNCTION'." : "Expected 'ENDPROCEDURE'.");
+    }
+  }
+
+  emit_u8(&sub, OP_RET);
+  parser_finish(&sub);
+
+  p->lex = sub.lex;
+  p->tok = sub.tok;
+  p->failed |= sub.failed;
+}
+
+/* Parse an integer array bound. */
+static int parse_bound(Parser *p, i32 *o)
+{
+  bool neg = peek(p) == '-';
+  if (neg)
+    next(p);
+
+  if (peek(p) != TK_lit_integer) {
+    parse_err(p, "Expected INTEGER array bound");
+    return 1;
+  }
+
+  *o = literal_i32(p, neg);
+  next(p);
+  return 0;
+}
+
+/* Parse the bounds and element type of an array type. */
+static int parse_array_type(Parser *p, Type **elem_type, Bounds *bounds)
+{
+  if (!expect_next(p, '[')) {
+    parse_err(p, "Expected '[' after ARRAY");
+    return 1;
+  }
+
+  next(p);
+  bounds->dims = 0;
+  for (;;) {
+    u8 d = bounds->dims;
+    if (d >= PSEU_MAX_DIMS) {
+      parse_err(p, "Too many array dimensions");
+      return 1;
+    }
+
+    if (parse_bound(p, &bounds->lower[d]))
+      return 1;
+    if (peek(p) != ':') {
+      parse_err(p, "Expected ':' between array bounds");
+      return 1;
+    }
+    next(p);
+    if (parse_bound(p, &bounds->upper[d]))
+      return 1;
+    if (bounds->upper[d] < bounds->lower[d]) {
+      parse_err(p, "Array upper bound is less than lower bound");
+      return 1;
+    }
+
+    bounds->dims++;
+    if (peek(p) != ',')
+      break;
+    next(p);
+  }
+
+  /* Make sure the number of elements fits the array length. */
+  i64 length = 1;
+  for (u8 d = 0; d < bounds->dims; d++) {
+    length *= (i64)bounds->upper[d] - bounds->lower[d] + 1;
+    if (length > INT32_MAX) {
+      parse_err(p, "Array is too large");
+      return 1;
+    }
+  }
+
+  if (peek(p) != ']') {
+    parse_err(p, "Expected ']'");
+    return 1;
+  }
+  if (!expect_next(p, TK_kw_of)) {
+    parse_err(p, "Expected OF after array bounds");
+    return 1;
+  }
+  if (!expect_next(p, TK_identifier)) {
+    parse_err(p, "Expected array element type");
+    return 1;
+  }
+
+  Span type_ident = p->lex.span;
+  u16 type_index = pseu_get_type(V(p->lex.state), type_ident.pos, type_ident.len);
+  if (type_index == PSEU_INVALID_TYPE) {
+    parse_err(p, "Unknown type specified.");
+    return 1;
+  }
+
+  *elem_type = &V(p->lex.state)->types[type_index];
+  if (t_isarray(p->lex.state, *elem_type)) {
+    parse_err(p, "Array elements cannot be arrays; use more dimensions");
+    return 1;
+  }
+
+  next(p);
+  return 0;
+}
+
+/* Parse a declare statement. */
+static void parse_declare(Parser *p)
+{
+  if (!expect_next(p, TK_identifier)) {
+    parse_err(p, "Expected variable identifier");
+    return;
+  }
+
+  Span ident = p->lex.span;
+
+  if (next(p) == ':') {
+    next(p);
+    if (peek(p) == TK_kw_array) {
+      Local lcl = {
+        .scope = p->scope,
+        .ident = ident,
+        .type = V(p->lex.state)->array_type
+      };
+
+      if (parse_array_type(p, &lcl.elem_type, &lcl.bounds))
+        return;
+      if (declare_local(p, &lcl))
+        return;
+
+      add_site(p, p->vars_count - 1);
+      emit_new_array(p, lcl.elem_type, &lcl.bounds);
+      emit_st_local(p, ident.pos, ident.len);
+    } else if (peek(p) != TK_identifier) {
+      parse_err(p, "Expected variable type");
+    } else {
+      Span type_ident = p->lex.span;
+      u16 type_index = pseu_get_type(V(p->lex.state), type_ident.pos, type_ident.len);
+      if (type_index == PSEU_INVALID_TYPE) {
+        parse_err(p, "Unknown type specified.");
+      } else {
+        Type *type = &V(p->lex.state)->types[type_index];
+        Local lcl = {
+          .scope = p->scope,
+          .ident = ident,
+          .type_ident = type_ident,
+          .type = type
+        };
+
+        if (t_isarray(p->lex.state, type))
+          parse_err(p, "Expected array bounds; ARRAY[l:u] OF type");
+        else
+          declare_local(p, &lcl);
+      }
+
+      next(p);
+
+      /* Parse assignment after declaration if its here. */
+      if (peek(p) == TK_op_assign) {
+        next(p);
+        size start = p->code_count;
+        parse_expr(p);
+        if (type_index != PSEU_INVALID_TYPE && t_isrecord(&V(p->lex.state)->types[type_index]))
+          unescape(p, start);
+        emit_st_local(p, ident.pos, ident.len);
+      } else if (type_index != PSEU_INVALID_TYPE) {
+        /* Records are created where they are declared. */
+        Type *type = &V(p->lex.state)->types[type_index];
+        int index = resolve_local(p, ident.pos, ident.len);
+        if (t_isrecord(type) && index != -1) {
+          add_site(p, index);
+          emit_new_record(p, type);
+          emit_st_local_index(p, index);
+        }
+      }
+    }
+  } else {
+    /* TODO: Non typed variable aka ANY. */
+    parse_err(p, "Expected type.");
+  }
+}
+
+/* Parse a TYPE declaration of a record; its fields are given slots in their
+ * order of declaration so field accesses compile to fixed offsets.
+ */
+static void parse_type_decl(Parser *p)
+{
+  State *s = p->lex.state;
+  VM *vm = V(s);
+
+  if (p->body || p->blocks_count > 1) {
+    parse_err(p, "TYPE must be declared at the top level.");
+    return;
+  }
+  if (!expect_next(p, TK_identifier)) {
+    parse_err(p, "Expected type identifier.");
+    return;
+  }
+
+  Span ident = p->lex.span;
+  if (pseu_get_type(vm, ident.pos, ident.len) != PSEU_INVALID_TYPE) {
+    parse_err(p, "Type \"%.*s\" is already defined.", (int)ident.len, ident.pos);
+    return;
+  }
+
+  Span idents[PSEU_MAX_FIELDS];
+  Type *types[PSEU_MAX_FIELDS];
+  u8 count = 0;
+
+  next(p);
+  for (;;) {
+    while (peek(p) == TK_newline)
+      next(p);
+    if (peek(p) != TK_kw_declare)
+      break;
+
+    if (!expect_next(p, TK_identifier)) {
+      parse_err(p, "Expected field identifier.");
+      return;
+    }
+    Span field = p->lex.span;
+    for (u8 i = 0; i < count; i++) {
+      if (spaneq(&idents[i], &field)) {
+        parse_err(p, "Field \"%.*s\" is already defined.", (int)field.len, field.pos);
+        return;
+      }
+    }
+    if (count >= PSEU_MAX_FIELDS) {
+      parse_err(p, "Exceeded maximum number of fields in a TYPE.");
+      return;
+    }
+    if (!expect_next(p, ':')) {
+      parse_err(p, "Expected ':' after field identifier.");
+      return;
+    }
+    if (next(p) == TK_kw_array) {
+      parse_err(p, "Record fields cannot be arrays.");
+      return;
+    }
+    if (parse_type(p, &types[count]))
+      return;
+    if (peek(p) != TK_newline) {
+      parse_err(p, "Expected new line after field type.");
+      return;
+    }
+
+    idents[count++] = field;
+  }
+
+  if (peek(p) != TK_kw_endtype) {
+    parse_err(p, "Expected 'ENDTYPE'.");
+    return;
+  }
+  if (count == 0) {
+    parse_err(p, "TYPE must declare at least one field.");
+    return;
+  }
+  next(p);
+
+  Type type = {
+    .ident = spandup(s, &ident),
+    .fields = pseu_alloc_nt(s, Field, count),
+    .fields_count = count
+  };
+  if (!type.ident || !type.fields) {
+    parse_err(p, "Out of memory.");
+    return;
+  }
+  for (u8 i = 0; i < count; i++) {
+    type.fields[i].type = types[i];
+    type.fields[i].ident = spandup(s, &idents[i]);
+    if (!type.fields[i].ident) {
+      parse_err(p, "Out of memory.");
+      return;
+    }
+  }
+
+  if (pseu_def_type(vm, &type) == PSEU_INVALID_TYPE)
+    parse_err(p, "Exceeded maximum number of types.");
+}
+
+/* Parse an assign statement. */
+static void parse_assignment(Parser *p)
+{
+  Span ident = p->lex.span;
+  int index = resolve_local(p, ident.pos, ident.len);
+  Local *lcl = index != -1 ? &p->vars[index] : NULL;
+
+  next(p);
+
+  /* Assignment to an array element or a record field. */
+  if (peek(p) == '[' || peek(p) == '.') {
+    FieldRef ref = {
+      .type = lcl ? lcl->type : NULL,
+      .slot = -1
+    };
+
+    if (lcl)
+      emit_own(p, index);
+    emit_ld_variable(p, ident.pos, ident.len);
+    if (peek(p) == '[')
+      parse_element(p, lcl, &ref, false);
+    if (peek(p) == '.' && parse_fields(p, &ref))
+      return;
+
+    if (!expect_peek(p, TK_op_assign)) {
+      parse_err(p, "Expected assign operator '<-'.");
+      return;
+    }
+
+    next(p);
+    size start = p->code_count;
+    parse_expr(p);
+
+    /* Records are copied into fields and into elements of arrays of
+     * records. */
+    if (ref.slot != -1) {
+      Type *field_type = ref.type->fields[ref.slot].type;
+      check_type(p, field_type);
+      if (t_isrecord(field_type)) {
+        unescape(p, start);
+        emit_copy_record(p, field_type);
+      }
+      emit_field_ref(p, &ref, true);
+    } else {
+      check_type(p, ref.type);
+      if (ref.type && t_isrecord(ref.type))
+        unescape(p, start);
+      emit_index(p, lcl, OP_ST_INDEX, ref.dims, ref.idx);
+    }
+    return;
+  }
+
+  if (!expect_peek(p, TK_op_assign)) {
+    parse_err(p, "Expected assign operator '<-'.");
+    return;
+  }
+
+  if (lcl && lcl->elem_type)
+    parse_err(p, "Cannot assign to an array; assign its elements instead");
+
+  next(p);
+  size start = p->code_count;
+  parse_expr(p);
+  if (lcl && lcl->type && t_isrecord(lcl->type))
+    unescape(p, start);
+  emit_st_local(p, ident.pos, ident.len);
+}
+
+static void parse_if_block(Parser *p)
+{
+  next(p);
+  Cond c;
+  parse_cond(p, &c);
+  if (!expect_peek(p, TK_kw_then)) {
+    parse_err(p, "Expected THEN keyword.");
+    return;
+  }
+
+  if (!expect_next(p, TK_newline)) {
+    parse_err(p, "Expected new line after THEN keyword.");
+    return;
+  }
+
+  next(p);
+
+  begin_block(p);
+  while (peek(p) != TK_kw_else && peek(p) != TK_kw_endif && peek(p) != TK_eof)
+    parse_statement(p);
+  end_block(p);
+
+  /* If ELSE, parse else block. */
+  if (peek(p) == TK_kw_else) {
+    if (!expect_next(p, TK_newline)) {
+      parse_err(p, "Expected new line after ELSE keyword.");
+      return;
+    }
+    
+    int else_jmp = emit_br(p);
+    jump_patch(p, &c.f, p->code_count);
+    begin_block(p);
+    while (peek(p) != TK_kw_endif && peek(p) != TK_eof)
+      parse_statement(p);
+    end_block(p);
+    patch_br(p, else_jmp);
+  } else {
+    jump_patch(p, &c.f, p->code_count);
+  }
+
+  next(p);
+
+  if (peek(p) != TK_newline && peek(p) != TK_eof)
+    parse_err(p, "Expected new line or end of file after ENDIF.");
+}
+
+/* Parse the STEP of a FOR loop; must be a non-zero INTEGER constant. */
+static int parse_step(Parser *p, i32 *o)
+{
+  bool neg = peek(p) == '-';
+  if (neg)
+    next(p);
+
+  if (peek(p) != TK_lit_integer) {
+    parse_err(p, "Expected INTEGER constant after STEP");
+    return 1;
+  }
 
-  default:
-    parse_err(p, "Expected expression term");
+  *o = literal_i32(p, neg);
+  if (*o == 0) {
+    parse_err(p, "FOR loop STEP cannot be zero");
     return 1;
   }
+
+  next(p);
+  return 0;
 }
 
-/* Parse a binary expression. */
-static void parse_expr_binop(Parser *p, int prece)
+/* Parse a FOR loop.
+ *
+ * The loop is laid out with its entry at the bottom so that bounds checks
+ * hoisted while parsing the body can be emitted in front of it:
+ *
+ *       i <- start; [end <- end]; BR guard
+ *   head:  IF NOT i <= end THEN BR exit
+ *          body; [IF i > MAX - step THEN BR exit]
+ *          i <- i + step; BR head
+ *   guard: IF i <= end THEN checks; BR head
+ *   exit:
+ *
+ * The test in front of the increment stops the loop variable from wrapping
+ * around when `end` is within `step` of the INTEGER limits; it is left out
+ * when the end is a constant far enough from them.
+ */
+static void parse_for(Parser *p)
 {
-  /* Parse lhs of expression; bail if failed. */
-  if (parse_expr_primary(p))
+  if (!expect_next(p, TK_identifier)) {
+    parse_err(p, "Expected FOR loop variable");
     return;
+  }
 
-  for (;;) {
-    Token op_tok = p->tok;
-    int cur_prece = op_precedence(op_tok);
-    if (cur_prece <= prece)
+  Span ident = p->lex.span;
+  int var = resolve_local(p, ident.pos, ident.len);
+  if (var == -1) {
+    parse_err(p, "Local \"%.*s\" not defined", (int)ident.len, ident.pos);
+    return;
+  }
+  if (!t_isint(p->lex.state, p->vars[var].type)) {
+    parse_err(p, "FOR loop variable must be an INTEGER");
+    return;
+  }
+  if (find_loop(p, var)) {
+    parse_err(p, "FOR loop variable is already used by an enclosing loop");
+    return;
+  }
+  if (p->loops_count >= PSEU_MAX_LOOPS) {
+    parse_err(p, "Exceeded maximum nesting of FOR loops");
+    return;
+  }
+
+  if (!expect_next(p, TK_op_assign)) {
+    parse_err(p, "Expected assign operator '<-'.");
+    return;
+  }
+
+  Loop loop = { .var = var, .end_local = -1, .step = 1 };
+
+  next(p);
+  size start = p->code_count;
+  parse_expr(p);
+  loop.start_konst = emitted_konst(p, start, &loop.start);
+  emit_st_checked(p, var);
+
+  if (!expect_peek(p, TK_kw_to)) {
+    parse_err(p, "Expected TO keyword.");
+    return;
+  }
+
+  /* Constant ends are loaded at the head of the loop, other ones are
+   * evaluated once into a temporary local.
+   */
+  next(p);
+  start = p->code_count;
+  parse_expr(p);
+  loop.end_konst = emitted_konst(p, start, &loop.end);
+  if (loop.end_konst) {
+    p->code_count = start;
+  } else {
+    loop.end_local = declare_temp(p, V(p->lex.state)->integer_type);
+    if (loop.end_local == -1)
       return;
+    emit_st_checked(p, loop.end_local);
+  }
 
+  if (peek(p) == TK_kw_step) {
     next(p);
-    /* Parse rhs of expression. */
-    parse_expr_binop(p, cur_prece);
+    if (parse_step(p, &loop.step))
+      return;
+  }
 
-    switch (op_tok) {
-    case '+': emit_call(p, "@add"); break;
-    case '-': emit_call(p, "@sub"); break;
-    case '*': emit_call(p, "@mul"); break;
-    case '/': emit_call(p, "@div"); break;
+  if (!expect_peek(p, TK_newline)) {
+    parse_err(p, "Expected new line after FOR loop.");
+    return;
+  }
 
-    case '=': emit_call(p, "@eq"); break;
-    case '>': emit_call(p, "@gt"); break;
-    case '<': emit_call(p, "@lt"); break;
-    case TK_op_ge: emit_call(p, "@ge"); break;
-    case TK_op_le: emit_call(p, "@le"); break;
+  Value end = v_i32(loop.end);
+  Value step = v_i32(loop.step);
+  CompareType cond = loop.step > 0 ? COMP_le : COMP_ge;
 
-    case TK_kw_and: emit_call(p, "@and"); break;
-    case TK_kw_or:  emit_call(p, "@or");  break;
+  int guard_jmp = emit_br(p);
+  u16 head = p->code_count;
+  emit_ld_local_index(p, var);
+  if (loop.end_konst)
+    emit_ld_const(p, &end);
+  else
+    emit_ld_local_index(p, loop.end_local);
+  int exit_jmp = emit_br_cmp(p, cond, false);
 
-    default:
-      pseu_unreachable();
-      break;
-    }
+  begin_block(p);
+  loop.block = p->blocks[p->blocks_count - 1];
+  p->loops[p->loops_count++] = loop;
+
+  next(p);
+  while (peek(p) != TK_kw_next && peek(p) != TK_eof)
+    parse_statement(p);
+
+  Loop *l = &p->loops[--p->loops_count];
+  end_block(p);
+
+  /* Past the last value which can be stepped from without overflow. */
+  i32 last = loop.step > 0 ? INT32_MAX - loop.step : INT32_MIN - loop.step;
+  int wrap_jmp = -1;
+  if (!l->end_konst || (loop.step > 0 ? l->end > last : l->end < last)) {
+    Value limit = v_i32(last);
+    emit_ld_local_index(p, var);
+    emit_ld_const(p, &limit);
+    wrap_jmp = emit_br_cmp(p, loop.step > 0 ? COMP_gt : COMP_lt, true);
   }
-}
 
-/* Parse an expression. */
-static void parse_expr(Parser *p)
-{
-  parse_expr_binop(p, 0);
+  emit_ld_local_index(p, var);
+  emit_ld_const(p, &step);
+  emit_arith(p, '+', static_type(p, p->vars[var].type), V(p->lex.state)->integer_type);
+  emit_st_checked(p, var);
+  emit_br_to(p, head);
+
+  if (l->checks_count > 0) {
+    patch_br(p, guard_jmp);
+    emit_ld_local_index(p, var);
+    if (l->end_konst)
+      emit_ld_const(p, &end);
+    else
+      emit_ld_local_index(p, l->end_local);
+    patch_br_to(p, emit_br_cmp(p, cond, false), head);
+
+    for (u8 i = 0; i < l->checks_count; i++)
+      emit_chk_index(p, &l->checks[i]);
+    emit_br_to(p, head);
+  } else {
+    patch_br_to(p, guard_jmp, head);
+  }
+  patch_br(p, exit_jmp);
+  if (wrap_jmp != -1)
+    patch_br(p, wrap_jmp);
+
+  if (!expect_peek(p, TK_kw_next)) {
+    parse_err(p, "Expected NEXT keyword.");
+    return;
+  }
+
+  /* NEXT may repeat the loop variable. */
+  if (next(p) == TK_identifier) {
+    if (!spaneq(&ident, &p->lex.span))
+      parse_err(p, "NEXT does not match FOR loop variable");
+    next(p);
+  }
 }
 
-/* Parse an output statement. */
-static void parse_output(Parser *p)
+/* Parse a CASE label into `label`; returns true if it is a STRING. */
+static bool parse_case_label(Parser *p, CaseLabel *label)
 {
+  label->lower = 0;
+  label->upper = 0;
+  label->konst = 0;
+
+  if (peek(p) == TK_lit_string) {
+    int index = declare_const(p, &p->lex.value);
+    if (index == -1)
+      parse_err(p, "Exceeded maximum number of constant in a function/procedure");
+    label->konst = (u16)index;
+    next(p);
+    return true;
+  }
+
+  bool neg = peek(p) == '-';
+  if (neg)
+    next(p);
+  if (peek(p) != TK_lit_integer) {
+    parse_err(p, "Expected INTEGER or STRING constant as CASE label.");
+    return false;
+  }
+
+  label->lower = literal_i32(p, neg);
+  label->upper = label->lower;
   next(p);
+  return false;
+}
 
-  parse_expr(p);
-  emit_call(p, "@output");
+static int compare_labels(const void *a, const void *b)
+{
+  i32 la = ((const CaseLabel *)a)->lower;
+  i32 lb = ((const CaseLabel *)b)->lower;
+  return (la > lb) - (la < lb);
 }
 
-/* Parse a declare statement. */
-static void parse_declare(Parser *p)
+/* Emits the dispatch of a CASE on INTEGER labels: a table indexed by the
+ * selector when the labels are dense, or a binary search over ranges.
+ */
+static void emit_case_ints(Parser *p, CaseLabel *labels, size count, int *other)
 {
-  if (!expect_next(p, TK_identifier)) {
-    parse_err(p, "Expected variable identifier");
+  qsort(labels, count, sizeof(CaseLabel), compare_labels);
+  for (size i = 1; i < count; i++) {
+    if (labels[i].lower <= labels[i - 1].upper) {
+      parse_err(p, "Duplicate CASE label.");
+      return;
+    }
+  }
+
+  i64 span = count ? (i64)labels[count - 1].upper - labels[0].lower + 1 : 0;
+  if (count > 0 && span <= PSEU_CASE_TABLE_MAX && span <= 4 * (i64)count + 8) {
+    emit_u8(p, OP_SWITCH_TABLE);
+    emit_u32(p, (u32)labels[0].lower);
+    emit_u16(p, (u16)span);
+    int offset = p->code_count;
+    emit_u16(p, 0);
+    jump_append(p, other, offset);
+
+    /* Values between labels take the OTHERWISE arm; patched below. */
+    size base = p->code_count;
+    for (i64 i = 0; i < span; i++)
+      emit_u16(p, 0);
+    for (size i = 0; i < count; i++)
+      for (i64 v = labels[i].lower; v <= labels[i].upper; v++)
+        patch_br_to(p, (int)(base + 2 * (v - labels[0].lower)), labels[i].target);
+    for (i64 i = 0; i < span && !p->failed; i++) {
+      offset = (int)(base + 2 * i);
+      if (p->code[offset] == 0 && p->code[offset + 1] == 0)
+        jump_append(p, other, offset);
+    }
     return;
   }
 
-  Span ident = p->lex.span;
+  emit_u8(p, OP_SWITCH_RANGE);
+  emit_u16(p, (u16)count);
+  int offset = p->code_count;
+  emit_u16(p, 0);
+  jump_append(p, other, offset);
+  for (size i = 0; i < count; i++) {
+    emit_u32(p, (u32)labels[i].lower);
+    emit_u32(p, (u32)labels[i].upper);
+    emit_u16(p, labels[i].target);
+  }
+}
 
-  if (next(p) == ':') {
-    if (!expect_next(p, TK_identifier)) {
-      parse_err(p, "Expected variable type");
-    } else {
-      Span type_ident = p->lex.span;
-      u16 type_index = pseu_get_type(V(p->lex.state), type_ident.pos, type_ident.len);
-      if (type_index == PSEU_INVALID_TYPE) {
-        parse_err(p, "Unknown type specified.");
-      } else {
-        Type *type = &V(p->lex.state)->types[type_index];
-        Local lcl = {
-          .scope = p->scope,
-          .ident = ident,
-          .type_ident = type_ident,
-          .type = type
-        };
+/* Emits the dispatch of a CASE on STRING labels through an open addressing
+ * table of their hashes.
+ */
+static void emit_case_strings(Parser *p, CaseLabel *labels, size count, int *other)
+{
+  State *s = p->lex.state;
+  u32 slots = 2;
+  while (slots < 2 * count)
+    slots *= 2;
+
+  emit_u8(p, OP_SWITCH_STR);
+  emit_u16(p, (u16)(slots - 1));
+  int offset = p->code_count;
+  emit_u16(p, 0);
+  jump_append(p, other, offset);
+
+  size base = p->code_count;
+  for (u32 i = 0; i < slots; i++) {
+    emit_u16(p, PSEU_SWITCH_EMPTY);
+    emit_u16(p, 0);
+  }
+  if (p->failed)
+    return;
 
-        declare_local(p, &lcl);
+  for (size i = 0; i < count; i++) {
+    String *label = v_asstr(&p->consts[labels[i].konst]);
+    u32 slot = string_hash(s, label) & (slots - 1);
+    for (;;) {
+      size offset = base + 4 * slot;
+      u16 konst = (u16)(p->code[offset] << 8 | p->code[offset + 1]);
+      if (konst == PSEU_SWITCH_EMPTY) {
+        patch_br_to(p, (int)offset, labels[i].konst);
+        patch_br_to(p, (int)offset + 2, labels[i].target);
+        break;
       }
-
-      next(p);
-
-      /* Parse assignment after declaration if its here. */
-      if (peek(p) == TK_op_assign) {
-        next(p);
-        parse_expr(p);
-        emit_st_local(p, ident.pos, ident.len);
+      /* Equal strings share their constant. */
+      if (konst == labels[i].konst) {
+        parse_err(p, "Duplicate CASE label.");
+        return;
       }
+      slot = (slot + 1) & (slots - 1);
     }
-  } else {
-    /* TODO: Non typed variable aka ANY. */
-    parse_err(p, "Expected type.");
   }
 }
 
-/* Parse an assign statement. */
-static void parse_assignment(Parser *p)
+/* Parse a CASE statement. The arms are emitted first and the selector
+ * branches over them to a single dispatch instruction after the last one.
+ */
+static void parse_case(Parser *p)
 {
-  Span ident = p->lex.span;
+  State *s = p->lex.state;
+  if (!expect_next(p, TK_kw_of)) {
+    parse_err(p, "Expected OF after CASE.");
+    return;
+  }
 
+  next(p);
+  parse_expr(p);
+  if (!expect_peek(p, TK_newline)) {
+    parse_err(p, "Expected new line after CASE selector.");
+    return;
+  }
   next(p);
 
-  if (!expect_peek(p, TK_op_assign)) {
-    parse_err(p, "Expected assign operator '<-'.");
+  size labels_size = 8;
+  size labels_count = 0;
+  CaseLabel *labels;
+  if (pseu_vec_init(s, &labels, labels_size, CaseLabel)) {
+    parse_err(p, "Out of memory.");
     return;
   }
 
+  int dispatch_jmp = emit_br(p);
+  int end_jmps = PSEU_NO_JUMP;
+  int otherwise = -1;
+  int strings = -1;
+
+  while (peek(p) == TK_newline)
+    next(p);
+
+  while (peek(p) != TK_kw_endcase && peek(p) != TK_eof && !p->failed) {
+    if (otherwise != -1) {
+      parse_err(p, "OTHERWISE must be the last arm of CASE.");
+      break;
+    }
+
+    if (peek(p) == TK_kw_otherwise) {
+      next(p);
+      otherwise = p->code_count;
+    } else {
+      for (;;) {
+        CaseLabel label;
+        label.target = p->code_count;
+        bool string = parse_case_label(p, &label);
+        if (!string && peek(p) == TK_kw_to) {
+          next(p);
+          CaseLabel upper;
+          bool upper_string = parse_case_label(p, &upper);
+          if (p->failed)
+            break;
+          if (upper_string || upper.lower < label.lower) {
+            parse_err(p, "Expected greater INTEGER constant after TO.");
+            break;
+          }
+          label.upper = upper.lower;
+        }
+
+        if (strings == -1)
+          strings = string;
+        else if (strings != string)
+          parse_err(p, "CASE labels must all be INTEGER or all be STRING.");
+        if (p->failed)
+          break;
+
+        if (labels_count >= labels_size &&
+            pseu_vec_grow(s, &labels, &labels_size, CaseLabel)) {
+          parse_err(p, "Out of memory.");
+          break;
+        }
+        labels[labels_count++] = label;
+
+        if (peek(p) != ',')
+          break;
+        next(p);
+      }
+      if (p->failed)
+        break;
+    }
+
+    if (peek(p) != ':') {
+      parse_err(p, "Expected ':' after CASE label.");
+      break;
+    }
+    next(p);
+
+    /* The arm runs until the next label. */
+    begin_block(p);
+    while (peek(p) != TK_kw_otherwise && peek(p) != TK_kw_endcase &&
+           peek(p) != TK_lit_integer && peek(p) != TK_lit_string &&
+           peek(p) != '-' && peek(p) != TK_eof && !p->failed)
+      parse_statement(p);
+    end_block(p);
+    jump_append(p, &end_jmps, emit_br(p));
+  }
+
+  if (!p->failed && !expect_peek(p, TK_kw_endcase))
+    parse_err(p, "Expected ENDCASE keyword.");
+  if (p->failed)
+    goto done;
+
+  patch_br(p, dispatch_jmp);
+  int other = PSEU_NO_JUMP;
+  if (strings == 1)
+    emit_case_strings(p, labels, labels_count, &other);
+  else
+    emit_case_ints(p, labels, labels_count, &other);
+  jump_patch(p, &other, otherwise != -1 ? (u16)otherwise : p->code_count);
+  jump_patch(p, &end_jmps, p->code_count);
+
   next(p);
-  parse_expr(p);
-  emit_st_local(p, ident.pos, ident.len);
+
+  if (peek(p) != TK_newline && peek(p) != TK_eof)
+    parse_err(p, "Expected new line or end of file after ENDCASE.");
+
+done:
+  pseu_free(s, labels);
 }
 
-static void parse_if_block(Parser *p)
+/* Parse a WHILE loop; the condition is tested before each iteration. */
+static void parse_while(Parser *p)
 {
   next(p);
-  parse_expr(p);
-  if (!expect_peek(p, TK_kw_then)) {
-    parse_err(p, "Expected THEN keyword.");
-    return;
-  }
 
-  if (!expect_next(p, TK_newline)) {
-    parse_err(p, "Expected new line after THEN keyword.");
+  u16 head = p->code_count;
+  Cond c;
+  parse_cond(p, &c);
+  if (peek(p) == TK_kw_do)
+    next(p);
+
+  if (!expect_peek(p, TK_newline)) {
+    parse_err(p, "Expected new line after WHILE condition.");
     return;
   }
 
   next(p);
 
-  int if_jmp = emit_br_false(p);
-  while (peek(p) != TK_kw_else && peek(p) != TK_kw_endif && peek(p) != TK_eof)
+  begin_block(p);
+  while (peek(p) != TK_kw_endwhile && peek(p) != TK_eof)
     parse_statement(p);
+  end_block(p);
+  emit_br_to(p, head);
+  jump_patch(p, &c.f, p->code_count);
 
-  /* If ELSE, parse else block. */
-  if (peek(p) == TK_kw_else) {
-    if (!expect_next(p, TK_newline)) {
-      parse_err(p, "Expected new line after ELSE keyword.");
-      return;
-    }
-    
-    int else_jmp = emit_br(p);
-    patch_br(p, if_jmp);
-    while (peek(p) != TK_kw_endif && peek(p) != TK_eof)
-      parse_statement(p);
-    patch_br(p, else_jmp);
-  } else {
-    patch_br(p, if_jmp);
+  if (!expect_peek(p, TK_kw_endwhile)) {
+    parse_err(p, "Expected ENDWHILE keyword.");
+    return;
   }
 
   next(p);
 
   if (peek(p) != TK_newline && peek(p) != TK_eof)
-    parse_err(p, "Expected new line or end of file after ENDIF.");
+    parse_err(p, "Expected new line or end of file after ENDWHILE.");
 }
 
 static void parse_statement(Parser *p)
@@ -494,9 +2882,43 @@ static void parse_statement(Parser *p)
   case TK_kw_declare:
     parse_declare(p);
     break;
+  case TK_kw_type:
+    parse_type_decl(p);
+    break;
   case TK_kw_if:
     parse_if_block(p);
     break;
+  case TK_kw_for:
+    parse_for(p);
+    break;
+  case TK_kw_while:
+    parse_while(p);
+    break;
+  case TK_kw_case:
+    parse_case(p);
+    break;
+  case TK_kw_function:
+  case TK_kw_procedure:
+    parse_function(p);
+    break;
+  case TK_kw_return:
+    parse_return(p);
+    break;
+  case TK_kw_call:
+    parse_call_statement(p);
+    break;
+  case TK_kw_openfile:
+    parse_openfile(p);
+    break;
+  case TK_kw_readfile:
+    parse_readfile(p);
+    break;
+  case TK_kw_writefile:
+    parse_writefile(p);
+    break;
+  case TK_kw_closefile:
+    parse_closefile(p);
+    break;
   case TK_identifier:
     parse_assignment(p);
     break;
@@ -519,66 +2941,165 @@ static int parse_root(Parser *p)
   return 0;
 }
 
-int pseu_parse(State *s, Function *fn, const char *src)
+/* Initializes a parser of a function body; the lexer is set up by the
+ * caller.
+ */
+static int parser_init(Parser *p, State *s, Function *fn)
 {
-  Parser p;	
-  if (pseu_lex_init(s, &p.lex, src))
+  p->fn = fn;
+  p->failed = 0;
+  p->scope = 0;
+  p->max_stack  = 0;
+  p->code_count = 0;
+  p->code_size  = 16;
+  p->calls[0] = 0;
+  p->calls[1] = 0;
+
+  if (pseu_vec_init(s, &p->code, p->code_size, BCode))
     goto fail;
 
-  p.fn = fn;
-  p.failed = 0;
-  p.scope = 0;
-  p.max_stack  = 0;
-  p.code_count = 0;
-  p.code_size  = 16;
+  p->consts_count = 0;
+  p->consts_size  = 8;
 
-  if (pseu_vec_init(s, &p.code, p.code_size, BCode))
-    goto fail;
+  if (pseu_vec_init(s, &p->consts, p->consts_size, Value))
+    goto fail_code;
 
-  p.consts_count = 0;
-  p.consts_size  = 8;
+  p->vars_count = 0;
+  p->vars_size  = 8;
+  p->values_count = 0;
+  p->slots_count = 0;
 
-  if (pseu_vec_init(s, &p.consts, p.consts_size, Value))
-    goto fail_code;
+  p->next_block = 1;
+  p->blocks_count = 1;
+  p->blocks[0] = 0;
+  p->loops_count = 0;
+  p->expr = NULL;
+  p->body = false;
+  p->own_args = false;
 
-  p.vars_count = 0;
-  p.vars_size  = 8;
+  p->sites_count = 0;
+  p->sites_size  = 8;
 
-  if (pseu_vec_init(s, &p.vars, p.vars_size, Local))
+  if (pseu_vec_init(s, &p->vars, p->vars_size, Local))
     goto fail_consts;
+  if (pseu_vec_init(s, &p->sites, p->sites_size, Site))
+    goto fail_vars;
+  return 0;
 
-  next(&p);
+fail_vars:
+  pseu_free(s, p->vars);
+fail_consts:
+  pseu_free(s, p->consts);
+fail_code:
+  pseu_free(s, p->code);
+fail:
+  return 1;
+}
 
-  if (parse_root(&p))
-    goto fail_vars;
+/* Makes the sites of the locals which do not escape allocate in the frame
+ * region. Every use of such a local reads or writes it in place, copies it,
+ * or passes it to a C function which does not keep it.
+ */
+static void patch_sites(Parser *p)
+{
+  for (size i = 0; i < p->sites_count; i++) {
+    Site *site = &p->sites[i];
+    BCode *op = &p->code[site->offset];
+
+    if (p->vars[site->local].escapes > 0)
+      continue;
+    if (*op == OP_NEW_ARRAY)
+      *op = OP_NEW_ARRAY_FRAME;
+    else if (*op == OP_NEW_RECORD)
+      *op = OP_NEW_RECORD_FRAME;
+    else if (*op == OP_COPY_RECORD)
+      *op = OP_COPY_RECORD_FRAME;
+  }
+}
+
+/* Returns the initial values of the locals held as Values which are not
+ * parameters, or NULL if there are none.
+ */
+static Value *frame_image(Parser *p)
+{
+  State *s = p->lex.state;
+
+  /* Parameters are the first locals and take the first slots. */
+  size params = 0;
+  while (params < p->vars_count && p->vars[params].pass != PASS_NONE)
+    params++;
+  if (p->values_count == params)
+    return NULL;
+
+  Value *result = pseu_alloc(s, (p->values_count - params) * sizeof(Value));
+  for (size i = params; i < p->vars_count; i++) {
+    Local *lcl = &p->vars[i];
+    if (lcl->raw != VAL_NIL)
+      continue;
+
+    if (lcl->type && t_isstring(s, lcl->type))
+      result[lcl->slot - params] = v_obj((Object *)V(s)->empty_string);
+    else
+      result[lcl->slot - params] = (Value) { 0 };
+  }
+  return result;
+}
+
+/* Moves the code, constants and locals of the parser into its function. */
+static void parser_finish(Parser *p)
+{
+  State *s = p->lex.state;
+  Function *fn = p->fn;
+
+  if (!p->failed)
+    patch_sites(p);
+  pseu_free(s, p->sites);
 
   fn->type  = FN_PSEU;
-  fn->ident = NULL;
-  fn->params_count = 0;
-  fn->param_types  = NULL;
-  fn->return_type  = NULL;
-  fn->as.pseu.code = p.code;
-  fn->as.pseu.code_count = p.code_count;
-  fn->as.pseu.consts = p.consts;
-  fn->as.pseu.const_count = p.consts_count;
-  fn->as.pseu.locals = p.vars_count > 0 ? pseu_alloc(s, p.vars_count * sizeof(Type *)) : NULL;
-  fn->as.pseu.local_count = p.vars_count;
-  fn->as.pseu.max_stack = p.max_stack;
+  fn->as.pseu.code = p->code;
+  fn->as.pseu.code_count = p->code_count;
+  fn->as.pseu.words = NULL;
+  fn->as.pseu.consts = p->consts;
+  fn->as.pseu.const_count = p->consts_count;
+  fn->as.pseu.locals = p->values_count > 0 ? pseu_alloc(s, p->values_count * sizeof(Type *)) : NULL;
+  fn->as.pseu.local_count = p->values_count;
+  fn->as.pseu.slot_count = p->slots_count;
+  fn->as.pseu.frame = frame_image(p);
+  fn->as.pseu.max_stack = p->max_stack;
 
-  for (size i = 0; i < fn->as.pseu.local_count; i++)
-    fn->as.pseu.locals[i] = p.vars[i].type;
+  for (size i = 0; i < p->vars_count; i++) {
+    if (p->vars[i].raw == VAL_NIL)
+      fn->as.pseu.locals[p->vars[i].slot] = p->vars[i].type;
+  }
+  pseu_free(s, p->vars);
 
+  if (!p->failed)
+    pseu_optimize(s, fn);
   if (pseu_config_flag(s, PSEU_CONFIG_DUMP_FUNCTION))
     pseu_dump_function(s, stdout, fn);
+}
+
+int pseu_parse(State *s, Function *fn, const char *src)
+{
+  Parser p;	
 
-  return p.failed;
+  /* Owns nothing until parsed; see pseu_function_free(). */
+  fn->type = FN_PSEU;
+  fn->ident = NULL;
+  fn->params_count = 0;
+  fn->param_types  = NULL;
+  fn->param_elems  = NULL;
+  fn->byref        = 0;
+  fn->return_type  = NULL;
+  fn->as.pseu = (FunctionPseu) { 0 };
 
-fail_vars:
-  pseu_free(s, p.vars);
-fail_consts:
-  pseu_free(s, p.consts);
-fail_code:
-  pseu_free(s, p.code);
-fail:
-  return 1;
+  if (pseu_lex_init(s, &p.lex, src))
+    return 1;
+  if (parser_init(&p, s, fn))
+    return 1;
+
+  next(&p);
+  parse_root(&p);
+  parser_finish(&p);
+  return p.failed || p.lex.failed;
 }
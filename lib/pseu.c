@@ -13,6 +13,13 @@ static void default_print(VM *vm, const char *text)
   printf("%s", text);
 }
 
+/* Default write function of the pseu virtual machine. */
+static void default_write(VM *vm, const char *ptr, size_t len)
+{
+  pseu_unused(vm);
+  fwrite(ptr, 1, len, stdout);
+}
+
 /* Default alloc function of the pseu virtual machine. */
 static void *default_alloc(VM *vm, size_t size) 
 {
@@ -47,8 +54,11 @@ static void default_panic(VM *vm, const char *message)
  */
 static void config_init_default(PseuConfig *config) 
 {
+  config->flags = 0;
+  config->gc = NULL;
   config->panic = default_panic;
   config->print = default_print;
+  config->write = default_write;
   config->alloc = default_alloc;
   config->realloc = default_realloc;
   config->free = default_free;
@@ -78,6 +88,10 @@ PseuVM *pseu_vm_new(PseuConfig *config)
   // XXX
   vm->data  = NULL;
   vm->error = NULL;
+  vm->strings = (StringTable) { 0 };
+  vm->empty_string = NULL;
+  vm->files = NULL;
+  pseu_gc_init(vm);
   vm->state = pseu_state_new(vm);
 
   if (!vm->state)
@@ -97,18 +111,34 @@ int pseu_vm_eval(PseuVM *vm, const char *src)
   assert(vm && src);
 
   Function fn;
-  if (pseu_parse(vm->state, &fn, src))
-    return PSEU_RESULT_ERROR;
-  if (pseu_call(vm->state, &fn))
-    return PSEU_RESULT_ERROR;
-  return PSEU_RESULT_SUCCESS;
+  int result = PSEU_RESULT_SUCCESS;
+  if (pseu_parse(vm->state, &fn, src) || pseu_call(vm->state, &fn))
+    result = PSEU_RESULT_ERROR;
+
+  /* Only reachable from here; the GC never sees it. */
+  pseu_function_free(vm->state, &fn);
+
+  pseu_flush(vm->state);
+  return result;
 }
 
 void pseu_vm_free(PseuVM *vm)
 {
   /* TODO: Free the other stuff as well. */
-  if (vm)
+  if (vm && vm->state) {
+    for (size i = 0; i < vm->fns_count; i++) {
+      if (vm->fns[i].type == FN_PSEU)
+        pseu_function_free(vm->state, &vm->fns[i]);
+    }
+    pseu_gc_free(vm->state);
     pseu_state_free(vm->state);
+  }
+}
+
+void pseu_vm_flush(PseuVM *vm)
+{
+  assert(vm);
+  pseu_flush(vm->state);
 }
 
 void pseu_vm_set_data(PseuVM *vm, void *data)
@@ -122,3 +152,133 @@ void *pseu_vm_get_data(PseuVM *vm)
   assert(vm);
   return vm->data;
 }
+
+void pseu_vm_heap_stats(PseuVM *vm, PseuHeapStats *stats)
+{
+  assert(vm && stats);
+  *stats = vm->gc.stats;
+}
+
+int pseu_vm_get_function(PseuVM *vm, const char *ident)
+{
+  assert(vm && ident);
+
+  u16 index = pseu_get_function(vm, ident, strlen(ident));
+  if (index == PSEU_INVALID_FUNC || vm->fns[index].type != FN_PSEU)
+    return PSEU_INVALID_FUNCTION;
+  return index;
+}
+
+/* Pushes `v`; returns one of pseu_result. */
+static int push(PseuVM *vm, Value v)
+{
+  return pseu_push(vm->state, &v) ? PSEU_RESULT_ERROR : PSEU_RESULT_SUCCESS;
+}
+
+int pseu_vm_push_boolean(PseuVM *vm, bool value)
+{
+  assert(vm);
+  return push(vm, v_bool(value));
+}
+
+int pseu_vm_push_integer(PseuVM *vm, int32_t value)
+{
+  assert(vm);
+  return push(vm, v_i32(value));
+}
+
+int pseu_vm_push_real(PseuVM *vm, float value)
+{
+  assert(vm);
+  return push(vm, v_f32(value));
+}
+
+int pseu_vm_push_string(PseuVM *vm, const char *chars, size_t length)
+{
+  assert(vm && (chars || length == 0));
+
+  if (length > UINT32_MAX)
+    return PSEU_RESULT_ERROR;
+
+  String *str = string_new(vm->state, chars, (u32)length);
+  return push(vm, v_obj((Object *)str));
+}
+
+int pseu_vm_call(PseuVM *vm, int fn)
+{
+  assert(vm);
+
+  State *s = vm->state;
+  if (fn < 0 || fn >= vm->fns_count || vm->fns[fn].type != FN_PSEU)
+    return PSEU_RESULT_ERROR;
+  if (s->sp - s->stack < vm->fns[fn].params_count)
+    return PSEU_RESULT_ERROR;
+
+  if (pseu_call(s, &vm->fns[fn]))
+    return PSEU_RESULT_ERROR;
+  return PSEU_RESULT_SUCCESS;
+}
+
+/* Returns the value on top of the stack or NULL if it is empty. */
+static Value *top(PseuVM *vm)
+{
+  State *s = vm->state;
+  return s->sp > s->stack ? s->sp - 1 : NULL;
+}
+
+int pseu_vm_pop_boolean(PseuVM *vm, bool *o)
+{
+  assert(vm && o);
+
+  Value *v = top(vm);
+  if (!v || !v_isbool(v))
+    return PSEU_RESULT_ERROR;
+
+  *o = v_asbool(v);
+  vm->state->sp--;
+  return PSEU_RESULT_SUCCESS;
+}
+
+int pseu_vm_pop_integer(PseuVM *vm, int32_t *o)
+{
+  assert(vm && o);
+
+  Value *v = top(vm);
+  if (!v || !v_isi32(v))
+    return PSEU_RESULT_ERROR;
+
+  *o = v_asi32(v);
+  vm->state->sp--;
+  return PSEU_RESULT_SUCCESS;
+}
+
+int pseu_vm_pop_real(PseuVM *vm, float *o)
+{
+  assert(vm && o);
+
+  Value *v = top(vm);
+  if (!v || !v_isnum(v))
+    return PSEU_RESULT_ERROR;
+
+  *o = v_isf32(v) ? v_asf32(v) : v_i2f(v);
+  vm->state->sp--;
+  return PSEU_RESULT_SUCCESS;
+}
+
+int pseu_vm_pop_string(PseuVM *vm, const char **chars, size_t *length)
+{
+  assert(vm && chars && length);
+
+  Value *v = top(vm);
+  if (!v || !v_isstr(vm->state, v))
+    return PSEU_RESULT_ERROR;
+
+  const char *c = string_chars(vm->state, v_asstr(v));
+  if (!c)
+    return PSEU_RESULT_ERROR;
+
+  *chars = c;
+  *length = v_asstr(v)->length;
+  vm->state->sp--;
+  return PSEU_RESULT_SUCCESS;
+}
@@ -0,0 +1,565 @@
+#include "vm.h"
+#include "obj.h"
+
+/* Arrays shorter than this are sorted by insertion. */
+#define PSEU_SORT_INSERTION_MAX 24
+/* Partitions larger than this pick their pivot with Tukey's ninther. */
+#define PSEU_SORT_NINTHER_MIN 128
+/* Number of moves a partial insertion sort may make before giving up. */
+#define PSEU_SORT_PARTIAL_MAX 8
+/* Integer arrays shorter than this are not worth the radix histograms. */
+#define PSEU_SORT_RADIX_MIN 256
+
+/* == Pattern-defeating quicksort. */
+
+/* Defines `static void N(T *a, size n)`, which sorts `a` by the strict weak
+ * order LESS(x, y), a function, with pdqsort: an introsort which detects sorted runs and
+ * runs of equal elements, and falls back to heapsort on bad partitions.
+ */
+#define PSEU_DEF_PDQSORT(N, T, LESS)                                           \
+  static void N##_swap(T *x, T *y)                                            \
+  {                                                                           \
+    T t = *x;                                                                 \
+    *x = *y;                                                                  \
+    *y = t;                                                                   \
+  }                                                                           \
+                                                                              \
+  static void N##_sort2(T *x, T *y)                                           \
+  {                                                                           \
+    if (LESS(*y, *x))                                                         \
+      N##_swap(x, y);                                                         \
+  }                                                                           \
+                                                                              \
+  static void N##_sort3(T *x, T *y, T *z)                                     \
+  {                                                                           \
+    N##_sort2(x, y);                                                          \
+    N##_sort2(y, z);                                                          \
+    N##_sort2(x, y);                                                          \
+  }                                                                           \
+                                                                              \
+  static void N##_insertion(T *begin, T *end)                                 \
+  {                                                                           \
+    if (begin == end)                                                         \
+      return;                                                                 \
+    for (T *cur = begin + 1; cur != end; cur++) {                             \
+      if (!LESS(*cur, cur[-1]))                                               \
+        continue;                                                             \
+      T t = *cur;                                                             \
+      T *sift = cur;                                                          \
+      do {                                                                    \
+        *sift = sift[-1];                                                     \
+        sift--;                                                               \
+      } while (sift != begin && LESS(t, sift[-1]));                           \
+      *sift = t;                                                              \
+    }                                                                         \
+  }                                                                           \
+                                                                              \
+  /* Insertion sort which relies on begin[-1] not being greater than any    \
+   * element of the range. */                                                 \
+  static void N##_insertion_unguarded(T *begin, T *end)                       \
+  {                                                                           \
+    for (T *cur = begin + 1; cur < end; cur++) {                              \
+      if (!LESS(*cur, cur[-1]))                                               \
+        continue;                                                             \
+      T t = *cur;                                                             \
+      T *sift = cur;                                                          \
+      do {                                                                    \
+        *sift = sift[-1];                                                     \
+        sift--;                                                               \
+      } while (LESS(t, sift[-1]));                                            \
+      *sift = t;                                                              \
+    }                                                                         \
+  }                                                                           \
+                                                                              \
+  /* Insertion sort which gives up once it has made too many moves. */       \
+  static bool N##_insertion_partial(T *begin, T *end)                         \
+  {                                                                           \
+    size moves = 0;                                                           \
+    if (begin == end)                                                         \
+      return true;                                                            \
+    for (T *cur = begin + 1; cur != end; cur++) {                             \
+      if (!LESS(*cur, cur[-1]))                                               \
+        continue;                                                             \
+      T t = *cur;                                                             \
+      T *sift = cur;                                                          \
+      do {                                                                    \
+        *sift = sift[-1];                                                     \
+        sift--;                                                               \
+      } while (sift != begin && LESS(t, sift[-1]));                           \
+      *sift = t;                                                              \
+      moves += (size)(cur - sift);                                            \
+      if (moves > PSEU_SORT_PARTIAL_MAX)                                      \
+        return false;                                                         \
+    }                                                                         \
+    return true;                                                              \
+  }                                                                           \
+                                                                              \
+  static void N##_sift_down(T *a, size i, size n)                             \
+  {                                                                           \
+    T t = a[i];                                                               \
+    for (size child; (child = 2 * i + 1) < n; i = child) {                    \
+      if (child + 1 < n && LESS(a[child], a[child + 1]))                      \
+        child++;                                                              \
+      if (!LESS(t, a[child]))                                                 \
+        break;                                                                \
+      a[i] = a[child];                                                        \
+    }                                                                         \
+    a[i] = t;                                                                 \
+  }                                                                           \
+                                                                              \
+  static void N##_heapsort(T *begin, T *end)                                  \
+  {                                                                           \
+    size n = (size)(end - begin);                                             \
+    for (size i = n / 2; i-- > 0; )                                           \
+      N##_sift_down(begin, i, n);                                             \
+    while (n > 1) {                                                           \
+      N##_swap(begin, begin + --n);                                           \
+      N##_sift_down(begin, 0, n);                                             \
+    }                                                                         \
+  }                                                                           \
+                                                                              \
+  /* Partitions around the pivot in *begin, putting elements equal to it on   \
+   * the right; *end is known to be not less than the pivot. */               \
+  static T *N##_partition_right(T *begin, T *end, bool *done)                 \
+  {                                                                           \
+    T pivot = *begin;                                                         \
+    T *first = begin;                                                         \
+    T *last = end;                                                            \
+                                                                              \
+    while (LESS(*++first, pivot))                                             \
+      ;                                                                       \
+    if (first - 1 == begin)                                                   \
+      while (first < last && !LESS(*--last, pivot))                           \
+        ;                                                                     \
+    else                                                                      \
+      while (!LESS(*--last, pivot))                                           \
+        ;                                                                     \
+                                                                              \
+    /* Nothing to swap; the range may already be sorted. */                  \
+    *done = first >= last;                                                    \
+    while (first < last) {                                                    \
+      N##_swap(first, last);                                                  \
+      while (LESS(*++first, pivot))                                           \
+        ;                                                                     \
+      while (!LESS(*--last, pivot))                                           \
+        ;                                                                     \
+    }                                                                         \
+                                                                              \
+    T *pos = first - 1;                                                       \
+    *begin = *pos;                                                            \
+    *pos = pivot;                                                             \
+    return pos;                                                               \
+  }                                                                           \
+                                                                              \
+  /* Partitions around the pivot in *begin, putting elements equal to it on   \
+   * the left; used when the pivot equals the element before the range. */    \
+  static T *N##_partition_left(T *begin, T *end)                              \
+  {                                                                           \
+    T pivot = *begin;                                                         \
+    T *first = begin;                                                         \
+    T *last = end;                                                            \
+                                                                              \
+    while (LESS(pivot, *--last))                                              \
+      ;                                                                       \
+    if (last + 1 == end)                                                      \
+      while (first < last && !LESS(pivot, *++first))                          \
+        ;                                                                     \
+    else                                                                      \
+      while (!LESS(pivot, *++first))                                          \
+        ;                                                                     \
+                                                                              \
+    while (first < last) {                                                    \
+      N##_swap(first, last);                                                  \
+      while (LESS(pivot, *--last))                                            \
+        ;                                                                     \
+      while (!LESS(pivot, *++first))                                          \
+        ;                                                                     \
+    }                                                                         \
+                                                                              \
+    *begin = *last;                                                           \
+    *last = pivot;                                                            \
+    return last;                                                              \
+  }                                                                           \
+                                                                              \
+  /* Breaks patterns in a partition which came out too unbalanced. */         \
+  static void N##_shuffle(T *begin, T *end)                                   \
+  {                                                                           \
+    size n = (size)(end - begin);                                             \
+    if (n < PSEU_SORT_INSERTION_MAX)                                          \
+      return;                                                                 \
+    N##_swap(begin, begin + n / 4);                                           \
+    N##_swap(end - 1, end - n / 4);                                           \
+    if (n > PSEU_SORT_NINTHER_MIN) {                                          \
+      N##_swap(begin + 1, begin + (n / 4 + 1));                               \
+      N##_swap(begin + 2, begin + (n / 4 + 2));                               \
+      N##_swap(end - 2, end - (n / 4 + 1));                                   \
+      N##_swap(end - 3, end - (n / 4 + 2));                                   \
+    }                                                                         \
+  }                                                                           \
+                                                                              \
+  static void N##_loop(T *begin, T *end, int bad_allowed, bool leftmost)      \
+  {                                                                           \
+    for (;;) {                                                                \
+      size n = (size)(end - begin);                                           \
+      if (n < PSEU_SORT_INSERTION_MAX) {                                      \
+        if (leftmost)                                                         \
+          N##_insertion(begin, end);                                          \
+        else                                                                  \
+          N##_insertion_unguarded(begin, end);                                \
+        return;                                                               \
+      }                                                                       \
+                                                                              \
+      /* Move the median of three, or of the ninther, into *begin. */         \
+      size half = n / 2;                                                      \
+      if (n > PSEU_SORT_NINTHER_MIN) {                                        \
+        N##_sort3(begin, begin + half, end - 1);                              \
+        N##_sort3(begin + 1, begin + (half - 1), end - 2);                    \
+        N##_sort3(begin + 2, begin + (half + 1), end - 3);                    \
+        N##_sort3(begin + (half - 1), begin + half, begin + (half + 1));      \
+        N##_swap(begin, begin + half);                                        \
+      } else {                                                                \
+        N##_sort3(begin + half, begin, end - 1);                              \
+      }                                                                       \
+                                                                              \
+      /* The pivot equals its predecessor: skip the run of equal elements. */ \
+      if (!leftmost && !LESS(begin[-1], *begin)) {                            \
+        begin = N##_partition_left(begin, end) + 1;                           \
+        continue;                                                             \
+      }                                                                       \
+                                                                              \
+      bool done;                                                              \
+      T *pos = N##_partition_right(begin, end, &done);                        \
+      size l = (size)(pos - begin);                                           \
+      size r = (size)(end - (pos + 1));                                       \
+                                                                              \
+      if (l < n / 8 || r < n / 8) {                                           \
+        if (--bad_allowed == 0) {                                             \
+          N##_heapsort(begin, end);                                           \
+          return;                                                             \
+        }                                                                     \
+        N##_shuffle(begin, pos);                                              \
+        N##_shuffle(pos + 1, end);                                            \
+      } else if (done && N##_insertion_partial(begin, pos) &&                 \
+                 N##_insertion_partial(pos + 1, end)) {                       \
+        return;                                                               \
+      }                                                                       \
+                                                                              \
+      N##_loop(begin, pos, bad_allowed, leftmost);                            \
+      begin = pos + 1;                                                        \
+      leftmost = false;                                                       \
+    }                                                                         \
+  }                                                                           \
+                                                                              \
+  static void N(T *a, size n)                                                 \
+  {                                                                           \
+    int depth = 0;                                                            \
+    for (size m = n; m > 1; m >>= 1)                                          \
+      depth++;                                                                \
+    N##_loop(a, a + n, depth + 1, true);                                      \
+  }
+
+static inline bool less_i32(i32 x, i32 y)
+{
+  return x < y;
+}
+
+/* NaNs order after every other real so the order stays strict weak. */
+static inline bool less_f32(f32 x, f32 y)
+{
+  return x < y || (y != y && x == x);
+}
+
+/* Strings are flattened beforehand; NIL elements order first. */
+static inline bool less_str(Value x, Value y)
+{
+  if (!v_isobj(&x) || !v_isobj(&y))
+    return v_isobj(&y) && !v_isobj(&x);
+
+  const String *a = v_asstr(&x);
+  const String *b = v_asstr(&y);
+  u32 len = a->length < b->length ? a->length : b->length;
+  int o = memcmp(a->chars, b->chars, len);
+  return o < 0 || (o == 0 && a->length < b->length);
+}
+
+/* Keys of the elements of an array of records, along with the index of the
+ * element; ties order by index so the sort is stable.
+ */
+typedef struct KeyI32 { i32 key; u32 index; } KeyI32;
+typedef struct KeyF32 { f32 key; u32 index; } KeyF32;
+typedef struct KeyStr { Value key; u32 index; } KeyStr;
+
+static inline bool less_key_i32(KeyI32 x, KeyI32 y)
+{
+  return x.key < y.key || (x.key == y.key && x.index < y.index);
+}
+
+static inline bool less_key_f32(KeyF32 x, KeyF32 y)
+{
+  return less_f32(x.key, y.key) || (!less_f32(y.key, x.key) && x.index < y.index);
+}
+
+static inline bool less_key_str(KeyStr x, KeyStr y)
+{
+  return less_str(x.key, y.key) || (!less_str(y.key, x.key) && x.index < y.index);
+}
+
+PSEU_DEF_PDQSORT(pdqsort_i32, i32, less_i32)
+PSEU_DEF_PDQSORT(pdqsort_f32, f32, less_f32)
+PSEU_DEF_PDQSORT(pdqsort_str, Value, less_str)
+PSEU_DEF_PDQSORT(pdqsort_key_i32, KeyI32, less_key_i32)
+PSEU_DEF_PDQSORT(pdqsort_key_f32, KeyF32, less_key_f32)
+PSEU_DEF_PDQSORT(pdqsort_key_str, KeyStr, less_key_str)
+
+/* == Radix sort. */
+
+/* Sorts packed integers with a least significant digit radix sort over their
+ * four bytes; a byte which is the same in every key skips its pass.
+ */
+static int radix_sort_i32(State *s, i32 *a, u32 n)
+{
+  u32 counts[4][256] = { { 0 } };
+  for (u32 i = 0; i < n; i++) {
+    /* Flip the sign bit so keys order as unsigned. */
+    u32 k = (u32)a[i] ^ 0x80000000u;
+    counts[0][k & 0xff]++;
+    counts[1][(k >> 8) & 0xff]++;
+    counts[2][(k >> 16) & 0xff]++;
+    counts[3][k >> 24]++;
+  }
+
+  i32 *tmp = pseu_alloc_nt(s, i32, n);
+  if (pseu_unlikely(!tmp))
+    return pseu_error(s, "Out of memory");
+
+  i32 *src = a;
+  i32 *dst = tmp;
+  u32 k0 = (u32)a[0] ^ 0x80000000u;
+  for (u32 pass = 0; pass < 4; pass++) {
+    u32 shift = pass * 8;
+    u32 *count = counts[pass];
+    if (count[(k0 >> shift) & 0xff] == n)
+      continue;
+
+    u32 offset = 0;
+    for (u32 d = 0; d < 256; d++) {
+      u32 c = count[d];
+      count[d] = offset;
+      offset += c;
+    }
+    for (u32 i = 0; i < n; i++) {
+      u32 k = (u32)src[i] ^ 0x80000000u;
+      dst[count[(k >> shift) & 0xff]++] = src[i];
+    }
+
+    i32 *t = src;
+    src = dst;
+    dst = t;
+  }
+
+  if (src != a)
+    memcpy(a, src, (size)n * sizeof(i32));
+  pseu_free(s, tmp);
+  return 0;
+}
+
+/* == Arrays. */
+
+/* Moves all the set bits of a boolean array to its end. */
+static void sort_bits(Array *a)
+{
+  u32 trues = 0;
+  for (u32 i = 0; i < a->length; i++)
+    trues += a_getbit(a, i);
+  for (u32 i = 0; i < a->length; i++)
+    a_setbit(a, i, i >= a->length - trues);
+}
+
+int array_sort(State *s, Array *a)
+{
+  if (a->dims != 1)
+    return pseu_error(s, "Cannot SORT an array with more than one dimension");
+  if (a->length < 2)
+    return 0;
+
+  switch (a->kind) {
+  case ARR_I32:
+    if (a->length < PSEU_SORT_RADIX_MIN) {
+      pdqsort_i32(a->items.i32s, a->length);
+      return 0;
+    }
+    return radix_sort_i32(s, a->items.i32s, a->length);
+
+  case ARR_F32:
+    pdqsort_f32(a->items.f32s, a->length);
+    return 0;
+
+  case ARR_BOOL:
+    sort_bits(a);
+    return 0;
+
+  case ARR_RECORD:
+    return pseu_error(s, "Cannot SORT an array of records; use SORTBY");
+
+  default:
+    /* Flatten the strings up front so comparisons cannot fail. */
+    for (u32 i = 0; i < a->length; i++) {
+      Value *v = &a->items.values[i];
+      if (v_isnil(v))
+        continue;
+      if (!v_isstr(s, v))
+        return pseu_error(s, "Cannot SORT an array of this type");
+      if (!string_chars(s, v_asstr(v)))
+        return 1;
+    }
+    pdqsort_str(a->items.values, a->length);
+    return 0;
+  }
+}
+
+/* Sorts the keys of the elements of an array of records by the column `key`
+ * and stores the resulting order of the elements in `perm`.
+ */
+static int sort_keys(State *s, Array *key, u32 n, u32 *perm)
+{
+  switch (key->kind) {
+  case ARR_I32:
+  case ARR_BOOL: {
+    KeyI32 *keys = pseu_alloc_nt(s, KeyI32, n);
+    if (pseu_unlikely(!keys))
+      return pseu_error(s, "Out of memory");
+    for (u32 i = 0; i < n; i++) {
+      keys[i].key = key->kind == ARR_I32 ? key->items.i32s[i] : (i32)a_getbit(key, i);
+      keys[i].index = i;
+    }
+    pdqsort_key_i32(keys, n);
+    for (u32 i = 0; i < n; i++)
+      perm[i] = keys[i].index;
+    pseu_free(s, keys);
+    return 0;
+  }
+
+  case ARR_F32: {
+    KeyF32 *keys = pseu_alloc_nt(s, KeyF32, n);
+    if (pseu_unlikely(!keys))
+      return pseu_error(s, "Out of memory");
+    for (u32 i = 0; i < n; i++) {
+      keys[i].key = key->items.f32s[i];
+      keys[i].index = i;
+    }
+    pdqsort_key_f32(keys, n);
+    for (u32 i = 0; i < n; i++)
+      perm[i] = keys[i].index;
+    pseu_free(s, keys);
+    return 0;
+  }
+
+  default: {
+    /* Flatten the strings up front so comparisons cannot fail. */
+    for (u32 i = 0; i < n; i++) {
+      Value *v = &key->items.values[i];
+      if (v_isnil(v))
+        continue;
+      if (!v_isstr(s, v))
+        return pseu_error(s, "Cannot SORT by a field of this type");
+      if (!string_chars(s, v_asstr(v)))
+        return 1;
+    }
+
+    KeyStr *keys = pseu_alloc_nt(s, KeyStr, n);
+    if (pseu_unlikely(!keys))
+      return pseu_error(s, "Out of memory");
+    for (u32 i = 0; i < n; i++) {
+      keys[i].key = key->items.values[i];
+      keys[i].index = i;
+    }
+    pdqsort_key_str(keys, n);
+    for (u32 i = 0; i < n; i++)
+      perm[i] = keys[i].index;
+    pseu_free(s, keys);
+    return 0;
+  }
+  }
+}
+
+/* Reorders the first `n` elements of column `c` so that element `i` becomes
+ * element `perm[i]`, through the scratch block `tmp`.
+ */
+static void permute_column(Array *c, const u32 *perm, u32 n, void *tmp)
+{
+  switch (c->kind) {
+  case ARR_I32: {
+    i32 *t = tmp;
+    for (u32 i = 0; i < n; i++)
+      t[i] = c->items.i32s[perm[i]];
+    break;
+  }
+  case ARR_F32: {
+    f32 *t = tmp;
+    for (u32 i = 0; i < n; i++)
+      t[i] = c->items.f32s[perm[i]];
+    break;
+  }
+  case ARR_BOOL: {
+    u32 *t = tmp;
+    memset(t, 0, array_bytes(ARR_BOOL, n));
+    for (u32 i = 0; i < n; i++)
+      t[i >> 5] |= (u32)a_getbit(c, perm[i]) << (i & 31);
+    break;
+  }
+  default: {
+    Value *t = tmp;
+    for (u32 i = 0; i < n; i++)
+      t[i] = c->items.values[perm[i]];
+    break;
+  }
+  }
+  memcpy(c->items.ptr, tmp, array_bytes(c->kind, n));
+}
+
+int array_sort_by(State *s, Array *a, String *field)
+{
+  if (a->kind != ARR_RECORD)
+    return pseu_error(s, "Expected an array of records");
+  if (a->dims != 1)
+    return pseu_error(s, "Cannot SORT an array with more than one dimension");
+
+  const char *ident = string_chars(s, field);
+  if (!ident)
+    return 1;
+
+  Type *type = a->record;
+  u8 slot = 0;
+  while (slot < type->fields_count &&
+         (strlen(type->fields[slot].ident) != field->length ||
+          memcmp(type->fields[slot].ident, ident, field->length) != 0))
+    slot++;
+  if (slot == type->fields_count)
+    return pseu_error(s, "Unknown field of the record TYPE");
+  if (t_isrecord(type->fields[slot].type))
+    return pseu_error(s, "Cannot SORT by a field of this type");
+
+  u32 n = a->length;
+  if (n < 2)
+    return 0;
+
+  /* The elements are sorted as a permutation which is then applied to every
+   * column, so records are never gathered. */
+  u32 *perm = pseu_alloc_nt(s, u32, n);
+  void *tmp = pseu_alloc_nt(s, Value, n);
+  if (pseu_unlikely(!perm || !tmp)) {
+    pseu_free(s, perm);
+    pseu_free(s, tmp);
+    return pseu_error(s, "Out of memory");
+  }
+
+  int result = sort_keys(s, a->items.columns[slot], n, perm);
+  if (result == 0) {
+    for (u8 k = 0; k < type->fields_count; k++)
+      permute_column(a->items.columns[k], perm, n, tmp);
+  }
+
+  pseu_free(s, perm);
+  pseu_free(s, tmp);
+  return result;
+}
@@ -0,0 +1,592 @@
+#include "vm.h"
+#include "obj.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PSEU_STR_SSE2
+#endif
+
+/* AVX2 kernels are compiled for their own target and selected at runtime. */
+#if defined(PSEU_STR_SSE2) && defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define PSEU_STR_AVX2
+#define PSEU_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Initial number of slots of the intern table. */
+#define PSEU_STR_TABLE_INIT_SIZE 64
+/* Initial capacity of the stack used to flatten ropes. */
+#define PSEU_STR_FLATTEN_INIT_SIZE 16
+
+/* Marks a removed slot in the intern table. */
+static String tombstone;
+
+/* == Kernels. */
+
+/* Returns the offset of the first occurrence of `n` in `h` or -1. */
+static i64 find_scalar(const char *h, size hl, const char *n, size nl)
+{
+  for (size i = 0; i + nl <= hl; i++) {
+    if (h[i] == n[0] && memcmp(h + i, n, nl) == 0)
+      return (i64)i;
+  }
+  return -1;
+}
+
+/* Flips the case of the ASCII letters in [lo, hi] of `src` into `dst`. */
+static void case_scalar(char *dst, const char *src, size len, char lo, char hi)
+{
+  for (size i = 0; i < len; i++) {
+    char c = src[i];
+    dst[i] = c >= lo && c <= hi ? c ^ 0x20 : c;
+  }
+}
+
+/* Returns the offset of the first differing byte of `a` and `b` or `len`. */
+static size mismatch_scalar(const char *a, const char *b, size len, size i)
+{
+  while (i < len && a[i] == b[i])
+    i++;
+  return i;
+}
+
+#if defined(PSEU_STR_SSE2)
+/* Candidate positions are filtered by comparing the first and last char of
+ * the needle against a block of starting positions at once.
+ */
+static i64 find_sse2(const char *h, size hl, const char *n, size nl)
+{
+  __m128i first = _mm_set1_epi8(n[0]);
+  __m128i last = _mm_set1_epi8(n[nl - 1]);
+  size end = hl - nl + 1;
+  size i = 0;
+
+  for (; i + 16 <= end; i += 16) {
+    __m128i bf = _mm_loadu_si128((const __m128i *)(h + i));
+    __m128i bl = _mm_loadu_si128((const __m128i *)(h + i + nl - 1));
+    u32 mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, first),
+                                               _mm_cmpeq_epi8(bl, last)));
+    while (mask) {
+      size k = i + __builtin_ctz(mask);
+      if (memcmp(h + k, n, nl) == 0)
+        return (i64)k;
+      mask &= mask - 1;
+    }
+  }
+
+  i64 result = find_scalar(h + i, hl - i, n, nl);
+  return result < 0 ? -1 : result + (i64)i;
+}
+
+static void case_sse2(char *dst, const char *src, size len, char lo, char hi)
+{
+  /* Maps [lo, hi] to [-128, -128 + hi - lo] so one signed compare selects
+   * the letters. */
+  __m128i shift = _mm_set1_epi8((char)(-128 - lo));
+  __m128i limit = _mm_set1_epi8((char)(-128 + (hi - lo) + 1));
+  __m128i flip = _mm_set1_epi8(0x20);
+  size i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i m = _mm_cmplt_epi8(_mm_add_epi8(v, shift), limit);
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_xor_si128(v, _mm_and_si128(m, flip)));
+  }
+  case_scalar(dst + i, src + i, len - i, lo, hi);
+}
+
+static size mismatch_sse2(const char *a, const char *b, size len)
+{
+  size i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xFFFF;
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return mismatch_scalar(a, b, len, i);
+}
+
+/* Returns the offset of the first non-ASCII byte from `i` or `len`. */
+static size ascii_sse2(const u8 *s, size len, size i)
+{
+  for (; i + 16 <= len; i += 16) {
+    u32 mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  while (i < len && s[i] < 0x80)
+    i++;
+  return i;
+}
+#endif
+
+#if defined(PSEU_STR_AVX2)
+PSEU_TARGET_AVX2
+static i64 find_avx2(const char *h, size hl, const char *n, size nl)
+{
+  __m256i first = _mm256_set1_epi8(n[0]);
+  __m256i last = _mm256_set1_epi8(n[nl - 1]);
+  size end = hl - nl + 1;
+  size i = 0;
+
+  for (; i + 32 <= end; i += 32) {
+    __m256i bf = _mm256_loadu_si256((const __m256i *)(h + i));
+    __m256i bl = _mm256_loadu_si256((const __m256i *)(h + i + nl - 1));
+    u32 mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(bf, first),
+                                                     _mm256_cmpeq_epi8(bl, last)));
+    while (mask) {
+      size k = i + __builtin_ctz(mask);
+      if (memcmp(h + k, n, nl) == 0)
+        return (i64)k;
+      mask &= mask - 1;
+    }
+  }
+
+  i64 result = find_sse2(h + i, hl - i, n, nl);
+  return result < 0 ? -1 : result + (i64)i;
+}
+
+PSEU_TARGET_AVX2
+static void case_avx2(char *dst, const char *src, size len, char lo, char hi)
+{
+  __m256i shift = _mm256_set1_epi8((char)(-128 - lo));
+  __m256i limit = _mm256_set1_epi8((char)(-128 + (hi - lo) + 1));
+  __m256i flip = _mm256_set1_epi8(0x20);
+  size i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i m = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, shift));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_xor_si256(v, _mm256_and_si256(m, flip)));
+  }
+  case_sse2(dst + i, src + i, len - i, lo, hi);
+}
+
+static bool has_avx2(void)
+{
+  static int result = -1;
+  if (result == -1)
+    result = __builtin_cpu_supports("avx2") != 0;
+  return result;
+}
+#endif
+
+static i64 str_find(const char *h, size hl, const char *n, size nl)
+{
+  if (nl == 0)
+    return 0;
+  if (nl > hl)
+    return -1;
+
+#if defined(PSEU_STR_AVX2)
+  if (has_avx2())
+    return find_avx2(h, hl, n, nl);
+#endif
+#if defined(PSEU_STR_SSE2)
+  return find_sse2(h, hl, n, nl);
+#else
+  return find_scalar(h, hl, n, nl);
+#endif
+}
+
+static void str_case(char *dst, const char *src, size len, char lo, char hi)
+{
+#if defined(PSEU_STR_AVX2)
+  if (has_avx2()) {
+    case_avx2(dst, src, len, lo, hi);
+    return;
+  }
+#endif
+#if defined(PSEU_STR_SSE2)
+  case_sse2(dst, src, len, lo, hi);
+#else
+  case_scalar(dst, src, len, lo, hi);
+#endif
+}
+
+static size str_mismatch(const char *a, const char *b, size len)
+{
+#if defined(PSEU_STR_SSE2)
+  return mismatch_sse2(a, b, len);
+#else
+  return mismatch_scalar(a, b, len, 0);
+#endif
+}
+
+bool string_valid_utf8(const char *chars, size len)
+{
+  const u8 *s = (const u8 *)chars;
+  size i = 0;
+
+  for (;;) {
+#if defined(PSEU_STR_SSE2)
+    i = ascii_sse2(s, len, i);
+#else
+    while (i < len && s[i] < 0x80)
+      i++;
+#endif
+    if (i >= len)
+      return true;
+
+    /* Decode one multi-byte sequence; rejects overlong forms, surrogates and
+     * code points past U+10FFFF. */
+    u8 c = s[i];
+    size n;
+    u32 cp;
+    u32 min;
+    if (c >= 0xC2 && c <= 0xDF)
+      n = 1, cp = c & 0x1F, min = 0x80;
+    else if (c >= 0xE0 && c <= 0xEF)
+      n = 2, cp = c & 0x0F, min = 0x800;
+    else if (c >= 0xF0 && c <= 0xF4)
+      n = 3, cp = c & 0x07, min = 0x10000;
+    else
+      return false;
+
+    if (len - i <= n)
+      return false;
+    for (size k = 1; k <= n; k++) {
+      if ((s[i + k] & 0xC0) != 0x80)
+        return false;
+      cp = (cp << 6) | (s[i + k] & 0x3F);
+    }
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+      return false;
+    i += n + 1;
+  }
+}
+
+/* == Strings. */
+
+u32 string_hash_chars(const char *chars, u32 len)
+{
+  /* FNV-1a. */
+  u32 hash = 2166136261u;
+  for (u32 i = 0; i < len; i++) {
+    hash ^= (u8)chars[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/* Allocates a flat string with `len` uninitialized inline chars. */
+static String *string_alloc(State *s, u32 len)
+{
+  String *result = &pseu_gc_new(s, V(s)->string_type, (size)len + 1)->as.string;
+  result->flags = 0;
+  result->length = len;
+  result->hash = 0;
+  result->chars = result->buffer;
+  result->left = NULL;
+  result->right = NULL;
+  result->buffer[len] = '\0';
+  return result;
+}
+
+String *string_new(State *s, const char *chars, u32 len)
+{
+  String *result = string_alloc(s, len);
+  memcpy(result->buffer, chars, len);
+  return result;
+}
+
+/* Returns the slot of the intern table where a string with the specified
+ * chars is or should be inserted.
+ */
+static String **table_find(StringTable *t, const char *chars, u32 len, u32 hash)
+{
+  String **insert = NULL;
+  u32 mask = t->size - 1;
+
+  for (u32 i = hash & mask;; i = (i + 1) & mask) {
+    String *str = t->slots[i];
+    if (!str)
+      return insert ? insert : &t->slots[i];
+
+    if (str == &tombstone) {
+      if (!insert)
+        insert = &t->slots[i];
+    } else if (str->hash == hash && str->length == len &&
+               memcmp(str->chars, chars, len) == 0) {
+      return &t->slots[i];
+    }
+  }
+}
+
+/* Grows the intern table, dropping its tombstones. */
+static int table_grow(State *s, StringTable *t)
+{
+  u32 size = t->size ? t->size * 2 : PSEU_STR_TABLE_INIT_SIZE;
+  String **slots = pseu_alloc(s, size * sizeof(String *));
+  if (pseu_unlikely(!slots))
+    return 1;
+  memset(slots, 0, size * sizeof(String *));
+
+  StringTable nt = { .count = 0, .size = size, .slots = slots };
+  for (u32 i = 0; i < t->size; i++) {
+    String *str = t->slots[i];
+    if (str && str != &tombstone) {
+      *table_find(&nt, str->chars, str->length, str->hash) = str;
+      nt.count++;
+    }
+  }
+
+  pseu_free(s, t->slots);
+  *t = nt;
+  return 0;
+}
+
+String *string_intern(State *s, const char *chars, u32 len)
+{
+  StringTable *t = &V(s)->strings;
+
+  /* Keep the load factor below 3/4. */
+  if ((t->count + 1) * 4 > t->size * 3 && table_grow(s, t))
+    return NULL;
+
+  u32 hash = string_hash_chars(chars, len);
+  String **slot = table_find(t, chars, len, hash);
+  if (*slot && *slot != &tombstone)
+    return *slot;
+
+  String *result = string_new(s, chars, len);
+  result->flags |= STR_INTERNED | STR_HASHED;
+  result->hash = hash;
+
+  if (!*slot)
+    t->count++;
+  *slot = result;
+  return result;
+}
+
+String *string_concat(State *s, String *a, String *b)
+{
+  if (a->length == 0)
+    return b;
+  if (b->length == 0)
+    return a;
+
+  if (pseu_unlikely(a->length > UINT32_MAX - b->length)) {
+    pseu_error(s, "String is too long");
+    return NULL;
+  }
+  u32 len = a->length + b->length;
+
+  /* Halves of short concatenations are never ropes. */
+  if (len <= PSEU_STR_FLAT_MAX) {
+    String *result = string_alloc(s, len);
+    memcpy(result->buffer, a->chars, a->length);
+    memcpy(result->buffer + a->length, b->chars, b->length);
+    return result;
+  }
+
+  String *result = &pseu_gc_new(s, V(s)->string_type, 0)->as.string;
+  result->flags = STR_ROPE;
+  result->length = len;
+  result->hash = 0;
+  result->chars = NULL;
+  result->left = a;
+  result->right = b;
+  return result;
+}
+
+String *string_slice(State *s, String *str, u32 start, u32 len)
+{
+  /* A window of a file is remapped as it is read, so it is never shared. */
+  if (start == 0 && len == str->length && !s_ismapped(str))
+    return str;
+
+  const char *chars = string_chars(s, str);
+  if (pseu_unlikely(!chars))
+    return NULL;
+  if (len <= PSEU_STR_FLAT_MAX)
+    return string_new(s, chars + start, len);
+
+  /* Slices always reference a string which owns its chars. */
+  String *parent = s_isslice(str) ? str->left : str;
+  String *result = &pseu_gc_new(s, V(s)->string_type, 0)->as.string;
+  result->flags = STR_SLICE;
+  result->length = len;
+  result->hash = 0;
+  result->chars = (char *)chars + start;
+  result->left = parent;
+  result->right = NULL;
+  return result;
+}
+
+/* Returns a copy of the specified string with its ASCII letters in [lo, hi]
+ * flipped to the other case.
+ */
+static String *string_case(State *s, String *str, char lo, char hi)
+{
+  const char *chars = string_chars(s, str);
+  if (pseu_unlikely(!chars))
+    return NULL;
+
+  String *result = string_alloc(s, str->length);
+  str_case(result->buffer, chars, str->length, lo, hi);
+  return result;
+}
+
+String *string_upper(State *s, String *str)
+{
+  return string_case(s, str, 'a', 'z');
+}
+
+String *string_lower(State *s, String *str)
+{
+  return string_case(s, str, 'A', 'Z');
+}
+
+/* Flattens the specified rope into an owned block of chars. The leaves are
+ * copied from the end of the block using an explicit stack, so ropes of any
+ * depth can be flattened.
+ */
+static int flatten(State *s, String *rope)
+{
+  char *chars = pseu_alloc(s, (size)rope->length + 1);
+  if (pseu_unlikely(!chars))
+    return 1;
+
+  size stack_size = PSEU_STR_FLATTEN_INIT_SIZE;
+  size stack_count = 0;
+  String **stack;
+  if (pseu_vec_init(s, &stack, stack_size, String *)) {
+    pseu_free(s, chars);
+    return 1;
+  }
+
+  u32 pos = rope->length;
+  stack[stack_count++] = rope;
+  while (stack_count > 0) {
+    String *str = stack[--stack_count];
+    if (!s_isrope(str)) {
+      pos -= str->length;
+      memcpy(chars + pos, str->chars, str->length);
+      continue;
+    }
+
+    if (stack_count + 2 > stack_size &&
+        pseu_vec_grow(s, &stack, &stack_size, String *)) {
+      pseu_free(s, stack);
+      pseu_free(s, chars);
+      return 1;
+    }
+
+    /* Right half is popped first since the block is filled backwards. */
+    stack[stack_count++] = str->left;
+    stack[stack_count++] = str->right;
+  }
+  pseu_free(s, stack);
+
+  /* Drop the halves so they can be collected. */
+  chars[rope->length] = '\0';
+  rope->flags = (rope->flags & ~STR_ROPE) | STR_OWNED;
+  rope->chars = chars;
+  rope->left = NULL;
+  rope->right = NULL;
+  pseu_gc_resize(s, (Object *)rope, 0, (size)rope->length + 1);
+  return 0;
+}
+
+const char *string_chars(State *s, String *str)
+{
+  if (s_isrope(str) && flatten(s, str))
+    return NULL;
+  return str->chars;
+}
+
+const char *string_cstr(State *s, String *str)
+{
+  if (!s_isslice(str))
+    return string_chars(s, str);
+
+  /* Copy the chars of a slice so they can be NUL terminated. */
+  char *chars = pseu_alloc(s, (size)str->length + 1);
+  if (pseu_unlikely(!chars))
+    return NULL;
+
+  memcpy(chars, str->chars, str->length);
+  chars[str->length] = '\0';
+  str->flags = (str->flags & ~STR_SLICE) | STR_OWNED;
+  str->chars = chars;
+  str->left = NULL;
+  pseu_gc_resize(s, (Object *)str, 0, (size)str->length + 1);
+  return chars;
+}
+
+u32 string_hash(State *s, String *str)
+{
+  if (!(str->flags & STR_HASHED)) {
+    const char *chars = string_chars(s, str);
+    if (pseu_unlikely(!chars))
+      return 0;
+
+    str->hash = string_hash_chars(chars, str->length);
+    str->flags |= STR_HASHED;
+  }
+  return str->hash;
+}
+
+int string_compare(State *s, String *a, String *b, int *o)
+{
+  if (a == b) {
+    *o = 0;
+    return 0;
+  }
+
+  const char *ca = string_chars(s, a);
+  const char *cb = string_chars(s, b);
+  if (pseu_unlikely(!ca || !cb))
+    return 1;
+
+  u32 len = a->length < b->length ? a->length : b->length;
+  size i = str_mismatch(ca, cb, len);
+  if (i < len)
+    *o = (u8)ca[i] < (u8)cb[i] ? -1 : 1;
+  else
+    *o = a->length < b->length ? -1 : a->length > b->length;
+  return 0;
+}
+
+int string_find(State *s, String *str, String *sub, i64 *o)
+{
+  const char *h = string_chars(s, str);
+  const char *n = string_chars(s, sub);
+  if (pseu_unlikely(!h || !n))
+    return 1;
+
+  *o = str_find(h, str->length, n, sub->length);
+  return 0;
+}
+
+size string_bytes(String *str)
+{
+  size result = sizeof(String);
+  if (s_isrope(str) || s_isslice(str) || s_ismapped(str))
+    return result;
+  return result + (size)str->length + 1;
+}
+
+void string_table_sweep(State *s, StringTable *t)
+{
+  pseu_unused(s);
+
+  for (u32 i = 0; i < t->size; i++) {
+    String *str = t->slots[i];
+    if (str && str != &tombstone && !str->marked)
+      t->slots[i] = &tombstone;
+  }
+}
+
+void string_table_free(State *s, StringTable *t)
+{
+  pseu_free(s, t->slots);
+  t->slots = NULL;
+  t->count = 0;
+  t->size = 0;
+}
@@ -0,0 +1,452 @@
+#include <math.h>
+
+#include "vm.h"
+#include "vec.h"
+
+#if defined(__GNUC__) && defined(__SSE2__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PSEU_VEC_X86
+#define PSEU_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Wrapping INTEGER and plain REAL arithmetic for tails and scalar kernels. */
+#define add_i(x, y) ((i32)((u32)(x) + (u32)(y)))
+#define mul_i(x, y) ((i32)((u32)(x) * (u32)(y)))
+#define add_f(x, y) ((x) + (y))
+#define mul_f(x, y) ((x) * (y))
+
+/* Adds up the eight partial sums of a REAL sum in a fixed order, then the
+ * elements from `i` on; every kernel agrees on the result this way.
+ */
+static f32 sum_finish(const f32 *lanes, const f32 *a, u32 i, u32 n)
+{
+  f32 result = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+               ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+  for (; i < n; i++)
+    result += a[i];
+  return result;
+}
+
+/* == Scalar kernels. */
+
+static i32 sum_i32_scalar(const i32 *a, u32 n)
+{
+  i32 result = 0;
+  for (u32 i = 0; i < n; i++)
+    result = add_i(result, a[i]);
+  return result;
+}
+
+static f32 sum_f32_scalar(const f32 *a, u32 n)
+{
+  f32 lanes[8] = { 0 };
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8)
+    for (u32 j = 0; j < 8; j++)
+      lanes[j] += a[i + j];
+  return sum_finish(lanes, a, i, n);
+}
+
+#define PSEU_DEF_MINMAX_SCALAR(name, T, init, cmp)   \
+  static T name(const T *a, u32 n)                   \
+  {                                                  \
+    T result = init;                                 \
+    for (u32 i = 0; i < n; i++)                      \
+      if (a[i] cmp result)                           \
+        result = a[i];                               \
+    return result;                                   \
+  }
+
+PSEU_DEF_MINMAX_SCALAR(min_i32_scalar, i32, INT32_MAX, <)
+PSEU_DEF_MINMAX_SCALAR(max_i32_scalar, i32, INT32_MIN, >)
+PSEU_DEF_MINMAX_SCALAR(min_f32_scalar, f32, INFINITY,  <)
+PSEU_DEF_MINMAX_SCALAR(max_f32_scalar, f32, -INFINITY, >)
+
+#define PSEU_DEF_COUNT_SCALAR(name, T)               \
+  static u32 name(const T *a, u32 n, T x)            \
+  {                                                  \
+    u32 result = 0;                                  \
+    for (u32 i = 0; i < n; i++)                      \
+      result += a[i] == x;                           \
+    return result;                                   \
+  }
+
+PSEU_DEF_COUNT_SCALAR(count_i32_scalar, i32)
+PSEU_DEF_COUNT_SCALAR(count_f32_scalar, f32)
+
+/* Defines `name` and `name##s`, which apply `op` elementwise with an array
+ * and with a single value. */
+#define PSEU_DEF_MAP_SCALAR(name, T, op)             \
+  static void name(T *a, const T *b, u32 n)          \
+  {                                                  \
+    for (u32 i = 0; i < n; i++)                      \
+      a[i] = op(a[i], b[i]);                         \
+  }                                                  \
+                                                     \
+  static void name##s(T *a, T x, u32 n)              \
+  {                                                  \
+    for (u32 i = 0; i < n; i++)                      \
+      a[i] = op(a[i], x);                            \
+  }
+
+PSEU_DEF_MAP_SCALAR(add_i32_scalar, i32, add_i)
+PSEU_DEF_MAP_SCALAR(mul_i32_scalar, i32, mul_i)
+PSEU_DEF_MAP_SCALAR(add_f32_scalar, f32, add_f)
+PSEU_DEF_MAP_SCALAR(mul_f32_scalar, f32, mul_f)
+
+static const VecOps scalar_ops = {
+  sum_i32_scalar, sum_f32_scalar,
+  min_i32_scalar, max_i32_scalar, min_f32_scalar, max_f32_scalar,
+  count_i32_scalar, count_f32_scalar,
+  add_i32_scalar, mul_i32_scalar, add_f32_scalar, mul_f32_scalar,
+  add_i32_scalars, mul_i32_scalars, add_f32_scalars, mul_f32_scalars
+};
+
+#if defined(PSEU_VEC_X86)
+#define ld_i128(p)    _mm_loadu_si128((const __m128i *)(p))
+#define st_i128(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+#define ld_i256(p)    _mm256_loadu_si256((const __m256i *)(p))
+#define st_i256(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+
+/* Defines `name` and `name##s` over vectors of W elements; the tail is
+ * left to the scalar `op`. */
+#define PSEU_DEF_MAP_VEC(name, attr, T, W, ld, st, set1, vop, op)  \
+  attr static void name(T *a, const T *b, u32 n)                   \
+  {                                                                \
+    u32 i = 0;                                                     \
+    for (; i + W <= n; i += W)                                     \
+      st(a + i, vop(ld(a + i), ld(b + i)));                        \
+    for (; i < n; i++)                                             \
+      a[i] = op(a[i], b[i]);                                       \
+  }                                                                \
+                                                                   \
+  attr static void name##s(T *a, T x, u32 n)                       \
+  {                                                                \
+    u32 i = 0;                                                     \
+    for (; i + W <= n; i += W)                                     \
+      st(a + i, vop(ld(a + i), set1(x)));                          \
+    for (; i < n; i++)                                             \
+      a[i] = op(a[i], x);                                          \
+  }
+
+/* == SSE2 kernels; every x86 CPU we run on has them. */
+
+static i32 sum_i32_sse2(const i32 *a, u32 n)
+{
+  __m128i acc0 = _mm_setzero_si128();
+  __m128i acc1 = _mm_setzero_si128();
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm_add_epi32(acc0, ld_i128(a + i));
+    acc1 = _mm_add_epi32(acc1, ld_i128(a + i + 4));
+  }
+
+  i32 lanes[4];
+  st_i128(lanes, _mm_add_epi32(acc0, acc1));
+  i32 result = add_i(add_i(lanes[0], lanes[1]), add_i(lanes[2], lanes[3]));
+  for (; i < n; i++)
+    result = add_i(result, a[i]);
+  return result;
+}
+
+static f32 sum_f32_sse2(const f32 *a, u32 n)
+{
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm_add_ps(acc0, _mm_loadu_ps(a + i));
+    acc1 = _mm_add_ps(acc1, _mm_loadu_ps(a + i + 4));
+  }
+
+  f32 lanes[8];
+  _mm_storeu_ps(lanes, acc0);
+  _mm_storeu_ps(lanes + 4, acc1);
+  return sum_finish(lanes, a, i, n);
+}
+
+/* SSE2 has no 32-bit integer min or max; select through a compare mask. */
+static __m128i select_i128(__m128i mask, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static i32 min_i32_sse2(const i32 *a, u32 n)
+{
+  __m128i acc = _mm_set1_epi32(INT32_MAX);
+  u32 i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = ld_i128(a + i);
+    acc = select_i128(_mm_cmplt_epi32(v, acc), v, acc);
+  }
+
+  i32 lanes[4];
+  st_i128(lanes, acc);
+  i32 result = min_i32_scalar(lanes, 4);
+  for (; i < n; i++)
+    if (a[i] < result)
+      result = a[i];
+  return result;
+}
+
+static i32 max_i32_sse2(const i32 *a, u32 n)
+{
+  __m128i acc = _mm_set1_epi32(INT32_MIN);
+  u32 i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = ld_i128(a + i);
+    acc = select_i128(_mm_cmpgt_epi32(v, acc), v, acc);
+  }
+
+  i32 lanes[4];
+  st_i128(lanes, acc);
+  i32 result = max_i32_scalar(lanes, 4);
+  for (; i < n; i++)
+    if (a[i] > result)
+      result = a[i];
+  return result;
+}
+
+/* minps and maxps return their second operand when either is NaN, so NaN
+ * elements never reach the accumulator. */
+static f32 min_f32_sse2(const f32 *a, u32 n)
+{
+  __m128 acc = _mm_set1_ps(INFINITY);
+  u32 i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm_min_ps(_mm_loadu_ps(a + i), acc);
+
+  f32 lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  f32 result = min_f32_scalar(lanes, 4);
+  for (; i < n; i++)
+    if (a[i] < result)
+      result = a[i];
+  return result;
+}
+
+static f32 max_f32_sse2(const f32 *a, u32 n)
+{
+  __m128 acc = _mm_set1_ps(-INFINITY);
+  u32 i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm_max_ps(_mm_loadu_ps(a + i), acc);
+
+  f32 lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  f32 result = max_f32_scalar(lanes, 4);
+  for (; i < n; i++)
+    if (a[i] > result)
+      result = a[i];
+  return result;
+}
+
+/* Equal lanes compare to -1, so subtracting the mask counts them. */
+static u32 count_i32_sse2(const i32 *a, u32 n, i32 x)
+{
+  __m128i key = _mm_set1_epi32(x);
+  __m128i acc = _mm_setzero_si128();
+  u32 i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm_sub_epi32(acc, _mm_cmpeq_epi32(ld_i128(a + i), key));
+
+  u32 lanes[4];
+  st_i128(lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         count_i32_scalar(a + i, n - i, x);
+}
+
+static u32 count_f32_sse2(const f32 *a, u32 n, f32 x)
+{
+  __m128 key = _mm_set1_ps(x);
+  __m128i acc = _mm_setzero_si128();
+  u32 i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 eq = _mm_cmpeq_ps(_mm_loadu_ps(a + i), key);
+    acc = _mm_sub_epi32(acc, _mm_castps_si128(eq));
+  }
+
+  u32 lanes[4];
+  st_i128(lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         count_f32_scalar(a + i, n - i, x);
+}
+
+PSEU_DEF_MAP_VEC(add_i32_sse2, , i32, 4, ld_i128, st_i128,
+                 _mm_set1_epi32, _mm_add_epi32, add_i)
+PSEU_DEF_MAP_VEC(add_f32_sse2, , f32, 4, _mm_loadu_ps, _mm_storeu_ps,
+                 _mm_set1_ps, _mm_add_ps, add_f)
+PSEU_DEF_MAP_VEC(mul_f32_sse2, , f32, 4, _mm_loadu_ps, _mm_storeu_ps,
+                 _mm_set1_ps, _mm_mul_ps, mul_f)
+
+/* SSE2 has no 32-bit multiply keeping the low halves; INTEGER products are
+ * left to the scalar kernels. */
+static const VecOps sse2_ops = {
+  sum_i32_sse2, sum_f32_sse2,
+  min_i32_sse2, max_i32_sse2, min_f32_sse2, max_f32_sse2,
+  count_i32_sse2, count_f32_sse2,
+  add_i32_sse2, mul_i32_scalar, add_f32_sse2, mul_f32_sse2,
+  add_i32_sse2s, mul_i32_scalars, add_f32_sse2s, mul_f32_sse2s
+};
+
+/* == AVX2 kernels. */
+
+PSEU_AVX2 static i32 sum_i32_avx2(const i32 *a, u32 n)
+{
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  u32 i = 0;
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm256_add_epi32(acc0, ld_i256(a + i));
+    acc1 = _mm256_add_epi32(acc1, ld_i256(a + i + 8));
+  }
+
+  i32 lanes[8];
+  st_i256(lanes, _mm256_add_epi32(acc0, acc1));
+  return add_i(sum_i32_scalar(lanes, 8), sum_i32_scalar(a + i, n - i));
+}
+
+PSEU_AVX2 static f32 sum_f32_avx2(const f32 *a, u32 n)
+{
+  __m256 acc = _mm256_setzero_ps();
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm256_add_ps(acc, _mm256_loadu_ps(a + i));
+
+  f32 lanes[8];
+  _mm256_storeu_ps(lanes, acc);
+  return sum_finish(lanes, a, i, n);
+}
+
+PSEU_AVX2 static i32 min_i32_avx2(const i32 *a, u32 n)
+{
+  __m256i acc = _mm256_set1_epi32(INT32_MAX);
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm256_min_epi32(acc, ld_i256(a + i));
+
+  i32 lanes[8];
+  st_i256(lanes, acc);
+  i32 result = min_i32_scalar(lanes, 8);
+  i32 tail = min_i32_scalar(a + i, n - i);
+  return tail < result ? tail : result;
+}
+
+PSEU_AVX2 static i32 max_i32_avx2(const i32 *a, u32 n)
+{
+  __m256i acc = _mm256_set1_epi32(INT32_MIN);
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm256_max_epi32(acc, ld_i256(a + i));
+
+  i32 lanes[8];
+  st_i256(lanes, acc);
+  i32 result = max_i32_scalar(lanes, 8);
+  i32 tail = max_i32_scalar(a + i, n - i);
+  return tail > result ? tail : result;
+}
+
+PSEU_AVX2 static f32 min_f32_avx2(const f32 *a, u32 n)
+{
+  __m256 acc = _mm256_set1_ps(INFINITY);
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm256_min_ps(_mm256_loadu_ps(a + i), acc);
+
+  f32 lanes[8];
+  _mm256_storeu_ps(lanes, acc);
+  f32 result = min_f32_scalar(lanes, 8);
+  f32 tail = min_f32_scalar(a + i, n - i);
+  return tail < result ? tail : result;
+}
+
+PSEU_AVX2 static f32 max_f32_avx2(const f32 *a, u32 n)
+{
+  __m256 acc = _mm256_set1_ps(-INFINITY);
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm256_max_ps(_mm256_loadu_ps(a + i), acc);
+
+  f32 lanes[8];
+  _mm256_storeu_ps(lanes, acc);
+  f32 result = max_f32_scalar(lanes, 8);
+  f32 tail = max_f32_scalar(a + i, n - i);
+  return tail > result ? tail : result;
+}
+
+PSEU_AVX2 static u32 count_i32_avx2(const i32 *a, u32 n, i32 x)
+{
+  __m256i key = _mm256_set1_epi32(x);
+  __m256i acc = _mm256_setzero_si256();
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm256_sub_epi32(acc, _mm256_cmpeq_epi32(ld_i256(a + i), key));
+
+  u32 lanes[8];
+  st_i256(lanes, acc);
+  u32 result = count_i32_scalar(a + i, n - i, x);
+  for (u32 j = 0; j < 8; j++)
+    result += lanes[j];
+  return result;
+}
+
+PSEU_AVX2 static u32 count_f32_avx2(const f32 *a, u32 n, f32 x)
+{
+  __m256 key = _mm256_set1_ps(x);
+  __m256i acc = _mm256_setzero_si256();
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 eq = _mm256_cmp_ps(_mm256_loadu_ps(a + i), key, _CMP_EQ_OQ);
+    acc = _mm256_sub_epi32(acc, _mm256_castps_si256(eq));
+  }
+
+  u32 lanes[8];
+  st_i256(lanes, acc);
+  u32 result = count_f32_scalar(a + i, n - i, x);
+  for (u32 j = 0; j < 8; j++)
+    result += lanes[j];
+  return result;
+}
+
+PSEU_DEF_MAP_VEC(add_i32_avx2, PSEU_AVX2, i32, 8, ld_i256, st_i256,
+                 _mm256_set1_epi32, _mm256_add_epi32, add_i)
+PSEU_DEF_MAP_VEC(mul_i32_avx2, PSEU_AVX2, i32, 8, ld_i256, st_i256,
+                 _mm256_set1_epi32, _mm256_mullo_epi32, mul_i)
+PSEU_DEF_MAP_VEC(add_f32_avx2, PSEU_AVX2, f32, 8, _mm256_loadu_ps,
+                 _mm256_storeu_ps, _mm256_set1_ps, _mm256_add_ps, add_f)
+PSEU_DEF_MAP_VEC(mul_f32_avx2, PSEU_AVX2, f32, 8, _mm256_loadu_ps,
+                 _mm256_storeu_ps, _mm256_set1_ps, _mm256_mul_ps, mul_f)
+
+static const VecOps avx2_ops = {
+  sum_i32_avx2, sum_f32_avx2,
+  min_i32_avx2, max_i32_avx2, min_f32_avx2, max_f32_avx2,
+  count_i32_avx2, count_f32_avx2,
+  add_i32_avx2, mul_i32_avx2, add_f32_avx2, mul_f32_avx2,
+  add_i32_avx2s, mul_i32_avx2s, add_f32_avx2s, mul_f32_avx2s
+};
+#endif
+
+/* == Dispatch. */
+
+static const VecOps *select_ops(void)
+{
+#if defined(PSEU_VEC_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return &avx2_ops;
+  if (__builtin_cpu_supports("sse2"))
+    return &sse2_ops;
+  return &scalar_ops;
+#else
+  return &scalar_ops;
+#endif
+}
+
+const VecOps *vec_ops(void)
+{
+  static const VecOps *ops = NULL;
+  if (pseu_unlikely(!ops))
+    ops = select_ops();
+  return ops;
+}
@@ -0,0 +1,34 @@
+#ifndef PSEU_VEC_H
+#define PSEU_VEC_H
+
+#include "obj.h"
+
+/* Kernels over packed array storage, picked for the CPU on first use.
+ * INTEGER arithmetic wraps as it does in the interpreter; REAL sums add
+ * eight partial sums, and MIN/MAX ignore NaN elements.
+ */
+typedef struct VecOps {
+  i32 (*sum_i32)(const i32 *a, u32 n);
+  f32 (*sum_f32)(const f32 *a, u32 n);
+  i32 (*min_i32)(const i32 *a, u32 n);
+  i32 (*max_i32)(const i32 *a, u32 n);
+  f32 (*min_f32)(const f32 *a, u32 n);
+  f32 (*max_f32)(const f32 *a, u32 n);
+  u32 (*count_i32)(const i32 *a, u32 n, i32 x);
+  u32 (*count_f32)(const f32 *a, u32 n, f32 x);
+
+  /* a[i] <- a[i] op b[i] */
+  void (*add_i32)(i32 *a, const i32 *b, u32 n);
+  void (*mul_i32)(i32 *a, const i32 *b, u32 n);
+  void (*add_f32)(f32 *a, const f32 *b, u32 n);
+  void (*mul_f32)(f32 *a, const f32 *b, u32 n);
+  /* a[i] <- a[i] op x */
+  void (*adds_i32)(i32 *a, i32 x, u32 n);
+  void (*muls_i32)(i32 *a, i32 x, u32 n);
+  void (*adds_f32)(f32 *a, f32 x, u32 n);
+  void (*muls_f32)(f32 *a, f32 x, u32 n);
+} VecOps;
+
+const VecOps *vec_ops(void);
+
+#endif /* PSEU_VEC_H */
@@ -51,6 +51,23 @@ static void compare_num(Value *a, Value *b, Value *o, CompareType op)
   }
 }
 
+static int compare_string(State *s, String *a, String *b, Value *o, CompareType op)
+{
+  /* Strings of different lengths or hashes cannot be equal. */
+  if ((op == COMP_eq || op == COMP_ne) && (a->length != b->length ||
+      ((a->flags & b->flags & STR_HASHED) && a->hash != b->hash))) {
+    *o = v_bool(op == COMP_ne);
+    return 0;
+  }
+
+  int k;
+  if (pseu_unlikely(string_compare(s, a, b, &k)))
+    return 1;
+
+  PSEU_COMP(k, 0, o, op);
+  return 0;
+}
+
 /* Attempts to coerce the specified value to a numeric one (float, int). */
 static int coerce_num(Value *i, Value *o)
 {
@@ -63,93 +80,519 @@ static int coerce_num(Value *i, Value *o)
   return 1;
 }
 
-/* Ensures that the specified number of slots 'n' is available. */
-static int ensure_stack(State *s, size n)
+/* Reports a runtime error; always returns 1. */
+static int runtime_err(State *s, const char *message)
 {
-  size k = s->sp - (s->stack + s->stack_size);
+  return pseu_error(s, message);
+}
 
-  if (k >= n)
+/* Ensures that `n` slots are available above the stack pointer. The stack
+ * moves when it grows, so the stack pointer and frame bases are rebased.
+ */
+static int ensure_stack(State *s, size n)
+{
+  size used = s->sp - s->stack;
+  if (pseu_likely(s->stack_size - used >= n))
     return 0;
 
-  /* TODO: Grow to the power 2 number closest to n. (or something) 
-   * Should also be careful to update frame pointers and stuff. */
-  pseu_assert(0);
-  return 1;
+  size new_size = s->stack_size;
+  while (new_size - used < n)
+    new_size *= 2;
+
+  Value *stack = pseu_realloc(s, s->stack, new_size * sizeof(Value));
+  if (pseu_unlikely(!stack))
+    return runtime_err(s, "Out of memory");
+
+  for (size i = 0; i < s->frames_count; i++)
+    s->frames[i].bp = stack + (s->frames[i].bp - s->stack);
+  s->sp = stack + used;
+  s->stack = stack;
+  s->stack_size = new_size;
+  return 0;
 }
 
-/* Initialize stack space for the specified frame. */
-static int init_stack(State *s, Frame *frame)
+/* Checks that the specified value can be stored in a variable of the
+ * specified type; INTEGER values are converted to REAL.
+ */
+static int coerce_type(State *s, Type *type, Value *v)
 {
-  Function *fn = frame->fn;
-  pseu_assert(fn->type == FN_PSEU);
+  if (t_isint(s, type))
+    return !v_isi32(v);
+  if (t_isfloat(s, type)) {
+    if (v_isi32(v))
+      *v = v_f32(v_i2f(v));
+    return !v_isf32(v);
+  }
+  if (type == V(s)->boolean_type)
+    return !v_isbool(v);
+  if (t_isstring(s, type))
+    return !v_isstr(s, v);
+  if (t_isrecord(type))
+    return !v_isobj(v) || v_asobj(v)->header.type != type;
+  return 0;
+}
 
-  for (size i = 0; i < fn->as.pseu.local_count; i++) {
-    Type *loc_type = fn->as.pseu.locals[i];
-    if (t_isany(s, loc_type))
-      continue;
+/* Gives the specified BYVAL argument its own copy of the array or record it
+ * shares with the caller.
+ */
+static int own_value(State *s, Value *v)
+{
+  v->borrowed = false;
+  if (!v_isobj(v))
+    return 0;
 
-    if (t_isint(s, loc_type))
-      frame->bp[i] = v_int(0);
-    else
+  Object *o = v_asobj(v);
+  if (o->header.type == V(s)->array_type) {
+    Array *a = array_copy(s, &o->as.array);
+    if (pseu_unlikely(!a))
       return 1;
+    *v = v_obj((Object *)a);
+  } else if (t_isrecord(o->header.type)) {
+    *v = v_obj((Object *)record_copy(s, &o->as.uobject));
   }
-
   return 0;
 }
 
-/* Appends the specified function as a call frame to the call stack. */
+/* Appends the specified function as a call frame to the call stack. Its
+ * arguments are the values on top of the stack and become its first locals.
+ */
 static int append_call(State *s, Function *fn)
 {
-  if (s->frames_count >= s->frames_size)
-    pseu_vec_grow(s, s->frames, &s->frames_size, Frame);
+  if (pseu_unlikely(s->frames_count >= PSEU_MAX_FRAMES))
+    return runtime_err(s, "Stack overflow");
+  if (s->frames_count >= s->frames_size &&
+      pseu_vec_grow(s, &s->frames, &s->frames_size, Frame))
+    return runtime_err(s, "Out of memory");
+  if (pseu_unlikely(ensure_stack(s, fn->as.pseu.local_count + fn->as.pseu.max_stack)))
+    return 1;
+
+  Value *bp = s->sp - fn->params_count;
+  for (u8 i = 0; i < fn->params_count; i++) {
+    if (fn->byref & (1u << i)) {
+      if (pseu_unlikely(!v_isref(&bp[i])))
+        return runtime_err(s, "BYREF argument must be a variable");
+      continue;
+    }
+    if (pseu_unlikely(coerce_type(s, fn->param_types[i], &bp[i])))
+      return runtime_err(s, "Invalid arguments to function");
+
+    /* Aggregates passed BYVAL are shared until the callee first writes them
+     * (see OP_OWN), unless a BYREF argument could alias them. */
+    bp[i].borrowed = true;
+    if (fn->byref && pseu_unlikely(own_value(s, &bp[i])))
+      return runtime_err(s, "Out of memory");
+  }
 
   s->frames[s->frames_count] = (Frame) {
     .fn = fn,
-    .ip = fn->as.pseu.code,
-    .bp = s->sp,
+    .ip = fn->as.pseu.words,
+    .bp = bp,
+    .region = s->region,
+    .top = s->region ? s->region->top : 0
   };
 
-  init_stack(s, &s->frames[s->frames_count]);
+  /* Unboxed locals start out as 0, 0.0 or FALSE; all zero bits. */
+  if (fn->as.pseu.slot_count > 0) {
+    size sz = fn->as.pseu.slot_count * sizeof(Slot);
+    Slot *slots = pseu_region_alloc(s, sz);
+    if (pseu_unlikely(!slots))
+      return runtime_err(s, "Out of memory");
+    memset(slots, 0, sz);
+    s->frames[s->frames_count].slots = slots;
+  }
+
+  /* Every slot gets a value since the GC scans locals. */
+  u8 locals = fn->as.pseu.local_count - fn->params_count;
+  if (locals > 0)
+    memcpy(bp + fn->params_count, fn->as.pseu.frame, locals * sizeof(Value));
+  s->sp = bp + fn->as.pseu.local_count;
   s->frames_count++;
   return 0;
 }
 
+/* Computes the linear offset of the element of the specified array at the
+ * `dims` indices in `idx`, checking them against the array bounds.
+ */
+static int array_offset(State *s, Array *a, Value *idx, u8 dims, u32 *o)
+{
+  if (pseu_unlikely(dims != a->dims))
+    return runtime_err(s, "Wrong number of array indices");
+
+  for (u8 d = 0; d < dims; d++) {
+    if (pseu_unlikely(!v_isi32(&idx[d])))
+      return runtime_err(s, "Array index must be an INTEGER");
+  }
+
+  if (dims == 1) {
+    u32 offset = (u32)v_asi32(&idx[0]) + (u32)a->base;
+    if (pseu_unlikely(offset >= a->length))
+      return runtime_err(s, "Array index out of bounds");
+
+    *o = offset;
+    return 0;
+  }
+
+  u32 offset = 0;
+  for (u8 d = 0; d < dims; d++) {
+    u32 k = (u32)v_asi32(&idx[d]) - (u32)a->lower[d];
+    if (pseu_unlikely(k >= a->extent[d]))
+      return runtime_err(s, "Array index out of bounds");
+    offset = offset * a->extent[d] + k;
+  }
+
+  *o = offset;
+  return 0;
+}
+
+/* Computes the linear offset of an element of the specified array at indices
+ * the compiler proved to be within bounds.
+ */
+static inline u32 proven_offset(Array *a, Value *idx, u8 dims)
+{
+  if (dims == 2)
+    return (u32)v_asi32(&idx[0]) * a->extent[1] + (u32)v_asi32(&idx[1]) + (u32)a->base;
+  return (u32)v_asi32(&idx[0]) + (u32)a->base;
+}
+
+/* Returns the array referenced by the specified value or NULL if the value is
+ * not an array.
+ */
+static Array *value_array(State *s, Value *v)
+{
+  if (!v_isobj(v) || v_asobj(v)->header.type != V(s)->array_type)
+    return NULL;
+  return &v_asobj(v)->as.array;
+}
+
+/* Loads the raw slot `sl` holding a value of type `raw`. */
+static inline Value slot_get(u8 raw, Slot *sl)
+{
+  switch (raw) {
+  case VAL_INT:   return v_i32(sl->integer);
+  case VAL_FLOAT: return v_f32(sl->real);
+  default:        return v_bool(sl->boolean);
+  }
+}
+
+/* Stores `v` in the raw slot `sl` holding a value of type `raw`; INTEGER
+ * values are converted to REAL. Returns 1 if `v` is not of that type.
+ */
+static inline int slot_set(u8 raw, Slot *sl, Value *v)
+{
+  switch (raw) {
+  case VAL_INT:
+    if (!v_isi32(v))
+      return 1;
+    sl->integer = v_asi32(v);
+    return 0;
+  case VAL_FLOAT:
+    if (v_isi32(v))
+      sl->real = v_i2f(v);
+    else if (v_isf32(v))
+      sl->real = v_asf32(v);
+    else
+      return 1;
+    return 0;
+  default:
+    if (!v_isbool(v))
+      return 1;
+    sl->boolean = v_asbool(v);
+    return 0;
+  }
+}
+
+/* Loads the variable referenced by `r`. */
+static inline void ref_get(State *s, Value *r, Value *o)
+{
+  Object *c = v_asobj(r);
+
+  if (r->raw)
+    *o = slot_get(r->raw, r->as.slot);
+  else if (!c)
+    *o = s->stack[r->offset];
+  else if (c->header.type == V(s)->array_type)
+    array_get(&c->as.array, r->offset, o);
+  else
+    *o = c->as.uobject.fields[r->offset];
+}
+
+/* Stores `v` in the variable referenced by `r`. */
+static inline int ref_set(State *s, Value *r, Value *v)
+{
+  Object *c = v_asobj(r);
+
+  if (r->raw)
+    return slot_set(r->raw, r->as.slot, v);
+  if (!c) {
+    s->stack[r->offset] = *v;
+    return 0;
+  }
+  if (c->header.type == V(s)->array_type)
+    return array_set(&c->as.array, r->offset, v);
+  if (coerce_type(s, c->header.type->fields[r->offset].type, v))
+    return 1;
+  c->as.uobject.fields[r->offset] = *v;
+  return 0;
+}
+
+/* Sets `o` to the INTEGER which the CASE selector `v` matches; returns false
+ * if it cannot match an INTEGER label.
+ */
+static bool case_key(Value *v, i32 *o)
+{
+  if (v_isi32(v)) {
+    *o = v_asi32(v);
+    return true;
+  }
+  if (v_isf32(v)) {
+    f32 f = v_asf32(v);
+    if (f >= -2147483648.0f && f < 2147483648.0f && f == (f32)(i32)f) {
+      *o = (i32)f;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Returns the address of the STRING label equal to `str` in the specified
+ * SWITCH_STR table, or `other`.
+ */
+static Word *case_string(State *s, Function *fn, Word *table, u16 mask,
+                         String *str, Word *other)
+{
+  u32 hash = string_hash(s, str);
+  for (u32 slot = hash & mask; ; slot = (slot + 1) & mask) {
+    Word *entry = table + 2 * slot;
+    if (entry[0].u == PSEU_SWITCH_EMPTY)
+      return other;
+
+    String *label = v_asstr(&fn->as.pseu.consts[entry[0].u]);
+    int o;
+    if (label->length == str->length && string_hash(s, label) == hash &&
+        string_compare(s, label, str, &o) == 0 && o == 0)
+      return entry[1].target;
+  }
+}
+
+#ifdef PSEU_USE_COMPUTEDGOTO
+/* Labels as values are a GNU extension. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
 /* Dispatches the last frame on the call stack. */
 static int dispatch(State *s) 
 {
-  #define READ_U8()  	(*ip++)
-  #define READ_U16() 	(ip += 2, (u16)(ip[-2] << 8 | ip[-1]))
-
+  /* Operands were decoded to a word each by pseu_decode. */
+  #define READ_U8()     ((u8)(ip++)->u)
+  #define READ_U16()    ((u16)(ip++)->u)
+  #define READ_U32()    ((ip++)->u)
+  #define READ_VALUE()  ((ip++)->value)
+  #define READ_TYPE()   ((ip++)->type)
+  #define READ_FN()     ((ip++)->fn)
+  #define READ_TARGET() ((ip++)->target)
+
+  #define ARITH_I32(op)                                                  \
+    {                                                                    \
+      Value *a = s->sp - 2;                                              \
+      a->as.integer = (i32)((u32)v_asi32(a) op (u32)v_asi32(s->sp - 1)); \
+      s->sp--;                                                           \
+      DISPATCH();                                                        \
+    }
+  #define ARITH_F32(op)                                                  \
+    {                                                                    \
+      Value *a = s->sp - 2;                                              \
+      a->as.real = v_asf32(a) op v_asf32(s->sp - 1);                     \
+      s->sp--;                                                           \
+      DISPATCH();                                                        \
+    }
+  /* d <- a op b over the raw slots of the frame. */
+  #define ARITH_I32_SS(op)                                               \
+    {                                                                    \
+      Slot *slots = frame->slots;                                        \
+      u8 d = READ_U8();                                                  \
+      u8 a = READ_U8();                                                  \
+      u8 b = READ_U8();                                                  \
+      slots[d].integer = (i32)((u32)slots[a].integer op (u32)slots[b].integer); \
+      DISPATCH();                                                        \
+    }
+  #define ARITH_I32_SI(op)                                               \
+    {                                                                    \
+      Slot *slots = frame->slots;                                        \
+      u8 d = READ_U8();                                                  \
+      u8 a = READ_U8();                                                  \
+      u32 b = READ_U32();                                                \
+      slots[d].integer = (i32)((u32)slots[a].integer op b);              \
+      DISPATCH();                                                        \
+    }
+  #define ARITH_F32_SS(op)                                               \
+    {                                                                    \
+      Slot *slots = frame->slots;                                        \
+      u8 d = READ_U8();                                                  \
+      u8 a = READ_U8();                                                  \
+      u8 b = READ_U8();                                                  \
+      slots[d].real = slots[a].real op slots[b].real;                    \
+      DISPATCH();                                                        \
+    }
   #define PUSH(x) 		*s->sp++ = x
   #define POP(x)  		(*(--s->sp))
 
   #ifdef PSEU_USE_COMPUTEDGOTO
-    #error Computed gotos are not implemented yet
+    /* Words start with the address of the handler of their instruction. */
+    static const void *const handlers[] = {
+      #define _(x) &&op_##x,
+      #include "op.def"
+      #undef  _
+    };
+    #define INTERPRET         DISPATCH();
+    #define DISPATCH_EXIT(c)  return c
+    #define DISPATCH()        goto *(ip++)->handler
+    #define OP(x)             op_##x
+    #define HANDLER(x)        handlers[OP_##x]
   #else
+    /* Words start with the opcode of their instruction. */
+    static const void *const *const handlers = NULL;
     #define INTERPRET  \
-      BCode op; 			 \
       decode: 				 \
-      switch ((op = READ_U8()))
+      switch ((size)(ip++)->handler)
     #define DISPATCH_EXIT(c) 	return c
     #define DISPATCH() 			  goto decode
     #define OP(x) 				    case OP_##x
+    #define HANDLER(x)        ((const void *)(size)OP_##x)
   #endif
 
-  Frame *frame = &s->frames[s->frames_count - 1];
-  BCode *ip = frame->ip;
-  Function *fn = frame->fn;
+  /* Loads the registers of the frame on top of the call stack. */
+  #define LOAD_FRAME()  \
+    (frame = &s->frames[s->frames_count - 1], fn = frame->fn, ip = frame->ip)
+  /* Decodes the code of a function the first time a frame enters it. */
+  #define LOAD_CODE()                                                    \
+    if (pseu_unlikely(!ip)) {                                            \
+      if (pseu_unlikely(pseu_decode(s, fn, handlers)))                   \
+        DISPATCH_EXIT(runtime_err(s, "Out of memory"));                  \
+      ip = frame->ip = fn->as.pseu.words;                                \
+    }
+
+  /* Dispatch returns once the frame it started with returns. */
+  size base = s->frames_count - 1;
+  Frame *frame;
+  Word *ip;
+  Function *fn;
+  LOAD_FRAME();
+  LOAD_CODE();
 
   INTERPRET {
     OP(LD_CONST): {
-      u8 index = READ_U8(); 
+      Value *k = READ_VALUE();
+
+      PUSH(*k);
+      DISPATCH();
+    }
+    /* The operands of the typed arithmetic are known to be of their type;
+     * INTEGER arithmetic wraps. */
+    OP(ADD_I32): ARITH_I32(+);
+    OP(SUB_I32): ARITH_I32(-);
+    OP(MUL_I32): ARITH_I32(*);
+    OP(DIV_I32): {
+      Value *a = s->sp - 2;
+      i32 b = v_asi32(s->sp - 1);
+
+      if (pseu_unlikely(b == 0))
+        DISPATCH_EXIT(runtime_err(s, "Division by zero"));
+      a->as.integer = b == -1 ? (i32)(0u - (u32)v_asi32(a)) : v_asi32(a) / b;
+      s->sp--;
+      DISPATCH();
+    }
+    OP(ADD_F32): ARITH_F32(+);
+    OP(SUB_F32): ARITH_F32(-);
+    OP(MUL_F32): ARITH_F32(*);
+    OP(DIV_F32): ARITH_F32(/);
+    OP(I2F): {
+      Value *v = s->sp - 1;
+
+      *v = v_f32(v_i2f(v));
+      DISPATCH();
+    }
+    /* Temporaries of the optimizer; see opt.c. */
+    OP(TEE_I32): {
+      u8 index = READ_U8();
+
+      frame->slots[index].integer = v_asi32(s->sp - 1);
+      DISPATCH();
+    }
+    OP(TEE_F32): {
+      u8 index = READ_U8();
+
+      frame->slots[index].real = v_asf32(s->sp - 1);
+      DISPATCH();
+    }
+    OP(INC_I32): {
+      u8 index = READ_U8();
+      u32 step = READ_U32();
+      Slot *slot = &frame->slots[index];
+
+      slot->integer = (i32)((u32)slot->integer + step);
+      DISPATCH();
+    }
+    /* Three-address instructions over raw slots; see lower_registers() in
+     * opt.c. */
+    OP(ADD_I32_SS): ARITH_I32_SS(+);
+    OP(SUB_I32_SS): ARITH_I32_SS(-);
+    OP(MUL_I32_SS): ARITH_I32_SS(*);
+    OP(ADD_I32_SI): ARITH_I32_SI(+);
+    OP(SUB_I32_SI): ARITH_I32_SI(-);
+    OP(MUL_I32_SI): ARITH_I32_SI(*);
+    OP(ADD_F32_SS): ARITH_F32_SS(+);
+    OP(SUB_F32_SS): ARITH_F32_SS(-);
+    OP(MUL_F32_SS): ARITH_F32_SS(*);
+    OP(DIV_F32_SS): ARITH_F32_SS(/);
+    OP(MOV_I32): {
+      u8 d = READ_U8();
+      u8 a = READ_U8();
+
+      frame->slots[d].integer = frame->slots[a].integer;
+      DISPATCH();
+    }
+    OP(MOV_F32): {
+      u8 d = READ_U8();
+      u8 a = READ_U8();
+
+      frame->slots[d].real = frame->slots[a].real;
+      DISPATCH();
+    }
+    OP(SET_I32): {
+      u8 d = READ_U8();
 
-      PUSH(fn->as.pseu.consts[index]);
+      frame->slots[d].integer = (i32)READ_U32();
+      DISPATCH();
+    }
+    OP(BR_CMP_SS): {
+      u8 cmp = READ_U8();
+      i32 a = frame->slots[READ_U8()].integer;
+      i32 b = frame->slots[READ_U8()].integer;
+      Word *target = READ_TARGET();
+      Value result;
+
+      PSEU_COMP(a, b, &result, cmp & PSEU_BR_CMP_MASK);
+      if (v_asbool(&result) == !!(cmp & PSEU_BR_CMP_TRUE))
+        ip = target;
+      DISPATCH();
+    }
+    OP(BR_CMP_SI): {
+      u8 cmp = READ_U8();
+      i32 a = frame->slots[READ_U8()].integer;
+      i32 b = (i32)READ_U32();
+      Word *target = READ_TARGET();
+      Value result;
+
+      PSEU_COMP(a, b, &result, cmp & PSEU_BR_CMP_MASK);
+      if (v_asbool(&result) == !!(cmp & PSEU_BR_CMP_TRUE))
+        ip = target;
       DISPATCH();
     }
     OP(LD_GLOBAL): {
-      u16 index = READ_U16(); 
+      Value *global = READ_VALUE();
 
-      PUSH(V(s)->vars[index].value);
+      PUSH(*global);
       DISPATCH();
     }
     OP(LD_LOCAL): {
@@ -161,48 +604,630 @@ static int dispatch(State *s)
     OP(ST_LOCAL): {
       u8 index = READ_U8();
 
-      /* TODO: Type checking. */
+      /* Checked before the store: by the parser when the type of the value is
+       * known, otherwise by CHK_TYPE or COPY_RECORD; see emit_st_checked(). */
       *(frame->bp + index) = POP();
       DISPATCH();
     }
-    OP(BR): {
-      u16 index = READ_U16();
+    OP(LD_I32): {
+      u8 index = READ_U8();
+
+      PUSH(v_i32(frame->slots[index].integer));
+      DISPATCH();
+    }
+    OP(ST_I32): {
+      u8 index = READ_U8();
+      Value *v = s->sp - 1;
+
+      /* Unboxed locals are checked as they are stored, not as they are read. */
+      if (pseu_unlikely(!v_isi32(v)))
+        DISPATCH_EXIT(runtime_err(s, "Value does not match the variable type"));
+      frame->slots[index].integer = v_asi32(v);
+      s->sp--;
+      DISPATCH();
+    }
+    OP(LD_F32): {
+      u8 index = READ_U8();
+
+      PUSH(v_f32(frame->slots[index].real));
+      DISPATCH();
+    }
+    OP(ST_F32): {
+      u8 index = READ_U8();
+      Value *v = s->sp - 1;
+
+      if (v_isf32(v))
+        frame->slots[index].real = v_asf32(v);
+      else if (pseu_likely(v_isi32(v)))
+        frame->slots[index].real = v_i2f(v);
+      else
+        DISPATCH_EXIT(runtime_err(s, "Value does not match the variable type"));
+      s->sp--;
+      DISPATCH();
+    }
+    OP(LD_BOOL): {
+      u8 index = READ_U8();
+
+      PUSH(v_bool(frame->slots[index].boolean));
+      DISPATCH();
+    }
+    OP(ST_BOOL): {
+      u8 index = READ_U8();
+      Value *v = s->sp - 1;
 
-      ip = &fn->as.pseu.code[index];
+      if (pseu_unlikely(!v_isbool(v)))
+        DISPATCH_EXIT(runtime_err(s, "Value does not match the variable type"));
+      frame->slots[index].boolean = v_asbool(v);
+      s->sp--;
+      DISPATCH();
+    }
+    OP(BR): {
+      ip = ip->target;
       DISPATCH();
     }
     OP(BR_FALSE): {
-      u16 index = READ_U16();
+      Word *target = READ_TARGET();
 
       if (!POP().as.boolean)
-        ip = &fn->as.pseu.code[index];
+        ip = target;
+      DISPATCH();
+    }
+    OP(BR_TRUE): {
+      Word *target = READ_TARGET();
+
+      if (POP().as.boolean)
+        ip = target;
+      DISPATCH();
+    }
+    OP(BR_CMP): {
+      u8 cmp = READ_U8();
+      Word *target = READ_TARGET();
+      Value *a = s->sp - 2;
+      Value *b = s->sp - 1;
+      Value result;
+
+      if (v_isi32(a) && v_isi32(b)) {
+        i32 ia = v_asi32(a);
+        i32 ib = v_asi32(b);
+        PSEU_COMP(ia, ib, &result, cmp & PSEU_BR_CMP_MASK);
+      } else if (pseu_unlikely(pseu_compare_binary(s, a, b, &result,
+                                                   cmp & PSEU_BR_CMP_MASK))) {
+        runtime_err(s, "Invalid arguments to function");
+        DISPATCH_EXIT(1);
+      }
+
+      s->sp -= 2;
+      if (v_asbool(&result) == !!(cmp & PSEU_BR_CMP_TRUE))
+        ip = target;
+      DISPATCH();
+    }
+    OP(SWITCH_TABLE): {
+      i32 lower = (i32)READ_U32();
+      u16 count = READ_U16();
+      Word *target = READ_TARGET();
+      i32 k;
+
+      Value v = POP();
+      if (case_key(&v, &k) && (u32)k - (u32)lower < count)
+        target = ip[(u32)k - (u32)lower].target;
+      ip = target;
+      DISPATCH();
+    }
+    OP(SWITCH_RANGE): {
+      u16 count = READ_U16();
+      Word *target = READ_TARGET();
+      i32 k;
+
+      /* Entries are the lower, upper and address words, sorted. */
+      Value v = POP();
+      if (case_key(&v, &k)) {
+        u32 lo = 0;
+        u32 hi = count;
+        while (lo < hi) {
+          u32 mid = (lo + hi) / 2;
+          if ((i32)ip[3 * mid].u <= k)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+        if (lo > 0) {
+          Word *entry = ip + 3 * (lo - 1);
+          if (k <= (i32)entry[1].u)
+            target = entry[2].target;
+        }
+      }
+      ip = target;
+      DISPATCH();
+    }
+    OP(SWITCH_STR): {
+      u16 mask = READ_U16();
+      Word *target = READ_TARGET();
+
+      Value v = POP();
+      if (v_isstr(s, &v))
+        target = case_string(s, fn, ip, mask, v_asstr(&v), target);
+      ip = target;
       DISPATCH();
     }
     OP(CALL): {
-      u16 index = READ_U16();
-      Function *f = &V(s)->fns[index];
+      Function *f = READ_FN();
 
       pseu_assert((s->sp - frame->bp) >= f->params_count);
 
       if (f->type == FN_C) {
-        f->as.c(s, s->sp - f->params_count);	
+        if (pseu_unlikely(f->as.c(s, s->sp - f->params_count))) {
+          /* The function may have reported a more precise error. */
+          if (!V(s)->error)
+            runtime_err(s, "Invalid arguments to function");
+          DISPATCH_EXIT(1);
+        }
         
         if (f->return_type != NULL)
           s->sp -= f->params_count - 1;
         else
           s->sp -= f->params_count;
+
+        /* Check if we need to do a garbage collection. */
+        if (pseu_gc_poll(s))
+          pseu_gc_collect(s);
+      } else if (f->type == FN_HOST) {
+        /* Thunks pop the arguments and push the result themselves. */
+        Value *sp = f->as.host.thunk(s, f, s->sp);
+        if (pseu_unlikely(!sp)) {
+          if (!V(s)->error)
+            runtime_err(s, "Invalid arguments to function");
+          DISPATCH_EXIT(1);
+        }
+        s->sp = sp;
+        /* The host may have called back into pseu and moved the frames. */
+        frame = &s->frames[s->frames_count - 1];
       } else if (f->type == FN_PSEU) {
-        pseu_unreachable();
+        frame->ip = ip;
+        if (pseu_unlikely(append_call(s, f)))
+          DISPATCH_EXIT(1);
+        LOAD_FRAME();
+        LOAD_CODE();
       } else {
         pseu_unreachable();
       }
       DISPATCH();
     }
     OP(RET): {
-      DISPATCH_EXIT(0);
+      if (pseu_unlikely(fn->return_type != NULL))
+        DISPATCH_EXIT(runtime_err(s, "FUNCTION ended without a RETURN"));
+
+      /* Objects allocated in the frame do not outlive it. */
+      pseu_region_reset(s, frame->region, frame->top);
+      s->sp = frame->bp;
+      if (--s->frames_count == base)
+        DISPATCH_EXIT(0);
+      LOAD_FRAME();
+      DISPATCH();
+    }
+    OP(RET_VAL): {
+      Value v = POP();
+      if (pseu_unlikely(coerce_type(s, fn->return_type, &v)))
+        DISPATCH_EXIT(runtime_err(s, "Value does not match the return type"));
+
+      /* The result replaces the arguments of the call. */
+      pseu_region_reset(s, frame->region, frame->top);
+      s->sp = frame->bp;
+      PUSH(v);
+      if (--s->frames_count == base)
+        DISPATCH_EXIT(0);
+      LOAD_FRAME();
+      DISPATCH();
+    }
+    OP(NEW_ARRAY): {
+      Type *type = READ_TYPE();
+      u8 dims = READ_U8();
+      Array *a = array_new(s, type, 0);
+      if (pseu_unlikely(!a))
+        DISPATCH_EXIT(runtime_err(s, "Out of memory"));
+
+      /* The product of PSEU_MAX_DIMS (2) u32 extents fits a u64. */
+      u64 length = 1;
+      a->dims = dims;
+      for (u8 d = 0; d < dims; d++) {
+        a->lower[d] = (i32)READ_U32();
+        a->extent[d] = READ_U32();
+        length *= a->extent[d];
+      }
+      a->base = (i32)READ_U32();
+
+      /* Push before resizing so the array is reachable by the GC. */
+      PUSH(v_obj((Object *)a));
+      if (pseu_unlikely(length > UINT32_MAX))
+        DISPATCH_EXIT(runtime_err(s, "Array is too large"));
+      if (pseu_unlikely(array_resize(s, a, (u32)length)))
+        DISPATCH_EXIT(runtime_err(s, "Out of memory"));
+
+      /* Check if we need to do a garbage collection. */
+      if (pseu_gc_poll(s))
+        pseu_gc_collect(s);
+      DISPATCH();
+    }
+    OP(LD_INDEX): {
+      u8 dims = READ_U8();
+      Value *base = s->sp - dims - 1;
+      Array *a = value_array(s, base);
+      u32 offset;
+
+      if (pseu_unlikely(!a))
+        DISPATCH_EXIT(runtime_err(s, "Indexed value is not an array"));
+      if (pseu_unlikely(array_offset(s, a, base + 1, dims, &offset)))
+        DISPATCH_EXIT(1);
+
+      if (pseu_unlikely(a->kind == ARR_RECORD))
+        array_gather(s, a, offset, base);
+      else
+        array_get(a, offset, base);
+      s->sp = base + 1;
+      DISPATCH();
+    }
+    OP(ST_INDEX): {
+      u8 dims = READ_U8();
+      Value *base = s->sp - dims - 2;
+      Array *a = value_array(s, base);
+      u32 offset;
+
+      if (pseu_unlikely(!a))
+        DISPATCH_EXIT(runtime_err(s, "Indexed value is not an array"));
+      if (pseu_unlikely(array_offset(s, a, base + 1, dims, &offset)))
+        DISPATCH_EXIT(1);
+      if (pseu_unlikely(a->kind == ARR_RECORD ? array_scatter(s, a, offset, s->sp - 1)
+                                              : array_set(a, offset, s->sp - 1)))
+        DISPATCH_EXIT(runtime_err(s, "Value does not match array element type"));
+
+      s->sp = base;
+      DISPATCH();
+    }
+    OP(LD_INDEX_NC): {
+      u8 dims = READ_U8();
+      Value *base = s->sp - dims - 1;
+      Array *a = &v_asobj(base)->as.array;
+
+      /* The compiler proved the array and indices are valid. */
+      u32 offset = proven_offset(a, base + 1, dims);
+
+      array_get(a, offset, base);
+      s->sp = base + 1;
+      DISPATCH();
+    }
+    OP(ST_INDEX_NC): {
+      u8 dims = READ_U8();
+      Value *base = s->sp - dims - 2;
+      Array *a = &v_asobj(base)->as.array;
+
+      /* The compiler proved the array and indices are valid. */
+      u32 offset = proven_offset(a, base + 1, dims);
+
+      if (pseu_unlikely(array_set(a, offset, s->sp - 1)))
+        DISPATCH_EXIT(runtime_err(s, "Value does not match array element type"));
+
+      s->sp = base;
+      DISPATCH();
+    }
+    OP(CHK_INDEX): {
+      i32 lower = (i32)READ_U32();
+      i32 upper = (i32)READ_U32();
+      Value v = POP();
+
+      if (pseu_unlikely(!v_isi32(&v) || v_asi32(&v) < lower || v_asi32(&v) > upper))
+        DISPATCH_EXIT(runtime_err(s, "Array index out of bounds"));
+      DISPATCH();
+    }
+    OP(CHK_TYPE): {
+      Type *type = READ_TYPE();
+
+      if (pseu_unlikely(coerce_type(s, type, s->sp - 1)))
+        DISPATCH_EXIT(runtime_err(s, "Value does not match the variable type"));
+      DISPATCH();
+    }
+    OP(NEW_RECORD): {
+      UObject *r = record_new(s, READ_TYPE());
+
+      PUSH(v_obj((Object *)r));
+
+      /* Check if we need to do a garbage collection. */
+      if (pseu_gc_poll(s))
+        pseu_gc_collect(s);
+      DISPATCH();
+    }
+    OP(LD_FIELD): {
+      Type *type = READ_TYPE();
+      u8 slot = READ_U8();
+      Value *base = s->sp - 1;
+
+      /* The slot was resolved by the compiler; only the type is checked. */
+      if (pseu_unlikely(!v_isobj(base) || v_asobj(base)->header.type != type))
+        DISPATCH_EXIT(runtime_err(s, "Value is not a record of the expected TYPE"));
+
+      *base = v_asobj(base)->as.uobject.fields[slot];
+      DISPATCH();
+    }
+    OP(ST_FIELD): {
+      Type *type = READ_TYPE();
+      u8 slot = READ_U8();
+      Value *base = s->sp - 2;
+
+      if (pseu_unlikely(!v_isobj(base) || v_asobj(base)->header.type != type))
+        DISPATCH_EXIT(runtime_err(s, "Value is not a record of the expected TYPE"));
+      if (pseu_unlikely(coerce_type(s, type->fields[slot].type, s->sp - 1)))
+        DISPATCH_EXIT(runtime_err(s, "Value does not match the field type"));
+
+      v_asobj(base)->as.uobject.fields[slot] = s->sp[-1];
+      s->sp = base;
+      DISPATCH();
+    }
+    OP(COPY_RECORD): {
+      Type *type = READ_TYPE();
+      Value *top = s->sp - 1;
+
+      if (pseu_unlikely(!v_isobj(top) || v_asobj(top)->header.type != type))
+        DISPATCH_EXIT(runtime_err(s, "Value is not a record of the expected TYPE"));
+
+      /* Records are assigned by value. */
+      *top = v_obj((Object *)record_copy(s, &v_asobj(top)->as.uobject));
+
+      /* Check if we need to do a garbage collection. */
+      if (pseu_gc_poll(s))
+        pseu_gc_collect(s);
+      DISPATCH();
+    }
+    OP(LD_COLUMN): {
+      u8 dims = READ_U8();
+      u8 slot = READ_U8();
+      Value *base = s->sp - dims - 1;
+      Array *a = value_array(s, base);
+      u32 offset;
+
+      if (pseu_unlikely(!a || a->kind != ARR_RECORD))
+        DISPATCH_EXIT(runtime_err(s, "Indexed value is not an array of records"));
+      if (pseu_unlikely(array_offset(s, a, base + 1, dims, &offset)))
+        DISPATCH_EXIT(1);
+
+      array_get(a->items.columns[slot], offset, base);
+      s->sp = base + 1;
+      DISPATCH();
+    }
+    OP(ST_COLUMN): {
+      u8 dims = READ_U8();
+      u8 slot = READ_U8();
+      Value *base = s->sp - dims - 2;
+      Array *a = value_array(s, base);
+      u32 offset;
+
+      if (pseu_unlikely(!a || a->kind != ARR_RECORD))
+        DISPATCH_EXIT(runtime_err(s, "Indexed value is not an array of records"));
+      if (pseu_unlikely(array_offset(s, a, base + 1, dims, &offset)))
+        DISPATCH_EXIT(1);
+      if (pseu_unlikely(coerce_type(s, a->record->fields[slot].type, s->sp - 1)))
+        DISPATCH_EXIT(runtime_err(s, "Value does not match the field type"));
+
+      array_set(a->items.columns[slot], offset, s->sp - 1);
+
+      s->sp = base;
+      DISPATCH();
+    }
+    OP(LD_COLUMN_NC): {
+      u8 dims = READ_U8();
+      u8 slot = READ_U8();
+      Value *base = s->sp - dims - 1;
+      Array *a = &v_asobj(base)->as.array;
+
+      /* The compiler proved the array and indices are valid. */
+      u32 offset = proven_offset(a, base + 1, dims);
+
+      array_get(a->items.columns[slot], offset, base);
+      s->sp = base + 1;
+      DISPATCH();
+    }
+    OP(ST_COLUMN_NC): {
+      u8 dims = READ_U8();
+      u8 slot = READ_U8();
+      Value *base = s->sp - dims - 2;
+      Array *a = &v_asobj(base)->as.array;
+
+      /* The compiler proved the array and indices are valid. */
+      u32 offset = proven_offset(a, base + 1, dims);
+
+      if (pseu_unlikely(coerce_type(s, a->record->fields[slot].type, s->sp - 1)))
+        DISPATCH_EXIT(runtime_err(s, "Value does not match the field type"));
+
+      array_set(a->items.columns[slot], offset, s->sp - 1);
+
+      s->sp = base;
+      DISPATCH();
+    }
+    OP(COLUMN): {
+      u8 slot = READ_U8();
+      Value *top = s->sp - 1;
+      Array *a = value_array(s, top);
+
+      if (pseu_unlikely(!a || a->kind != ARR_RECORD))
+        DISPATCH_EXIT(runtime_err(s, "Value is not an array of records"));
+
+      /* The column shares its storage with the array. */
+      *top = v_obj((Object *)a->items.columns[slot]);
+      DISPATCH();
+    }
+    OP(NEW_ARRAY_FRAME): {
+      Type *type = READ_TYPE();
+      u8 dims = READ_U8();
+      i32 lower[PSEU_MAX_DIMS];
+      u32 extent[PSEU_MAX_DIMS];
+      u64 length = 1;
+
+      for (u8 d = 0; d < dims; d++) {
+        lower[d] = (i32)READ_U32();
+        extent[d] = READ_U32();
+        length *= extent[d];
+      }
+      i32 base = (i32)READ_U32();
+      if (pseu_unlikely(length > UINT32_MAX))
+        DISPATCH_EXIT(runtime_err(s, "Array is too large"));
+
+      /* Fused with the ST_LOCAL which follows. A local declared in a loop
+       * reuses the array of the previous iteration, which is dead since it
+       * does not escape the frame. */
+      pseu_assert(ip[0].handler == HANDLER(ST_LOCAL));
+      Value *local = frame->bp + ip[1].u;
+      ip += 2;
+
+      Array *a = value_array(s, local);
+      if (a && a->frame) {
+        array_clear(a);
+      } else {
+        a = array_new_frame(s, type, (u32)length);
+        if (pseu_unlikely(!a))
+          DISPATCH_EXIT(runtime_err(s, "Out of memory"));
+      }
+
+      a->dims = dims;
+      a->base = base;
+      memcpy(a->lower, lower, dims * sizeof(i32));
+      memcpy(a->extent, extent, dims * sizeof(u32));
+      *local = v_obj((Object *)a);
+      if (pseu_unlikely(array_resize(s, a, (u32)length)))
+        DISPATCH_EXIT(runtime_err(s, "Out of memory"));
+      DISPATCH();
+    }
+    OP(NEW_RECORD_FRAME): {
+      Type *type = READ_TYPE();
+
+      /* Fused with the ST_LOCAL which follows; see NEW_ARRAY_FRAME. */
+      pseu_assert(ip[0].handler == HANDLER(ST_LOCAL));
+      Value *local = frame->bp + ip[1].u;
+      ip += 2;
+
+      if (v_isobj(local) && v_asobj(local)->header.frame) {
+        record_init(s, &v_asobj(local)->as.uobject);
+      } else {
+        UObject *r = record_new_frame(s, type);
+        if (pseu_unlikely(!r))
+          DISPATCH_EXIT(runtime_err(s, "Out of memory"));
+        *local = v_obj((Object *)r);
+      }
+      DISPATCH();
+    }
+    OP(COPY_RECORD_FRAME): {
+      Type *type = READ_TYPE();
+      Value *top = s->sp - 1;
+
+      if (pseu_unlikely(!v_isobj(top) || v_asobj(top)->header.type != type))
+        DISPATCH_EXIT(runtime_err(s, "Value is not a record of the expected TYPE"));
+
+      /* Fused with the ST_LOCAL which follows; the record is copied into the
+       * one of the frame held by the local. */
+      pseu_assert(ip[0].handler == HANDLER(ST_LOCAL));
+      Value *local = frame->bp + ip[1].u;
+      ip += 2;
+
+      if (!v_isobj(local) || !v_asobj(local)->header.frame) {
+        UObject *r = record_new_frame(s, type);
+        if (pseu_unlikely(!r))
+          DISPATCH_EXIT(runtime_err(s, "Out of memory"));
+        *local = v_obj((Object *)r);
+      }
+      record_assign(s, &v_asobj(local)->as.uobject, &v_asobj(top)->as.uobject);
+      s->sp--;
+      DISPATCH();
+    }
+    OP(REF_LOCAL): {
+      u8 index = READ_U8();
+
+      /* Stack slots are referenced by position as the stack may move. */
+      PUSH(v_ref(NULL, (u32)(frame->bp + index - s->stack)));
+      DISPATCH();
+    }
+    OP(REF_SLOT): {
+      u8 index = READ_U8();
+      u8 raw = READ_U8();
+
+      /* The region does not move, so raw slots are referenced directly. */
+      PUSH(v_refslot(&frame->slots[index], raw));
+      DISPATCH();
+    }
+    OP(REF_INDEX): {
+      u8 dims = READ_U8();
+      Value *base = s->sp - dims - 1;
+      Array *a = value_array(s, base);
+      u32 offset;
+
+      if (pseu_unlikely(!a))
+        DISPATCH_EXIT(runtime_err(s, "Indexed value is not an array"));
+      if (pseu_unlikely(a->kind == ARR_RECORD))
+        DISPATCH_EXIT(runtime_err(s, "Elements of arrays of records cannot be passed BYREF"));
+      if (pseu_unlikely(array_offset(s, a, base + 1, dims, &offset)))
+        DISPATCH_EXIT(1);
+
+      *base = v_ref((Object *)a, offset);
+      s->sp = base + 1;
+      DISPATCH();
+    }
+    OP(REF_COLUMN): {
+      u8 dims = READ_U8();
+      u8 slot = READ_U8();
+      Value *base = s->sp - dims - 1;
+      Array *a = value_array(s, base);
+      u32 offset;
+
+      if (pseu_unlikely(!a || a->kind != ARR_RECORD))
+        DISPATCH_EXIT(runtime_err(s, "Indexed value is not an array of records"));
+      if (pseu_unlikely(array_offset(s, a, base + 1, dims, &offset)))
+        DISPATCH_EXIT(1);
+
+      *base = v_ref((Object *)a->items.columns[slot], offset);
+      s->sp = base + 1;
+      DISPATCH();
+    }
+    OP(REF_FIELD): {
+      Type *type = READ_TYPE();
+      u8 slot = READ_U8();
+      Value *top = s->sp - 1;
+
+      if (pseu_unlikely(!v_isobj(top) || v_asobj(top)->header.type != type))
+        DISPATCH_EXIT(runtime_err(s, "Value is not a record of the expected TYPE"));
+
+      *top = v_ref(v_asobj(top), slot);
+      DISPATCH();
+    }
+    OP(LD_REF): {
+      u8 index = READ_U8();
+
+      ref_get(s, frame->bp + index, s->sp);
+      s->sp++;
+      DISPATCH();
+    }
+    OP(ST_REF): {
+      u8 index = READ_U8();
+
+      if (pseu_unlikely(ref_set(s, frame->bp + index, s->sp - 1)))
+        DISPATCH_EXIT(runtime_err(s, "Value does not match the variable type"));
+      s->sp--;
+      DISPATCH();
+    }
+    OP(OWN): {
+      Value *v = frame->bp + READ_U8();
+
+      if (v->borrowed) {
+        if (pseu_unlikely(own_value(s, v)))
+          DISPATCH_EXIT(runtime_err(s, "Out of memory"));
+
+        /* Check if we need to do a garbage collection. */
+        if (pseu_gc_poll(s))
+          pseu_gc_collect(s);
+      }
+      DISPATCH();
     }
   }
-  
+
+#ifdef PSEU_USE_COMPUTEDGOTO
+  /* Instructions without a handler leave the dispatch. */
+  op_END:
+  op_ST_GLOBAL:
+#endif
   /* Check if we need to do a garbage collection. */
   if (pseu_gc_poll(s))
     pseu_gc_collect(s);
@@ -210,6 +1235,10 @@ static int dispatch(State *s)
   return 1;
 }
 
+#ifdef PSEU_USE_COMPUTEDGOTO
+#pragma GCC diagnostic pop
+#endif
+
 State *pseu_state_new(VM *vm)
 {
   State *s = (State *)vm->config.alloc(vm, sizeof(*s));
@@ -221,15 +1250,21 @@ State *pseu_state_new(VM *vm)
   s->stack_size = PSEU_INIT_EVALSTACK_SIZE;
   s->frames_count = 0;
   s->frames_size = PSEU_INIT_CALLSTACK_SIZE;
+  s->region = NULL;
 
   if (pseu_vec_init(s, &s->frames, s->frames_size, Frame))
     goto free_frames;
   if (pseu_vec_init(s, &s->stack, s->stack_size, Value))
     goto free_stack;
+  /* Extra byte for the NUL terminator passed to config.print. */
+  if (cbuf_new(s, &s->out, PSEU_OUTPUT_BUFFER_SIZE + 1))
+    goto free_out;
 
+  s->out.size = PSEU_OUTPUT_BUFFER_SIZE;
   s->sp = s->stack;
   return s;
 
+free_out:
 free_stack:
   pseu_free(s, s->stack);
 free_frames:
@@ -240,21 +1275,55 @@ free_frames:
 
 void pseu_state_free(State *s)
 {
+  pseu_flush(s);
+  pseu_region_reset(s, NULL, 0);
+  cbuf_free(s, &s->out);
   pseu_free(s, s->stack);
   pseu_free(s, s->frames);
   pseu_free(s, s);
 }
 
+void pseu_function_free(State *s, Function *fn)
+{
+  FunctionPseu *pseu = &fn->as.pseu;
+
+  pseu_free(s, pseu->code);
+  pseu_free(s, pseu->words);
+  pseu_free(s, pseu->consts);
+  pseu_free(s, pseu->locals);
+  pseu_free(s, pseu->frame);
+}
+
 int pseu_call(State *s, Function *fn) 
 {
   pseu_assert(s->sp - s->stack >= fn->params_count);
   pseu_assert(fn->type == FN_PSEU);
 
-  if (pseu_unlikely(ensure_stack(s, fn->as.pseu.max_stack)))
+  V(s)->error = NULL;
+
+  /* Unwind the frames and stack of the call if it fails; the arguments are
+   * popped either way.
+   */
+  size frames_count = s->frames_count;
+  size sp = s->sp - s->stack - fn->params_count;
+  Region *region = s->region;
+  size top = region ? region->top : 0;
+
+  if (pseu_unlikely(append_call(s, fn) || dispatch(s))) {
+    pseu_region_reset(s, region, top);
+    s->frames_count = frames_count;
+    s->sp = s->stack + sp;
     return 1;
-  if (pseu_unlikely(append_call(s, fn)))
+  }
+  return 0;
+}
+
+int pseu_push(State *s, Value *v)
+{
+  if (pseu_unlikely(ensure_stack(s, 1)))
     return 1;
-  return dispatch(s);
+  *s->sp++ = *v;
+  return 0;
 }
 
 void *pseu_alloc(State *s, size sz) 
@@ -272,21 +1341,114 @@ void pseu_free(State *s, void *ptr)
   V(s)->config.free(V(s), ptr);
 }
 
+void *pseu_region_alloc(State *s, size sz)
+{
+  Region *r = s->region;
+
+  sz = (sz + 7) & ~(size)7;
+  if (!r || r->top + sz > r->size) {
+    size chunk = sz > PSEU_REGION_CHUNK_SIZE ? sz : PSEU_REGION_CHUNK_SIZE;
+    Region *next = pseu_alloc(s, sizeof(Region) + chunk);
+    if (pseu_unlikely(!next))
+      return NULL;
+
+    next->prev = r;
+    next->size = chunk;
+    next->top = 0;
+    s->region = r = next;
+  }
+
+  void *result = r->data + r->top;
+  r->top += sz;
+  return result;
+}
+
+void pseu_region_reset(State *s, Region *r, size top)
+{
+  while (s->region != r) {
+    Region *prev = s->region->prev;
+    pseu_free(s, s->region);
+    s->region = prev;
+  }
+  if (r)
+    r->top = top;
+}
+
 void pseu_print(State *s, const char *text) 
 {
-  V(s)->config.print(V(s), text);
+  pseu_write(s, text, strlen(text));
+}
+
+/* Hands the specified block to the user output callbacks. */
+static void output(State *s, const char *ptr, size len, bool terminated)
+{
+  VM *vm = V(s);
+
+  if (vm->config.write) {
+    vm->config.write(vm, ptr, len);
+  } else if (terminated) {
+    vm->config.print(vm, ptr);
+  } else {
+    /* Blocks which bypass the buffer are printed through it in pieces. */
+    while (len > 0) {
+      size n = len < s->out.size ? len : s->out.size;
+      memcpy(s->out.buffer, ptr, n);
+      s->out.buffer[n] = '\0';
+      vm->config.print(vm, s->out.buffer);
+      ptr += n;
+      len -= n;
+    }
+  }
+}
+
+void pseu_write(State *s, const char *ptr, size len)
+{
+  CBuffer *out = &s->out;
+
+  if (pseu_likely(out->count + len <= out->size)) {
+    memcpy(out->buffer + out->count, ptr, len);
+    out->count += len;
+    return;
+  }
+
+  pseu_flush(s);
+  if (len <= out->size) {
+    memcpy(out->buffer, ptr, len);
+    out->count = len;
+  } else {
+    output(s, ptr, len, false);
+  }
+}
+
+void pseu_flush(State *s)
+{
+  CBuffer *out = &s->out;
+  if (out->count == 0)
+    return;
+
+  out->buffer[out->count] = '\0';
+  output(s, out->buffer, out->count, true);
+  out->count = 0;
 }
 
 void pseu_panic(State *s, const char *message)
 {
+  pseu_flush(s);
   // TODO: Jump to somewhere safe. longjmp and stuff.
   V(s)->config.panic(V(s), message);
 }
 
+int pseu_error(State *s, const char *message)
+{
+  V(s)->error = (char *)message;
+  pseu_panic(s, message);
+  return 1;
+}
+
 char *pseu_strdup(State *s, const char *str)
 {
   size len = strlen(str);
-  char *nstr = pseu_alloc(s, len);
+  char *nstr = pseu_alloc(s, len + 1);
   if (pseu_unlikely(!nstr))
     return NULL;
 
@@ -333,12 +1495,14 @@ int pseu_arith_binary(Value *a, Value *b, Value *o, ArithType op)
   return 0;
 }
 
-int pseu_compare_binary(Value *a, Value *b, Value *o, CompareType op)
+int pseu_compare_binary(State *s, Value *a, Value *b, Value *o, CompareType op)
 {
   if (v_isnum(a) && v_isnum(b)) {
     compare_num(a, b, o, op);
     return 0;
   }
+  if (v_isstr(s, a) && v_isstr(s, b))
+    return compare_string(s, v_asstr(a), v_asstr(b), o, op);
 
   Value na;
   Value nb;
@@ -351,14 +1515,21 @@ int pseu_compare_binary(Value *a, Value *b, Value *o, CompareType op)
 
 u16 pseu_def_type(VM *vm, Type *type)
 {
+  if (vm->types_count >= PSEU_VM_TYPES_SIZE)
+    return PSEU_INVALID_TYPE;
+
   u16 result = vm->types_count++;
 
   vm->types[result] = *type;
+  pseu_gc_track_type(vm, &vm->types[result]);
   return result;
 }
 
 u16 pseu_def_function(VM *vm, Function *fn)
 {
+  if (vm->fns_count >= PSEU_VM_FNS_SIZE)
+    return PSEU_INVALID_FUNC;
+
   u16 result = vm->fns_count++;
 
   vm->fns[result] = *fn;
@@ -367,6 +1538,9 @@ u16 pseu_def_function(VM *vm, Function *fn)
 
 u16 pseu_def_variable(VM *vm, Variable *var)
 {
+  if (vm->vars_count >= PSEU_VM_VARS_SIZE)
+    return PSEU_INVALID_GLOBAL;
+
   u16 result = vm->vars_count++;
 
   vm->vars[result] = *var;
@@ -376,7 +1550,8 @@ u16 pseu_def_variable(VM *vm, Variable *var)
 u16 pseu_get_type(VM *vm, const char *ident, size len)
 {
   for (size i = 0; i < vm->types_count; i++) {
-    if (strncmp(vm->types[i].ident, ident, len) == 0)
+    if (strncmp(vm->types[i].ident, ident, len) == 0 &&
+        vm->types[i].ident[len] == '\0')
       return i;
   }
 
@@ -386,7 +1561,8 @@ u16 pseu_get_type(VM *vm, const char *ident, size len)
 u16 pseu_get_function(VM *vm, const char *ident, size len)
 {
   for (size i = 0; i < vm->fns_count; i++) {
-    if (strncmp(vm->fns[i].ident, ident, len) == 0)
+    if (strncmp(vm->fns[i].ident, ident, len) == 0 &&
+        vm->fns[i].ident[len] == '\0')
       return i;
   }
 
@@ -396,7 +1572,8 @@ u16 pseu_get_function(VM *vm, const char *ident, size len)
 u16 pseu_get_variable(VM *vm, const char *ident, size len)
 {
   for (size i = 0; i < vm->vars_count; i++) {
-    if (strncmp(vm->vars[i].ident, ident, len) == 0)
+    if (strncmp(vm->vars[i].ident, ident, len) == 0 &&
+        vm->vars[i].ident[len] == '\0')
       return i;
   }
 
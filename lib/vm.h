@@ -14,11 +14,27 @@
 #define PSEU_INIT_EVALSTACK_SIZE 256
 /* Initial size of the call stack. */
 #define PSEU_INIT_CALLSTACK_SIZE 8
+/* Size of the standard output buffer; larger writes bypass the buffer. */
+#define PSEU_OUTPUT_BUFFER_SIZE  8192
+/* Minimum size of a chunk of the frame region. */
+#define PSEU_REGION_CHUNK_SIZE   (64 * 1024)
 
 /* Maximum number of constants in a function. */
 #define PSEU_MAX_CONST  (1 << 8)
 /* Maximum number of local variables in a function. */
 #define PSEU_MAX_LOCAL  (1 << 8)
+/* Maximum number of parameters of a pseu function. */
+#define PSEU_MAX_PARAMS (1 << 5)
+/* Maximum number of fields of a record TYPE. */
+#define PSEU_MAX_FIELDS (1 << 6)
+/* Maximum depth of the call stack. */
+#define PSEU_MAX_FRAMES (1 << 16)
+/* Operand of BR_CMP: the CompareType, with PSEU_BR_CMP_TRUE set to branch
+ * when the comparison holds rather than when it fails. */
+#define PSEU_BR_CMP_MASK 0x7F
+#define PSEU_BR_CMP_TRUE 0x80
+/* Marks an empty slot of a SWITCH_STR table. */
+#define PSEU_SWITCH_EMPTY 0xFFFF
 /* Maximum number of globals in a pseu virtual machine instance. */
 #define PSEU_MAX_GLOBAL ((1 << 16) - 1)
 /* Maximum number of functions in a pseu virtual machine instance. */
@@ -71,10 +87,15 @@ State *pseu_state_new(VM *vm);
 void pseu_state_free(State *s);
 
 void *pseu_alloc(State *s, size sz);
+void *pseu_region_alloc(State *s, size sz);
+void pseu_region_reset(State *s, Region *r, size top);
 void *pseu_realloc(State *s, void *ptr, size sz);
 void pseu_free(State *s, void *ptr);
 void pseu_print(State *s, const char *text);
+void pseu_write(State *s, const char *ptr, size len);
+void pseu_flush(State *s);
 void pseu_panic(State *s, const char *message);
+int pseu_error(State *s, const char *message);
 
 char *pseu_strdup(State *s, const char *str);
 
@@ -82,17 +103,27 @@ int _pseu_vec_init(State *s, void **vec, size cap_elm, size size_elm);
 int _pseu_vec_grow(State *s, void **vec, size *cap_elm, size size_elm);
 
 int pseu_call(State *s, Function *fn);
+int pseu_push(State *s, Value *v);
 int pseu_parse(State *s, Function *fn, const char *src);
+void pseu_function_free(State *s, Function *fn);
+void pseu_optimize(State *s, Function *fn);
+u32 pseu_code_len(const BCode *ip);
+int pseu_decode(State *s, Function *fn, const void *const *handlers);
 
 void pseu_dump_stack(State *s, FILE* f);
 void pseu_dump_function(State *s, FILE* f, Function *fn);
 
+void pseu_gc_init(VM *vm);
+void pseu_gc_free(State *s);
+void pseu_gc_track_type(VM *vm, Type *type);
+void pseu_gc_resize(State *s, Object *o, size old_sz, size new_sz);
 bool pseu_gc_poll(State *s);
 void pseu_gc_collect(State *s);
 Object *pseu_gc_new(State *s, Type *type, size n);
+Object *pseu_frame_new(State *s, Type *type, size n);
 
 int pseu_arith_binary(Value *a, Value *b, Value *o, ArithType op);
-int pseu_compare_binary(Value *a, Value *b, Value *o, CompareType op);
+int pseu_compare_binary(State *s, Value *a, Value *b, Value *o, CompareType op);
 
 u16 pseu_def_type(VM *vm, Type *type);
 u16 pseu_def_variable(VM *vm, Variable *var);
@@ -54,12 +54,10 @@ void buffer_deinit(struct char_buffer *buffer)
 
 int buffer_write(struct char_buffer *buffer, const char *data, size_t length)
 {
-	if (length > CHAR_BUFFER_CHUNK)
-		return 1;
-
 	size_t new_length = buffer->length + length;
 	if (new_length > buffer->size) {
-		buffer->size *= 2;
+		while (new_length > buffer->size)
+			buffer->size *= 2;
 		buffer->data = realloc(buffer->data, buffer->size);
 	}
 	
@@ -111,12 +109,12 @@ struct pseu_test {
 	enum pseu_test_state state;
 };
 
-static void runner_print(PseuVM *vm, const char *text)
+static void runner_write(PseuVM *vm, const char *ptr, size_t len)
 {
 	struct pseu_test *test = pseu_vm_get_data(vm);
-	buffer_write(&test->output, text, strlen(text));
+	buffer_write(&test->output, ptr, len);
 
-	printf("%s", text);
+	fwrite(ptr, 1, len, stdout);
 }
 
 static void *runner_alloc(PseuVM *vm, size_t sz)
@@ -143,6 +141,75 @@ static void runner_panic(PseuVM *vm, const char *message)
 	fprintf(stderr, "error: %s.\n", message);
 }
 
+/* Host functions available to every test; see core/host.pseut. */
+static int32_t host_add(int32_t a, int32_t b)
+{
+	return a + b;
+}
+
+static float host_scale(float x, int32_t k)
+{
+	return x * k;
+}
+
+static bool host_positive(int32_t x)
+{
+	return x > 0;
+}
+
+static int host_repeat(PseuVM *vm, const PseuValue *args, PseuValue *result)
+{
+	static char buffer[256];
+	size_t length = args[0].as.string.length;
+	int32_t count = args[1].as.integer;
+
+	unused(vm);
+	if (count < 0 || length * count > sizeof(buffer))
+		return 1;
+
+	for (int32_t i = 0; i < count; i++)
+		memcpy(buffer + i * length, args[0].as.string.chars, length);
+	result->as.string.chars = buffer;
+	result->as.string.length = length * count;
+	return 0;
+}
+
+static int host_apply(PseuVM *vm, const PseuValue *args, PseuValue *result)
+{
+	char ident[64];
+	size_t length = args[0].as.string.length;
+	if (length >= sizeof(ident))
+		return 1;
+	memcpy(ident, args[0].as.string.chars, length);
+	ident[length] = '\0';
+
+	int fn = pseu_vm_get_function(vm, ident);
+	if (fn == PSEU_INVALID_FUNCTION ||
+	    pseu_vm_push_integer(vm, args[1].as.integer) ||
+	    pseu_vm_call(vm, fn) ||
+	    pseu_vm_pop_integer(vm, &result->as.integer))
+		return 1;
+	return 0;
+}
+
+static int runner_def_host(PseuVM *vm)
+{
+	const pseu_type_t ii[] = { PSEU_TYPE_INTEGER, PSEU_TYPE_INTEGER };
+	const pseu_type_t ri[] = { PSEU_TYPE_REAL, PSEU_TYPE_INTEGER };
+	const pseu_type_t si[] = { PSEU_TYPE_STRING, PSEU_TYPE_INTEGER };
+
+	return pseu_vm_def_native(vm, "HADD", PSEU_TYPE_INTEGER, ii, 2,
+	                          (PseuNative)host_add) ||
+	       pseu_vm_def_native(vm, "HSCALE", PSEU_TYPE_REAL, ri, 2,
+	                          (PseuNative)host_scale) ||
+	       pseu_vm_def_native(vm, "HPOSITIVE", PSEU_TYPE_BOOLEAN, ii, 1,
+	                          (PseuNative)host_positive) ||
+	       pseu_vm_def_function(vm, "HREPEAT", PSEU_TYPE_STRING, si, 2,
+	                            host_repeat) ||
+	       pseu_vm_def_function(vm, "HAPPLY", PSEU_TYPE_INTEGER, si, 2,
+	                            host_apply);
+}
+
 /* Represents a test runner. */
 struct pseu_test_runner {
 	/* Final result of test. 0 all passed; otherwise atleast 1 failed. */
@@ -295,7 +362,7 @@ void test(struct pseu_test_runner *runner, const char *path)
 
 	/* Runner configuration. */
 	PseuConfig config = {
-		.print = runner_print,
+		.write = runner_write,
 		.alloc = runner_alloc,
 		.realloc = runner_realloc,
 		.free = runner_free,
@@ -305,7 +372,9 @@ void test(struct pseu_test_runner *runner, const char *path)
 
 	PseuVM *vm = pseu_vm_new(&config);
 	pseu_vm_set_data(vm, test);
-	int result = pseu_vm_eval(vm, test->input);
+	int result = PSEU_RESULT_ERROR;
+	if (runner_def_host(vm) == PSEU_RESULT_SUCCESS)
+		result = pseu_vm_eval(vm, test->input);
 	pseu_vm_free(vm);
 
 	if (result == PSEU_RESULT_SUCCESS) {
@@ -338,6 +407,162 @@ finalize:
 	test_free(test);
 }
 
+/* Adds runtime errors to the output of the test, after the parse errors. */
+static void error_panic(PseuVM *vm, const char *message)
+{
+	struct pseu_test *test = pseu_vm_get_data(vm);
+	buffer_write(&test->output, message, strlen(message));
+	buffer_write(&test->output, "\n", 1);
+	runner_panic(vm, message);
+}
+
+/* Checks that the specified source is rejected with the `expected` error. */
+void test_error(struct pseu_test_runner *runner, const char *name,
+		const char *input, const char *expected)
+{
+	printf("\x1B[33mtest\x1B[0m %s:\n", name);
+	fflush(stdout);
+
+	PseuConfig config = {
+		.write = runner_write,
+		.alloc = runner_alloc,
+		.realloc = runner_realloc,
+		.free = runner_free,
+		.panic = error_panic
+	};
+
+	struct pseu_test test = { 0 };
+	buffer_init(&test.output);
+
+	PseuVM *vm = pseu_vm_new(&config);
+	pseu_vm_set_data(vm, &test);
+	int result = pseu_vm_eval(vm, input);
+	pseu_vm_free(vm);
+
+	buffer_write(&test.output, "", 1);
+	int reported = strstr(test.output.data, expected) != NULL;
+	buffer_deinit(&test.output);
+
+	printf(" - ");
+	if (result == PSEU_RESULT_ERROR && reported) {
+		printf("\x1B[32mpassed\x1B[0m\n");
+	} else {
+		printf("\x1B[31mfailed\x1B[0m: expected error \"%s\"\n", expected);
+		runner->result = 1;
+	}
+}
+
+/* Checks that a function with more code than its u16 offsets can address is
+ * rejected. */
+void test_too_large(struct pseu_test_runner *runner)
+{
+	static const char head[] = "DECLARE x : INTEGER\nIF x = 0 THEN\n";
+	static const char line[] = "  x <- x + 1\n";
+	static const char tail[] = "ENDIF\n";
+	const int lines = 11000;
+
+	char *input = malloc(sizeof(head) + lines * (sizeof(line) - 1) + sizeof(tail));
+	char *end = input;
+	memcpy(end, head, sizeof(head) - 1);
+	end += sizeof(head) - 1;
+	for (int i = 0; i < lines; i++) {
+		memcpy(end, line, sizeof(line) - 1);
+		end += sizeof(line) - 1;
+	}
+	memcpy(end, tail, sizeof(tail));
+
+	test_error(runner, "function too large", input, "Function is too large");
+	free(input);
+}
+
+/* Records the collections reported to PseuConfig.gc by test_gc(). */
+struct gc_probe {
+	/* Number of START and END events. */
+	size_t starts;
+	size_t ends;
+	/* Set if an event came out of its START, END order. */
+	int unpaired;
+	/* Set if a collection freed objects of some type. */
+	int dropped;
+	/* Live objects of each type when the last collection started. */
+	size_t objects[PSEU_HEAP_STATS_TYPES];
+};
+
+static void gc_probe_event(PseuVM *vm, pseu_gc_event_t event,
+		const PseuHeapStats *stats)
+{
+	struct gc_probe *probe = pseu_vm_get_data(vm);
+
+	if (event == PSEU_GC_EVENT_START) {
+		if (probe->starts != probe->ends)
+			probe->unpaired = 1;
+		probe->starts++;
+		for (size_t i = 0; i < stats->types_count; i++)
+			probe->objects[i] = stats->types[i].objects;
+		return;
+	}
+
+	if (probe->ends + 1 != probe->starts)
+		probe->unpaired = 1;
+	probe->ends++;
+	for (size_t i = 0; i < stats->types_count; i++) {
+		if (stats->types[i].objects < probe->objects[i])
+			probe->dropped = 1;
+	}
+}
+
+/* Allocates garbage past the first collection threshold and checks the
+ * collector ran and reported it. */
+void test_gc(struct pseu_test_runner *runner)
+{
+	static const char *input =
+		"DECLARE s : STRING\n"
+		"DECLARE i : INTEGER\n"
+		"s <- \"\"\n"
+		"FOR i <- 1 TO 40000\n"
+		"  s <- s & \"abcdefghijklmnopqrstuvwxyz0123456789\"\n"
+		"  IF LENGTH(s) > 8000 THEN\n"
+		"    s <- \"\"\n"
+		"  ENDIF\n"
+		"NEXT i\n";
+
+	printf("\x1B[33mtest\x1B[0m gc:\n");
+	fflush(stdout);
+
+	PseuConfig config = {
+		.alloc = runner_alloc,
+		.realloc = runner_realloc,
+		.free = runner_free,
+		.panic = runner_panic,
+		.gc = gc_probe_event
+	};
+
+	struct gc_probe probe = { 0 };
+	PseuHeapStats stats;
+
+	PseuVM *vm = pseu_vm_new(&config);
+	pseu_vm_set_data(vm, &probe);
+	int result = pseu_vm_eval(vm, input);
+	pseu_vm_heap_stats(vm, &stats);
+	pseu_vm_free(vm);
+
+	int passed = result == PSEU_RESULT_SUCCESS &&
+		stats.collections > 0 &&
+		probe.starts == stats.collections &&
+		probe.ends == probe.starts &&
+		!probe.unpaired &&
+		probe.dropped;
+
+	printf(" - ");
+	if (passed) {
+		printf("\x1B[32mpassed\x1B[0m\n");
+	} else {
+		printf("\x1B[31mfailed\x1B[0m: %zu collections, %zu starts, %zu ends\n",
+			stats.collections, probe.starts, probe.ends);
+		runner->result = 1;
+	}
+}
+
 int main(int argc, const char **argv)
 {
 	/* TODO: Enable ANSI color codes when on Windows. */
@@ -365,10 +590,49 @@ int main(int argc, const char **argv)
 	test(&runner, "core/assign.pseut");
 	test(&runner, "core/comment.pseut");
 	test(&runner, "core/arith.pseut");
+	test(&runner, "core/real.pseut");
 	test(&runner, "core/logic.pseut");
+	test(&runner, "core/shortcircuit.pseut");
 	test(&runner, "core/if.pseut");
 	test(&runner, "core/compare.pseut");
+	test(&runner, "core/array.pseut");
+	test(&runner, "core/for.pseut");
+	test(&runner, "core/while.pseut");
+	test(&runner, "core/case.pseut");
+	test(&runner, "core/record.pseut");
+	test(&runner, "core/columns.pseut");
+	test(&runner, "core/byref.pseut");
+	test(&runner, "core/escape.pseut");
+	test(&runner, "core/slots.pseut");
+	test(&runner, "core/typed.pseut");
+	test(&runner, "core/optimize.pseut");
+	test(&runner, "core/registers.pseut");
+	test(&runner, "core/string.pseut");
+	test(&runner, "core/strlib.pseut");
+	test(&runner, "core/sort.pseut");
+	test(&runner, "core/vector.pseut");
+	test(&runner, "core/function.pseut");
+	test(&runner, "core/call.pseut");
+	test(&runner, "core/file.pseut");
+	/* Files core/file.pseut writes to the working directory. */
+	remove("file-small.tmp");
+	remove("file-large.tmp");
+	test(&runner, "core/host.pseut");
 	test(&runner, "core/sandbox.pseut");
+	test_gc(&runner);
+	test_error(&runner, "array too large",
+		"DECLARE A : ARRAY[1:70000, 1:70000] OF INTEGER\n",
+		"Array is too large");
+	test_too_large(&runner);
+	test_error(&runner, "string too long",
+		"DECLARE s : STRING\n"
+		"DECLARE i : INTEGER\n"
+		"s <- \"abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz0123456789ab\"\n"
+		"FOR i <- 1 TO 26\n"
+		"  s <- s & s\n"
+		"NEXT i\n"
+		"OUTPUT LEFT(s, 10)\n",
+		"String is too long");
 #endif
 
 	clock_t end = clock();